@@ -0,0 +1,190 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Heap allocation tracking of the frame path
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+#include "alloctracker.h"
+
+#ifdef OPENPNP_CAPTURE_ALLOCTRACK
+
+// The thread local state is plain data, so accessing it does
+// not run a constructor that could allocate in turn.
+static thread_local allocCounters_t t_counters;
+static thread_local uint32_t t_framePathDepth;
+
+static std::atomic<uint64_t> s_allocations(0);
+static std::atomic<uint64_t> s_bytes(0);
+static std::atomic<uint64_t> s_framePathAllocations(0);
+static std::atomic<uint64_t> s_framePathBytes(0);
+
+#ifdef OPENPNP_CAPTURE_WRAPMALLOC
+// the linker redirects the malloc calls of the library to
+// __wrap_malloc and the original function is __real_malloc.
+extern "C" void* __real_malloc(size_t bytes);
+extern "C" void* __real_calloc(size_t count, size_t bytes);
+extern "C" void* __real_realloc(void *ptr, size_t bytes);
+#define REAL_MALLOC __real_malloc
+#else
+#define REAL_MALLOC malloc
+#endif
+
+static void countAllocation(size_t bytes)
+{
+    t_counters.allocations++;
+    t_counters.bytes += bytes;
+    s_allocations.fetch_add(1, std::memory_order_relaxed);
+    s_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    if (t_framePathDepth > 0)
+    {
+        s_framePathAllocations.fetch_add(1, std::memory_order_relaxed);
+        s_framePathBytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+}
+
+static void* trackedAlloc(size_t bytes)
+{
+    countAllocation(bytes);
+    return REAL_MALLOC((bytes > 0) ? bytes : 1);
+}
+
+#ifdef OPENPNP_CAPTURE_WRAPMALLOC
+extern "C" void* __wrap_malloc(size_t bytes)
+{
+    countAllocation(bytes);
+    return __real_malloc(bytes);
+}
+
+extern "C" void* __wrap_calloc(size_t count, size_t bytes)
+{
+    countAllocation(count*bytes);
+    return __real_calloc(count, bytes);
+}
+
+extern "C" void* __wrap_realloc(void *ptr, size_t bytes)
+{
+    // counted as an allocation, as it may move the block
+    countAllocation(bytes);
+    return __real_realloc(ptr, bytes);
+}
+#endif
+
+void* operator new(size_t bytes)
+{
+    void *ptr = trackedAlloc(bytes);
+    if (ptr == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void* operator new[](size_t bytes)
+{
+    return operator new(bytes);
+}
+
+void* operator new(size_t bytes, const std::nothrow_t &) noexcept
+{
+    return trackedAlloc(bytes);
+}
+
+void* operator new[](size_t bytes, const std::nothrow_t &) noexcept
+{
+    return trackedAlloc(bytes);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept
+{
+    free(ptr);
+}
+
+FramePathScope::FramePathScope()
+{
+    t_framePathDepth++;
+}
+
+FramePathScope::~FramePathScope()
+{
+    t_framePathDepth--;
+}
+
+bool isAllocTrackingEnabled()
+{
+    return true;
+}
+
+void getAllocCounters(allocCounters_t *total, allocCounters_t *framePath, allocCounters_t *thread)
+{
+    if (total != nullptr)
+    {
+        total->allocations = s_allocations;
+        total->bytes = s_bytes;
+    }
+    if (framePath != nullptr)
+    {
+        framePath->allocations = s_framePathAllocations;
+        framePath->bytes = s_framePathBytes;
+    }
+    if (thread != nullptr)
+    {
+        *thread = t_counters;
+    }
+}
+
+#else
+
+bool isAllocTrackingEnabled()
+{
+    return false;
+}
+
+void getAllocCounters(allocCounters_t *total, allocCounters_t *framePath, allocCounters_t *thread)
+{
+    allocCounters_t zero = {0, 0};
+    if (total != nullptr) *total = zero;
+    if (framePath != nullptr) *framePath = zero;
+    if (thread != nullptr) *thread = zero;
+}
+
+#endif
@@ -0,0 +1,73 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Heap allocation tracking of the frame path
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#ifndef alloctracker_h
+#define alloctracker_h
+
+#include <stdint.h>
+
+/** Heap allocation counters */
+struct allocCounters_t
+{
+    uint64_t allocations;   ///< number of allocations
+    uint64_t bytes;         ///< bytes allocated
+};
+
+/** With the OPENPNP_CAPTURE_ALLOCTRACK build option, the library
+    replaces the global operator new and counts the allocations
+    of each thread. On Linux, the malloc, calloc and realloc calls
+    of the library and of the libjpeg-turbo linked into it are
+    counted as well, by wrapping them at link time. Allocations
+    made inside a FRAMEPATH_SCOPE are also counted as frame path
+    allocations, which should stay at zero once a stream has
+    delivered its first frames.
+
+    Without the option, FRAMEPATH_SCOPE compiles to nothing and
+    all counters read zero.
+*/
+#ifdef OPENPNP_CAPTURE_ALLOCTRACK
+class FramePathScope
+{
+public:
+    FramePathScope();
+    ~FramePathScope();
+};
+
+#define FRAMEPATH_SCOPE FramePathScope framePathScope_
+#else
+#define FRAMEPATH_SCOPE do {} while(0)
+#endif
+
+/** returns true if the library was built with allocation tracking */
+bool isAllocTrackingEnabled();
+
+/** get the allocations of all threads, of the frame path and
+    of the calling thread. Each pointer may be NULL. */
+void getAllocCounters(allocCounters_t *total, allocCounters_t *framePath, allocCounters_t *thread);
+
+#endif
@@ -0,0 +1,321 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Platform independent focus search on the frames of a stream
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include "autofocus.h"
+#include "stream.h"
+#include "logging.h"
+
+#define AUTOFOCUS_FRAMETIMEOUT 2000     ///< time to wait for a frame after a move in ms
+#define AUTOFOCUS_SWEEPPOINTS  9        ///< positions per sweep of the coarse-to-fine search
+
+static uint64_t getMonotonicMicros()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+AutoFocus::AutoFocus(Stream *stream) :
+    m_stream(stream),
+    m_min(0),
+    m_max(0),
+    m_failed(false),
+    m_result(nullptr)
+{
+    memset(&m_roi, 0, sizeof(m_roi));
+}
+
+CapResult AutoFocus::run(const CapRect *roi, uint32_t strategy, CapFocusResult *result)
+{
+    if ((strategy != CAPFOCUS_COARSETOFINE) && (strategy != CAPFOCUS_GOLDENSECTION))
+    {
+        LOG(LOG_ERR, "AutoFocus: unknown strategy %d\n", strategy);
+        return CAPRESULT_ERR;
+    }
+
+    int32_t dValue;
+    if (!m_stream->getPropertyLimits(CAPPROPID_FOCUS, &m_min, &m_max, &dValue) || (m_max < m_min))
+    {
+        return CAPRESULT_PROPERTYNOTSUPPORTED;
+    }
+
+    uint32_t frameWidth, frameHeight;
+    m_stream->getFrameSize(frameWidth, frameHeight);
+    if ((roi == nullptr) || (roi->width == 0) || (roi->height == 0))
+    {
+        m_roi.x = 0;
+        m_roi.y = 0;
+        m_roi.width  = frameWidth;
+        m_roi.height = frameHeight;
+    }
+    else
+    {
+        m_roi = *roi;
+    }
+
+    if ((m_roi.width < 3) || (m_roi.height < 3) || (m_roi.x >= frameWidth) || (m_roi.y >= frameHeight) ||
+        (m_roi.width > frameWidth - m_roi.x) || (m_roi.height > frameHeight - m_roi.y))
+    {
+        LOG(LOG_ERR, "AutoFocus: the region of interest must lie within the frame and be at least 3 x 3 pixels\n");
+        return CAPRESULT_ERR;
+    }
+
+    memset(result, 0, sizeof(CapFocusResult));
+    m_result = result;
+    m_scores.clear();
+    m_failed = false;
+    m_region.resize(static_cast<size_t>(m_roi.width)*m_roi.height*3);
+
+    // cameras without automatic focus may not have the control
+    m_stream->setAutoProperty(CAPPROPID_FOCUS, false);
+
+    auto startTime = std::chrono::steady_clock::now();
+    if (strategy == CAPFOCUS_GOLDENSECTION)
+    {
+        goldenSection();
+    }
+    else
+    {
+        coarseToFine();
+    }
+
+    if (m_scores.empty())
+    {
+        LOG(LOG_ERR, "AutoFocus: no frames were received\n");
+        return CAPRESULT_ERR;
+    }
+
+    // leave the lens at the best position
+    auto best = m_scores.begin();
+    for(auto it = m_scores.begin(); it != m_scores.end(); ++it)
+    {
+        if (it->second > best->second)
+        {
+            best = it;
+        }
+    }
+    result->bestPosition = best->first;
+    result->bestScore    = best->second;
+    m_stream->setProperty(CAPPROPID_FOCUS, best->first);
+
+    result->durationMillis = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - startTime).count());
+
+    LOG(LOG_INFO, "AutoFocus: best position %d (score %f) after %d samples in %d ms\n",
+        result->bestPosition, result->bestScore, result->samples, result->durationMillis);
+    return m_failed && (result->samples < CAPFOCUS_MAXSAMPLES) ? CAPRESULT_ERR : CAPRESULT_OK;
+}
+
+void AutoFocus::coarseToFine()
+{
+    int32_t lo = m_min;
+    int32_t hi = m_max;
+    while(!m_failed)
+    {
+        int32_t step = std::max<int32_t>(1, (hi - lo) / (AUTOFOCUS_SWEEPPOINTS-1));
+        int32_t bestPosition = lo;
+        float   bestScore = -1.0f;
+        for(int32_t pos = lo; (pos <= hi) && !m_failed; pos += step)
+        {
+            float score;
+            if (evaluate(pos, score) && (score > bestScore))
+            {
+                bestScore = score;
+                bestPosition = pos;
+            }
+
+            // the last step can fall short of hi
+            if ((pos < hi) && (pos + step > hi))
+            {
+                pos = hi - step;
+            }
+        }
+
+        if (step == 1)
+        {
+            break;
+        }
+
+        lo = std::max(m_min, bestPosition - step);
+        hi = std::min(m_max, bestPosition + step);
+    }
+}
+
+void AutoFocus::goldenSection()
+{
+    const double invPhi = 0.5*(sqrt(5.0) - 1.0);   // 0.618..
+
+    double a = m_min;
+    double b = m_max;
+    while((b - a > 2.0) && !m_failed)
+    {
+        int32_t c = static_cast<int32_t>(lround(b - invPhi*(b - a)));
+        int32_t d = static_cast<int32_t>(lround(a + invPhi*(b - a)));
+        if (c == d)
+        {
+            break;
+        }
+
+        float fc, fd;
+        if (!evaluate(c, fc) || !evaluate(d, fd))
+        {
+            return;
+        }
+
+        if (fc > fd)
+        {
+            b = d;
+        }
+        else
+        {
+            a = c;
+        }
+    }
+
+    // measure the few positions that are left
+    for(int32_t pos = static_cast<int32_t>(ceil(a)); (pos <= static_cast<int32_t>(floor(b))) && !m_failed; pos++)
+    {
+        float score;
+        evaluate(pos, score);
+    }
+}
+
+bool AutoFocus::evaluate(int32_t position, float &score)
+{
+    auto it = m_scores.find(position);
+    if (it != m_scores.end())
+    {
+        score = it->second;
+        return true;
+    }
+
+    if (m_result->samples >= CAPFOCUS_MAXSAMPLES)
+    {
+        m_failed = true;
+        return false;
+    }
+
+    uint32_t moveFrames = m_stream->getFrameCount();
+    if (!m_stream->setProperty(CAPPROPID_FOCUS, position))
+    {
+        LOG(LOG_ERR, "AutoFocus: could not set the focus to %d\n", position);
+        m_failed = true;
+        return false;
+    }
+
+    if (!captureAfterMove(getMonotonicMicros(), moveFrames))
+    {
+        LOG(LOG_ERR, "AutoFocus: no frame after moving the focus to %d\n", position);
+        m_failed = true;
+        return false;
+    }
+
+    score = sharpness(&m_region[0], m_roi.width, m_roi.height, m_roi.width*3);
+    m_scores[position] = score;
+    m_result->positions[m_result->samples] = position;
+    m_result->scores[m_result->samples] = score;
+    m_result->samples++;
+    return true;
+}
+
+bool AutoFocus::captureAfterMove(uint64_t moveMicros, uint32_t moveFrames)
+{
+    // Without exposure timestamps, the first frame after
+    // the move may have been exposed while the lens moved,
+    // so the second one is used.
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(AUTOFOCUS_FRAMETIMEOUT);
+    uint32_t lastFrames = moveFrames;
+    while(std::chrono::steady_clock::now() < deadline)
+    {
+        uint32_t frames = m_stream->getFrameCount();
+        if (frames == lastFrames)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        lastFrames = frames;
+
+        if (!m_stream->captureFrameRegion(m_roi.x, m_roi.y, m_roi.width, m_roi.height, &m_region[0], 0))
+        {
+            return false;
+        }
+
+        CapFrameMetadata meta;
+        if (m_stream->getFrameMetadata(&meta) && ((meta.flags & CAPFRAMEMETA_EXPOSURE) != 0))
+        {
+            if (meta.exposureTimestamp >= moveMicros)
+            {
+                return true;
+            }
+        }
+        else if (frames - moveFrames >= 2)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+float AutoFocus::sharpness(const uint8_t *rgb, uint32_t width, uint32_t height, uint32_t stride)
+{
+    // luma, approximately (R + 2G + B) / 4
+    std::vector<uint16_t> luma(static_cast<size_t>(width)*height);
+    for(uint32_t y=0; y<height; y++)
+    {
+        const uint8_t *src = rgb + static_cast<size_t>(y)*stride;
+        uint16_t *dst = &luma[static_cast<size_t>(y)*width];
+        for(uint32_t x=0; x<width; x++)
+        {
+            dst[x] = (src[x*3] + 2*src[x*3+1] + src[x*3+2]) >> 2;
+        }
+    }
+
+    // Brenner gradient. The inner loops are free of branches
+    // and loop-carried dependencies other than the sum, so 
+    // the compiler can vectorize them.
+    uint64_t sum = 0;
+    for(uint32_t y=0; y+2<height; y++)
+    {
+        const uint16_t *line = &luma[static_cast<size_t>(y)*width];
+        const uint16_t *below = line + 2*width;
+        uint32_t lineSum = 0;
+        for(uint32_t x=0; x+2<width; x++)
+        {
+            int32_t dx = line[x+2] - line[x];
+            int32_t dy = below[x] - line[x];
+            lineSum += static_cast<uint32_t>(dx*dx + dy*dy);
+        }
+        sum += lineSum;
+    }
+
+    return static_cast<float>(sum) / (static_cast<float>(width-2)*(height-2));
+}
@@ -0,0 +1,90 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Platform independent focus search on the frames of a stream
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#ifndef autofocus_h
+#define autofocus_h
+
+#include <stdint.h>
+#include <vector>
+#include <map>
+#include "openpnp-capture.h"
+
+class Stream;   // pre-declaration
+
+/** AutoFocus searches the focus position of a stream with the
+    sharpest region of interest. It drives the stream's focus
+    property directly and measures each position on a frame that
+    was exposed after the move, so a sweep runs at about the
+    frame rate of the camera.
+
+    Positions that were measured before are not measured again,
+    which makes the coarse-to-fine and golden-section searches
+    cheap when they revisit a position.
+*/
+class AutoFocus
+{
+public:
+    AutoFocus(Stream *stream);
+
+    /** Run a search, CAPFOCUS_xxx, and leave the stream at the 
+        best position. roi may be NULL for the whole frame. */
+    CapResult run(const CapRect *roi, uint32_t strategy, CapFocusResult *result);
+
+    /** Returns the sharpness of a 24-bit image: the mean squared 
+        difference of the luma of pixels two apart, horizontally 
+        and vertically. The image must be at least 3 x 3 pixels. */
+    static float sharpness(const uint8_t *rgb, uint32_t width, uint32_t height, uint32_t stride);
+
+protected:
+    /** sweep [lo, hi] in steps, then sweep around the best
+        position with a four times smaller step */
+    void coarseToFine();
+
+    /** golden-section search of [lo, hi], assuming a single peak */
+    void goldenSection();
+
+    /** move to 'position' and measure it, or return the earlier
+        measurement. Returns false if no frame arrived or the
+        maximum number of samples was reached. */
+    bool evaluate(int32_t position, float &score);
+
+    /** wait for a frame exposed after the focus moved and copy
+        its region of interest to m_region */
+    bool captureAfterMove(uint64_t moveMicros, uint32_t moveFrames);
+
+    Stream      *m_stream;
+    CapRect     m_roi;              ///< region of interest in frame pixels
+    int32_t     m_min;              ///< lowest focus position
+    int32_t     m_max;              ///< highest focus position
+    bool        m_failed;           ///< set when a measurement failed
+    CapFocusResult *m_result;       ///< receives the samples
+    std::map<int32_t, float> m_scores;  ///< measured positions
+    std::vector<uint8_t> m_region;  ///< pixels of the region of interest
+};
+
+#endif
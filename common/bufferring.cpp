@@ -0,0 +1,157 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Ring of application supplied frame buffers
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#include <string.h>
+#include "bufferring.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+
+static uint32_t loadAcquire(const uint32_t *ptr)
+{
+    uint32_t value = *reinterpret_cast<const volatile uint32_t*>(ptr);
+    _ReadWriteBarrier();
+    return value;
+}
+
+static void storeRelease(uint32_t *ptr, uint32_t value)
+{
+    _ReadWriteBarrier();
+    *reinterpret_cast<volatile uint32_t*>(ptr) = value;
+}
+
+static bool compareExchange(uint32_t *ptr, uint32_t expected, uint32_t desired)
+{
+    return _InterlockedCompareExchange(reinterpret_cast<volatile long*>(ptr), 
+        static_cast<long>(desired), static_cast<long>(expected)) == static_cast<long>(expected);
+}
+#else
+static uint32_t loadAcquire(const uint32_t *ptr)
+{
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static void storeRelease(uint32_t *ptr, uint32_t value)
+{
+    __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+}
+
+static bool compareExchange(uint32_t *ptr, uint32_t expected, uint32_t desired)
+{
+    return __atomic_compare_exchange_n(ptr, &expected, desired, false, 
+        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+#endif
+
+BufferRing::BufferRing(uint32_t count, void * const *buffers, const uint32_t *sizes) :
+    m_buffers(count),
+    m_sizes(sizes, sizes + count),
+    m_metadata(count)
+{
+    memset(&m_indices, 0, sizeof(m_indices));
+    m_indices.count = count;
+    for(uint32_t i=0; i<count; i++)
+    {
+        m_buffers[i] = static_cast<uint8_t*>(buffers[i]);
+        memset(&m_metadata[i], 0, sizeof(CapFrameMetadata));
+    }
+}
+
+bool BufferRing::fits(size_t bytes) const
+{
+    for(uint32_t i=0; i<m_indices.count; i++)
+    {
+        if ((m_buffers[i] == nullptr) || (m_sizes[i] < bytes))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint8_t* BufferRing::beginFrame(size_t bytes)
+{
+    // only this thread writes head
+    uint32_t head = m_indices.head;
+    uint32_t slot = head % m_indices.count;
+    if ((head - loadAcquire(&m_indices.tail) >= m_indices.count) || (m_sizes[slot] < bytes))
+    {
+        dropFrame();
+        return nullptr;
+    }
+    return m_buffers[slot];
+}
+
+void BufferRing::commitFrame(const CapFrameMetadata *metadata)
+{
+    uint32_t head = m_indices.head;
+    CapFrameMetadata &slotMetadata = m_metadata[head % m_indices.count];
+    if (metadata != nullptr)
+    {
+        slotMetadata = *metadata;
+    }
+    else
+    {
+        memset(&slotMetadata, 0, sizeof(CapFrameMetadata));
+    }
+    storeRelease(&m_indices.head, head + 1);
+}
+
+void BufferRing::dropFrame()
+{
+    storeRelease(&m_indices.dropped, m_indices.dropped + 1);
+}
+
+bool BufferRing::release(uint32_t frames)
+{
+    while(true)
+    {
+        uint32_t tail = loadAcquire(&m_indices.tail);
+        uint32_t head = loadAcquire(&m_indices.head);
+        if (head - tail < frames)
+        {
+            return false;
+        }
+        if (compareExchange(&m_indices.tail, tail, tail + frames))
+        {
+            return true;
+        }
+    }
+}
+
+bool BufferRing::getMetadata(uint32_t frame, CapFrameMetadata *metadata)
+{
+    uint32_t tail = loadAcquire(&m_indices.tail);
+    uint32_t head = loadAcquire(&m_indices.head);
+    if (frame - tail >= head - tail)
+    {
+        return false;
+    }
+    *metadata = m_metadata[frame % m_indices.count];
+    return true;
+}
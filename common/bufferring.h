@@ -0,0 +1,86 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Ring of application supplied frame buffers
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#ifndef bufferring_h
+#define bufferring_h
+
+#include <stdint.h>
+#include <vector>
+#include "openpnp-capture.h"
+
+/** BufferRing hands the converted frames of a stream to a ring of
+    application buffers, see Cap_registerBufferRing. 
+
+    The head and tail indices live in a CapBufferRing that the
+    application reads directly, so they are plain 32-bit words
+    accessed with atomic builtins rather than std::atomic members.
+    Only the capture thread writes frames and head; tail is written
+    by the application, through release() or directly.
+
+    The ring does not own the buffers.
+*/
+class BufferRing
+{
+public:
+    BufferRing(uint32_t count, void * const *buffers, const uint32_t *sizes);
+
+    /** returns true if every slot can hold 'bytes' */
+    bool fits(size_t bytes) const;
+
+    /** returns the slot the next frame is written to, or NULL if
+        the ring is full or the slot is smaller than 'bytes'. A
+        NULL return counts as a dropped frame. */
+    uint8_t* beginFrame(size_t bytes);
+
+    /** publish the frame written to the slot returned by beginFrame */
+    void commitFrame(const CapFrameMetadata *metadata);
+
+    /** count a frame that was not written, e.g. after a failed conversion */
+    void dropFrame();
+
+    /** mark the oldest 'frames' frames as done. Returns false if
+        fewer frames are in the ring. */
+    bool release(uint32_t frames);
+
+    /** get the metadata of a frame that is in the ring */
+    bool getMetadata(uint32_t frame, CapFrameMetadata *metadata);
+
+    /** returns the indices shared with the application */
+    CapBufferRing* getIndices()
+    {
+        return &m_indices;
+    }
+
+protected:
+    CapBufferRing           m_indices;      ///< head, tail and counters shared with the application
+    std::vector<uint8_t*>   m_buffers;      ///< the slots
+    std::vector<uint32_t>   m_sizes;        ///< size of each slot in bytes
+    std::vector<CapFrameMetadata> m_metadata;   ///< metadata of the frame in each slot
+};
+
+#endif
@@ -29,20 +29,52 @@
 #include "context.h"
 #include "logging.h"
 #include "stream.h"
+#include "controlworker.h"
+#include "metricsserver.h"
+#include "autofocus.h"
+#include "exposurecontroller.h"
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <string.h>
+#include <stdlib.h>
 
 Context::Context() :
-    m_streamCounter(0)
+    m_memoryBudget(0),
+    m_streamCounter(0),
+    m_metricsServer(nullptr),
+    m_enumerated(false)
 {
-    //NOTE: derived platform dependent class must enumerate
-    //      the devices here and place them in m_devices.
+    //NOTE: the devices are enumerated by enumerate or
+    //      enumerateAsync, after the derived platform 
+    //      dependent class has been constructed.
+
+    // opt-in metrics exporter that does not need
+    // changes to the application
+    const char *metrics = getenv("OPENPNP_CAPTURE_METRICS");
+    if ((metrics != nullptr) && (metrics[0] != 0))
+    {
+        startMetricsServer(metrics);
+    }
 }
 
 Context::~Context()
 {
+    // normally already joined by Cap_releaseContext,
+    // before the platform context was destroyed.
+    joinEnumeration();
+
+    // the metrics server reads the streams
+    stopMetricsServer();
+
     // delete stream objects
     auto iter = m_streams.begin();
     while(iter != m_streams.end())
     {
+        if (iter->second != nullptr)
+        {
+            iter->second->stopControlWorker();
+        }
         delete iter->second;
         iter++;
     }
@@ -57,8 +89,70 @@ Context::~Context()
     LOG(LOG_DEBUG, "Context destroyed\n");
 }
 
+void Context::enumerate()
+{
+    enumerateDevices();
+
+    std::lock_guard<std::mutex> lock(m_enumMutex);
+    m_enumerated = true;
+    m_enumCond.notify_all();
+}
+
+void Context::enumerateAsync(CapContextCallback callback, void *user)
+{
+    m_enumThread = std::thread([this, callback, user]()
+    {
+        auto startTime = std::chrono::steady_clock::now();
+        enumerateDevicesInBackground();
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - startTime);
+        LOG(LOG_VERBOSE, "Background enumeration found %d devices in %d ms\n", 
+            (uint32_t)m_devices.size(), (uint32_t)elapsed.count());
+
+        {
+            std::lock_guard<std::mutex> lock(m_enumMutex);
+            m_enumerated = true;
+            m_enumCond.notify_all();
+        }
+
+        if (callback != nullptr)
+        {
+            callback(this, m_devices.size(), user);
+        }
+    });
+}
+
+bool Context::isEnumerated() const
+{
+    std::lock_guard<std::mutex> lock(m_enumMutex);
+    return m_enumerated;
+}
+
+void Context::joinEnumeration()
+{
+    if (m_enumThread.joinable())
+    {
+        if (m_enumThread.get_id() == std::this_thread::get_id())
+        {
+            // released from its own callback, which is not allowed;
+            // don't deadlock on ourselves.
+            LOG(LOG_ERR, "Context released from the enumeration callback\n");
+            m_enumThread.detach();
+            return;
+        }
+        m_enumThread.join();
+    }
+}
+
+void Context::waitForDevices() const
+{
+    std::unique_lock<std::mutex> lock(m_enumMutex);
+    m_enumCond.wait(lock, [this]() { return m_enumerated; });
+}
+
 const char* Context::getDeviceName(CapDeviceID id) const
 {
+    waitForDevices();
     if (id >= m_devices.size())
     {
         LOG(LOG_ERR,"Device with ID %d not found", id);
@@ -74,6 +168,7 @@ const char* Context::getDeviceName(CapDeviceID id) const
 
 const char* Context::getDeviceUniqueID(CapDeviceID id) const
 {
+    waitForDevices();
     if (id >= m_devices.size())
     {
         LOG(LOG_ERR,"Device with ID %d not found", id);
@@ -89,12 +184,14 @@ const char* Context::getDeviceUniqueID(CapDeviceID id) const
 
 uint32_t Context::getDeviceCount() const
 {
+    waitForDevices();
     return m_devices.size();
 }
 
 
 int32_t Context::getNumFormats(CapDeviceID index) const
 {
+    waitForDevices();
     if (index >= m_devices.size())
     {
         LOG(LOG_ERR,"Device with ID %d not found", index);
@@ -111,6 +208,7 @@ int32_t Context::getNumFormats(CapDeviceID index) const
 
 bool Context::getFormatInfo(CapDeviceID index, CapFormatID formatID, CapFormatInfo *info) const
 {
+    waitForDevices();
     if (index >= m_devices.size())
     {
         LOG(LOG_ERR,"Device with ID %d not found", index);
@@ -134,9 +232,115 @@ bool Context::getFormatInfo(CapDeviceID index, CapFormatID formatID, CapFormatIn
 }
 
 int32_t Context::openStream(CapDeviceID id, CapFormatID formatID)
+{
+    Stream *s = createStream(id, formatID);
+    if (s == nullptr)
+    {
+        return -1;
+    }
+
+    int32_t streamID = storeStream(s);
+    return streamID;
+}
+
+bool Context::openStreams(uint32_t count, const CapDeviceID *ids, const CapFormatID *formatIDs, 
+    int32_t *streamIDs, uint32_t timeoutMillis)
+{
+    waitForDevices();
+
+    // group the devices by bus. Devices on the same bus are
+    // negotiated one at a time so their control transfers 
+    // don't compete, different buses are negotiated in parallel.
+    std::map<std::string, std::vector<uint32_t> > groups;
+    for(uint32_t i=0; i<count; i++)
+    {
+        std::string key;
+        if (!supportsConcurrentOpen())
+        {
+            // a single group, opened on one thread
+        }
+        else if ((ids[i] < m_devices.size()) && (m_devices[ids[i]] != nullptr) && 
+            (!m_devices[ids[i]]->m_busKey.empty()))
+        {
+            key = m_devices[ids[i]]->m_busKey;
+        }
+        else
+        {
+            // unknown bus, give the device its own group
+            key = "#" + std::to_string(i);
+        }
+        groups[key].push_back(i);
+    }
+
+    std::vector<Stream*> streams(count, nullptr);
+    std::vector<std::thread> threads;
+    for(auto const &group : groups)
+    {
+        const std::vector<uint32_t> &indices = group.second;
+        threads.push_back(std::thread([this, &streams, &indices, ids, formatIDs]()
+        {
+            for(uint32_t i : indices)
+            {
+                streams[i] = createStream(ids[i], formatIDs[i]);
+            }
+        }));
+    }
+
+    for(auto &t : threads)
+    {
+        t.join();
+    }
+
+    bool ok = true;
+    for(uint32_t i=0; i<count; i++)
+    {
+        if (streams[i] != nullptr)
+        {
+            streamIDs[i] = storeStream(streams[i]);
+        }
+        else
+        {
+            streamIDs[i] = -1;
+            ok = false;
+        }
+    }
+
+    // the streams are capturing now, wait for 
+    // the first frame of each of them.
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMillis);
+    while(true)
+    {
+        bool waiting = false;
+        for(uint32_t i=0; i<count; i++)
+        {
+            if ((streams[i] != nullptr) && (streams[i]->getFrameCount() == 0))
+            {
+                waiting = true;
+            }
+        }
+
+        if (!waiting)
+        {
+            break;
+        }
+
+        if (std::chrono::steady_clock::now() >= deadline)
+        {
+            LOG(LOG_ERR, "openStreams: timeout waiting for the first frames\n");
+            ok = false;
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+
+    return ok;
+}
+
+Stream* Context::createStream(CapDeviceID id, CapFormatID formatID)
 {
     deviceInfo *device = nullptr;
 
+    waitForDevices();
     if (m_devices.size() > id)
     {
         device = m_devices[id];
@@ -144,40 +348,46 @@ int32_t Context::openStream(CapDeviceID id, CapFormatID formatID)
     else
     {
         LOG(LOG_ERR, "openStream: No devices found\n");
-        return -1;
+        return nullptr;
     }
 
     // lookup desired format
     if (formatID >= device->m_formats.size())
     {
         LOG(LOG_ERR, "openStream: Requested format index out of range\n");
-        return -1;        
+        return nullptr;        
     }
 
     Stream *s = createPlatformStream();
+    s->setDeviceName(device->m_name);
+
+    // the stream counts towards the memory
+    // budget while it is being opened
+    m_streamsMutex.lock();
+    m_openingStreams.push_back(s);
+    m_streamsMutex.unlock();
 
-    if (!s->open(this, device, device->m_formats[formatID].width,
+    bool ok = s->open(this, device, device->m_formats[formatID].width,
                  device->m_formats[formatID].height,
                  device->m_formats[formatID].fourcc,
-                 device->m_formats[formatID].fps))
+                 device->m_formats[formatID].fps);
+
+    m_streamsMutex.lock();
+    m_openingStreams.erase(std::find(m_openingStreams.begin(), m_openingStreams.end(), s));
+    m_streamsMutex.unlock();
+
+    if (!ok)
     {
         LOG(LOG_ERR, "Could not open stream for device %s\n", device->m_name.c_str());
-        return -1;
+        delete s;
+        return nullptr;
     }
     else
     {
-        printf("[DBG ] FOURCC = ");
-        uint32_t fcc = s->getFOURCC();
-        for(uint32_t i=0; i<4; i++)
-        {            
-            printf("%c", (fcc & 0xff));
-            fcc >>= 8;
-        }
-        printf("\n");
+        LOG(LOG_DEBUG, "FOURCC = %s\n", fourCCToString(s->getFOURCC()).c_str());
     }
 
-    int32_t streamID = storeStream(s);
-    return streamID;
+    return s;
 }
 
 bool Context::closeStream(int32_t streamID)
@@ -205,13 +415,16 @@ uint32_t Context::isOpenStream(int32_t streamID)
         return 0;
     }    
 
-    if (static_cast<uint32_t>(streamID) >= m_streams.size())
+    // stream IDs are not re-used, so they can be larger
+    // than the number of streams after streams were closed.
+    Stream *stream = lookupStreamByID(streamID);
+    if (stream == nullptr)
     {
-        LOG(LOG_ERR, "isOpenStream was called with an out-of-bounds stream ID\n");
-        return 0;        
+        LOG(LOG_ERR, "isOpenStream was called with an unknown stream ID\n");
+        return 0;
     }
 
-    return m_streams[streamID]->isOpen() ? 1 : 0;
+    return stream->isOpen() ? 1 : 0;
 }
 
 bool Context::captureFrame(int32_t streamID, uint8_t *RGBbufferPtr, size_t RGBbufferBytes)
@@ -222,14 +435,33 @@ bool Context::captureFrame(int32_t streamID, uint8_t *RGBbufferPtr, size_t RGBbu
         return false;
     }    
 
-    Stream *stream = m_streams[streamID];
+    Stream *stream = lookupStreamByID(streamID);
     if (stream == nullptr)
     {
         LOG(LOG_ERR, "hasNewFrame was called with an unknown stream ID\n");
         return false; 
     }
     
-    return m_streams[streamID]->captureFrame(RGBbufferPtr, RGBbufferBytes);
+    return stream->captureFrame(RGBbufferPtr, RGBbufferBytes);
+}
+
+bool Context::captureFrameRegion(int32_t streamID, uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+    uint8_t *dst, uint32_t dstStride)
+{
+    if (streamID < 0)
+    {
+        LOG(LOG_ERR, "captureFrameRegion was called with a negative stream ID\n");
+        return false;
+    }
+
+    Stream *stream = lookupStreamByID(streamID);
+    if (stream == nullptr)
+    {
+        LOG(LOG_ERR, "captureFrameRegion was called with an unknown stream ID\n");
+        return false;
+    }
+
+    return stream->captureFrameRegion(x, y, width, height, dst, dstStride);
 }
 
 bool Context::hasNewFrame(int32_t streamID)
@@ -240,7 +472,7 @@ bool Context::hasNewFrame(int32_t streamID)
         return false;
     }    
 
-    Stream *stream = m_streams[streamID];
+    Stream *stream = lookupStreamByID(streamID);
     if (stream == nullptr)
     {
         LOG(LOG_ERR, "hasNewFrame was called with an unknown stream ID\n");
@@ -250,6 +482,51 @@ bool Context::hasNewFrame(int32_t streamID)
     return stream->hasNewFrame();
 }
 
+bool Context::hasChangedFrame(int32_t streamID)
+{
+    if (streamID < 0)
+    {
+        LOG(LOG_ERR, "hasChangedFrame was called with a negative stream ID\n");
+        return false;
+    }    
+
+    Stream *stream = lookupStreamByID(streamID);
+    if (stream == nullptr)
+    {
+        LOG(LOG_ERR, "hasChangedFrame was called with an unknown stream ID\n");
+        return false; 
+    }
+
+    return stream->hasChangedFrame();
+}
+
+CapResult Context::setStreamChangeDetection(int32_t streamID, uint32_t threshold)
+{
+    Stream* stream = lookupStreamByID(streamID);
+    if (stream == nullptr) return CAPRESULT_ERR;
+    return stream->setChangeDetection(threshold) ? CAPRESULT_OK : CAPRESULT_FORMATNOTSUPPORTED;
+}
+
+CapResult Context::setStreamOutputSize(int32_t streamID, uint32_t width, uint32_t height)
+{
+    Stream* stream = lookupStreamByID(streamID);
+    if (stream == nullptr) return CAPRESULT_ERR;
+    return stream->setOutputSize(width, height) ? CAPRESULT_OK : CAPRESULT_FORMATNOTSUPPORTED;
+}
+
+CapResult Context::setStreamPriority(int32_t streamID, uint32_t priority)
+{
+    if (priority > CAPPRIORITY_BACKGROUND)
+    {
+        LOG(LOG_ERR, "setStreamPriority: invalid priority %d\n", priority);
+        return CAPRESULT_ERR;
+    }
+
+    Stream* stream = lookupStreamByID(streamID);
+    if (stream == nullptr) return CAPRESULT_ERR;
+    return stream->setPriority(priority) ? CAPRESULT_OK : CAPRESULT_PROPERTYNOTSUPPORTED;
+}
+
 uint32_t Context::getStreamFrameCount(int32_t streamID)
 {
     if (streamID < 0)
@@ -258,7 +535,7 @@ uint32_t Context::getStreamFrameCount(int32_t streamID)
         return 0;
     }    
 
-    Stream *stream = m_streams[streamID];
+    Stream *stream = lookupStreamByID(streamID);
     if (stream == nullptr)
     {
         LOG(LOG_ERR, "hasNewFrame was called with an unknown stream ID\n");
@@ -268,6 +545,198 @@ uint32_t Context::getStreamFrameCount(int32_t streamID)
     return stream->getFrameCount();
 }
 
+/** add the memory usage of a stream to the totals */
+static void addMemoryUsage(CapMemoryUsage *usage, Stream *stream)
+{
+    CapMemoryUsage streamUsage;
+    stream->getMemoryUsage(&streamUsage);
+    usage->driverBuffers  += streamUsage.driverBuffers;
+    usage->frameBuffers   += streamUsage.frameBuffers;
+    usage->decoderScratch += streamUsage.decoderScratch;
+    usage->total          += streamUsage.total;
+}
+
+void Context::getMemoryUsage(CapMemoryUsage *usage)
+{
+    memset(usage, 0, sizeof(CapMemoryUsage));
+
+    std::lock_guard<std::mutex> lock(m_streamsMutex);
+    for(auto const &s : m_streams)
+    {
+        if (s.second != nullptr)
+        {
+            addMemoryUsage(usage, s.second);
+        }
+    }
+
+    for(auto s : m_openingStreams)
+    {
+        addMemoryUsage(usage, s);
+    }
+}
+
+bool Context::getStreamMemoryUsage(int32_t streamID, CapMemoryUsage *usage)
+{
+    std::lock_guard<std::mutex> lock(m_streamsMutex);
+    auto it = m_streams.find(streamID);
+    if ((it == m_streams.end()) || (it->second == nullptr))
+    {
+        return false;
+    }
+    it->second->getMemoryUsage(usage);
+    return true;
+}
+
+CapResult Context::startStreamRecording(int32_t streamID, const char *filename)
+{
+    Stream* stream = lookupStreamByID(streamID);
+    if (stream == nullptr) return CAPRESULT_ERR;
+    if (!stream->supportsRecording()) return CAPRESULT_PROPERTYNOTSUPPORTED;
+    return stream->startRecording(filename) ? CAPRESULT_OK : CAPRESULT_ERR;
+}
+
+CapResult Context::stopStreamRecording(int32_t streamID)
+{
+    Stream* stream = lookupStreamByID(streamID);
+    if (stream == nullptr) return CAPRESULT_ERR;
+    return stream->stopRecording() ? CAPRESULT_OK : CAPRESULT_ERR;
+}
+
+CapResult Context::startStreamPreviewServer(int32_t streamID, const char *address)
+{
+    Stream* stream = lookupStreamByID(streamID);
+    if (stream == nullptr) return CAPRESULT_ERR;
+    if (!stream->supportsPreviewServer()) return CAPRESULT_PROPERTYNOTSUPPORTED;
+    return stream->startPreviewServer(address) ? CAPRESULT_OK : CAPRESULT_ERR;
+}
+
+CapResult Context::stopStreamPreviewServer(int32_t streamID)
+{
+    Stream* stream = lookupStreamByID(streamID);
+    if (stream == nullptr) return CAPRESULT_ERR;
+    return stream->stopPreviewServer() ? CAPRESULT_OK : CAPRESULT_ERR;
+}
+
+bool Context::getStreamStats(int32_t streamID, CapStreamStats *stats)
+{
+    std::lock_guard<std::mutex> lock(m_streamsMutex);
+    auto it = m_streams.find(streamID);
+    if ((it == m_streams.end()) || (it->second == nullptr))
+    {
+        return false;
+    }
+    it->second->getStats(stats);
+    return true;
+}
+
+void Context::collectMetrics(std::vector<streamMetrics_t> &metrics)
+{
+    std::lock_guard<std::mutex> lock(m_streamsMutex);
+    for(auto const &s : m_streams)
+    {
+        if (s.second != nullptr)
+        {
+            streamMetrics_t m;
+            m.streamID = s.first;
+            m.device   = s.second->getDeviceName();
+            s.second->getStats(&m.stats);
+            metrics.push_back(m);
+        }
+    }
+}
+
+bool Context::startMetricsServer(const std::string &address)
+{
+    stopMetricsServer();
+    m_metricsServer = new MetricsServer(this);
+    if (!m_metricsServer->start(address))
+    {
+        delete m_metricsServer;
+        m_metricsServer = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void Context::stopMetricsServer()
+{
+    if (m_metricsServer != nullptr)
+    {
+        delete m_metricsServer;
+        m_metricsServer = nullptr;
+    }
+}
+
+void Context::setMemoryBudget(uint64_t bytes)
+{
+    std::lock_guard<std::mutex> lock(m_streamsMutex);
+    m_memoryBudget = bytes;
+    LOG(LOG_INFO, "Memory budget set to %llu bytes\n", static_cast<unsigned long long>(bytes));
+}
+
+uint32_t Context::chooseBufferCount(Stream *stream, size_t bufferBytes, size_t otherBytes,
+    uint32_t minCount, uint32_t maxCount)
+{
+    std::lock_guard<std::mutex> lock(m_streamsMutex);
+
+    uint32_t count = maxCount;
+    if ((m_memoryBudget != 0) && (bufferBytes != 0))
+    {
+        // memory used by the other streams
+        uint64_t used = 0;
+        for(auto const &s : m_streams)
+        {
+            if ((s.second != nullptr) && (s.second != stream))
+            {
+                CapMemoryUsage usage;
+                s.second->getMemoryUsage(&usage);
+                used += usage.total;
+            }
+        }
+        for(auto s : m_openingStreams)
+        {
+            if (s != stream)
+            {
+                CapMemoryUsage usage;
+                s->getMemoryUsage(&usage);
+                used += usage.total;
+            }
+        }
+
+        used += otherBytes;
+        uint64_t available = (m_memoryBudget > used) ? m_memoryBudget - used : 0;
+        uint64_t fit = available / bufferBytes;
+        if (fit < minCount)
+        {
+            LOG(LOG_WARNING, "Memory budget exceeded, using the minimum of %d driver buffers\n", minCount);
+            count = minCount;
+        }
+        else if (fit < maxCount)
+        {
+            count = static_cast<uint32_t>(fit);
+        }
+    }
+
+    // reserve the buffers until the capture thread
+    // reports the actual size
+    stream->setDriverBufferBytes(count*bufferBytes);
+    return count;
+}
+
+CapResult Context::getStreamOpenTiming(int32_t streamID, CapOpenTiming *timing)
+{
+    Stream* stream = lookupStreamByID(streamID);
+    if (stream == nullptr) return CAPRESULT_ERR;
+    return stream->getOpenTiming(timing) ? CAPRESULT_OK : CAPRESULT_PROPERTYNOTSUPPORTED;
+}
+
+CapResult Context::getStreamFrameMetadata(int32_t streamID, CapFrameMetadata *metadata)
+{
+    Stream* stream = lookupStreamByID(streamID);
+    if (stream == nullptr) return CAPRESULT_ERR;
+    return stream->getFrameMetadata(metadata) ? CAPRESULT_OK : CAPRESULT_PROPERTYNOTSUPPORTED;
+}
+
 bool Context::setStreamFrameRate(int32_t streamID, uint32_t fps)
 {
     if (streamID < 0)
@@ -276,7 +745,7 @@ bool Context::setStreamFrameRate(int32_t streamID, uint32_t fps)
         return 0;
     }    
 
-    Stream *stream = m_streams[streamID];
+    Stream *stream = lookupStreamByID(streamID);
     if (stream == nullptr)
     {
         LOG(LOG_ERR, "setStreamFrameRate was called with an unknown stream ID\n");
@@ -286,12 +755,14 @@ bool Context::setStreamFrameRate(int32_t streamID, uint32_t fps)
     return stream->setFrameRate(fps);
 }
 
-#if 0
 /** Lookup a stream by ID and return a pointer
     to it if it exists. If it doesnt exist, 
     return NULL */
 Stream* Context::lookupStreamByID(int32_t ID)
 {
+    // find() does not insert unknown IDs into the map,
+    // which the metrics thread may be iterating.
+    std::lock_guard<std::mutex> lock(m_streamsMutex);
     auto it = m_streams.find(ID);
     if (it != m_streams.end())
     {
@@ -299,12 +770,12 @@ Stream* Context::lookupStreamByID(int32_t ID)
     }
     return nullptr;
 }
-#endif
 
 /** Store a stream pointer in the m_streams map
     and return its unique ID */
 int32_t Context::storeStream(Stream *stream)
 {   
+    std::lock_guard<std::mutex> lock(m_streamsMutex);
     int32_t ID = m_streamCounter++; 
     m_streams.insert(std::pair<int32_t,Stream*>(ID, stream));    
     return ID;
@@ -314,34 +785,45 @@ int32_t Context::storeStream(Stream *stream)
     Return true if this was successful */
 bool Context::removeStream(int32_t ID)
 {
+    m_streamsMutex.lock();
     auto it = m_streams.find(ID);
-    if (it != m_streams.end())
+    if (it == m_streams.end())
+    {
+        m_streamsMutex.unlock();
+        return false;
+    }
+    Stream *stream = it->second;
+    m_streams.erase(it);
+    m_streamsMutex.unlock();
+
+    // the control worker uses the platform stream,
+    // so it must stop before the stream is destroyed.
+    if (stream != nullptr)
     {
-        delete it->second;
-        m_streams.erase(it);
-        return true;
+        stream->stopControlWorker();
     }
-    return false;
+    delete stream;
+    return true;
 }
 
 bool Context::getStreamPropertyLimits(int32_t streamID, uint32_t propertyID, 
         int32_t *min, int32_t *max, int32_t *dValue)
 {
-    Stream* stream = m_streams[streamID];
+    Stream* stream = lookupStreamByID(streamID);
     if (stream == nullptr) return false;
     return stream->getPropertyLimits(propertyID, min, max, dValue);
 }
 
 bool Context::setStreamAutoProperty(int32_t streamID, uint32_t propertyID, bool enable)
 {
-    Stream* stream = m_streams[streamID];
+    Stream* stream = lookupStreamByID(streamID);
     if (stream == nullptr) return false;
     return stream->setAutoProperty(propertyID, enable);
 }
 
 bool Context::setStreamProperty(int32_t streamID, uint32_t propertyID, int32_t value)
 {
-    Stream* stream = m_streams[streamID];
+    Stream* stream = lookupStreamByID(streamID);
     if (stream == nullptr) return false;
     return stream->setProperty(propertyID, value);
 }
@@ -349,19 +831,155 @@ bool Context::setStreamProperty(int32_t streamID, uint32_t propertyID, int32_t v
 
 bool Context::getStreamProperty(int32_t streamID, uint32_t propertyID, int32_t &outValue)
 {
-    Stream* stream = m_streams[streamID];
+    Stream* stream = lookupStreamByID(streamID);
     if (stream == nullptr) return false;
     return stream->getProperty(propertyID, outValue);
 }
 
 
+bool Context::setStreamPropertyAsync(int32_t streamID, uint32_t propertyID, int32_t value,
+    CapPropertyCallback callback, void *user)
+{
+    Stream* stream = lookupStreamByID(streamID);
+    if (stream == nullptr) return false;
+    stream->getControlWorker()->setProperty(propertyID, value, callback, user);
+    return true;
+}
+
+bool Context::setStreamAutoPropertyAsync(int32_t streamID, uint32_t propertyID, bool enable,
+    CapPropertyCallback callback, void *user)
+{
+    Stream* stream = lookupStreamByID(streamID);
+    if (stream == nullptr) return false;
+    stream->getControlWorker()->setAutoProperty(propertyID, enable, callback, user);
+    return true;
+}
+
+bool Context::getStreamPropertyAsync(int32_t streamID, uint32_t propertyID,
+    CapPropertyCallback callback, void *user)
+{
+    Stream* stream = lookupStreamByID(streamID);
+    if (stream == nullptr) return false;
+    stream->getControlWorker()->getProperty(propertyID, callback, user);
+    return true;
+}
+
+bool Context::flushStreamProperties(int32_t streamID)
+{
+    Stream* stream = lookupStreamByID(streamID);
+    if (stream == nullptr) return false;
+    stream->getControlWorker()->flush();
+    return true;
+}
+
 bool Context::getStreamAutoProperty(int32_t streamID, uint32_t propertyID, bool &enable)
 {
-    Stream* stream = m_streams[streamID];
+    Stream* stream = lookupStreamByID(streamID);
     if (stream == nullptr) return false;
     return stream->getAutoProperty(propertyID, enable);
 }
 
+CapResult Context::setStreamColorPipeline(int32_t streamID, const CapColorPipeline *pipeline)
+{
+    Stream* stream = lookupStreamByID(streamID);
+    if (stream == nullptr) return CAPRESULT_ERR;
+    return stream->setColorPipeline(pipeline) ? CAPRESULT_OK : CAPRESULT_FORMATNOTSUPPORTED;
+}
+
+CapResult Context::autoFocusStream(int32_t streamID, const CapRect *roi, uint32_t strategy, CapFocusResult *result)
+{
+    Stream* stream = lookupStreamByID(streamID);
+    if (stream == nullptr) return CAPRESULT_ERR;
+    if (!stream->isOpen()) return CAPRESULT_ERR;
+    if (stream->hasBufferRing())
+    {
+        // the search reads m_frameBuffer, which the ring bypasses
+        LOG(LOG_ERR, "autoFocusStream: not available while a buffer ring is registered\n");
+        return CAPRESULT_ERR;
+    }
+
+    AutoFocus autoFocus(stream);
+    return autoFocus.run(roi, strategy, result);
+}
+
+CapResult Context::setStreamExposureControl(int32_t streamID, const CapExposureControl *control)
+{
+    Stream* stream = lookupStreamByID(streamID);
+    if (stream == nullptr) return CAPRESULT_ERR;
+
+    if (control != nullptr)
+    {
+        if (!ExposureController::isValid(*control))
+        {
+            LOG(LOG_ERR, "setStreamExposureControl: invalid target, tolerance or damping\n");
+            return CAPRESULT_ERR;
+        }
+
+        int32_t emin, emax, dValue;
+        if (!stream->getPropertyLimits(CAPPROPID_EXPOSURE, &emin, &emax, &dValue))
+        {
+            return CAPRESULT_PROPERTYNOTSUPPORTED;
+        }
+    }
+    return stream->setExposureControl(control) ? CAPRESULT_OK : CAPRESULT_FORMATNOTSUPPORTED;
+}
+
+CapResult Context::registerStreamBufferRing(int32_t streamID, uint32_t count, void * const *buffers,
+    const uint32_t *sizes)
+{
+    Stream* stream = lookupStreamByID(streamID);
+    if (stream == nullptr) return CAPRESULT_ERR;
+    if (!stream->supportsBufferRing()) return CAPRESULT_FORMATNOTSUPPORTED;
+
+    if ((count > 0) && ((buffers == nullptr) || (sizes == nullptr)))
+    {
+        LOG(LOG_ERR, "registerStreamBufferRing: buffers or sizes is NULL\n");
+        return CAPRESULT_ERR;
+    }
+
+    // head wraps at 2^32, so i % count only stays continuous
+    // across the wrap when count divides 2^32.
+    if ((count & (count - 1)) != 0)
+    {
+        LOG(LOG_ERR, "registerStreamBufferRing: count %u is not a power of two\n", count);
+        return CAPRESULT_ERR;
+    }
+    return stream->registerBufferRing(count, buffers, sizes) ? CAPRESULT_OK : CAPRESULT_ERR;
+}
+
+CapBufferRing* Context::getStreamBufferRing(int32_t streamID)
+{
+    Stream* stream = lookupStreamByID(streamID);
+    if (stream == nullptr) return nullptr;
+    return stream->getBufferRing();
+}
+
+CapResult Context::releaseStreamBufferRingFrames(int32_t streamID, uint32_t frames)
+{
+    Stream* stream = lookupStreamByID(streamID);
+    if (stream == nullptr) return CAPRESULT_ERR;
+    return stream->releaseBufferRingFrames(frames) ? CAPRESULT_OK : CAPRESULT_ERR;
+}
+
+CapResult Context::getStreamBufferRingMetadata(int32_t streamID, uint32_t frame, CapFrameMetadata *metadata)
+{
+    Stream* stream = lookupStreamByID(streamID);
+    if (stream == nullptr) return CAPRESULT_ERR;
+    return stream->getBufferRingMetadata(frame, metadata) ? CAPRESULT_OK : CAPRESULT_ERR;
+}
+
+CapResult Context::getStreamExposureState(int32_t streamID, CapExposureState *state)
+{
+    Stream* stream = lookupStreamByID(streamID);
+    if (stream == nullptr) return CAPRESULT_ERR;
+
+    if (!stream->getExposureState(state))
+    {
+        memset(state, 0, sizeof(CapExposureState));
+    }
+    return CAPRESULT_OK;
+}
+
 /** convert a FOURCC uint32_t to human readable form */
 std::string fourCCToString(uint32_t fourcc)
 {
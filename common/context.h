@@ -31,12 +31,17 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 #include <stdint.h>
 
 #include "openpnp-capture.h"
 #include "deviceinfo.h"
 
 class Stream;   // pre-declaration
+class MetricsServer;
+struct streamMetrics_t;
 
 /* Define a platform stream factory call to
    separate platform dependent code from this class.
@@ -51,15 +56,32 @@ class Context
 {
 public:
     /** Create a context for the library.
-        Device enumeration is perform in the constructor,
-        so all devices must be present in the system when
-        the Context is created or devices will not be found.
+        The devices are not enumerated by the constructor;
+        the creator calls enumerate or enumerateAsync. All 
+        devices must be present in the system at that time
+        or they will not be found.
 
         Re-enumeration support is pending.
     */
     Context();
     virtual ~Context();
 
+    /** Enumerate the devices on the calling thread */
+    void enumerate();
+
+    /** Enumerate the devices on a background thread. Device
+        queries wait until it has finished. The callback, if
+        not NULL, is called on that thread afterwards. */
+    void enumerateAsync(CapContextCallback callback, void *user);
+
+    /** returns true if the devices have been enumerated */
+    bool isEnumerated() const;
+
+    /** Wait for the enumeration thread to finish. Must be called 
+        before the derived platform context is destroyed, as the
+        thread calls its enumerateDevices function. */
+    void joinEnumeration();
+
     /** Get the UTF-8 device name of a device with index/ID id */
     const char* getDeviceName(CapDeviceID id) const;
 
@@ -105,6 +127,17 @@ public:
     */
     int32_t openStream(CapDeviceID id, CapFormatID formatID);
 
+    /** Opens streams to several devices at once. Devices on different
+        buses are negotiated concurrently, devices on the same bus one
+        after another. Waits until every stream has produced its first
+        frame or the timeout expires. The stream IDs are written to
+        streamIDs, -1 for devices that could not be opened.
+
+        @return true if all streams were opened and produced a frame in time.
+    */
+    bool openStreams(uint32_t count, const CapDeviceID *ids, const CapFormatID *formatIDs, 
+        int32_t *streamIDs, uint32_t timeoutMillis);
+
     /** close the stream to a device */
     bool closeStream(int32_t streamID);
 
@@ -114,12 +147,83 @@ public:
     /** returns true if succeeds, else false */
     bool captureFrame(int32_t streamID, uint8_t *RGBbufferPtr, size_t RGBbufferBytes);
 
+    /** copy a region of the most recent frame, returns true if succeeds */
+    bool captureFrameRegion(int32_t streamID, uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+        uint8_t *dst, uint32_t dstStride);
+
     /** returns true if the stream has a new frame, false otherwise */
     bool hasNewFrame(int32_t streamID);
 
+    /** returns true if the stream has a frame that differs from the 
+        previously converted frame, false otherwise */
+    bool hasChangedFrame(int32_t streamID);
+
+    /** set the change detection threshold of a stream, 0 turns it off */
+    CapResult setStreamChangeDetection(int32_t streamID, uint32_t threshold);
+
+    /** set the output frame size of a stream, 0 x 0 selects the native size */
+    CapResult setStreamOutputSize(int32_t streamID, uint32_t width, uint32_t height);
+
+    /** set the priority class of a stream, CAPPRIORITY_xxx */
+    CapResult setStreamPriority(int32_t streamID, uint32_t priority);
+
     /** returns the number of frames captured during the lifetime of the stream */
     uint32_t getStreamFrameCount(int32_t streamID);
 
+    /** get the time spent in each step of opening a stream */
+    CapResult getStreamOpenTiming(int32_t streamID, CapOpenTiming *timing);
+
+    /** get the metadata of the frame most recently read from a stream */
+    CapResult getStreamFrameMetadata(int32_t streamID, CapFrameMetadata *metadata);
+
+    /** get the memory used by all streams, including streams being opened */
+    void getMemoryUsage(CapMemoryUsage *usage);
+
+    /** get the memory used by a stream */
+    bool getStreamMemoryUsage(int32_t streamID, CapMemoryUsage *usage);
+
+    /** start recording the raw frames of a stream to a capture archive */
+    CapResult startStreamRecording(int32_t streamID, const char *filename);
+
+    /** stop recording a stream */
+    CapResult stopStreamRecording(int32_t streamID);
+
+    /** start serving the frames of a stream as MJPEG over HTTP */
+    CapResult startStreamPreviewServer(int32_t streamID, const char *address);
+
+    /** stop the preview server of a stream */
+    CapResult stopStreamPreviewServer(int32_t streamID);
+
+    /** get the counters of a stream */
+    bool getStreamStats(int32_t streamID, CapStreamStats *stats);
+
+    /** take a snapshot of the counters of all open streams */
+    void collectMetrics(std::vector<streamMetrics_t> &metrics);
+
+    /** start the metrics server, see MetricsServer::start */
+    bool startMetricsServer(const std::string &address);
+
+    /** stop the metrics server, if running */
+    void stopMetricsServer();
+
+    /** set the memory budget in bytes, 0 for no budget */
+    void setMemoryBudget(uint64_t bytes);
+
+    /** Choose the number of driver buffers of a stream that is being opened,
+        so the context stays within its memory budget. The chosen buffers are
+        accounted to the stream right away, so streams opened concurrently 
+        see each other's reservations.
+
+        @param stream the stream being opened.
+        @param bufferBytes the size of one driver buffer.
+        @param otherBytes the other memory the stream will allocate, e.g. its frame buffer.
+        @param minCount the minimum number of buffers.
+        @param maxCount the number of buffers used without a budget.
+        @return the number of buffers, between minCount and maxCount.
+    */
+    uint32_t chooseBufferCount(Stream *stream, size_t bufferBytes, size_t otherBytes,
+        uint32_t minCount, uint32_t maxCount);
+
     /** set the frame rate of a stream 
         returns false if the camera does not support the frame rate
     */
@@ -174,6 +278,101 @@ public:
     */
     bool getStreamAutoProperty(int32_t stream, uint32_t propID, bool &enable);
 
+    /** Queue setting the value of a property on the control worker of the stream.
+        The callback may be NULL.
+
+        @return true if the request was queued.
+    */
+    bool setStreamPropertyAsync(int32_t streamID, uint32_t propertyID, int32_t value,
+        CapPropertyCallback callback, void *user);
+
+    /** Queue setting the automatic state of a property on the control worker of the stream.
+        The callback may be NULL.
+
+        @return true if the request was queued.
+    */
+    bool setStreamAutoPropertyAsync(int32_t streamID, uint32_t propertyID, bool enable,
+        CapPropertyCallback callback, void *user);
+
+    /** Queue reading the value of a property on the control worker of the stream.
+
+        @return true if the request was queued.
+    */
+    bool getStreamPropertyAsync(int32_t streamID, uint32_t propertyID,
+        CapPropertyCallback callback, void *user);
+
+    /** Wait until all queued property requests of a stream have been applied.
+
+        @return true if succesful.
+    */
+    bool flushStreamProperties(int32_t streamID);
+
+    /** Set the software colour correction of a stream.
+
+        @param streamID the ID of the stream.
+        @param pipeline the colour correction settings, or NULL to turn it off.
+        @return CAPRESULT_OK if succesful.
+    */
+    CapResult setStreamColorPipeline(int32_t streamID, const CapColorPipeline *pipeline);
+
+    /** Find the sharpest focus position of a stream, see AutoFocus.
+
+        @param streamID the ID of the stream.
+        @param roi the region of interest, or NULL for the whole frame.
+        @param strategy the search strategy, CAPFOCUS_xxx.
+        @param result receives the best position and the score curve.
+        @return CAPRESULT_OK if succesful.
+    */
+    CapResult autoFocusStream(int32_t streamID, const CapRect *roi, uint32_t strategy, 
+        CapFocusResult *result);
+
+    /** Enable or disable the software exposure controller of a stream.
+
+        @param streamID the ID of the stream.
+        @param control the controller settings, or NULL to turn it off.
+        @return CAPRESULT_OK if succesful.
+    */
+    CapResult setStreamExposureControl(int32_t streamID, const CapExposureControl *control);
+
+    /** Get the state of the software exposure controller of a stream.
+
+        @param streamID the ID of the stream.
+        @param state receives the state.
+        @return CAPRESULT_OK if succesful.
+    */
+    CapResult getStreamExposureState(int32_t streamID, CapExposureState *state);
+
+    /** Register a ring of application buffers for a stream.
+
+        @param streamID the ID of the stream.
+        @param count the number of slots, 0 to remove the ring.
+        @param buffers pointers to the slots.
+        @param sizes the size of each slot in bytes.
+        @return CAPRESULT_OK if succesful.
+    */
+    CapResult registerStreamBufferRing(int32_t streamID, uint32_t count, void * const *buffers,
+        const uint32_t *sizes);
+
+    /** Get the indices of the buffer ring of a stream, or NULL */
+    CapBufferRing* getStreamBufferRing(int32_t streamID);
+
+    /** Mark the oldest frames of the buffer ring of a stream as done.
+
+        @param streamID the ID of the stream.
+        @param frames the number of frames.
+        @return CAPRESULT_OK if succesful.
+    */
+    CapResult releaseStreamBufferRingFrames(int32_t streamID, uint32_t frames);
+
+    /** Get the metadata of a frame in the buffer ring of a stream.
+
+        @param streamID the ID of the stream.
+        @param frame the frame number.
+        @param metadata receives the metadata.
+        @return CAPRESULT_OK if succesful.
+    */
+    CapResult getStreamBufferRingMetadata(int32_t streamID, uint32_t frame, CapFrameMetadata *metadata);
+
 protected:
     /** Enumerate all capture devices and put their 
         information (name, buffer formats etc) into 
@@ -184,6 +383,34 @@ protected:
     */
     virtual bool enumerateDevices() = 0;
 
+    /** Called on the thread started by enumerateAsync. Platforms
+        that need per-thread setup before enumerating override it. */
+    virtual bool enumerateDevicesInBackground()
+    {
+        return enumerateDevices();
+    }
+
+    /** wait until the devices have been enumerated, called
+        by all functions that read m_devices */
+    void waitForDevices() const;
+
+    /** Returns true if the platform streams can be opened
+        from several threads at once. Otherwise openStreams
+        opens the devices one after another. */
+    virtual bool supportsConcurrentOpen() const
+    {
+        return false;
+    }
+
+    /** Create a platform stream and open it, returns NULL
+        if the device could not be opened. The stream is 
+        not stored in m_streams. */
+    Stream* createStream(CapDeviceID id, CapFormatID formatID);
+
+    /** Lookup a stream by ID with m_streamsMutex held.
+        Returns NULL if the stream does not exist. */
+    Stream* lookupStreamByID(int32_t ID);
+
     /** Store a stream pointer in the m_streams map
         and return its unique ID */
     int32_t storeStream(Stream *stream);
@@ -195,7 +422,16 @@ protected:
 
     std::vector<deviceInfo*>    m_devices;          ///< list of enumerated devices
     std::map<int32_t, Stream*>  m_streams;          ///< collection of streams
+    std::vector<Stream*>        m_openingStreams;   ///< streams being opened, not yet in m_streams
+    uint64_t                    m_memoryBudget;     ///< memory budget in bytes, 0 for none
+    std::mutex                  m_streamsMutex;     ///< protects m_streams, m_openingStreams and m_memoryBudget
     int32_t                     m_streamCounter;    ///< counter to generate stream IDs
+    MetricsServer*              m_metricsServer;    ///< metrics exporter, or NULL
+
+    std::thread                 m_enumThread;       ///< background enumeration, see enumerateAsync
+    mutable std::mutex          m_enumMutex;        ///< protects m_enumerated
+    mutable std::condition_variable m_enumCond;     ///< signalled when m_enumerated is set
+    bool                        m_enumerated;       ///< true when m_devices is complete
 };
 
 /** convert a FOURCC uint32_t to human readable form */
@@ -0,0 +1,206 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Platform independent control worker that applies
+    property requests of a stream on a background thread
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#include "controlworker.h"
+#include "stream.h"
+#include "logging.h"
+
+ControlWorker::ControlWorker(Stream *stream) :
+    m_stream(stream),
+    m_busy(false),
+    m_quit(false),
+    m_coalesced(0)
+{
+    m_thread = std::thread(&ControlWorker::threadFunction, this);
+}
+
+ControlWorker::~ControlWorker()
+{
+    std::vector<request_t*> dropped;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+        dropped.swap(m_queue);
+    }
+    m_wake.notify_all();
+    m_thread.join();
+
+    for(request_t *req : dropped)
+    {
+        for(auto const &cb : req->callbacks)
+        {
+            cb.func(req->propID, CAPRESULT_ERR, req->value, cb.user);
+        }
+        delete req;
+    }
+
+    for(request_t *req : m_free)
+    {
+        delete req;
+    }
+}
+
+void ControlWorker::setProperty(uint32_t propID, int32_t value, CapPropertyCallback callback, void *user)
+{
+    post(REQ_SET, propID, value, callback, user);
+}
+
+void ControlWorker::setAutoProperty(uint32_t propID, bool enabled, CapPropertyCallback callback, void *user)
+{
+    post(REQ_SETAUTO, propID, enabled ? 1 : 0, callback, user);
+}
+
+void ControlWorker::getProperty(uint32_t propID, CapPropertyCallback callback, void *user)
+{
+    post(REQ_GET, propID, 0, callback, user);
+}
+
+void ControlWorker::flush()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_idle.wait(lock, [this]{ return m_queue.empty() && !m_busy; });
+}
+
+uint32_t ControlWorker::getCoalescedCount()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_coalesced;
+}
+
+void ControlWorker::post(requestType type, uint32_t propID, int32_t value, 
+    CapPropertyCallback callback, void *user)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        // find the most recent request for this property,
+        // a write of the same kind takes the new value.
+        if (type != REQ_GET)
+        {
+            for(auto iter = m_queue.rbegin(); iter != m_queue.rend(); ++iter)
+            {
+                request_t *req = *iter;
+                if (req->propID != propID)
+                {
+                    continue;
+                }
+
+                if (req->type == type)
+                {
+                    req->value = value;
+                    if (callback != nullptr)
+                    {
+                        req->callbacks.push_back({callback, user});
+                    }
+                    m_coalesced++;
+                    return;
+                }
+                break;
+            }
+        }
+
+        request_t *req;
+        if (m_free.empty())
+        {
+            req = new request_t();
+        }
+        else
+        {
+            req = m_free.back();
+            m_free.pop_back();
+        }
+
+        req->type   = type;
+        req->propID = propID;
+        req->value  = value;
+        req->callbacks.clear();
+        if (callback != nullptr)
+        {
+            req->callbacks.push_back({callback, user});
+        }
+        m_queue.push_back(req);
+    }
+    m_wake.notify_one();
+}
+
+void ControlWorker::threadFunction()
+{
+    LOG(LOG_DEBUG, "Control worker started\n");
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while(true)
+    {
+        m_wake.wait(lock, [this]{ return m_quit || !m_queue.empty(); });
+        if (m_quit)
+        {
+            break;
+        }
+
+        request_t *req = m_queue.front();
+        m_queue.erase(m_queue.begin());
+        m_busy = true;
+
+        // the control transfer runs without the lock
+        // so new requests can be queued meanwhile.
+        lock.unlock();
+
+        bool ok = false;
+        int32_t value = req->value;
+        switch(req->type)
+        {
+        case REQ_SET:
+            ok = m_stream->setProperty(req->propID, req->value);
+            break;
+        case REQ_SETAUTO:
+            ok = m_stream->setAutoProperty(req->propID, req->value != 0);
+            break;
+        case REQ_GET:
+            ok = m_stream->getProperty(req->propID, value);
+            break;
+        }
+
+        CapResult result = ok ? CAPRESULT_OK : CAPRESULT_PROPERTYNOTSUPPORTED;
+        for(auto const &cb : req->callbacks)
+        {
+            cb.func(req->propID, result, value, cb.user);
+        }
+
+        lock.lock();
+        m_free.push_back(req);
+        m_busy = false;
+        if (m_queue.empty())
+        {
+            m_idle.notify_all();
+        }
+    }
+
+    m_busy = false;
+    m_idle.notify_all();
+    LOG(LOG_DEBUG, "Control worker stopped\n");
+}
@@ -0,0 +1,123 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Platform independent control worker that applies
+    property requests of a stream on a background thread
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#ifndef controlworker_h
+#define controlworker_h
+
+#include <stdint.h>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include "openpnp-capture.h"
+
+class Stream;   // pre-declaration
+
+/** The ControlWorker applies property requests of a stream on 
+    its own thread, so slow control transfers do not block the 
+    caller.
+
+    Writes to a property that is still waiting in the queue are
+    coalesced: the pending request takes the newest value, and 
+    all callbacks of the coalesced requests are called when it
+    completes. A write is only coalesced if no later request for
+    the same property is queued, so the order of writes to a 
+    property is preserved.
+
+    Callbacks are called on the worker thread.
+
+    Requests are recycled rather than freed, so once the queue
+    has reached its working size, posting a request does not
+    allocate memory. This makes it safe to post from the
+    capture thread.
+*/
+class ControlWorker
+{
+public:
+    ControlWorker(Stream *stream);
+
+    /** stops the worker thread. Callbacks of requests that are still
+        queued are called with CAPRESULT_ERR. */
+    virtual ~ControlWorker();
+
+    /** queue setting the value of a property */
+    void setProperty(uint32_t propID, int32_t value, CapPropertyCallback callback, void *user);
+
+    /** queue setting the automatic flag of a property */
+    void setAutoProperty(uint32_t propID, bool enabled, CapPropertyCallback callback, void *user);
+
+    /** queue reading the value of a property */
+    void getProperty(uint32_t propID, CapPropertyCallback callback, void *user);
+
+    /** wait until all queued requests have been applied */
+    void flush();
+
+    /** returns the number of writes that were merged into a pending write */
+    uint32_t getCoalescedCount();
+
+protected:
+    enum requestType
+    {
+        REQ_SET,
+        REQ_SETAUTO,
+        REQ_GET
+    };
+
+    struct callback_t
+    {
+        CapPropertyCallback func;
+        void *user;
+    };
+
+    struct request_t
+    {
+        requestType type;
+        uint32_t    propID;
+        int32_t     value;
+        std::vector<callback_t> callbacks;
+    };
+
+    void post(requestType type, uint32_t propID, int32_t value, 
+        CapPropertyCallback callback, void *user);
+
+    void threadFunction();
+
+    Stream                  *m_stream;
+    std::vector<request_t*> m_queue;        ///< pending requests, oldest first
+    std::vector<request_t*> m_free;         ///< requests that can be reused
+    std::mutex              m_mutex;        ///< protects m_queue, m_free, m_busy and m_quit
+    std::condition_variable m_wake;         ///< signals new requests or m_quit
+    std::condition_variable m_idle;         ///< signals an empty queue
+    bool                    m_busy;         ///< true while a request is being applied
+    bool                    m_quit;         ///< true if the worker thread should exit
+    uint32_t                m_coalesced;    ///< number of coalesced writes
+    std::thread             m_thread;
+};
+
+#endif
@@ -39,6 +39,7 @@ public:
     std::string                 m_name;     ///< UTF-8 printable name
     std::string                 m_uniqueID; ///< UTF-8 string uniquely identifying a camera
     std::vector<CapFormatInfo>  m_formats;  ///< available buffer formats
+    std::string                 m_busKey;   ///< devices with the same bus key share bandwidth, empty if unknown
 };
 
 #endif
\ No newline at end of file
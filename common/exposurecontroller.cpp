@@ -0,0 +1,257 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Platform independent software exposure controller
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <algorithm>
+#include "exposurecontroller.h"
+#include "controlworker.h"
+#include "stream.h"
+#include "logging.h"
+
+#define AE_MAXRATIO 4.0f    ///< largest change of the exposure per step
+
+static uint64_t getMonotonicMicros()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+ExposureController::ExposureController(Stream *stream) :
+    m_stream(stream),
+    m_exposureMin(0),
+    m_exposureMax(0),
+    m_gainMin(0),
+    m_gainMax(0),
+    m_hasGain(false),
+    m_pending(0),
+    m_appliedMicros(0),
+    m_framesSinceApplied(2)
+{
+    memset(&m_control, 0, sizeof(m_control));
+    memset(&m_state, 0, sizeof(m_state));
+}
+
+ExposureController::~ExposureController()
+{
+    // queued adjustments call back into this object
+    if (m_pending > 0)
+    {
+        m_stream->getControlWorker()->flush();
+    }
+}
+
+bool ExposureController::isValid(const CapExposureControl &control)
+{
+    return (control.target >= 1) && (control.target <= 254) && (control.tolerance < 128) &&
+        (control.damping > 0.0f) && (control.damping <= 1.0f);
+}
+
+bool ExposureController::configure(const CapExposureControl &control)
+{
+    int32_t dValue;
+    if (!m_stream->getPropertyLimits(CAPPROPID_EXPOSURE, &m_exposureMin, &m_exposureMax, &dValue) ||
+        (m_exposureMax <= m_exposureMin))
+    {
+        return false;
+    }
+
+    // create the control worker here, so the capture
+    // thread does not start a thread when it posts.
+    m_stream->getControlWorker();
+
+    m_control = control;
+    m_state.enabled = 1;
+    m_stream->setAutoProperty(CAPPROPID_EXPOSURE, false);
+    if (!m_stream->getProperty(CAPPROPID_EXPOSURE, m_state.exposure))
+    {
+        m_state.exposure = dValue;
+    }
+
+    m_hasGain = false;
+    if (((control.flags & CAPAE_USEGAIN) != 0) &&
+        m_stream->getPropertyLimits(CAPPROPID_GAIN, &m_gainMin, &m_gainMax, &dValue) && (m_gainMax > m_gainMin))
+    {
+        m_hasGain = true;
+        m_stream->setAutoProperty(CAPPROPID_GAIN, false);
+        if (!m_stream->getProperty(CAPPROPID_GAIN, m_state.gain))
+        {
+            m_state.gain = dValue;
+        }
+    }
+
+    LOG(LOG_INFO, "ExposureController: target %d +/- %d, exposure %d (%d..%d), gain %s\n",
+        control.target, control.tolerance, m_state.exposure, m_exposureMin, m_exposureMax,
+        m_hasGain ? "on" : "off");
+    return true;
+}
+
+void ExposureController::processFrame(const uint8_t *rgb, uint32_t width, uint32_t height, uint32_t stride,
+    const CapFrameMetadata *metadata)
+{
+    if (!isEffective(metadata))
+    {
+        return;
+    }
+
+    // a region outside the frame, e.g. after the output
+    // size changed, measures the whole frame.
+    CapRect roi = m_control.roi;
+    if ((roi.width == 0) || (roi.height == 0) || (roi.x >= width) || (roi.y >= height) ||
+        (roi.width > width - roi.x) || (roi.height > height - roi.y))
+    {
+        roi.x = 0;
+        roi.y = 0;
+        roi.width  = width;
+        roi.height = height;
+    }
+
+    float mean = meanLuma(rgb, stride, roi);
+    m_state.meanLuma = mean;
+    m_state.measuredFrames++;
+    if (fabsf(mean - static_cast<float>(m_control.target)) <= static_cast<float>(m_control.tolerance))
+    {
+        m_state.settled = 1;
+        return;
+    }
+    m_state.settled = 0;
+
+    // the exposure is proportional to the luma, except near
+    // black and white, so the damping is applied to the ratio
+    // in the log domain.
+    float ratio = static_cast<float>(m_control.target) / std::max(mean, 1.0f);
+    ratio = std::min(AE_MAXRATIO, std::max(1.0f/AE_MAXRATIO, ratio));
+    float damped = powf(ratio, m_control.damping);
+
+    // Raise the exposure before the gain and lower the gain 
+    // before the exposure, as the gain adds noise. The gain 
+    // moves in proportion to its range.
+    int32_t exposure = m_state.exposure;
+    int32_t gain = m_state.gain;
+    bool brighter = (ratio > 1.0f);
+    if (m_hasGain && !brighter && (gain > m_gainMin))
+    {
+        int32_t step = std::max(1, static_cast<int32_t>(lroundf((m_gainMax - m_gainMin)*(1.0f - damped))));
+        gain = std::max(m_gainMin, gain - step);
+    }
+    else if (m_hasGain && brighter && (exposure >= m_exposureMax))
+    {
+        int32_t step = std::max(1, static_cast<int32_t>(lroundf((m_gainMax - m_gainMin)*(damped - 1.0f))));
+        gain = std::min(m_gainMax, gain + step);
+    }
+    else
+    {
+        int32_t target = static_cast<int32_t>(lroundf(exposure*damped));
+        if (target == exposure)
+        {
+            target += brighter ? 1 : -1;
+        }
+        exposure = std::min(m_exposureMax, std::max(m_exposureMin, target));
+    }
+
+    if ((exposure == m_state.exposure) && (gain == m_state.gain))
+    {
+        // at the limits of the camera
+        return;
+    }
+
+    m_framesSinceApplied = 0;
+    if (exposure != m_state.exposure)
+    {
+        m_state.exposure = exposure;
+        post(CAPPROPID_EXPOSURE, exposure);
+    }
+    if (gain != m_state.gain)
+    {
+        m_state.gain = gain;
+        post(CAPPROPID_GAIN, gain);
+    }
+    m_state.adjustments++;
+}
+
+void ExposureController::getState(CapExposureState *state) const
+{
+    *state = m_state;
+}
+
+float ExposureController::meanLuma(const uint8_t *rgb, uint32_t stride, const CapRect &roi)
+{
+    uint64_t sum = 0;
+    uint32_t count = 0;
+    for(uint32_t y=roi.y; y<roi.y+roi.height; y+=2)
+    {
+        const uint8_t *src = rgb + static_cast<size_t>(y)*stride + roi.x*3;
+        uint32_t lineSum = 0;
+        for(uint32_t x=0; x<roi.width; x+=2)
+        {
+            lineSum += src[x*3] + 2*src[x*3+1] + src[x*3+2];
+        }
+        sum += lineSum;
+        count += (roi.width+1)/2;
+    }
+    return (count > 0) ? static_cast<float>(sum) / (4.0f*count) : 0.0f;
+}
+
+void ExposureController::appliedCallback(CapPropertyID propID, CapResult result, int32_t value, void *user)
+{
+    ExposureController *controller = reinterpret_cast<ExposureController*>(user);
+    if (result != CAPRESULT_OK)
+    {
+        LOG_LIMITED(LOG_WARNING, "ExposureController: setting property %d to %d failed\n", propID, value);
+    }
+    controller->m_appliedMicros = getMonotonicMicros();
+    controller->m_pending--;
+}
+
+void ExposureController::post(uint32_t propID, int32_t value)
+{
+    m_pending++;
+    m_stream->getControlWorker()->setProperty(propID, value, appliedCallback, this);
+}
+
+bool ExposureController::isEffective(const CapFrameMetadata *metadata)
+{
+    if (m_pending > 0)
+    {
+        return false;
+    }
+
+    if ((metadata != nullptr) && ((metadata->flags & CAPFRAMEMETA_EXPOSURE) != 0))
+    {
+        return metadata->exposureTimestamp >= m_appliedMicros;
+    }
+
+    // the first frame after the adjustment may have been
+    // exposed partly with the old values.
+    if (m_framesSinceApplied < 2)
+    {
+        m_framesSinceApplied++;
+    }
+    return m_framesSinceApplied >= 2;
+}
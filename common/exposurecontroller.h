@@ -0,0 +1,111 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Platform independent software exposure controller
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#ifndef exposurecontroller_h
+#define exposurecontroller_h
+
+#include <stdint.h>
+#include <atomic>
+#include "openpnp-capture.h"
+
+class Stream;   // pre-declaration
+
+/** ExposureController keeps the mean luma of a region of
+    interest at a target by adjusting the exposure and gain
+    of a stream, see Cap_setExposureControl.
+
+    processFrame is called by the capture thread of the
+    platform stream for every converted frame, with the
+    frame buffer locked. Adjustments are posted to the
+    control worker of the stream, so the capture thread
+    does not wait for the camera. After an adjustment, 
+    frames are ignored until one is exposed with the new 
+    values: the first frame that started its exposure after 
+    the worker applied them, or the second frame after that
+    when the platform reports no exposure timestamps.
+
+    The controller must be destroyed before the control
+    worker of the stream is stopped.
+*/
+class ExposureController
+{
+public:
+    ExposureController(Stream *stream);
+
+    /** waits for adjustments that are still queued */
+    ~ExposureController();
+
+    /** returns true if the settings are valid */
+    static bool isValid(const CapExposureControl &control);
+
+    /** read the limits and current values of the exposure and
+        gain properties and turn off the hardware automatic 
+        exposure and gain. Call from the application thread, 
+        before the controller is handed to the capture thread.
+        Returns false if the camera has no exposure control. */
+    bool configure(const CapExposureControl &control);
+
+    /** measure a converted 24-bit RGB frame and adjust the 
+        exposure if needed. metadata may be NULL. */
+    void processFrame(const uint8_t *rgb, uint32_t width, uint32_t height, uint32_t stride,
+        const CapFrameMetadata *metadata);
+
+    /** get the state of the controller */
+    void getState(CapExposureState *state) const;
+
+    /** returns the mean luma, approximately (R + 2G + B) / 4, of
+        every second pixel of every second line of a region of
+        a 24-bit RGB image. */
+    static float meanLuma(const uint8_t *rgb, uint32_t stride, const CapRect &roi);
+
+protected:
+    /** called by the control worker when an adjustment was applied */
+    static void appliedCallback(CapPropertyID propID, CapResult result, int32_t value, void *user);
+
+    /** post a new property value to the control worker */
+    void post(uint32_t propID, int32_t value);
+
+    /** returns true if the frame was exposed with the values
+        of the last adjustment */
+    bool isEffective(const CapFrameMetadata *metadata);
+
+    Stream              *m_stream;
+    CapExposureControl  m_control;          ///< settings
+    int32_t             m_exposureMin;      ///< exposure limits
+    int32_t             m_exposureMax;
+    int32_t             m_gainMin;          ///< gain limits
+    int32_t             m_gainMax;
+    bool                m_hasGain;          ///< true if the gain is used
+    CapExposureState    m_state;            ///< reported state
+
+    std::atomic<uint32_t> m_pending;        ///< adjustments not yet applied by the worker
+    std::atomic<uint64_t> m_appliedMicros;  ///< time the last adjustment was applied
+    uint32_t            m_framesSinceApplied;  ///< frames seen since the last adjustment was applied
+};
+
+#endif
@@ -30,6 +30,7 @@
 #include "openpnp-capture.h"
 #include "context.h"
 #include "logging.h"
+#include "alloctracker.h"
 #include "version.h"
 
 // Define a PlatformContext factory call 
@@ -39,10 +40,63 @@
 // This function must be implemented in platformcontext.cpp
 Context* createPlatformContext();
 
+// Define a platform context factory call for contexts 
+// whose devices replay capture archives. Returns NULL 
+// if the platform does not support replay.
+//
+// This function must be implemented in platformcontext.cpp
+Context* createPlatformReplayContext(const char **filenames, uint32_t count, bool realtime);
+
+// Define a platform frame conversion call so
+// frames that did not come from a stream can
+// be converted by the platform's converters.
+//
+// This function must be implemented in the platform code
+CapResult platformConvertFrame(uint32_t srcFourcc, const uint8_t *src, size_t srcBytes,
+    uint32_t srcStride, uint32_t width, uint32_t height,
+    uint32_t dstFormat, uint8_t *dst, uint32_t dstStride);
+
 
 DLLPUBLIC CapContext Cap_createContext()
 {
     Context *ctx = createPlatformContext();
+    if (ctx != nullptr)
+    {
+        ctx->enumerate();
+    }
+    return ctx;
+}
+
+DLLPUBLIC CapContext Cap_createContextAsync(CapContextCallback callback, void *user)
+{
+    Context *ctx = createPlatformContext();
+    if (ctx != nullptr)
+    {
+        ctx->enumerateAsync(callback, user);
+    }
+    return ctx;
+}
+
+DLLPUBLIC uint32_t Cap_isContextReady(CapContext ctx)
+{
+    if (ctx != 0)
+    {
+        return ((Context*)ctx)->isEnumerated() ? 1 : 0;
+    }
+    return 0;
+}
+
+DLLPUBLIC CapContext Cap_createReplayContext(const char **filenames, uint32_t count, uint32_t realtime)
+{
+    if ((filenames == nullptr) || (count == 0))
+    {
+        return nullptr;
+    }
+    Context *ctx = createPlatformReplayContext(filenames, count, realtime != 0);
+    if (ctx != nullptr)
+    {
+        ctx->enumerate();
+    }
     return ctx;
 }
 
@@ -50,7 +104,14 @@ DLLPUBLIC CapResult Cap_releaseContext(CapContext ctx)
 {
     if (ctx != 0)
     {
+        // the enumeration thread calls into the platform context,
+        // so it must finish before the derived class is destroyed.
+        ((Context*)ctx)->joinEnumeration();
         delete (Context*)ctx;
+
+        // report what the rate limited messages of the
+        // context's streams suppressed after they went quiet.
+        flushLogSites();
         return CAPRESULT_OK;
     }
 
@@ -121,6 +182,17 @@ DLLPUBLIC CapStream Cap_openStream(CapContext ctx, CapDeviceID index, CapFormatI
     return -1;
 }
 
+DLLPUBLIC CapResult Cap_openStreams(CapContext ctx, uint32_t count, const CapDeviceID *devices, 
+    const CapFormatID *formats, CapStream *outStreams)
+{
+    if ((ctx != 0) && (devices != nullptr) && (formats != nullptr) && (outStreams != nullptr))
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        return c->openStreams(count, devices, formats, outStreams, 5000) ? CAPRESULT_OK : CAPRESULT_ERR;
+    }
+    return CAPRESULT_ERR;
+}
+
 DLLPUBLIC CapResult Cap_closeStream(CapContext ctx, CapStream stream)
 {
     if (ctx != 0)
@@ -151,6 +223,17 @@ DLLPUBLIC CapResult Cap_captureFrame(CapContext ctx, CapStream stream, void *RGB
     return CAPRESULT_ERR;
 }
 
+DLLPUBLIC CapResult Cap_captureFrameRegion(CapContext ctx, CapStream stream, 
+    uint32_t x, uint32_t y, uint32_t width, uint32_t height, void *dst, uint32_t dstStride)
+{
+    if ((ctx != 0) && (dst != nullptr))
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        return c->captureFrameRegion(stream, x, y, width, height, (uint8_t*)dst, dstStride) ? CAPRESULT_OK : CAPRESULT_ERR;
+    }
+    return CAPRESULT_ERR;
+}
+
 DLLPUBLIC uint32_t Cap_hasNewFrame(CapContext ctx, CapStream stream)
 {
     if (ctx != 0)
@@ -161,6 +244,46 @@ DLLPUBLIC uint32_t Cap_hasNewFrame(CapContext ctx, CapStream stream)
     return 0;
 }
 
+DLLPUBLIC uint32_t Cap_hasChangedFrame(CapContext ctx, CapStream stream)
+{
+    if (ctx != 0)
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        return c->hasChangedFrame(stream) ? 1: 0;
+    }    
+    return 0;
+}
+
+DLLPUBLIC CapResult Cap_setChangeDetection(CapContext ctx, CapStream stream, uint32_t threshold)
+{
+    if (ctx != 0)
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        return c->setStreamChangeDetection(stream, threshold);
+    }    
+    return CAPRESULT_ERR;
+}
+
+DLLPUBLIC CapResult Cap_setOutputSize(CapContext ctx, CapStream stream, uint32_t width, uint32_t height)
+{
+    if (ctx != 0)
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        return c->setStreamOutputSize(stream, width, height);
+    }    
+    return CAPRESULT_ERR;
+}
+
+DLLPUBLIC CapResult Cap_setStreamPriority(CapContext ctx, CapStream stream, CapPriority priority)
+{
+    if (ctx != 0)
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        return c->setStreamPriority(stream, priority);
+    }    
+    return CAPRESULT_ERR;
+}
+
 DLLPUBLIC uint32_t Cap_getStreamFrameCount(CapContext ctx, CapStream stream)
 {
     if (ctx != 0)
@@ -171,6 +294,129 @@ DLLPUBLIC uint32_t Cap_getStreamFrameCount(CapContext ctx, CapStream stream)
     return 0;    
 }
 
+DLLPUBLIC CapResult Cap_getMemoryUsage(CapContext ctx, CapMemoryUsage *usage)
+{
+    if ((ctx != 0) && (usage != nullptr))
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        c->getMemoryUsage(usage);
+        return CAPRESULT_OK;
+    }
+    return CAPRESULT_ERR;
+}
+
+DLLPUBLIC CapResult Cap_getStreamMemoryUsage(CapContext ctx, CapStream stream, CapMemoryUsage *usage)
+{
+    if ((ctx != 0) && (usage != nullptr))
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        return c->getStreamMemoryUsage(stream, usage) ? CAPRESULT_OK : CAPRESULT_ERR;
+    }
+    return CAPRESULT_ERR;
+}
+
+DLLPUBLIC CapResult Cap_setMemoryBudget(CapContext ctx, uint64_t bytes)
+{
+    if (ctx != 0)
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        c->setMemoryBudget(bytes);
+        return CAPRESULT_OK;
+    }
+    return CAPRESULT_ERR;
+}
+
+DLLPUBLIC CapResult Cap_startRecording(CapContext ctx, CapStream stream, const char *filename)
+{
+    if ((ctx != 0) && (filename != nullptr))
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        return c->startStreamRecording(stream, filename);
+    }
+    return CAPRESULT_ERR;
+}
+
+DLLPUBLIC CapResult Cap_stopRecording(CapContext ctx, CapStream stream)
+{
+    if (ctx != 0)
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        return c->stopStreamRecording(stream);
+    }
+    return CAPRESULT_ERR;
+}
+
+DLLPUBLIC CapResult Cap_startPreviewServer(CapContext ctx, CapStream stream, const char *address)
+{
+    if ((ctx != 0) && (address != nullptr))
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        return c->startStreamPreviewServer(stream, address);
+    }
+    return CAPRESULT_ERR;
+}
+
+DLLPUBLIC CapResult Cap_stopPreviewServer(CapContext ctx, CapStream stream)
+{
+    if (ctx != 0)
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        return c->stopStreamPreviewServer(stream);
+    }
+    return CAPRESULT_ERR;
+}
+
+DLLPUBLIC CapResult Cap_getStreamStats(CapContext ctx, CapStream stream, CapStreamStats *stats)
+{
+    if ((ctx != 0) && (stats != nullptr))
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        return c->getStreamStats(stream, stats) ? CAPRESULT_OK : CAPRESULT_ERR;
+    }
+    return CAPRESULT_ERR;
+}
+
+DLLPUBLIC CapResult Cap_startMetricsServer(CapContext ctx, const char *address)
+{
+    if ((ctx != 0) && (address != nullptr))
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        return c->startMetricsServer(address) ? CAPRESULT_OK : CAPRESULT_ERR;
+    }
+    return CAPRESULT_ERR;
+}
+
+DLLPUBLIC CapResult Cap_stopMetricsServer(CapContext ctx)
+{
+    if (ctx != 0)
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        c->stopMetricsServer();
+        return CAPRESULT_OK;
+    }
+    return CAPRESULT_ERR;
+}
+
+DLLPUBLIC CapResult Cap_getStreamOpenTiming(CapContext ctx, CapStream stream, CapOpenTiming *timing)
+{
+    if ((ctx != 0) && (timing != nullptr))
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        return c->getStreamOpenTiming(stream, timing);
+    }
+    return CAPRESULT_ERR;
+}
+
+DLLPUBLIC CapResult Cap_getFrameMetadata(CapContext ctx, CapStream stream, CapFrameMetadata *metadata)
+{
+    if ((ctx != 0) && (metadata != nullptr))
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        return c->getStreamFrameMetadata(stream, metadata);
+    }
+    return CAPRESULT_ERR;
+}
+
 #if 0
 
 // not used for now..
@@ -219,6 +465,49 @@ DLLPUBLIC CapResult Cap_setProperty(CapContext ctx, CapStream stream, CapPropert
     return CAPRESULT_ERR;
 }
 
+DLLPUBLIC CapResult Cap_setPropertyAsync(CapContext ctx, CapStream stream, CapPropertyID propID, int32_t value,
+    CapPropertyCallback callback, void *user)
+{
+    if (ctx != 0)
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        return c->setStreamPropertyAsync(stream, propID, value, callback, user) ? CAPRESULT_OK : CAPRESULT_ERR;
+    }
+    return CAPRESULT_ERR;
+}
+
+DLLPUBLIC CapResult Cap_setAutoPropertyAsync(CapContext ctx, CapStream stream, CapPropertyID propID, uint32_t bOnOff,
+    CapPropertyCallback callback, void *user)
+{
+    if (ctx != 0)
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        return c->setStreamAutoPropertyAsync(stream, propID, bOnOff != 0, callback, user) ? CAPRESULT_OK : CAPRESULT_ERR;
+    }
+    return CAPRESULT_ERR;
+}
+
+DLLPUBLIC CapResult Cap_getPropertyAsync(CapContext ctx, CapStream stream, CapPropertyID propID,
+    CapPropertyCallback callback, void *user)
+{
+    if ((ctx != 0) && (callback != nullptr))
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        return c->getStreamPropertyAsync(stream, propID, callback, user) ? CAPRESULT_OK : CAPRESULT_ERR;
+    }
+    return CAPRESULT_ERR;
+}
+
+DLLPUBLIC CapResult Cap_flushProperties(CapContext ctx, CapStream stream)
+{
+    if (ctx != 0)
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        return c->flushStreamProperties(stream) ? CAPRESULT_OK : CAPRESULT_ERR;
+    }
+    return CAPRESULT_ERR;
+}
+
 DLLPUBLIC CapResult Cap_setAutoProperty(CapContext ctx, CapStream stream, CapPropertyID propID, uint32_t bOnOff)
 {
     if (ctx != 0)
@@ -275,11 +564,146 @@ DLLPUBLIC CapResult Cap_getAutoProperty(CapContext ctx, CapStream stream, CapPro
     return CAPRESULT_ERR;
 }
 
+DLLPUBLIC CapResult Cap_convertFrame(uint32_t srcFourcc, const void *src, uint32_t srcBytes,
+    uint32_t srcStride, uint32_t width, uint32_t height,
+    CapOutputFormat dstFormat, void *dst, uint32_t dstStride)
+{
+    if ((src == NULL) || (dst == NULL) || (width == 0) || (height == 0))
+    {
+        return CAPRESULT_ERR;
+    }
+
+    return platformConvertFrame(srcFourcc, (const uint8_t*)src, srcBytes, srcStride,
+        width, height, dstFormat, (uint8_t*)dst, dstStride);
+}
+
+DLLPUBLIC CapResult Cap_setColorPipeline(CapContext ctx, CapStream stream, const CapColorPipeline *pipeline)
+{
+    if ((pipeline != NULL) && (pipeline->gamma <= 0.0f))
+    {
+        return CAPRESULT_ERR;
+    }
+
+    if (ctx != 0)
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        return c->setStreamColorPipeline(stream, pipeline);
+    }
+    return CAPRESULT_ERR;
+}
+
+DLLPUBLIC CapResult Cap_autoFocus(CapContext ctx, CapStream stream, const CapRect *roi,
+    uint32_t strategy, CapFocusResult *result)
+{
+    if ((ctx != 0) && (result != nullptr))
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        return c->autoFocusStream(stream, roi, strategy, result);
+    }
+    return CAPRESULT_ERR;
+}
+
+DLLPUBLIC CapResult Cap_setExposureControl(CapContext ctx, CapStream stream, const CapExposureControl *control)
+{
+    if (ctx != 0)
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        return c->setStreamExposureControl(stream, control);
+    }
+    return CAPRESULT_ERR;
+}
+
+DLLPUBLIC CapResult Cap_registerBufferRing(CapContext ctx, CapStream stream, uint32_t count,
+    void * const *buffers, const uint32_t *sizes)
+{
+    if (ctx != 0)
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        return c->registerStreamBufferRing(stream, count, buffers, sizes);
+    }
+    return CAPRESULT_ERR;
+}
+
+DLLPUBLIC CapBufferRing* Cap_getBufferRing(CapContext ctx, CapStream stream)
+{
+    if (ctx != 0)
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        return c->getStreamBufferRing(stream);
+    }
+    return nullptr;
+}
+
+DLLPUBLIC CapResult Cap_releaseBufferRingFrames(CapContext ctx, CapStream stream, uint32_t frames)
+{
+    if (ctx != 0)
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        return c->releaseStreamBufferRingFrames(stream, frames);
+    }
+    return CAPRESULT_ERR;
+}
+
+DLLPUBLIC CapResult Cap_getBufferRingMetadata(CapContext ctx, CapStream stream, uint32_t frame,
+    CapFrameMetadata *metadata)
+{
+    if ((ctx != 0) && (metadata != nullptr))
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        return c->getStreamBufferRingMetadata(stream, frame, metadata);
+    }
+    return CAPRESULT_ERR;
+}
+
+DLLPUBLIC CapResult Cap_getExposureState(CapContext ctx, CapStream stream, CapExposureState *state)
+{
+    if ((ctx != 0) && (state != nullptr))
+    {
+        Context *c = reinterpret_cast<Context*>(ctx);
+        return c->getStreamExposureState(stream, state);
+    }
+    return CAPRESULT_ERR;
+}
+
 DLLPUBLIC void Cap_installCustomLogFunction(CapCustomLogFunc logFunc)
 {
     installCustomLogFunction(logFunc);
 }
 
+DLLPUBLIC void Cap_setLogRateLimit(uint32_t burst, uint32_t intervalMillis)
+{
+    setLogRateLimit(burst, intervalMillis);
+}
+
+DLLPUBLIC CapResult Cap_getLogStats(CapLogStats *stats)
+{
+    if (stats == nullptr)
+    {
+        return CAPRESULT_ERR;
+    }
+    getLogCounters(&stats->messages, &stats->suppressed, &stats->limitedSites);
+    return CAPRESULT_OK;
+}
+
+DLLPUBLIC CapResult Cap_getAllocationStats(CapAllocationStats *stats)
+{
+    if (stats == nullptr)
+    {
+        return CAPRESULT_ERR;
+    }
+
+    allocCounters_t total, framePath, thread;
+    getAllocCounters(&total, &framePath, &thread);
+    stats->enabled              = isAllocTrackingEnabled() ? 1 : 0;
+    stats->allocations          = total.allocations;
+    stats->bytes                = total.bytes;
+    stats->framePathAllocations = framePath.allocations;
+    stats->framePathBytes       = framePath.bytes;
+    stats->threadAllocations    = thread.allocations;
+    stats->threadBytes          = thread.bytes;
+    return CAPRESULT_OK;
+}
+
 DLLPUBLIC const char* Cap_getLibraryVersion()
 {
     #ifndef __LIBVER__
@@ -0,0 +1,145 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Platform independent helper to create listening sockets
+    for the metrics and preview servers
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "listensocket.h"
+#include "logging.h"
+
+#ifdef _WIN32
+
+int createListenSocket(const std::string &address, std::string &unixPath)
+{
+    LOG(LOG_ERR, "Listening sockets are not supported on this platform\n");
+    return -1;
+}
+
+#else
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+int createListenSocket(const std::string &address, std::string &unixPath)
+{
+    int fd = -1;
+    unixPath.clear();
+
+    if (address.compare(0, 4, "tcp:") == 0)
+    {
+        int port = atoi(address.c_str() + 4);
+        if ((port <= 0) || (port > 65535))
+        {
+            LOG(LOG_ERR, "Invalid port in '%s'\n", address.c_str());
+            return -1;
+        }
+
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0)
+        {
+            LOG(LOG_ERR, "Cannot create socket (errno = %d)\n", errno);
+            return -1;
+        }
+
+        int reuse = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(static_cast<uint16_t>(port));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+        {
+            LOG(LOG_ERR, "Cannot bind to port %d (errno = %d)\n", port, errno);
+            close(fd);
+            return -1;
+        }
+    }
+    else
+    {
+        std::string path = address;
+        if (path.compare(0, 5, "unix:") == 0)
+        {
+            path = path.substr(5);
+        }
+
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.empty() || (path.size() >= sizeof(addr.sun_path)))
+        {
+            LOG(LOG_ERR, "Invalid socket path '%s'\n", path.c_str());
+            return -1;
+        }
+        strcpy(addr.sun_path, path.c_str());
+
+        // remove a socket left behind by an earlier process,
+        // but never any other kind of file.
+        struct stat st;
+        if ((stat(path.c_str(), &st) == 0) && S_ISSOCK(st.st_mode))
+        {
+            unlink(path.c_str());
+        }
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+        {
+            LOG(LOG_ERR, "Cannot create socket (errno = %d)\n", errno);
+            return -1;
+        }
+
+        if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+        {
+            LOG(LOG_ERR, "Cannot bind to %s (errno = %d)\n", path.c_str(), errno);
+            close(fd);
+            return -1;
+        }
+        unixPath = path;
+    }
+
+    if (listen(fd, 8) != 0)
+    {
+        LOG(LOG_ERR, "Cannot listen on %s (errno = %d)\n", address.c_str(), errno);
+        close(fd);
+        if (!unixPath.empty())
+        {
+            unlink(unixPath.c_str());
+            unixPath.clear();
+        }
+        return -1;
+    }
+
+    return fd;
+}
+
+#endif
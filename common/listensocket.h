@@ -0,0 +1,47 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Platform independent helper to create listening sockets
+    for the metrics and preview servers
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#ifndef listensocket_h
+#define listensocket_h
+
+#include <string>
+
+/** Create a socket that listens on an address, either "unix:<path>",
+    "tcp:<port>" or a socket path. TCP sockets are bound to the loopback
+    interface only. A stale Unix socket at the path is replaced, any 
+    other file is left alone.
+
+    @param address the address to listen on.
+    @param unixPath receives the path of a Unix socket, which the caller 
+           must unlink when it closes the socket. Empty for TCP.
+    @return the socket, or -1 if it could not be created.
+*/
+int createListenSocket(const std::string &address, std::string &unixPath);
+
+#endif
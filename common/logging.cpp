@@ -25,6 +25,8 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
+#include <chrono>
 #include "logging.h"
 
 /* In their infinite "wisdom" Microsoft have declared snprintf is deprecated
@@ -37,18 +39,23 @@
 static uint32_t gs_logLevel = LOG_NOTICE;
 static customLogFunc gs_logFunc = NULL;
 
+static std::atomic<uint32_t> gs_rateBurst(10);          ///< messages per LOG_LIMITED site before limiting
+static std::atomic<uint32_t> gs_rateInterval(5000);     ///< interval between limited messages in ms
+static std::atomic<uint64_t> gs_messages(0);            ///< number of emitted messages
+static std::atomic<uint64_t> gs_suppressed(0);          ///< number of suppressed messages
+static std::atomic<uint32_t> gs_sites(0);               ///< number of LOG_LIMITED sites that have logged
+static std::atomic<logSite_t*> gs_siteList(nullptr);    ///< LOG_LIMITED sites that have logged
+
 void installCustomLogFunction(customLogFunc logfunc)
 {
     gs_logFunc = logfunc;
 }
 
-void LOG(uint32_t logLevel, const char *format, ...)
+/** format and emit a message. 'suppressed', if not 0, is
+    the number of messages of the same site that were 
+    suppressed before it. */
+static void emitMessage(uint32_t logLevel, uint32_t suppressed, const char *format, va_list args)
 {
-    if (logLevel > gs_logLevel)
-    {
-        return;
-    }
-
     char logbuffer[1024];
     char *ptr = logbuffer;
 
@@ -78,17 +85,24 @@ void LOG(uint32_t logLevel, const char *format, ...)
         break;
     }
     
-    va_list args;
+    char *msg = ptr;
+    if (suppressed != 0)
+    {
+        int n = snprintf(ptr, 1024-7, "[%u similar messages suppressed] ", suppressed);
+        if (n > 0)
+        {
+            ptr += n;
+        }
+    }
+    vsnprintf(ptr, logbuffer + sizeof(logbuffer) - ptr, format, args);
 
-    va_start(args, format);
-    vsnprintf(ptr, 1024-7, format, args);
-    va_end(args);
+    gs_messages++;
 
     if (gs_logFunc != nullptr)
     {
         // custom log functions to no include the 
         // prefix.
-        gs_logFunc(logLevel, ptr);
+        gs_logFunc(logLevel, msg);
     }
     else
     {
@@ -96,6 +110,122 @@ void LOG(uint32_t logLevel, const char *format, ...)
     }
 }
 
+void LOG(uint32_t logLevel, const char *format, ...)
+{
+    if (logLevel > gs_logLevel)
+    {
+        return;
+    }
+
+    va_list args;
+    va_start(args, format);
+    emitMessage(logLevel, 0, format, args);
+    va_end(args);
+}
+
+static uint64_t getLogMillis()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void LOGSITE(logSite_t *site, uint32_t logLevel, const char *format, ...)
+{
+    if (logLevel > gs_logLevel)
+    {
+        return;
+    }
+
+    uint32_t burst = gs_rateBurst;
+    uint32_t count = ++site->occurrences;
+    if (!site->registered.exchange(true))
+    {
+        // only the first caller gets here, so the site is added
+        // to the list exactly once, even after 'occurrences' wraps.
+        gs_sites++;
+        site->logLevel = logLevel;
+        logSite_t *head = gs_siteList;
+        do
+        {
+            site->next = head;
+        } while(!gs_siteList.compare_exchange_weak(head, site));
+    }
+
+    uint32_t suppressed = 0;
+    if ((burst != 0) && (count > burst))
+    {
+        // limited: only the first message after each interval
+        // is emitted, it reports the ones that were dropped.
+        uint64_t now  = getLogMillis();
+        uint64_t last = site->lastSummary;
+        if ((now - last < gs_rateInterval) || 
+            (!site->lastSummary.compare_exchange_strong(last, now)))
+        {
+            site->suppressed++;
+            gs_suppressed++;
+            return;
+        }
+        suppressed = site->suppressed.exchange(0);
+    }
+    else if (count == burst)
+    {
+        // the interval starts with the last message of the burst
+        site->lastSummary = getLogMillis();
+    }
+
+    va_list args;
+    va_start(args, format);
+    emitMessage(logLevel, suppressed, format, args);
+    va_end(args);
+}
+
+/** emit a message that is formatted from its arguments */
+static void emitFormatted(uint32_t logLevel, uint32_t suppressed, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    emitMessage(logLevel, suppressed, format, args);
+    va_end(args);
+}
+
+void flushLogSites()
+{
+    // sites are only ever added at the head, so the list 
+    // can be walked while other threads log.
+    for(logSite_t *site = gs_siteList; site != nullptr; site = site->next)
+    {
+        uint32_t suppressed = site->suppressed.exchange(0);
+        if ((suppressed != 0) && (site->logLevel <= gs_logLevel))
+        {
+            const char *file = strrchr(site->file, '/');
+            file = (file != nullptr) ? file + 1 : site->file;
+            emitFormatted(site->logLevel, suppressed, "before release (%s:%u)\n", file, site->line);
+        }
+    }
+}
+
+void setLogRateLimit(uint32_t burst, uint32_t intervalMillis)
+{
+    gs_rateBurst = burst;
+    gs_rateInterval = intervalMillis;
+}
+
+void getLogCounters(uint64_t *messages, uint64_t *suppressed, uint32_t *sites)
+{
+    if (messages != nullptr)
+    {
+        *messages = gs_messages;
+    }
+    if (suppressed != nullptr)
+    {
+        *suppressed = gs_suppressed;
+    }
+    if (sites != nullptr)
+    {
+        *sites = gs_sites;
+    }
+}
+
 void setLogLevel(uint32_t logLevel)
 {
     gs_logLevel = logLevel;
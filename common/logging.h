@@ -27,6 +27,7 @@
 #define logging_h
 
 #include <stdint.h>
+#include <atomic>
 
 // define log levels
 #define LOG_EMERG 0
@@ -42,6 +43,52 @@
 /** Log information or an error. The format is the same as printf */
 void LOG(uint32_t logLevel, const char *format, ...);
 
+/** State of a rate limited log call site, see LOG_LIMITED.
+    The constructor is constexpr so a static instance is 
+    initialised without a guard. */
+struct logSite_t
+{
+    constexpr logSite_t(const char *file_, uint32_t line_) : occurrences(0), suppressed(0), 
+        lastSummary(0), registered(false), logLevel(0), file(file_), line(line_), next(nullptr) {}
+
+    std::atomic<uint32_t> occurrences;  ///< number of messages at this site
+    std::atomic<uint32_t> suppressed;   ///< messages suppressed since the last emitted one
+    std::atomic<uint64_t> lastSummary;  ///< time of the last emitted message in ms
+    std::atomic<bool>     registered;   ///< true once the site is in the list of sites
+    uint32_t    logLevel;               ///< level of the site, set on its first message
+    const char *file;                   ///< source file of the site
+    uint32_t    line;                   ///< source line of the site
+    logSite_t  *next;                   ///< next site that has logged, see flushLogSites
+};
+
+/** Log a message from a rate limited call site. The first
+    messages of a site are emitted, after that one message per
+    interval that reports how many were suppressed since the
+    previous one. */
+void LOGSITE(logSite_t *site, uint32_t logLevel, const char *format, ...);
+
+/** LOG for messages that can occur on every frame, such as 
+    driver errors or corrupt frames. Each call site is rate
+    limited on its own, see setLogRateLimit. */
+#define LOG_LIMITED(logLevel, ...) \
+    do { static logSite_t logSite_(__FILE__, __LINE__); LOGSITE(&logSite_, logLevel, __VA_ARGS__); } while(0)
+
+/** Set the number of messages a LOG_LIMITED call site emits
+    before it is limited to one message per 'intervalMillis'. 
+    A burst of 0 turns rate limiting off. */
+void setLogRateLimit(uint32_t burst, uint32_t intervalMillis);
+
+/** Report the messages that rate limited call sites have
+    suppressed since they last emitted one, so the count of a
+    site that went quiet is not lost. The arguments of those
+    messages are gone, so each site is named by its source
+    location. Called when a context is released. */
+void flushLogSites();
+
+/** Get the number of emitted and suppressed messages, and
+    the number of rate limited call sites that have logged. */
+void getLogCounters(uint64_t *messages, uint64_t *suppressed, uint32_t *sites);
+
 /** Set the log leveel */
 void setLogLevel(uint32_t logLevel);
 
@@ -0,0 +1,344 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Platform independent metrics exporter that serves the
+    counters of all streams in Prometheus text format
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "metricsserver.h"
+#include "context.h"
+#include "logging.h"
+#include "listensocket.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#endif
+
+MetricsServer::MetricsServer(Context *owner) :
+    m_owner(owner),
+    m_listenFd(-1),
+    m_thread(nullptr)
+{
+    m_wakePipe[0] = -1;
+    m_wakePipe[1] = -1;
+}
+
+MetricsServer::~MetricsServer()
+{
+    stop();
+}
+
+/** escape a Prometheus label value */
+static std::string escapeLabel(const std::string &value)
+{
+    std::string result;
+    for(char c : value)
+    {
+        switch(c)
+        {
+        case '\\':
+            result += "\\\\";
+            break;
+        case '"':
+            result += "\\\"";
+            break;
+        case '\n':
+            result += "\\n";
+            break;
+        default:
+            result += c;
+        }
+    }
+    return result;
+}
+
+/** metric families, in the order they are written */
+enum metricID_t
+{
+    METRIC_FRAMES = 0,
+    METRIC_DROPPED,
+    METRIC_FPS,
+    METRIC_DECODE_SECONDS,
+    METRIC_LAST_DECODE_SECONDS,
+    METRIC_QUEUE_DEPTH,
+    METRIC_RECOVERIES,
+    METRIC_MEMORY,
+    METRIC_COUNT
+};
+
+static const struct
+{
+    const char *name;
+    const char *type;
+    const char *help;
+} metricInfo[METRIC_COUNT] = 
+{
+    {"openpnp_capture_frames_total",             "counter", "Frames delivered to the frame buffer."},
+    {"openpnp_capture_dropped_frames_total",     "counter", "Frames captured but not converted."},
+    {"openpnp_capture_fps",                      "gauge",   "Frames per second over the last second."},
+    {"openpnp_capture_decode_seconds_total",     "counter", "Time spent converting frames."},
+    {"openpnp_capture_last_decode_seconds",      "gauge",   "Time spent converting the last frame."},
+    {"openpnp_capture_queue_depth",              "gauge",   "Captured frames waiting to be converted."},
+    {"openpnp_capture_recoveries_total",         "counter", "Transient capture errors the stream recovered from."},
+    {"openpnp_capture_memory_bytes",             "gauge",   "Memory used by the stream."}
+};
+
+std::string MetricsServer::formatMetrics(const std::vector<streamMetrics_t> &metrics)
+{
+    std::string out;
+    char line[512];
+
+    for(uint32_t m=0; m<METRIC_COUNT; m++)
+    {
+        snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s %s\n", 
+            metricInfo[m].name, metricInfo[m].help, metricInfo[m].name, metricInfo[m].type);
+        out += line;
+
+        for(auto const &sm : metrics)
+        {
+            const CapStreamStats &s = sm.stats;
+            std::string labels = "stream=\"" + std::to_string(sm.streamID) + 
+                "\",device=\"" + escapeLabel(sm.device) + "\"";
+            const char *name = metricInfo[m].name;
+
+            switch(m)
+            {
+            case METRIC_FRAMES:
+                snprintf(line, sizeof(line), "%s{%s} %llu\n", name, labels.c_str(), 
+                    static_cast<unsigned long long>(s.frames));
+                break;
+            case METRIC_DROPPED:
+                snprintf(line, sizeof(line), "%s{%s} %llu\n", name, labels.c_str(), 
+                    static_cast<unsigned long long>(s.droppedFrames));
+                break;
+            case METRIC_FPS:
+                snprintf(line, sizeof(line), "%s{%s} %.2f\n", name, labels.c_str(), s.fps);
+                break;
+            case METRIC_DECODE_SECONDS:
+                snprintf(line, sizeof(line), "%s{%s} %.6f\n", name, labels.c_str(), 
+                    static_cast<double>(s.decodeMicros)*1.0e-6);
+                break;
+            case METRIC_LAST_DECODE_SECONDS:
+                snprintf(line, sizeof(line), "%s{%s} %.6f\n", name, labels.c_str(), 
+                    static_cast<double>(s.lastDecodeMicros)*1.0e-6);
+                break;
+            case METRIC_QUEUE_DEPTH:
+                snprintf(line, sizeof(line), "%s{%s} %u\n", name, labels.c_str(), s.queueDepth);
+                break;
+            case METRIC_RECOVERIES:
+                snprintf(line, sizeof(line), "%s{%s} %u\n", name, labels.c_str(), s.recoveries);
+                break;
+            case METRIC_MEMORY:
+                snprintf(line, sizeof(line), 
+                    "%s{%s,type=\"driver\"} %llu\n"
+                    "%s{%s,type=\"frame\"} %llu\n"
+                    "%s{%s,type=\"scratch\"} %llu\n", 
+                    name, labels.c_str(), static_cast<unsigned long long>(s.memory.driverBuffers),
+                    name, labels.c_str(), static_cast<unsigned long long>(s.memory.frameBuffers),
+                    name, labels.c_str(), static_cast<unsigned long long>(s.memory.decoderScratch));
+                break;
+            }
+            out += line;
+        }
+    }
+    return out;
+}
+
+#ifdef _WIN32
+
+bool MetricsServer::start(const std::string &address)
+{
+    LOG(LOG_ERR, "The metrics server is not supported on this platform\n");
+    return false;
+}
+
+void MetricsServer::stop()
+{
+}
+
+void MetricsServer::serverThread()
+{
+}
+
+void MetricsServer::serveClient(int fd)
+{
+}
+
+#else
+
+bool MetricsServer::start(const std::string &address)
+{
+    stop();
+
+    m_listenFd = createListenSocket(address, m_unixPath);
+    if (m_listenFd < 0)
+    {
+        return false;
+    }
+
+    if (pipe(m_wakePipe) != 0)
+    {
+        LOG(LOG_ERR, "Metrics server: cannot create pipe (errno = %d)\n", errno);
+        stop();
+        return false;
+    }
+
+    m_thread = new std::thread(&MetricsServer::serverThread, this);
+    LOG(LOG_INFO, "Metrics server listening on %s\n", address.c_str());
+    return true;
+}
+
+void MetricsServer::stop()
+{
+    if (m_thread != nullptr)
+    {
+        char c = 0;
+        if (write(m_wakePipe[1], &c, 1) != 1)
+        {
+            LOG(LOG_ERR, "Metrics server: cannot wake the server thread\n");
+        }
+        m_thread->join();
+        delete m_thread;
+        m_thread = nullptr;
+    }
+
+    for(uint32_t i=0; i<2; i++)
+    {
+        if (m_wakePipe[i] >= 0)
+        {
+            ::close(m_wakePipe[i]);
+            m_wakePipe[i] = -1;
+        }
+    }
+
+    if (m_listenFd >= 0)
+    {
+        ::close(m_listenFd);
+        m_listenFd = -1;
+    }
+
+    if (!m_unixPath.empty())
+    {
+        unlink(m_unixPath.c_str());
+        m_unixPath.clear();
+    }
+}
+
+void MetricsServer::serverThread()
+{
+    LOG(LOG_DEBUG, "Metrics server thread started\n");
+    while(true)
+    {
+        pollfd fds[2];
+        fds[0].fd = m_listenFd;
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        fds[1].fd = m_wakePipe[0];
+        fds[1].events = POLLIN;
+        fds[1].revents = 0;
+
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            LOG(LOG_ERR, "Metrics server: poll failed (errno = %d)\n", errno);
+            break;
+        }
+
+        if (fds[1].revents != 0)
+        {
+            break;  // stop() was called
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            int client = accept(m_listenFd, nullptr, nullptr);
+            if (client >= 0)
+            {
+                serveClient(client);
+                ::close(client);
+            }
+        }
+    }
+    LOG(LOG_DEBUG, "Metrics server thread exited\n");
+}
+
+void MetricsServer::serveClient(int fd)
+{
+    // don't let a silent client block the server
+    timeval tv;
+    tv.tv_sec = 1;
+    tv.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    // read the request header, its contents are ignored:
+    // every request is answered with the metrics.
+    std::string request;
+    char buffer[1024];
+    while(request.find("\r\n\r\n") == std::string::npos)
+    {
+        ssize_t bytes = recv(fd, buffer, sizeof(buffer), 0);
+        if (bytes <= 0)
+        {
+            break;
+        }
+        request.append(buffer, bytes);
+        if (request.size() > 16384)
+        {
+            break;
+        }
+    }
+
+    std::vector<streamMetrics_t> metrics;
+    m_owner->collectMetrics(metrics);
+    std::string body = formatMetrics(metrics);
+
+    std::string response = "HTTP/1.0 200 OK\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        "Content-Length: " + std::to_string(body.size()) + "\r\n"
+        "Connection: close\r\n\r\n" + body;
+
+    size_t sent = 0;
+    while(sent < response.size())
+    {
+        ssize_t bytes = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (bytes <= 0)
+        {
+            break;
+        }
+        sent += bytes;
+    }
+}
+
+#endif
@@ -0,0 +1,93 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Platform independent metrics exporter that serves the
+    counters of all streams in Prometheus text format
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#ifndef metricsserver_h
+#define metricsserver_h
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include "openpnp-capture.h"
+
+class Context;  // pre-declaration
+
+/** snapshot of the counters of one stream */
+struct streamMetrics_t
+{
+    int32_t         streamID;   ///< ID of the stream
+    std::string     device;     ///< name of the capture device
+    CapStreamStats  stats;      ///< counters of the stream
+};
+
+/** The MetricsServer serves the counters of all streams of a 
+    context in Prometheus text format over a Unix domain socket
+    or a loopback TCP port.
+
+    Each connection is answered with a plain HTTP/1.0 response, 
+    so the endpoint can be scraped directly over TCP or through
+    a proxy (or curl --unix-socket) over the Unix socket. The 
+    counters are collected once per request, the server thread 
+    sleeps in poll() otherwise.
+*/
+class MetricsServer
+{
+public:
+    MetricsServer(Context *owner);
+
+    /** stops the server */
+    virtual ~MetricsServer();
+
+    /** Start serving on an address, either "unix:<path>", 
+        "tcp:<port>" or a socket path. TCP servers only listen 
+        on the loopback interface. Returns false if the socket 
+        could not be created. */
+    bool start(const std::string &address);
+
+    /** stop the server thread and close the socket */
+    void stop();
+
+    /** format a snapshot of the stream counters in Prometheus text format */
+    static std::string formatMetrics(const std::vector<streamMetrics_t> &metrics);
+
+protected:
+    /** server thread function */
+    void serverThread();
+
+    /** answer a single connection */
+    void serveClient(int fd);
+
+    Context*        m_owner;        ///< context whose streams are reported
+    int             m_listenFd;     ///< listening socket, -1 if not running
+    int             m_wakePipe[2];  ///< pipe used to wake the server thread for stop()
+    std::string     m_unixPath;     ///< path of the Unix socket, empty for TCP
+    std::thread*    m_thread;       ///< server thread, or NULL
+};
+
+#endif
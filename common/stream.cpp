@@ -29,6 +29,8 @@
 #include <memory.h> // for memcpy
 #include "stream.h"
 #include "context.h"
+#include "controlworker.h"
+#include "alloctracker.h"
 
 
 // **********************************************************************
@@ -38,16 +40,71 @@
 Stream::Stream() :
     m_owner(nullptr),
     m_isOpen(false),
-    m_frames(0)
+    m_driverBufferBytes(0),
+    m_controlWorker(nullptr),
+    m_newFrame(false),
+    m_changedFrame(false),
+    m_frameBufferBytes(0),
+    m_frames(0),
+    m_hasBufferRing(false)
 {
+    memset(&m_frameMetadata, 0, sizeof(m_frameMetadata));
+    memset(&m_capturedMetadata, 0, sizeof(m_capturedMetadata));
 }
 
 Stream::~Stream()
 {
-    LOG(LOG_DEBUG,"Stream::~Stream reports %d frames captured.\n", m_frames);
+    stopControlWorker();
+    LOG(LOG_DEBUG,"Stream::~Stream reports %d frames captured.\n", m_frames.load());
     //Note: close() should be called/handled by the PlatformStream!
 }
 
+ControlWorker* Stream::getControlWorker()
+{
+    std::lock_guard<std::mutex> lock(m_controlMutex);
+    if (m_controlWorker == nullptr)
+    {
+        m_controlWorker = new ControlWorker(this);
+    }
+    return m_controlWorker;
+}
+
+void Stream::stopControlWorker()
+{
+    std::lock_guard<std::mutex> lock(m_controlMutex);
+    if (m_controlWorker != nullptr)
+    {
+        delete m_controlWorker;
+        m_controlWorker = nullptr;
+    }
+}
+
+void Stream::getMemoryUsage(CapMemoryUsage *usage)
+{
+    usage->driverBuffers  = m_driverBufferBytes;
+    usage->frameBuffers   = m_frameBufferBytes;
+    usage->decoderScratch = 0;
+    usage->total          = usage->driverBuffers + usage->frameBuffers;
+}
+
+void Stream::getStats(CapStreamStats *stats)
+{
+    memset(stats, 0, sizeof(CapStreamStats));
+    getMemoryUsage(&stats->memory);
+    stats->frames = m_frames;
+}
+
+void Stream::resizeFrameBuffer(size_t bytes)
+{
+    m_frameBuffer.resize(bytes);
+    m_frameBufferBytes = m_frameBuffer.capacity();
+}
+
+void Stream::setDriverBufferBytes(size_t bytes)
+{
+    m_driverBufferBytes = bytes;
+}
+
 bool Stream::hasNewFrame()
 {
     m_bufferMutex.lock();
@@ -56,8 +113,17 @@ bool Stream::hasNewFrame()
     return ok;
 }
 
+bool Stream::hasChangedFrame()
+{
+    m_bufferMutex.lock();
+    bool ok = m_changedFrame;
+    m_bufferMutex.unlock();
+    return ok;
+}
+
 bool Stream::captureFrame(uint8_t *RGBbufferPtr, uint32_t RGBbufferBytes)
 {
+    FRAMEPATH_SCOPE;
     if (!m_isOpen) return false;
 
     m_bufferMutex.lock();    
@@ -67,10 +133,74 @@ bool Stream::captureFrame(uint8_t *RGBbufferPtr, uint32_t RGBbufferBytes)
         memcpy(RGBbufferPtr, &m_frameBuffer[0], maxBytes);
     }
     m_newFrame = false;
+    m_changedFrame = false;
+    m_capturedMetadata = m_frameMetadata;
     m_bufferMutex.unlock();
     return true;
 }
 
+void Stream::getFrameSize(uint32_t &width, uint32_t &height)
+{
+    std::lock_guard<std::mutex> lock(m_bufferMutex);
+    width = m_width;
+    height = m_height;
+}
+
+bool Stream::hasBufferRing()
+{
+    std::lock_guard<std::mutex> lock(m_bufferMutex);
+    return m_hasBufferRing;
+}
+
+bool Stream::captureFrameRegion(uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+    uint8_t *dst, uint32_t dstStride)
+{
+    FRAMEPATH_SCOPE;
+    if (!m_isOpen) return false;
+
+    if (dstStride == 0)
+    {
+        dstStride = width*3;
+    }
+
+    if ((width == 0) || (height == 0) || (dstStride < width*3))
+    {
+        LOG(LOG_ERR, "captureFrameRegion: invalid region size or stride\n");
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_bufferMutex);
+    if (m_hasBufferRing)
+    {
+        LOG(LOG_ERR, "captureFrameRegion: the frames go to a buffer ring\n");
+        return false;
+    }
+
+    // m_width and m_height can change with the output size,
+    // so the region is checked against the current frame.
+    if ((x >= m_width) || (y >= m_height) || (width > m_width - x) || (height > m_height - y) ||
+        (m_frameBuffer.size() < static_cast<size_t>(m_width)*m_height*3))
+    {
+        LOG(LOG_ERR, "captureFrameRegion: region %d,%d %d x %d is outside the %d x %d frame\n",
+            x, y, width, height, m_width, m_height);
+        return false;
+    }
+
+    const size_t srcStride = static_cast<size_t>(m_width)*3;
+    const uint8_t *src = &m_frameBuffer[0] + y*srcStride + x*3;
+    for(uint32_t line=0; line<height; line++)
+    {
+        memcpy(dst, src, width*3);
+        src += srcStride;
+        dst += dstStride;
+    }
+
+    m_newFrame = false;
+    m_changedFrame = false;
+    m_capturedMetadata = m_frameMetadata;
+    return true;
+}
+
 void Stream::submitBuffer(const uint8_t *ptr, size_t bytes)
 {
     // sanity check
@@ -83,7 +213,7 @@ void Stream::submitBuffer(const uint8_t *ptr, size_t bytes)
     
     if (m_frameBuffer.size() == 0)
     {
-        LOG(LOG_ERR,"Stream::m_frameBuffer size is 0 - cant store frame buffers!\n");
+        LOG_LIMITED(LOG_ERR,"Stream::m_frameBuffer size is 0 - cant store frame buffers!\n");
     }
 
     // Generate warning every 100 frames if the frame buffer is not
@@ -92,13 +222,14 @@ void Stream::submitBuffer(const uint8_t *ptr, size_t bytes)
     const uint32_t wantSize = m_width*m_height*3;
     if ((bytes != wantSize) && ((m_frames % 100) == 0))
     {
-        LOG(LOG_WARNING, "Warning: captureFrame received incorrect buffer size (got %d want %d)\n", bytes, wantSize);
+        LOG_LIMITED(LOG_WARNING, "Warning: captureFrame received incorrect buffer size (got %d want %d)\n", bytes, wantSize);
     }
 
     if (m_frameBuffer.size() >= bytes)
     {
         memcpy(&m_frameBuffer[0], ptr, bytes);
         m_newFrame = true; 
+        m_changedFrame = true;
         m_frames++;
     }
     m_bufferMutex.unlock();
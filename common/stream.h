@@ -31,11 +31,15 @@
 #include <stdint.h>
 #include <vector>
 #include <mutex>
+#include <atomic>
+#include <string>
+#include "openpnp-capture.h"
 #include "logging.h"
 
 class Context;      // pre-declaration
 class deviceInfo;   // pre-declaration
 class Stream;       // pre-declaration
+class ControlWorker;// pre-declaration
 
 
 /** The stream class handles the capturing of a single device */
@@ -59,12 +63,31 @@ public:
     */
     bool hasNewFrame();
 
+    /** Returns true if a frame that differs from the previously
+        converted frame is available for reading using 'captureFrame'.
+        Without change detection, this is the same as hasNewFrame.
+        The internal changed frame flag is reset by captureFrame.
+    */
+    bool hasChangedFrame();
+
     /** Retrieve the most recently captured frame and copy it in a
         buffer pointed to by RGBbufferPtr. The maximum buffer size 
         must be supplied in RGBbufferBytes.
     */
     bool captureFrame(uint8_t *RGBbufferPtr, uint32_t RGBbufferBytes);
+
+    /** Copy a region of the most recently captured frame to 'dst',
+        line by line. A dstStride of 0 selects width*3. Returns false
+        if the region does not lie within the frame. Resets the new
+        frame flag like captureFrame. Fails while a buffer ring is 
+        registered, as m_frameBuffer is not updated then.
+    */
+    bool captureFrameRegion(uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+        uint8_t *dst, uint32_t dstStride);
     
+    /** Get the size of the frames returned by captureFrame */
+    void getFrameSize(uint32_t &width, uint32_t &height);
+
     /** Set the frame rate of this stream.
         Returns false if the camera does not support the desired
         frame rate.
@@ -80,9 +103,7 @@ public:
     /** Return the FOURCC media type of the stream */
     virtual uint32_t getFOURCC() = 0;
 
-    /** Return the number of frames captured.
-        FIXME: protect by mutex 
-    */
+    /** Return the number of frames captured. */
     uint32_t getFrameCount() const
     {
         return m_frames;
@@ -103,6 +124,176 @@ public:
     /** get automatic state of property (exposure, zoom etc) of camera/stream */
     virtual bool getAutoProperty(uint32_t propID, bool &enable) = 0;
 
+    /** set the software colour correction of the stream, NULL turns it off.
+        Returns false if the platform does not support colour correction. */
+    virtual bool setColorPipeline(const CapColorPipeline * /*pipeline*/)
+    {
+        return false;
+    }
+
+    /** set the change detection threshold in parts per thousand, 0 turns it off.
+        Returns false if the platform does not support change detection. */
+    virtual bool setChangeDetection(uint32_t /*threshold*/)
+    {
+        return false;
+    }
+
+    /** enable the software exposure controller with the given settings,
+        NULL turns it off. Returns false if the platform does not support
+        software exposure control. */
+    virtual bool setExposureControl(const CapExposureControl * /*control*/)
+    {
+        return false;
+    }
+
+    /** get the state of the software exposure controller. Returns false
+        if the platform does not support software exposure control. */
+    virtual bool getExposureState(CapExposureState * /*state*/)
+    {
+        return false;
+    }
+
+    /** returns true if the platform can convert frames into
+        an application buffer ring */
+    virtual bool supportsBufferRing() const
+    {
+        return false;
+    }
+
+    /** register a ring of application buffers the frames are
+        converted into, count = 0 removes it. Returns false if
+        a slot is too small for a frame. */
+    virtual bool registerBufferRing(uint32_t /*count*/, void * const * /*buffers*/, const uint32_t * /*sizes*/)
+    {
+        return false;
+    }
+
+    /** returns true if a buffer ring is registered */
+    bool hasBufferRing();
+
+    /** returns the indices of the buffer ring, or NULL */
+    virtual CapBufferRing* getBufferRing()
+    {
+        return nullptr;
+    }
+
+    /** mark the oldest frames of the buffer ring as done */
+    virtual bool releaseBufferRingFrames(uint32_t /*frames*/)
+    {
+        return false;
+    }
+
+    /** get the metadata of a frame in the buffer ring */
+    virtual bool getBufferRingMetadata(uint32_t /*frame*/, CapFrameMetadata * /*metadata*/)
+    {
+        return false;
+    }
+
+    /** set the size of the frames returned by captureFrame, 0 x 0
+        selects the native frame size. Returns false if the size is 
+        not supported. */
+    virtual bool setOutputSize(uint32_t /*width*/, uint32_t /*height*/)
+    {
+        return false;
+    }
+
+    /** set the priority class of the stream, CAPPRIORITY_xxx.
+        Returns false if the platform does not support priorities. */
+    virtual bool setPriority(uint32_t /*priority*/)
+    {
+        return false;
+    }
+
+    /** returns the control worker that applies asynchronous property 
+        requests. It is created on first use. */
+    ControlWorker* getControlWorker();
+
+    /** stop the control worker, if running. Must be called before the
+        platform stream is closed or destroyed, as the worker calls its
+        property functions. */
+    void stopControlWorker();
+
+    /** get the memory used by the stream. The base class accounts 
+        for the frame buffer and the driver buffers, derived classes
+        add their scratch memory. Does not take m_bufferMutex, so
+        it does not wait for a conversion in progress. */
+    virtual void getMemoryUsage(CapMemoryUsage *usage);
+
+    /** set the number of bytes used by driver buffers, called by
+        the platform code when it allocates or frees them. */
+    void setDriverBufferBytes(size_t bytes);
+
+    /** returns true if the platform can record capture archives */
+    virtual bool supportsRecording() const
+    {
+        return false;
+    }
+
+    /** start recording the raw frames to a capture archive.
+        Returns false if the archive could not be created. */
+    virtual bool startRecording(const char * /*filename*/)
+    {
+        return false;
+    }
+
+    /** stop recording and close the archive. Returns false
+        if the stream was not recording or writing failed. */
+    virtual bool stopRecording()
+    {
+        return false;
+    }
+
+    /** returns true if the platform can serve an MJPEG preview */
+    virtual bool supportsPreviewServer() const
+    {
+        return false;
+    }
+
+    /** start serving the frames of the stream as MJPEG over HTTP.
+        Returns false if the server could not be started. */
+    virtual bool startPreviewServer(const char * /*address*/)
+    {
+        return false;
+    }
+
+    /** stop the preview server. Returns false if it was not running. */
+    virtual bool stopPreviewServer()
+    {
+        return false;
+    }
+
+    /** get the counters of the stream. The base class reports the
+        frame count and the memory usage, derived classes add the
+        counters they keep. Like getMemoryUsage, it reads counters
+        that are published atomically and takes no stream lock. */
+    virtual void getStats(CapStreamStats *stats);
+
+    /** set the name of the capture device, used when reporting */
+    void setDeviceName(const std::string &name)
+    {
+        m_deviceName = name;
+    }
+
+    /** returns the name of the capture device */
+    const std::string& getDeviceName() const
+    {
+        return m_deviceName;
+    }
+
+    /** get the time spent in each step of opening the stream.
+        Returns false if the platform does not record open timing. */
+    virtual bool getOpenTiming(CapOpenTiming * /*timing*/)
+    {
+        return false;
+    }
+
+    /** get the metadata of the frame most recently read by captureFrame.
+        Returns false if the platform does not report frame metadata. */
+    virtual bool getFrameMetadata(CapFrameMetadata * /*metadata*/)
+    {
+        return false;
+    }
+
 protected:
     /** Thread-safe copying of the 24-bit RGB buffer pointed to
         by 'ptr' with length 'bytes'.
@@ -115,16 +306,28 @@ protected:
     */
     virtual void submitBuffer(const uint8_t* ptr, size_t bytes);
 
+    /** resize m_frameBuffer and publish its capacity for getMemoryUsage */
+    void resizeFrameBuffer(size_t bytes);
+
     Context*    m_owner;                    ///< The context object associated with this stream
 
-    uint32_t    m_width;                    ///< The width of the frame in pixels
-    uint32_t    m_height;                   ///< The height of the frame in pixels
+    uint32_t    m_width;                    ///< The width of the output frame in pixels
+    uint32_t    m_height;                   ///< The height of the output frame in pixels
     bool        m_isOpen;
+    std::string m_deviceName;               ///< name of the capture device
 
-    std::mutex  m_bufferMutex;              ///< mutex to protect m_frameBuffer and m_newFrame
+    std::atomic<size_t> m_driverBufferBytes;///< bytes of driver buffers
+    ControlWorker *m_controlWorker;         ///< applies asynchronous property requests, or NULL
+    std::mutex  m_controlMutex;             ///< protects m_controlWorker
+    std::mutex  m_bufferMutex;              ///< mutex to protect m_frameBuffer, m_newFrame and m_changedFrame
     bool        m_newFrame;                 ///< new frame buffer flag
+    bool        m_changedFrame;             ///< changed frame buffer flag
     std::vector<uint8_t> m_frameBuffer;     ///< raw frame buffer
-    uint32_t    m_frames;                   ///< number of frames captured
+    std::atomic<size_t> m_frameBufferBytes; ///< capacity of m_frameBuffer, see resizeFrameBuffer
+    CapFrameMetadata m_frameMetadata;       ///< metadata of the frame in m_frameBuffer, protected by m_bufferMutex
+    CapFrameMetadata m_capturedMetadata;    ///< metadata of the frame last read by captureFrame, protected by m_bufferMutex
+    std::atomic<uint32_t> m_frames;         ///< number of frames captured
+    bool        m_hasBufferRing;            ///< frames go to a buffer ring, not m_frameBuffer, protected by m_bufferMutex
 };
 
 #endif
\ No newline at end of file
@@ -88,6 +88,14 @@ typedef uint32_t CapFormatID;   ///< format identifier 0 .. numFormats
 
 typedef uint32_t CapPropertyID; ///< property ID (exposure, zoom, focus etc.)
 
+/** completion callback of the asynchronous property functions, see Cap_setPropertyAsync.
+    'value' is the value that was written or read. */
+typedef void (*CapPropertyCallback)(CapPropertyID propID, CapResult result, int32_t value, void *user);
+
+/** completion callback of Cap_createContextAsync, called on the enumeration
+    thread. 'deviceCount' is the number of devices that were found. */
+typedef void (*CapContextCallback)(CapContext ctx, uint32_t deviceCount, void *user);
+
 typedef struct
 {
     uint32_t width;     ///< width in pixels
@@ -103,6 +111,156 @@ typedef struct
 #define CAPRESULT_FORMATNOTSUPPORTED 3
 #define CAPRESULT_PROPERTYNOTSUPPORTED 4
 
+// supported output formats of Cap_convertFrame:
+#define CAPOUTFMT_RGB24 0       ///< 24-bit RGB, the format returned by Cap_captureFrame
+#define CAPOUTFMT_BGR24 1       ///< 24-bit BGR
+
+typedef uint32_t CapOutputFormat; ///< output pixel format defined by CAPOUTFMT_xxx
+
+// stream priority classes, see Cap_setStreamPriority:
+#define CAPPRIORITY_REALTIME   0    ///< frames on the critical path, e.g. vision
+#define CAPPRIORITY_NORMAL     1    ///< default priority of a stream
+#define CAPPRIORITY_BACKGROUND 2    ///< previews, decimated when the CPU is busy
+
+typedef uint32_t CapPriority;   ///< stream priority defined by CAPPRIORITY_xxx
+
+/** software colour correction settings of a stream, see Cap_setColorPipeline */
+typedef struct
+{
+    float gains[3];     ///< red, green and blue gains (1.0 = unity)
+    float ccm[9];       ///< row-major 3x3 colour correction matrix, applied after the gains
+    float gamma;        ///< gamma correction, output = (input/255)^(1/gamma)*255 (1.0 = linear)
+} CapColorPipeline;
+
+/** time spent in each step of opening a stream, see Cap_getStreamOpenTiming.
+    All durations are in microseconds. Steps that have not run yet are 0. */
+typedef struct
+{
+    uint32_t deviceOpen;        ///< opening the device
+    uint32_t setFormat;         ///< setting the frame format
+    uint32_t getFormat;         ///< reading back the frame format
+    uint32_t setFrameRate;      ///< setting the frame rate
+    uint32_t requestBuffers;    ///< requesting the driver buffers
+    uint32_t mapBuffers;        ///< mapping the driver buffers
+    uint32_t queueBuffers;      ///< queueing the driver buffers
+    uint32_t streamOn;          ///< starting the stream
+    uint32_t firstFrame;        ///< waiting for the first frame after the stream was started
+    uint32_t total;             ///< time from the start of the open to the first frame
+} CapOpenTiming;
+
+/** memory used by the library, see Cap_getMemoryUsage. All sizes are in bytes. */
+typedef struct
+{
+    uint64_t driverBuffers;     ///< buffers shared with the capture driver
+    uint64_t frameBuffers;      ///< RGB frame buffers read by Cap_captureFrame
+    uint64_t decoderScratch;    ///< scratch memory of the decoders and converters
+    uint64_t total;             ///< sum of the above
+} CapMemoryUsage;
+
+/** heap allocations made through operator new and, on Linux, malloc, see Cap_getAllocationStats */
+typedef struct
+{
+    uint32_t enabled;               ///< 1 if the library was built with OPENPNP_CAPTURE_ALLOCTRACK
+    uint64_t allocations;           ///< allocations of all threads since the library was loaded
+    uint64_t bytes;                 ///< bytes allocated by all threads
+    uint64_t framePathAllocations;  ///< allocations while capturing, converting or reading frames
+    uint64_t framePathBytes;        ///< bytes allocated while capturing, converting or reading frames
+    uint64_t threadAllocations;     ///< allocations of the calling thread
+    uint64_t threadBytes;           ///< bytes allocated by the calling thread
+} CapAllocationStats;
+
+/** counters of a stream, see Cap_getStreamStats */
+typedef struct
+{
+    uint64_t frames;            ///< frames delivered to the frame buffer
+    uint64_t droppedFrames;     ///< frames that were captured but not converted
+    uint64_t decodeMicros;      ///< total time spent converting frames, in microseconds
+    uint32_t lastDecodeMicros;  ///< time spent converting the last frame, in microseconds
+    uint32_t queueDepth;        ///< captured frames waiting to be converted
+    uint32_t recoveries;        ///< transient capture errors the stream recovered from
+    float    fps;               ///< frames delivered per second, measured over about a second
+    CapMemoryUsage memory;      ///< memory used by the stream
+} CapStreamStats;
+
+// frame metadata flags, see CapFrameMetadata:
+#define CAPFRAMEMETA_TIMESTAMP  1   ///< captureTimestamp is valid
+#define CAPFRAMEMETA_PTS        2   ///< devicePTS is valid
+#define CAPFRAMEMETA_EXPOSURE   4   ///< exposureTimestamp is valid
+
+/** metadata of a captured frame, see Cap_getFrameMetadata. 
+    Timestamps are in microseconds of the host's monotonic clock,
+    CLOCK_MONOTONIC on Linux. */
+typedef struct
+{
+    uint32_t sequence;          ///< sequence number of the frame assigned by the driver
+    uint32_t flags;             ///< CAPFRAMEMETA_xxx flags of the valid fields
+    uint64_t captureTimestamp;  ///< time at which the driver received the frame
+    uint64_t exposureTimestamp; ///< estimated time at which the exposure of the frame started
+    uint32_t devicePTS;         ///< presentation time stamp of the frame in device clock ticks
+} CapFrameMetadata;
+
+/** a rectangle in a frame, in pixels */
+typedef struct
+{
+    uint32_t x;         ///< left column
+    uint32_t y;         ///< top line
+    uint32_t width;     ///< width in pixels
+    uint32_t height;    ///< height in pixels
+} CapRect;
+
+// search strategies of Cap_autoFocus:
+#define CAPFOCUS_COARSETOFINE   0   ///< sweep the range, then sweep finer around the best position
+#define CAPFOCUS_GOLDENSECTION  1   ///< golden-section search, fewer moves but needs a single peak
+
+#define CAPFOCUS_MAXSAMPLES     64  ///< maximum number of focus positions evaluated by Cap_autoFocus
+
+/** result of Cap_autoFocus */
+typedef struct
+{
+    int32_t  bestPosition;                      ///< focus position with the highest sharpness
+    float    bestScore;                         ///< sharpness at bestPosition
+    uint32_t samples;                           ///< number of evaluated positions
+    int32_t  positions[CAPFOCUS_MAXSAMPLES];    ///< evaluated positions, in the order they were visited
+    float    scores[CAPFOCUS_MAXSAMPLES];       ///< sharpness at each evaluated position
+    uint32_t durationMillis;                    ///< duration of the search
+} CapFocusResult;
+
+// flags of CapExposureControl:
+#define CAPAE_USEGAIN   1   ///< raise the gain when the exposure time is at its maximum
+
+/** settings of the software exposure controller, see Cap_setExposureControl */
+typedef struct
+{
+    uint32_t target;        ///< target mean luma of the region of interest, 1..254
+    uint32_t tolerance;     ///< no adjustment while the mean luma is within target +/- tolerance
+    float    damping;       ///< fraction of the correction applied per step, 0 < damping <= 1
+    CapRect  roi;           ///< measured region, a zero width or height for the whole frame
+    uint32_t flags;         ///< CAPAE_xxx
+} CapExposureControl;
+
+/** state of the software exposure controller, see Cap_getExposureState */
+typedef struct
+{
+    uint32_t enabled;       ///< 1 if the controller is running
+    uint32_t settled;       ///< 1 if the last measured luma was within the tolerance
+    float    meanLuma;      ///< mean luma of the region of interest on the last measured frame
+    int32_t  exposure;      ///< last exposure value requested by the controller
+    int32_t  gain;          ///< last gain value requested by the controller
+    uint32_t adjustments;   ///< number of adjustments made since the controller was enabled
+    uint32_t measuredFrames;///< number of frames measured since the controller was enabled
+} CapExposureState;
+
+/** indices of an application buffer ring, see Cap_registerBufferRing.
+    head and tail count frames and wrap around at 2^32; frame i is
+    stored in slot i % count, where count is a power of two. */
+typedef struct
+{
+    uint32_t head;      ///< frames written by the library, updated atomically by the library
+    uint32_t tail;      ///< frames the application is done with, updated atomically by the application
+    uint32_t count;     ///< number of slots
+    uint32_t dropped;   ///< frames dropped because the ring was full or a slot was too small
+} CapBufferRing;
+
 /********************************************************************************** 
      CONTEXT CREATION AND DEVICE ENUMERATION
 **********************************************************************************/
@@ -112,6 +270,49 @@ typedef struct
 */
 DLLPUBLIC CapContext Cap_createContext(void);
 
+/** Initialize the capture library without waiting for the devices.
+    The context is returned immediately and the devices are enumerated
+    on a background thread. Functions that need the device list, such
+    as Cap_getDeviceCount and Cap_openStream, wait until enumeration
+    has finished; stream-less functions do not wait.
+
+    The callback, if not NULL, is called on the enumeration thread when
+    the devices are known. It may query the devices but must not release
+    the context. Cap_releaseContext waits for a running enumeration.
+
+    @param callback Called when enumeration has finished, may be NULL.
+    @param user Passed to the callback.
+    @return The context ID.
+*/
+DLLPUBLIC CapContext Cap_createContextAsync(CapContextCallback callback, void *user);
+
+/** Check whether the devices of a context have been enumerated,
+    i.e. whether device queries return without waiting.
+    @param ctx The ID of the context.
+    @return 1 if enumeration has finished, 0 otherwise.
+*/
+DLLPUBLIC uint32_t Cap_isContextReady(CapContext ctx);
+
+/** Create a context whose devices replay capture archives recorded
+    with Cap_startRecording. Each archive becomes a device with the
+    format it was recorded in. Streams opened on these devices go
+    through the normal conversion pipeline. The archives loop when
+    their end is reached.
+
+    Replay is only supported on Linux. The environment variable
+    OPENPNP_CAPTURE_ARCHIVE=<file>[:<file>...] makes Cap_createContext 
+    replay archives as well; OPENPNP_CAPTURE_ARCHIVE_FAST=1 turns off 
+    real-time pacing.
+
+    @param filenames Array of archive file names.
+    @param count The number of file names.
+    @param realtime 1 to deliver the frames at their recorded intervals,
+           0 to deliver them as fast as they are read.
+    @return The context ID, or NULL if no archive could be read or
+            the platform does not support replay.
+*/
+DLLPUBLIC CapContext Cap_createReplayContext(const char **filenames, uint32_t count, uint32_t realtime);
+
 /** Un-initialize the capture library context
     @param ctx The ID of the context to destroy.
     @return The context ID.
@@ -196,6 +397,26 @@ DLLPUBLIC CapResult Cap_getFormatInfo(CapContext ctx, CapDeviceID index, CapForm
 */
 DLLPUBLIC CapStream Cap_openStream(CapContext ctx, CapDeviceID index, CapFormatID formatID);
 
+/** Open capture streams to several devices at once.
+
+    All devices are negotiated and started concurrently, except for devices 
+    that share a bus (e.g. the same USB host controller), which are negotiated
+    one after another. The function returns when every stream has produced
+    its first frame, or after 5 seconds.
+
+    @param ctx The ID of the context.
+    @param count The number of streams to open.
+    @param devices Array of 'count' device indices.
+    @param formats Array of 'count' format IDs, one for each device.
+    @param outStreams Array of 'count' stream IDs that receives the IDs of the
+           opened streams, or -1 for devices that could not be opened.
+    @return CAPRESULT_OK if all streams were opened and produced a frame.
+            CAPRESULT_ERR if a stream could not be opened or timed out; streams 
+            that did open remain open and must be closed.
+*/
+DLLPUBLIC CapResult Cap_openStreams(CapContext ctx, uint32_t count, const CapDeviceID *devices, 
+    const CapFormatID *formats, CapStream *outStreams);
+
 /** Close a capture stream 
     @param ctx The ID of the context.
     @param stream The stream ID.
@@ -219,13 +440,135 @@ DLLPUBLIC uint32_t Cap_isOpenStream(CapContext ctx, CapStream stream);
 */
 DLLPUBLIC CapResult Cap_captureFrame(CapContext ctx, CapStream stream, void *RGBbufferPtr, uint32_t RGBbufferBytes);
 
+/** Copy a rectangular region of the most recent RGB frame to
+    the given buffer. Only the requested pixels are copied, so 
+    reading a small window costs in proportion to the window.
+    Like Cap_captureFrame, this resets the new frame flag and 
+    the frame metadata refers to the frame the region came from.
+
+    @param ctx The ID of the context.
+    @param stream The stream ID.
+    @param x The left column of the region.
+    @param y The top line of the region.
+    @param width The width of the region in pixels.
+    @param height The height of the region in pixels.
+    @param dst The buffer that receives the 24-bit RGB pixels.
+    @param dstStride The number of bytes between lines in dst, 0 for width*3.
+    @return CAPRESULT_OK if all is well.
+            CAPRESULT_ERR if context or stream are invalid, the region
+            does not lie within the frame, or a buffer ring is registered.
+*/
+DLLPUBLIC CapResult Cap_captureFrameRegion(CapContext ctx, CapStream stream, 
+    uint32_t x, uint32_t y, uint32_t width, uint32_t height, void *dst, uint32_t dstStride);
+
 /** returns 1 if a new frame has been captured, 0 otherwise */
 DLLPUBLIC uint32_t Cap_hasNewFrame(CapContext ctx, CapStream stream);
 
+/** returns 1 if a frame that differs from the previously converted
+    frame has been captured since the last call to Cap_captureFrame, 
+    0 otherwise. 
+    
+    Without change detection (see Cap_setChangeDetection), every 
+    new frame counts as a changed frame.
+*/
+DLLPUBLIC uint32_t Cap_hasChangedFrame(CapContext ctx, CapStream stream);
+
+/** Turn change-gated conversion of a stream on or off.
+
+    When on, each frame is first compared to the most recently 
+    converted frame using a cheap test: the compressed size and
+    a hash of sampled bytes for MJPEG, or the difference of a 
+    sparse grid of luma samples for uncompressed formats. The 
+    frame is only converted when it differs by at least the threshold.
+    Unchanged frames still count as new frames for Cap_hasNewFrame,
+    but not for Cap_hasChangedFrame.
+
+    @param ctx The ID of the context.
+    @param stream The stream ID.
+    @param threshold The threshold in parts per thousand of the compressed frame 
+           size or of the luma range. 1 reports any detectable change, 0 turns 
+           change detection off.
+    @return CAPRESULT_OK if all is well.
+            CAPRESULT_FORMATNOTSUPPORTED if the stream does not support change detection.
+            CAPRESULT_ERR if context or stream are invalid.
+*/
+DLLPUBLIC CapResult Cap_setChangeDetection(CapContext ctx, CapStream stream, uint32_t threshold);
+
+/** Set the size of the frames returned by Cap_captureFrame.
+
+    The frames are downscaled while they are converted, using an 
+    area-averaging filter for uncompressed formats. MJPEG frames 
+    are scaled while decoding and only support the sizes that
+    libjpeg-turbo can scale to (e.g. 1/2, 1/4 or 1/8 of the frame).
+    The RGB buffer passed to Cap_captureFrame must hold 
+    width*height*3 bytes of the output size.
+
+    @param ctx The ID of the context.
+    @param stream The stream ID.
+    @param width The output width in pixels, at most the frame width.
+    @param height The output height in pixels, at most the frame height.
+           0 x 0 selects the native frame size.
+    @return CAPRESULT_OK if all is well.
+            CAPRESULT_FORMATNOTSUPPORTED if the stream cannot produce frames of this size,
+            or the slots of a registered buffer ring cannot hold them.
+            CAPRESULT_ERR if context or stream are invalid.
+*/
+DLLPUBLIC CapResult Cap_setOutputSize(CapContext ctx, CapStream stream, uint32_t width, uint32_t height);
+
+/** Set the priority class of a stream.
+
+    The decoder threads that are shared by all streams work on
+    the frames of higher-priority streams first, and leave the
+    frame of a lower-priority stream as soon as a higher-priority
+    frame is waiting. Background streams skip frames while frames
+    of other streams are being converted, but convert at least 
+    one frame in five.
+
+    @param ctx The ID of the context.
+    @param stream The stream ID.
+    @param priority The priority class, CAPPRIORITY_xxx.
+    @return CAPRESULT_OK if all is well.
+            CAPRESULT_PROPERTYNOTSUPPORTED if the platform does not support stream priorities.
+            CAPRESULT_ERR if context, stream or priority are invalid.
+*/
+DLLPUBLIC CapResult Cap_setStreamPriority(CapContext ctx, CapStream stream, CapPriority priority);
+
 /** returns the number of frames captured during the lifetime of the stream. 
     For debugging purposes */
 DLLPUBLIC uint32_t Cap_getStreamFrameCount(CapContext ctx, CapStream stream);
 
+/** Get the time spent in each step of opening a stream, from opening
+    the device to receiving the first frame. The steps after setting
+    the frame rate run on the capture thread, so they fill in shortly
+    after Cap_openStream returns.
+
+    @param ctx The ID of the context.
+    @param stream The stream ID.
+    @param timing Pointer to a CapOpenTiming structure to be filled with data.
+    @return CAPRESULT_OK if all is well.
+            CAPRESULT_PROPERTYNOTSUPPORTED if the platform does not record open timing.
+            CAPRESULT_ERR if context or stream are invalid.
+*/
+DLLPUBLIC CapResult Cap_getStreamOpenTiming(CapContext ctx, CapStream stream, CapOpenTiming *timing);
+
+/** Get the metadata of the frame most recently read with Cap_captureFrame.
+
+    The capture timestamp marks when the last part of the frame arrived.
+    UVC cameras with a metadata node also report the presentation time
+    stamp of the frame, which marks the start of the exposure in device
+    clock ticks. The library correlates the device clock with the host 
+    clock and estimates the host time at which the exposure started. 
+    The estimate becomes available after a few frames.
+
+    @param ctx The ID of the context.
+    @param stream The stream ID.
+    @param metadata Pointer to a CapFrameMetadata structure to be filled with data.
+    @return CAPRESULT_OK if all is well.
+            CAPRESULT_PROPERTYNOTSUPPORTED if the platform does not report frame metadata.
+            CAPRESULT_ERR if context or stream are invalid.
+*/
+DLLPUBLIC CapResult Cap_getFrameMetadata(CapContext ctx, CapStream stream, CapFrameMetadata *metadata);
+
 
 /********************************************************************************** 
      NEW CAMERA CONTROL API FUNCTIONS
@@ -272,6 +615,378 @@ DLLPUBLIC CapResult Cap_getProperty(CapContext ctx, CapStream stream, CapPropert
 */
 DLLPUBLIC CapResult Cap_getAutoProperty(CapContext ctx, CapStream stream, CapPropertyID propID, uint32_t *outValue);
 
+/** queue setting the value of a camera/stream property without waiting for the camera.
+
+    The request is applied by a control thread of the stream. A write to a
+    property that is still queued replaces the queued value, so dragging a 
+    slider does not build up a backlog of control transfers. The callback,
+    if not NULL, is called on the control thread when the request completes
+    (or with CAPRESULT_ERR when the stream is closed first). Callbacks of
+    coalesced writes are called when the write that replaced them completes.
+
+    returns: CAPRESULT_OK if the request was queued.
+             CAPRESULT_ERR if context, stream are invalid.
+*/
+DLLPUBLIC CapResult Cap_setPropertyAsync(CapContext ctx, CapStream stream, CapPropertyID propID, int32_t value,
+    CapPropertyCallback callback, void *user);
+
+/** queue setting the automatic flag of a camera/stream property, 
+    see Cap_setPropertyAsync.
+
+    returns: CAPRESULT_OK if the request was queued.
+             CAPRESULT_ERR if context, stream are invalid.
+*/
+DLLPUBLIC CapResult Cap_setAutoPropertyAsync(CapContext ctx, CapStream stream, CapPropertyID propID, uint32_t bOnOff,
+    CapPropertyCallback callback, void *user);
+
+/** queue reading the value of a camera/stream property. The value is
+    passed to the callback, see Cap_setPropertyAsync. Reads are never coalesced.
+
+    returns: CAPRESULT_OK if the request was queued.
+             CAPRESULT_ERR if context, stream are invalid or callback == NULL.
+*/
+DLLPUBLIC CapResult Cap_getPropertyAsync(CapContext ctx, CapStream stream, CapPropertyID propID,
+    CapPropertyCallback callback, void *user);
+
+/** wait until all queued property requests of a stream have been applied.
+
+    returns: CAPRESULT_OK if all is well.
+             CAPRESULT_ERR if context, stream are invalid.
+*/
+DLLPUBLIC CapResult Cap_flushProperties(CapContext ctx, CapStream stream);
+
+/** set the software colour correction of a stream.
+
+    The per-channel gains, the colour correction matrix and the
+    gamma curve are folded into the conversion of the captured
+    frames to RGB, so they do not cost an extra pass over the frame.
+    Pass NULL to turn the colour correction off.
+
+    returns: CAPRESULT_OK if all is well.
+             CAPRESULT_FORMATNOTSUPPORTED if the stream does not support colour correction.
+             CAPRESULT_ERR if context, stream or the settings are invalid.
+*/
+DLLPUBLIC CapResult Cap_setColorPipeline(CapContext ctx, CapStream stream, const CapColorPipeline *pipeline);
+
+/********************************************************************************** 
+     AUTOFOCUS
+**********************************************************************************/
+
+/** Find the sharpest focus position of a stream. Automatic focus is
+    turned off and CAPPROPID_FOCUS is searched with the given strategy.
+    After each move, the sharpness of the region of interest is measured
+    on the first frame whose exposure started after the move (when the
+    platform reports exposure timestamps) or else on the second frame
+    after the move. The stream is left at the best position.
+
+    The sharpness is the mean squared difference of the luma of pixels
+    two apart, horizontally and vertically. The call blocks until the 
+    search is done; it reads frames like Cap_captureFrame does, so it
+    resets the new frame flag.
+
+    @param ctx The ID of the context.
+    @param stream The stream ID.
+    @param roi The region of interest, NULL or a zero width or height for the whole frame.
+    @param strategy CAPFOCUS_COARSETOFINE or CAPFOCUS_GOLDENSECTION.
+    @param result Receives the best position and the score of every evaluated position.
+    @return CAPRESULT_OK if all is well.
+            CAPRESULT_PROPERTYNOTSUPPORTED if the camera has no focus control.
+            CAPRESULT_ERR if context, stream or arguments are invalid, no frames arrived,
+            or a buffer ring is registered.
+*/
+DLLPUBLIC CapResult Cap_autoFocus(CapContext ctx, CapStream stream, const CapRect *roi,
+    uint32_t strategy, CapFocusResult *result);
+
+/********************************************************************************** 
+     SOFTWARE AUTO EXPOSURE
+**********************************************************************************/
+
+/** Enable the software exposure controller of a stream, or turn it off with NULL.
+
+    The hardware automatic exposure and gain are turned off. On the capture
+    thread, the mean luma of the region of interest of each converted frame is
+    compared to the target; outside the tolerance, CAPPROPID_EXPOSURE is moved
+    by the damped ratio of target and mean (and, with CAPAE_USEGAIN, CAPPROPID_GAIN
+    once the exposure is at its maximum or the gain is above its minimum).
+    The new values are applied through the asynchronous property queue and the
+    controller waits for a frame exposed with them before it measures again, so
+    it adjusts at most once per effective frame. The application does not need
+    to read frames for the controller to run.
+
+    While the controller runs, it overrides values set with Cap_setProperty
+    for CAPPROPID_EXPOSURE and CAPPROPID_GAIN. Turning it off leaves the last
+    values in place.
+
+    returns: CAPRESULT_OK if all is well.
+             CAPRESULT_PROPERTYNOTSUPPORTED if the camera has no exposure control.
+             CAPRESULT_FORMATNOTSUPPORTED if the stream does not support software exposure control.
+             CAPRESULT_ERR if context, stream or the settings are invalid.
+*/
+DLLPUBLIC CapResult Cap_setExposureControl(CapContext ctx, CapStream stream, const CapExposureControl *control);
+
+/** get the state of the software exposure controller of a stream.
+
+    returns: CAPRESULT_OK if all is well.
+             CAPRESULT_ERR if context, stream are invalid.
+*/
+DLLPUBLIC CapResult Cap_getExposureState(CapContext ctx, CapStream stream, CapExposureState *state);
+
+/********************************************************************************** 
+     APPLICATION BUFFER RING
+**********************************************************************************/
+
+/** Register a ring of application buffers, e.g. the pages of a memory
+    mapped file, that the frames of a stream are converted into in order.
+
+    Frame i is written as 24-bit RGB, like Cap_captureFrame, to slot
+    i % count, and then the head of the ring is incremented. The library
+    only writes to a slot while head - tail < count, otherwise the frame
+    is dropped; the application increments tail when it is done with the
+    oldest frames, see Cap_getBufferRing and Cap_releaseBufferRingFrames.
+
+    While a ring is registered, frames are not copied to the internal
+    frame buffer, so Cap_hasNewFrame and Cap_captureFrame do not report
+    them, and Cap_captureFrameRegion and Cap_autoFocus return CAPRESULT_ERR.
+    Registering a new ring or passing count = 0 removes the previous
+    one; when the call returns, the library no longer uses its buffers.
+
+    @param ctx The ID of the context.
+    @param stream The stream ID.
+    @param count The number of slots, a power of two so that slot i % count
+           continues across the wrap of head at 2^32, or 0 to remove the ring.
+    @param buffers Pointers to the slots.
+    @param sizes The size of each slot in bytes, at least width*height*3.
+    @return CAPRESULT_OK if all is well.
+            CAPRESULT_FORMATNOTSUPPORTED if the platform does not support buffer rings.
+            CAPRESULT_ERR if context, stream or the buffers are invalid,
+            or count is not a power of two.
+*/
+DLLPUBLIC CapResult Cap_registerBufferRing(CapContext ctx, CapStream stream, uint32_t count,
+    void * const *buffers, const uint32_t *sizes);
+
+/** Get the indices of the buffer ring of a stream. 
+
+    The library stores head with release semantics after a frame is
+    written, so a reader that loads head with acquire semantics (e.g.
+    __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) sees the frames before
+    it. The application advances tail the same way, or calls
+    Cap_releaseBufferRingFrames. The pointer stays valid until the ring
+    is removed or the stream is closed.
+
+    @return the indices, or NULL if the stream has no buffer ring.
+*/
+DLLPUBLIC CapBufferRing* Cap_getBufferRing(CapContext ctx, CapStream stream);
+
+/** Mark the oldest 'frames' frames of the buffer ring as done, so their
+    slots can be written again.
+
+    @return CAPRESULT_OK if all is well.
+            CAPRESULT_ERR if context or stream are invalid, the stream has no
+            buffer ring or fewer than 'frames' frames are in the ring.
+*/
+DLLPUBLIC CapResult Cap_releaseBufferRingFrames(CapContext ctx, CapStream stream, uint32_t frames);
+
+/** Get the metadata of frame 'frame' of the buffer ring, which must
+    have been written and not yet released (tail <= frame < head).
+
+    @return CAPRESULT_OK if all is well.
+            CAPRESULT_ERR if context or stream are invalid, the stream has no
+            buffer ring or the frame is not in the ring.
+*/
+DLLPUBLIC CapResult Cap_getBufferRingMetadata(CapContext ctx, CapStream stream, uint32_t frame,
+    CapFrameMetadata *metadata);
+
+/********************************************************************************** 
+     FRAME CONVERSION
+**********************************************************************************/
+
+/** Convert a frame that did not necessarily come from a capture stream,
+    e.g. a frame read from a file or received over the network, using
+    the same converters that the capture streams use.
+
+    The source FOURCC codes are the same (platform dependent) codes that
+    are reported by Cap_getFormatInfo. Currently, only the Linux platform
+    provides converters.
+
+    @param srcFourcc FOURCC code of the source frame.
+    @param src pointer to the source frame.
+    @param srcBytes size of the source frame in bytes.
+    @param srcStride number of bytes per source line, or 0 for tightly packed lines.
+                     This is ignored for compressed formats such as MJPEG.
+    @param width width of the frame in pixels.
+    @param height height of the frame in pixels.
+    @param dstFormat the desired output format (CAPOUTFMT_xxx).
+    @param dst pointer to the destination buffer.
+    @param dstStride number of bytes per destination line, or 0 for tightly packed lines.
+    @return CAPRESULT_OK if the frame was converted.
+            CAPRESULT_FORMATNOTSUPPORTED if the source or destination format is not supported.
+            CAPRESULT_ERR if the parameters are invalid or the frame could not be decoded.
+*/
+DLLPUBLIC CapResult Cap_convertFrame(uint32_t srcFourcc, const void *src, uint32_t srcBytes,
+    uint32_t srcStride, uint32_t width, uint32_t height,
+    CapOutputFormat dstFormat, void *dst, uint32_t dstStride);
+
+/********************************************************************************** 
+     MEMORY
+**********************************************************************************/
+
+/** Get the memory used by all streams of a context.
+
+    @param ctx The ID of the context.
+    @param usage Pointer to a CapMemoryUsage structure to be filled with data.
+    @return CAPRESULT_OK if all is well.
+            CAPRESULT_ERR if the context is invalid or usage == NULL.
+*/
+DLLPUBLIC CapResult Cap_getMemoryUsage(CapContext ctx, CapMemoryUsage *usage);
+
+/** Get the memory used by a stream.
+
+    @param ctx The ID of the context.
+    @param stream The stream ID.
+    @param usage Pointer to a CapMemoryUsage structure to be filled with data.
+    @return CAPRESULT_OK if all is well.
+            CAPRESULT_ERR if context or stream are invalid or usage == NULL.
+*/
+DLLPUBLIC CapResult Cap_getStreamMemoryUsage(CapContext ctx, CapStream stream, CapMemoryUsage *usage);
+
+/** Set a memory budget for the streams of a context.
+
+    Streams opened after this call use fewer driver buffers (down to 
+    two) when the memory already used by the context and the frame 
+    buffer of the new stream leave too little room for the usual eight.
+    A stream whose minimum does not fit is still opened, and a warning 
+    is logged. Streams that are already open are not changed.
+
+    @param ctx The ID of the context.
+    @param bytes The budget in bytes, 0 for no budget.
+    @return CAPRESULT_OK if all is well.
+            CAPRESULT_ERR if the context is invalid.
+*/
+DLLPUBLIC CapResult Cap_setMemoryBudget(CapContext ctx, uint64_t bytes);
+
+/** Get the heap allocation counters of the library.
+
+    The counters are only kept when the library is built with the
+    OPENPNP_CAPTURE_ALLOCTRACK CMake option, which replaces the global
+    operator new of the process and, on Linux, wraps the malloc calls
+    of the library and its bundled libjpeg-turbo; otherwise they read
+    zero. The frame path is everything from dequeueing a buffer to 
+    converting it into the frame buffer, and Cap_captureFrame. Once a
+    stream has delivered its first frames, its frame path allocates no
+    memory, so the frame path counters should not change while streams
+    run. This includes MJPEG streams on Linux: the decompressors of the
+    bundled libjpeg-turbo reuse their memory from frame to frame (a
+    system libturbojpeg allocates for every frame). The exception is
+    recording, as the index of the archive grows with each frame.
+
+    @param stats Pointer to a CapAllocationStats struct that receives the counters.
+    @return CAPRESULT_OK if succesful.
+            CAPRESULT_ERR if stats == NULL.
+*/
+DLLPUBLIC CapResult Cap_getAllocationStats(CapAllocationStats *stats);
+
+/********************************************************************************** 
+     RECORDING
+**********************************************************************************/
+
+/** Start recording the raw frames of a stream to a capture archive.
+
+    Each buffer dequeued from the device is stored as it was captured
+    (MJPEG, YUYV etc.) with its timestamp, sequence number and the 
+    control values at the time of capture. The archive is indexed
+    when the recording stops, and can be replayed with 
+    Cap_createReplayContext. Recording an already recording stream
+    closes the previous archive first, so the same file name can be
+    used again; the previous archive is closed even if the new one
+    cannot be created.
+
+    @param ctx The ID of the context.
+    @param stream The stream ID.
+    @param filename The file name of the archive.
+    @return CAPRESULT_OK if all is well.
+            CAPRESULT_PROPERTYNOTSUPPORTED if the platform does not support recording.
+            CAPRESULT_ERR if context or stream are invalid or the file could not be created.
+*/
+DLLPUBLIC CapResult Cap_startRecording(CapContext ctx, CapStream stream, const char *filename);
+
+/** Stop recording a stream and write the index of the archive.
+
+    @param ctx The ID of the context.
+    @param stream The stream ID.
+    @return CAPRESULT_OK if all is well.
+            CAPRESULT_ERR if context or stream are invalid, the stream was not
+            recording or writing the archive failed.
+*/
+DLLPUBLIC CapResult Cap_stopRecording(CapContext ctx, CapStream stream);
+
+/********************************************************************************** 
+     PREVIEW
+**********************************************************************************/
+
+/** Serve the frames of a stream as a multipart/x-mixed-replace MJPEG
+    stream over HTTP, which can be watched in a browser. MJPEG streams
+    are forwarded as the camera compressed them, other formats are 
+    JPEG-encoded after conversion. Clients that cannot keep up skip
+    frames. No frame is encoded or copied while no client is connected.
+    Starting the server of a stream that already has one replaces it.
+
+    @param ctx The ID of the context.
+    @param stream The stream ID.
+    @param address "tcp:<port>" to listen on the loopback interface, or
+           "unix:<path>" to listen on a Unix domain socket.
+    @return CAPRESULT_OK if all is well.
+            CAPRESULT_PROPERTYNOTSUPPORTED if the platform does not support the preview server.
+            CAPRESULT_ERR if context or stream are invalid or the socket could not be created.
+*/
+DLLPUBLIC CapResult Cap_startPreviewServer(CapContext ctx, CapStream stream, const char *address);
+
+/** Stop the preview server of a stream and disconnect its clients.
+
+    @param ctx The ID of the context.
+    @param stream The stream ID.
+    @return CAPRESULT_OK if all is well.
+            CAPRESULT_ERR if context or stream are invalid or the stream had no preview server.
+*/
+DLLPUBLIC CapResult Cap_stopPreviewServer(CapContext ctx, CapStream stream);
+
+/********************************************************************************** 
+     METRICS
+**********************************************************************************/
+
+/** Get the counters of a stream.
+
+    @param ctx The ID of the context.
+    @param stream The stream ID.
+    @param stats Pointer to a CapStreamStats structure to be filled with data.
+    @return CAPRESULT_OK if all is well.
+            CAPRESULT_ERR if context or stream are invalid or stats == NULL.
+*/
+DLLPUBLIC CapResult Cap_getStreamStats(CapContext ctx, CapStream stream, CapStreamStats *stats);
+
+/** Start serving the counters of all streams of a context in 
+    Prometheus text format. Every connection is answered with an
+    HTTP response containing a snapshot of the counters.
+
+    The server can also be started without changing the application,
+    by setting the environment variable OPENPNP_CAPTURE_METRICS to
+    the address before the context is created.
+
+    @param ctx The ID of the context.
+    @param address "unix:<path>" or a path for a Unix domain socket,
+           "tcp:<port>" for a TCP port on the loopback interface.
+    @return CAPRESULT_OK if all is well.
+            CAPRESULT_ERR if the context is invalid or the socket could not be created.
+*/
+DLLPUBLIC CapResult Cap_startMetricsServer(CapContext ctx, const char *address);
+
+/** Stop the metrics server of a context.
+
+    @param ctx The ID of the context.
+    @return CAPRESULT_OK if all is well.
+            CAPRESULT_ERR if the context is invalid.
+*/
+DLLPUBLIC CapResult Cap_stopMetricsServer(CapContext ctx);
+
 /********************************************************************************** 
      DEBUGGING
 **********************************************************************************/
@@ -306,6 +1021,32 @@ typedef void (*CapCustomLogFunc)(uint32_t level, const char *string);
 */
 DLLPUBLIC void Cap_installCustomLogFunction(CapCustomLogFunc logFunc);
 
+/** counters of the logging subsystem, see Cap_getLogStats */
+typedef struct
+{
+    uint64_t messages;      ///< messages written to stderr or the custom log function
+    uint64_t suppressed;    ///< messages dropped by rate limiting
+    uint32_t limitedSites;  ///< rate limited places in the library that have logged
+} CapLogStats;
+
+/** Set the rate limit of messages that can occur on every frame,
+    such as driver errors and corrupt frames. Each place in the 
+    library that logs such a message emits its first 'burst' 
+    messages, then at most one per 'intervalMillis', prefixed
+    with the number of messages suppressed since the previous
+    one. Counts still pending are reported by Cap_releaseContext.
+
+    The default is 10 messages, then one per 5000 ms.
+    A burst of 0 turns rate limiting off.
+*/
+DLLPUBLIC void Cap_setLogRateLimit(uint32_t burst, uint32_t intervalMillis);
+
+/** Get the counters of the logging subsystem.
+    @param stats Pointer to a CapLogStats struct that receives the counters.
+    @return CAPRESULT_OK if succesful.
+*/
+DLLPUBLIC CapResult Cap_getLogStats(CapLogStats *stats);
+
 /** Return the version of the library as a string.
     In addition to a version number, this should 
     contain information on the platform,
@@ -0,0 +1,176 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Linux platform code
+    Virtual V4L2 devices that replay capture archives
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#include <string.h>
+#include <algorithm>
+#include "../common/logging.h"
+#include "archivedeviceio.h"
+
+ArchiveDeviceIO::ArchiveDeviceIO()
+{
+}
+
+ArchiveDeviceIO::~ArchiveDeviceIO()
+{
+}
+
+bool ArchiveDeviceIO::addArchive(const std::string &filename, bool realtime)
+{
+    std::shared_ptr<CaptureArchiveReader> archive = std::make_shared<CaptureArchiveReader>();
+    if (!archive->open(filename))
+    {
+        return false;
+    }
+
+    archiveFrame_t frame;
+    if (!archive->getFrame(0, frame))
+    {
+        LOG(LOG_ERR, "Capture archive %s has no frames\n", filename.c_str());
+        return false;
+    }
+
+    const archiveHeader_t &header = archive->getHeader();
+
+    FakeDeviceConfig config;
+    std::string basename = filename.substr(filename.find_last_of('/') + 1);
+    config.name     = "Archive " + basename;
+    config.busInfo  = "archive:" + filename;
+    config.realtime = realtime;
+
+    FakeFormat format;
+    format.fourcc       = header.fourcc;
+    format.width        = header.width;
+    format.height       = header.height;
+    format.bytesPerLine = header.bytesPerLine;
+    format.sizeImage    = header.sizeImage;
+    format.fps.push_back((header.fps != 0) ? header.fps : 30);
+
+    // the buffers must hold the largest frame
+    for(uint32_t i=0; i<archive->getFrameCount(); i++)
+    {
+        archiveFrame_t f;
+        if (archive->getFrame(i, f))
+        {
+            format.sizeImage = std::max<uint32_t>(format.sizeImage, f.bytes);
+        }
+    }
+    config.formats.push_back(format);
+
+    // offer the recorded controls, with the range of
+    // values they took during the recording.
+    for(uint32_t c=0; c<frame.controlCount; c++)
+    {
+        FakeControl ctrl;
+        ctrl.id           = frame.controls[c].id;
+        ctrl.minimum      = frame.controls[c].value;
+        ctrl.maximum      = frame.controls[c].value;
+        ctrl.step         = 1;
+        ctrl.defaultValue = frame.controls[c].value;
+        config.controls.push_back(ctrl);
+    }
+
+    for(uint32_t i=1; i<archive->getFrameCount(); i++)
+    {
+        archiveFrame_t f;
+        if (!archive->getFrame(i, f))
+        {
+            continue;
+        }
+        for(uint32_t c=0; c<f.controlCount; c++)
+        {
+            for(auto &ctrl : config.controls)
+            {
+                if (ctrl.id == f.controls[c].id)
+                {
+                    ctrl.minimum = std::min(ctrl.minimum, f.controls[c].value);
+                    ctrl.maximum = std::max(ctrl.maximum, f.controls[c].value);
+                }
+            }
+        }
+    }
+
+    uint32_t index = addDevice(config);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_archives.size() <= index)
+    {
+        m_archives.resize(index+1);
+    }
+    m_archives[index] = archive;
+    return true;
+}
+
+void ArchiveDeviceIO::fillFrame(fakeFile &file, uint8_t *dst, size_t bytes, 
+    uint32_t sequence, uint32_t *bytesUsed)
+{
+    *bytesUsed = 0;
+    if ((file.device >= m_archives.size()) || (!m_archives[file.device]))
+    {
+        FakeDeviceIO::fillFrame(file, dst, bytes, sequence, bytesUsed);
+        return;
+    }
+
+    const CaptureArchiveReader &archive = *m_archives[file.device];
+    archiveFrame_t frame;
+    if (!archive.getFrame(sequence % archive.getFrameCount(), frame))
+    {
+        return;
+    }
+
+    *bytesUsed = std::min(bytes, frame.bytes);
+    memcpy(dst, frame.data, *bytesUsed);
+
+    // report the control values of the frame
+    std::map<uint32_t, int32_t> &values = m_devices[file.device].values;
+    for(uint32_t c=0; c<frame.controlCount; c++)
+    {
+        values[frame.controls[c].id] = frame.controls[c].value;
+    }
+}
+
+uint64_t ArchiveDeviceIO::frameInterval(const fakeFile &file) const
+{
+    if ((file.device >= m_archives.size()) || (!m_archives[file.device]))
+    {
+        return FakeDeviceIO::frameInterval(file);
+    }
+
+    // file.sequence is the next frame, the interval is the
+    // recorded time between it and the frame before it.
+    const CaptureArchiveReader &archive = *m_archives[file.device];
+    const uint32_t count = archive.getFrameCount();
+    const uint32_t next = file.sequence % count;
+    archiveFrame_t prevFrame, nextFrame;
+    if ((next == 0) || (!archive.getFrame(next-1, prevFrame)) || 
+        (!archive.getFrame(next, nextFrame)) || (nextFrame.timestamp < prevFrame.timestamp))
+    {
+        return FakeDeviceIO::frameInterval(file);
+    }
+    return nextFrame.timestamp - prevFrame.timestamp;
+}
@@ -0,0 +1,68 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Linux platform code
+    Virtual V4L2 devices that replay capture archives
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#ifndef linux_archivedeviceio_h
+#define linux_archivedeviceio_h
+
+#include <string>
+#include <memory>
+#include "fakedeviceio.h"
+#include "capturearchive.h"
+
+/** DeviceIO implementation that replays capture archives as
+    V4L2 devices, so the archived buffers go through the normal
+    capture and conversion pipeline of PlatformStream.
+
+    Each archive becomes a device with a single format, the one 
+    it was recorded in. The frames are delivered at their recorded
+    intervals or, if realtime is off, as fast as they are dequeued.
+    The archive loops when its end is reached. The control values
+    follow the values recorded with the frames.
+*/
+class ArchiveDeviceIO : public FakeDeviceIO
+{
+public:
+    ArchiveDeviceIO();
+    virtual ~ArchiveDeviceIO();
+
+    /** add a device that replays an archive. Returns false
+        if the archive cannot be read or is empty. */
+    bool addArchive(const std::string &filename, bool realtime);
+
+protected:
+    virtual void fillFrame(fakeFile &file, uint8_t *dst, size_t bytes, 
+        uint32_t sequence, uint32_t *bytesUsed) override;
+
+    virtual uint64_t frameInterval(const fakeFile &file) const override;
+
+    /** the archives, indexed by device */
+    std::vector<std::shared_ptr<CaptureArchiveReader> > m_archives;
+};
+
+#endif
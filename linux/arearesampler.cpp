@@ -0,0 +1,219 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Linux platform code
+    Area-average (box filter) downscaling of 24-bit lines
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#include <string.h>
+#include "arearesampler.h"
+
+// number of fractional bits of the filter weights.
+// the product of a horizontal and a vertical weight
+// times 255 must fit in 32 bits.
+#define WEIGHT_BITS 12
+#define WEIGHT_ONE  (1 << WEIGHT_BITS)
+
+/* the edges of the output pixels are expressed in units of
+   1/dstSize source pixels so all overlaps are integers. The 
+   cumulative weight up to an edge is rounded, which makes the
+   weights of each output pixel add up to exactly WEIGHT_ONE.
+*/
+static inline uint32_t cumulativeWeight(uint64_t pos, uint32_t srcSize)
+{
+    return static_cast<uint32_t>((pos * WEIGHT_ONE + srcSize/2) / srcSize);
+}
+
+AreaResampler::AreaResampler() :
+    m_srcWidth(0),
+    m_srcHeight(0),
+    m_dstWidth(0),
+    m_dstHeight(0),
+    m_dst(nullptr),
+    m_dstStride(0),
+    m_srcLine(0),
+    m_dstLine(0)
+{
+}
+
+bool AreaResampler::setup(uint32_t srcWidth, uint32_t srcHeight, uint32_t dstWidth, uint32_t dstHeight)
+{
+    if ((dstWidth == 0) || (dstHeight == 0) || (dstWidth > srcWidth) || (dstHeight > srcHeight))
+    {
+        return false;
+    }
+
+    m_srcWidth  = srcWidth;
+    m_srcHeight = srcHeight;
+    m_dstWidth  = dstWidth;
+    m_dstHeight = dstHeight;
+
+    // horizontal weights: output pixel x covers [x*srcWidth, (x+1)*srcWidth)
+    // and source pixel p covers [p*dstWidth, (p+1)*dstWidth).
+    m_hStart.resize(dstWidth);
+    m_hCount.resize(dstWidth);
+    m_hWeights.clear();
+    for(uint32_t x=0; x<dstWidth; x++)
+    {
+        const uint64_t begin = static_cast<uint64_t>(x)*srcWidth;
+        const uint64_t end   = begin + srcWidth;
+        uint32_t p = static_cast<uint32_t>(begin / dstWidth);
+        m_hStart[x] = p;
+        m_hCount[x] = 0;
+        while((p < srcWidth) && (static_cast<uint64_t>(p)*dstWidth < end))
+        {
+            uint64_t a = static_cast<uint64_t>(p)*dstWidth;
+            uint64_t b = a + dstWidth;
+            a = (a < begin) ? begin : a;
+            b = (b > end) ? end : b;
+            m_hWeights.push_back(cumulativeWeight(b - begin, srcWidth) - 
+                cumulativeWeight(a - begin, srcWidth));
+            m_hCount[x]++;
+            p++;
+        }
+    }
+
+    // vertical weights: a source line contributes to at most two output lines
+    m_vWeights.resize(srcHeight);
+    for(uint32_t y=0; y<srcHeight; y++)
+    {
+        const uint64_t a = static_cast<uint64_t>(y)*dstHeight;
+        const uint64_t b = a + dstHeight;
+        const uint32_t j = static_cast<uint32_t>(a / srcHeight);
+        const uint64_t lineEnd = static_cast<uint64_t>(j+1)*srcHeight;
+
+        vweight_t &w = m_vWeights[y];
+        w.dstLine = j;
+        if (b <= lineEnd)
+        {
+            w.w0 = cumulativeWeight(b - static_cast<uint64_t>(j)*srcHeight, srcHeight) -
+                cumulativeWeight(a - static_cast<uint64_t>(j)*srcHeight, srcHeight);
+            w.w1 = 0;
+            w.last = (b == lineEnd);
+        }
+        else
+        {
+            w.w0 = WEIGHT_ONE - cumulativeWeight(a - static_cast<uint64_t>(j)*srcHeight, srcHeight);
+            w.w1 = cumulativeWeight(b - lineEnd, srcHeight);
+            w.last = true;
+        }
+    }
+
+    m_hLine.resize(dstWidth*3);
+    m_acc0.resize(dstWidth*3);
+    m_acc1.resize(dstWidth*3);
+    return true;
+}
+
+size_t AreaResampler::getScratchBytes() const
+{
+    return (m_hStart.capacity() + m_hCount.capacity() + m_hWeights.capacity() + 
+        m_hLine.capacity() + m_acc0.capacity() + m_acc1.capacity())*sizeof(uint32_t) +
+        m_vWeights.capacity()*sizeof(vweight_t);
+}
+
+void AreaResampler::begin(uint8_t *dst, uint32_t dstStride)
+{
+    m_dst = dst;
+    m_dstStride = dstStride;
+    m_srcLine = 0;
+    m_dstLine = 0;
+    memset(&m_acc0[0], 0, m_acc0.size()*sizeof(uint32_t));
+    memset(&m_acc1[0], 0, m_acc1.size()*sizeof(uint32_t));
+}
+
+void AreaResampler::addLine(const uint8_t *line)
+{
+    if (m_srcLine >= m_srcHeight)
+    {
+        return;
+    }
+
+    // horizontal pass
+    const uint32_t *weights = &m_hWeights[0];
+    uint32_t *hLine = &m_hLine[0];
+    for(uint32_t x=0; x<m_dstWidth; x++)
+    {
+        const uint8_t *src = line + m_hStart[x]*3;
+        uint32_t r = 0;
+        uint32_t g = 0;
+        uint32_t b = 0;
+        for(uint32_t i=0; i<m_hCount[x]; i++)
+        {
+            const uint32_t w = *weights++;
+            r += w*src[0];
+            g += w*src[1];
+            b += w*src[2];
+            src += 3;
+        }
+        hLine[0] = r;
+        hLine[1] = g;
+        hLine[2] = b;
+        hLine += 3;
+    }
+
+    // vertical pass
+    const vweight_t &vw = m_vWeights[m_srcLine++];
+    const uint32_t n = m_dstWidth*3;
+    uint32_t *acc0 = &m_acc0[0];
+    const uint32_t w0 = vw.w0;
+    for(uint32_t i=0; i<n; i++)
+    {
+        acc0[i] += w0*m_hLine[i];
+    }
+
+    if (vw.w1 != 0)
+    {
+        uint32_t *acc1 = &m_acc1[0];
+        const uint32_t w1 = vw.w1;
+        for(uint32_t i=0; i<n; i++)
+        {
+            acc1[i] += w1*m_hLine[i];
+        }
+    }
+
+    if (vw.last)
+    {
+        emitLine();
+    }
+}
+
+void AreaResampler::emitLine()
+{
+    if (m_dstLine < m_dstHeight)
+    {
+        uint8_t *out = m_dst + static_cast<size_t>(m_dstLine)*m_dstStride;
+        const uint32_t n = m_dstWidth*3;
+        const uint32_t *acc = &m_acc0[0];
+        for(uint32_t i=0; i<n; i++)
+        {
+            out[i] = static_cast<uint8_t>((acc[i] + (1 << (2*WEIGHT_BITS-1))) >> (2*WEIGHT_BITS));
+        }
+    }
+
+    m_dstLine++;
+    m_acc0.swap(m_acc1);
+    memset(&m_acc1[0], 0, m_acc1.size()*sizeof(uint32_t));
+}
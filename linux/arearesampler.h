@@ -0,0 +1,97 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Linux platform code
+    Area-average (box filter) downscaling of 24-bit lines
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#ifndef linux_arearesampler_h
+#define linux_arearesampler_h
+
+#include <stdint.h>
+#include <vector>
+
+/** The AreaResampler downscales a frame to an arbitrary
+    smaller size by averaging the area of the source frame
+    that each output pixel covers.
+
+    The filter is separable and uses fixed-point weights.
+    The frame is fed one 24-bit source line at a time, so 
+    it can be fused with the conversion of the lines and no
+    full-size intermediate frame is needed. Output lines are
+    written as soon as all their source lines have been seen.
+*/
+class AreaResampler
+{
+public:
+    AreaResampler();
+
+    /** Setup the filter weights. The output size cannot be
+        larger than the source size. */
+    bool setup(uint32_t srcWidth, uint32_t srcHeight, uint32_t dstWidth, uint32_t dstHeight);
+
+    /** Start a new output frame */
+    void begin(uint8_t *dst, uint32_t dstStride);
+
+    /** Add the next 24-bit source line */
+    void addLine(const uint8_t *line);
+
+    /** Returns the number of bytes of weight tables and line buffers */
+    size_t getScratchBytes() const;
+
+protected:
+    /** write the accumulated output line */
+    void emitLine();
+
+    /** per source line vertical weights */
+    struct vweight_t
+    {
+        uint32_t dstLine;   ///< first output line the source line contributes to
+        uint32_t w0;        ///< weight for dstLine
+        uint32_t w1;        ///< weight for dstLine+1
+        bool     last;      ///< true if this is the last source line of dstLine
+    };
+
+    uint32_t    m_srcWidth;
+    uint32_t    m_srcHeight;
+    uint32_t    m_dstWidth;
+    uint32_t    m_dstHeight;
+
+    std::vector<uint32_t>   m_hStart;   ///< first source pixel of each output pixel
+    std::vector<uint32_t>   m_hCount;   ///< number of source pixels of each output pixel
+    std::vector<uint32_t>   m_hWeights; ///< weights of the source pixels, flattened
+    std::vector<vweight_t>  m_vWeights; ///< weights of each source line
+
+    std::vector<uint32_t>   m_hLine;    ///< horizontally filtered source line
+    std::vector<uint32_t>   m_acc0;     ///< accumulator of the current output line
+    std::vector<uint32_t>   m_acc1;     ///< accumulator of the next output line
+
+    uint8_t*    m_dst;          ///< output frame
+    uint32_t    m_dstStride;    ///< bytes per output line
+    uint32_t    m_srcLine;      ///< index of the next source line
+    uint32_t    m_dstLine;      ///< index of the current output line
+};
+
+#endif
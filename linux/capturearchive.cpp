@@ -0,0 +1,312 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Linux platform code
+    Indexed capture archive of raw frames
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../common/logging.h"
+#include "capturearchive.h"
+
+static_assert(sizeof(archiveHeader_t) == 64, "archive header must be 64 bytes");
+static_assert(sizeof(archiveRecord_t) == 24, "archive record header must be 24 bytes");
+static_assert(sizeof(archiveTrailer_t) == 24, "archive trailer must be 24 bytes");
+
+/** round up to a multiple of 8 bytes */
+static inline uint64_t pad8(uint64_t bytes)
+{
+    return (bytes + 7) & ~static_cast<uint64_t>(7);
+}
+
+// **********************************************************************
+//   CaptureArchiveWriter
+// **********************************************************************
+
+CaptureArchiveWriter::CaptureArchiveWriter() :
+    m_file(nullptr),
+    m_offset(0),
+    m_failed(false)
+{
+}
+
+CaptureArchiveWriter::~CaptureArchiveWriter()
+{
+    close();
+}
+
+bool CaptureArchiveWriter::open(const std::string &filename, uint32_t fourcc, uint32_t width, 
+    uint32_t height, uint32_t bytesPerLine, uint32_t sizeImage, uint32_t fps)
+{
+    close();
+
+    m_file = fopen(filename.c_str(), "wb");
+    if (m_file == nullptr)
+    {
+        LOG(LOG_ERR, "Cannot create capture archive %s\n", filename.c_str());
+        return false;
+    }
+
+    archiveHeader_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ARCHIVE_HEADER_MAGIC, sizeof(header.magic));
+    header.version      = ARCHIVE_VERSION;
+    header.fourcc       = fourcc;
+    header.width        = width;
+    header.height       = height;
+    header.bytesPerLine = bytesPerLine;
+    header.sizeImage    = sizeImage;
+    header.fps          = fps;
+
+    m_failed = (fwrite(&header, sizeof(header), 1, m_file) != 1);
+    m_offset = sizeof(header);
+    m_index.clear();
+    return !m_failed;
+}
+
+bool CaptureArchiveWriter::addFrame(const uint8_t *data, size_t bytes, uint64_t timestamp, 
+    uint32_t sequence, const std::vector<archiveControl_t> &controls)
+{
+    if ((m_file == nullptr) || m_failed)
+    {
+        return false;
+    }
+
+    archiveRecord_t record;
+    record.magic        = ARCHIVE_RECORD_MAGIC;
+    record.dataBytes    = bytes;
+    record.timestamp    = timestamp;
+    record.sequence     = sequence;
+    record.controlCount = controls.size();
+
+    static const uint8_t padding[8] = {0};
+    uint64_t padBytes = pad8(bytes) - bytes;
+
+    bool ok = (fwrite(&record, sizeof(record), 1, m_file) == 1);
+    if (ok && (controls.size() > 0))
+    {
+        ok = (fwrite(&controls[0], sizeof(archiveControl_t), controls.size(), m_file) == controls.size());
+    }
+    if (ok && (bytes > 0))
+    {
+        ok = (fwrite(data, 1, bytes, m_file) == bytes);
+    }
+    if (ok && (padBytes > 0))
+    {
+        ok = (fwrite(padding, 1, padBytes, m_file) == padBytes);
+    }
+
+    if (!ok)
+    {
+        LOG(LOG_ERR, "Writing to the capture archive failed\n");
+        m_failed = true;
+        return false;
+    }
+
+    m_index.push_back(m_offset);
+    m_offset += sizeof(record) + controls.size()*sizeof(archiveControl_t) + bytes + padBytes;
+    return true;
+}
+
+bool CaptureArchiveWriter::close()
+{
+    if (m_file == nullptr)
+    {
+        return false;
+    }
+
+    archiveTrailer_t trailer;
+    memset(&trailer, 0, sizeof(trailer));
+    trailer.indexOffset = m_offset;
+    trailer.frameCount  = m_index.size();
+    memcpy(trailer.magic, ARCHIVE_TRAILER_MAGIC, sizeof(trailer.magic));
+
+    bool ok = !m_failed;
+    if (ok && (m_index.size() > 0))
+    {
+        ok = (fwrite(&m_index[0], sizeof(uint64_t), m_index.size(), m_file) == m_index.size());
+    }
+    if (ok)
+    {
+        ok = (fwrite(&trailer, sizeof(trailer), 1, m_file) == 1);
+    }
+    if (fclose(m_file) != 0)
+    {
+        ok = false;
+    }
+    m_file = nullptr;
+
+    LOG(LOG_INFO, "Capture archive closed with %d frames\n", static_cast<int>(m_index.size()));
+    return ok;
+}
+
+// **********************************************************************
+//   CaptureArchiveReader
+// **********************************************************************
+
+CaptureArchiveReader::CaptureArchiveReader() :
+    m_data(nullptr),
+    m_size(0)
+{
+}
+
+CaptureArchiveReader::~CaptureArchiveReader()
+{
+    close();
+}
+
+bool CaptureArchiveReader::open(const std::string &filename)
+{
+    close();
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        LOG(LOG_ERR, "Cannot open capture archive %s\n", filename.c_str());
+        return false;
+    }
+
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || (static_cast<size_t>(st.st_size) < sizeof(archiveHeader_t)))
+    {
+        LOG(LOG_ERR, "%s is not a capture archive\n", filename.c_str());
+        ::close(fd);
+        return false;
+    }
+
+    void *ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (ptr == MAP_FAILED)
+    {
+        LOG(LOG_ERR, "Cannot map capture archive %s\n", filename.c_str());
+        return false;
+    }
+    m_data = static_cast<const uint8_t*>(ptr);
+    m_size = st.st_size;
+
+    const archiveHeader_t &header = getHeader();
+    if ((memcmp(header.magic, ARCHIVE_HEADER_MAGIC, sizeof(header.magic)) != 0) ||
+        (header.version != ARCHIVE_VERSION))
+    {
+        LOG(LOG_ERR, "%s is not a capture archive\n", filename.c_str());
+        close();
+        return false;
+    }
+
+    // use the index of a closed archive, scan the
+    // records of an archive that was not closed.
+    bool indexed = false;
+    if (m_size >= sizeof(archiveHeader_t) + sizeof(archiveTrailer_t))
+    {
+        const archiveTrailer_t *trailer = reinterpret_cast<const archiveTrailer_t*>(
+            m_data + m_size - sizeof(archiveTrailer_t));
+        uint64_t indexBytes = static_cast<uint64_t>(trailer->frameCount)*sizeof(uint64_t);
+        if ((memcmp(trailer->magic, ARCHIVE_TRAILER_MAGIC, sizeof(trailer->magic)) == 0) &&
+            (trailer->indexOffset + indexBytes + sizeof(archiveTrailer_t) == m_size))
+        {
+            const uint64_t *index = reinterpret_cast<const uint64_t*>(m_data + trailer->indexOffset);
+            m_index.assign(index, index + trailer->frameCount);
+            indexed = true;
+        }
+    }
+
+    if (!indexed)
+    {
+        LOG(LOG_WARNING, "Capture archive %s has no index, scanning the records\n", filename.c_str());
+        scanRecords();
+    }
+
+    LOG(LOG_INFO, "Capture archive %s: %s %d x %d, %d frames\n", filename.c_str(),
+        std::string(reinterpret_cast<const char*>(&header.fourcc), 4).c_str(),
+        header.width, header.height, getFrameCount());
+    return true;
+}
+
+void CaptureArchiveReader::close()
+{
+    if (m_data != nullptr)
+    {
+        munmap(const_cast<uint8_t*>(m_data), m_size);
+        m_data = nullptr;
+        m_size = 0;
+    }
+    m_index.clear();
+}
+
+const archiveRecord_t* CaptureArchiveReader::getRecord(uint64_t offset) const
+{
+    if ((offset % 8 != 0) || (offset + sizeof(archiveRecord_t) > m_size))
+    {
+        return nullptr;
+    }
+
+    const archiveRecord_t *record = reinterpret_cast<const archiveRecord_t*>(m_data + offset);
+    uint64_t bytes = sizeof(archiveRecord_t) + 
+        static_cast<uint64_t>(record->controlCount)*sizeof(archiveControl_t) + record->dataBytes;
+    if ((record->magic != ARCHIVE_RECORD_MAGIC) || (offset + bytes > m_size))
+    {
+        return nullptr;
+    }
+    return record;
+}
+
+void CaptureArchiveReader::scanRecords()
+{
+    uint64_t offset = sizeof(archiveHeader_t);
+    const archiveRecord_t *record;
+    while((record = getRecord(offset)) != nullptr)
+    {
+        m_index.push_back(offset);
+        offset += pad8(sizeof(archiveRecord_t) + 
+            static_cast<uint64_t>(record->controlCount)*sizeof(archiveControl_t) + record->dataBytes);
+    }
+}
+
+bool CaptureArchiveReader::getFrame(uint32_t index, archiveFrame_t &frame) const
+{
+    if (index >= m_index.size())
+    {
+        return false;
+    }
+
+    const archiveRecord_t *record = getRecord(m_index[index]);
+    if (record == nullptr)
+    {
+        return false;
+    }
+
+    const uint8_t *ptr = reinterpret_cast<const uint8_t*>(record + 1);
+    frame.controls      = reinterpret_cast<const archiveControl_t*>(ptr);
+    frame.controlCount  = record->controlCount;
+    frame.data          = ptr + record->controlCount*sizeof(archiveControl_t);
+    frame.bytes         = record->dataBytes;
+    frame.timestamp     = record->timestamp;
+    frame.sequence      = record->sequence;
+    return true;
+}
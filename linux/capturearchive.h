@@ -0,0 +1,191 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Linux platform code
+    Indexed capture archive of raw frames
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#ifndef linux_capturearchive_h
+#define linux_capturearchive_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+/*
+    A capture archive stores the raw buffers dequeued from a 
+    V4L2 device (MJPEG, YUYV etc.) with their timestamps,
+    sequence numbers and the control values at the time of
+    capture. All fields are little endian.
+
+    header      archiveHeader_t
+    record 0    archiveRecord_t, controlCount x archiveControl_t,
+                dataBytes of frame data padded to a multiple of 8 bytes
+    record 1    ...
+    index       frameCount x uint64_t file offsets of the records
+    trailer     archiveTrailer_t
+
+    The index and trailer are written when the archive is closed.
+    Archives without them, e.g. after a crash, can still be read
+    by scanning the records.
+*/
+
+#define ARCHIVE_HEADER_MAGIC    "OPCARCH1"
+#define ARCHIVE_TRAILER_MAGIC   "OPCINDEX"
+#define ARCHIVE_RECORD_MAGIC    0x4D415246  // 'FRAM'
+#define ARCHIVE_VERSION         1
+
+/** archive header at the start of the file */
+struct archiveHeader_t
+{
+    char     magic[8];      ///< ARCHIVE_HEADER_MAGIC
+    uint32_t version;       ///< ARCHIVE_VERSION
+    uint32_t fourcc;        ///< V4L2 pixel format of the frames
+    uint32_t width;         ///< width of the frames in pixels
+    uint32_t height;        ///< height of the frames in pixels
+    uint32_t bytesPerLine;  ///< bytes per line of uncompressed frames
+    uint32_t sizeImage;     ///< driver buffer size
+    uint32_t fps;           ///< frame rate requested from the device
+    uint32_t reserved[7];
+};
+
+/** header of a frame record */
+struct archiveRecord_t
+{
+    uint32_t magic;         ///< ARCHIVE_RECORD_MAGIC
+    uint32_t dataBytes;     ///< bytes of frame data, without padding
+    uint64_t timestamp;     ///< capture time in microseconds
+    uint32_t sequence;      ///< sequence number of the frame
+    uint32_t controlCount;  ///< number of archiveControl_t that follow
+};
+
+/** value of a V4L2 control */
+struct archiveControl_t
+{
+    uint32_t id;            ///< V4L2 control ID
+    int32_t  value;         ///< value of the control
+};
+
+/** trailer at the end of a closed archive */
+struct archiveTrailer_t
+{
+    uint64_t indexOffset;   ///< file offset of the index
+    uint32_t frameCount;    ///< number of records in the index
+    uint32_t reserved;
+    char     magic[8];      ///< ARCHIVE_TRAILER_MAGIC
+};
+
+/** a frame read from an archive, pointing into the mapped file */
+struct archiveFrame_t
+{
+    const uint8_t*          data;           ///< frame data
+    size_t                  bytes;          ///< bytes of frame data
+    uint64_t                timestamp;      ///< capture time in microseconds
+    uint32_t                sequence;       ///< sequence number of the frame
+    const archiveControl_t* controls;       ///< control values at the time of capture
+    uint32_t                controlCount;   ///< number of control values
+};
+
+/** Writes a capture archive. Records are written through
+    a buffered stdio stream, so adding a frame costs one
+    copy of the frame. */
+class CaptureArchiveWriter
+{
+public:
+    CaptureArchiveWriter();
+
+    /** closes the archive */
+    virtual ~CaptureArchiveWriter();
+
+    /** create the archive and write its header */
+    bool open(const std::string &filename, uint32_t fourcc, uint32_t width, uint32_t height,
+        uint32_t bytesPerLine, uint32_t sizeImage, uint32_t fps);
+
+    /** append a frame record */
+    bool addFrame(const uint8_t *data, size_t bytes, uint64_t timestamp, uint32_t sequence,
+        const std::vector<archiveControl_t> &controls);
+
+    /** write the index and trailer and close the file. 
+        Returns false if any write failed. */
+    bool close();
+
+    /** returns the number of frames written */
+    uint32_t getFrameCount() const
+    {
+        return m_index.size();
+    }
+
+protected:
+    FILE*                   m_file;     ///< archive file, or NULL
+    uint64_t                m_offset;   ///< file offset of the next record
+    std::vector<uint64_t>   m_index;    ///< file offsets of the records
+    bool                    m_failed;   ///< true if a write failed
+};
+
+/** Reads a capture archive. The file is memory mapped, so 
+    frames can be accessed in any order without copying. */
+class CaptureArchiveReader
+{
+public:
+    CaptureArchiveReader();
+
+    /** unmaps the archive */
+    virtual ~CaptureArchiveReader();
+
+    /** map an archive and read its index */
+    bool open(const std::string &filename);
+
+    /** unmap the archive */
+    void close();
+
+    /** returns the archive header */
+    const archiveHeader_t& getHeader() const
+    {
+        return *reinterpret_cast<const archiveHeader_t*>(m_data);
+    }
+
+    /** returns the number of frames in the archive */
+    uint32_t getFrameCount() const
+    {
+        return m_index.size();
+    }
+
+    /** get frame 'index' of the archive */
+    bool getFrame(uint32_t index, archiveFrame_t &frame) const;
+
+protected:
+    /** check a record and return a pointer to it, or NULL */
+    const archiveRecord_t* getRecord(uint64_t offset) const;
+
+    /** build the index by walking the records */
+    void scanRecords();
+
+    const uint8_t*          m_data;     ///< mapped file, or NULL
+    size_t                  m_size;     ///< size of the mapped file
+    std::vector<uint64_t>   m_index;    ///< file offsets of the records
+};
+
+#endif
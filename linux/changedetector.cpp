@@ -0,0 +1,186 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Linux platform code
+    Cheap frame change detection to skip the
+    conversion of frames of static scenes
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#include <linux/videodev2.h>
+#include "changedetector.h"
+
+// size of the sparse sample grid of uncompressed frames
+#define SAMPLES_X 32
+#define SAMPLES_Y 24
+
+// number of bytes hashed in compressed frames
+#define HASH_SAMPLES 256
+
+ChangeDetector::ChangeDetector() :
+    m_threshold(0),
+    m_hasReference(false),
+    m_refBytes(0),
+    m_refHash(0),
+    m_hasPending(false),
+    m_pendingBytes(0),
+    m_pendingHash(0)
+{
+    m_refSamples.resize(SAMPLES_X*SAMPLES_Y);
+    m_samples.resize(SAMPLES_X*SAMPLES_Y);
+}
+
+void ChangeDetector::setThreshold(uint32_t threshold)
+{
+    m_threshold = threshold;
+    m_hasReference = false;
+    m_hasPending = false;
+}
+
+bool ChangeDetector::hasChanged(uint32_t fourcc, const uint8_t *ptr, size_t bytes, 
+    uint32_t width, uint32_t height, uint32_t stride)
+{
+    m_hasPending = false;
+    if (m_threshold == 0)
+    {
+        return true;
+    }
+
+    uint32_t score = 0;
+    switch(fourcc)
+    {
+    case V4L2_PIX_FMT_MJPEG:
+        score = scoreCompressed(ptr, bytes);
+        break;
+    case V4L2_PIX_FMT_YUYV:
+        score = scoreUncompressed(ptr, bytes, width, height, 
+            (stride != 0) ? stride : width*2, 2, 0);
+        break;
+    case V4L2_PIX_FMT_RGB24:
+        score = scoreUncompressed(ptr, bytes, width, height, 
+            (stride != 0) ? stride : width*3, 3, 1);
+        break;
+    default:
+        // no cheap test available
+        return true;
+    }
+
+    if ((!m_hasReference) || (score >= m_threshold))
+    {
+        return true;
+    }
+    m_hasPending = false;
+    return false;
+}
+
+void ChangeDetector::commit()
+{
+    if (!m_hasPending)
+    {
+        return;
+    }
+
+    // only one of the two kinds of reference is used
+    // for a stream, so both are taken over.
+    m_refBytes = m_pendingBytes;
+    m_refHash  = m_pendingHash;
+    m_refSamples.swap(m_samples);
+    m_hasReference = true;
+    m_hasPending = false;
+}
+
+uint32_t ChangeDetector::scoreCompressed(const uint8_t *ptr, size_t bytes)
+{
+    // FNV-1a hash of evenly spaced bytes
+    uint32_t hash = 2166136261u;
+    const size_t step = (bytes > HASH_SAMPLES) ? bytes / HASH_SAMPLES : 1;
+    for(size_t i=0; i<bytes; i+=step)
+    {
+        hash = (hash ^ ptr[i]) * 16777619u;
+    }
+
+    uint32_t score = 0;
+    if (m_hasReference)
+    {
+        size_t delta = (bytes > m_refBytes) ? bytes - m_refBytes : m_refBytes - bytes;
+        score = static_cast<uint32_t>((delta * 1000) / ((m_refBytes != 0) ? m_refBytes : 1));
+
+        // any content change counts as a minimal change
+        if ((score == 0) && (hash != m_refHash))
+        {
+            score = 1;
+        }
+    }
+
+    m_pendingBytes = bytes;
+    m_pendingHash  = hash;
+    m_hasPending = true;
+    return score;
+}
+
+uint32_t ChangeDetector::scoreUncompressed(const uint8_t *ptr, size_t bytes, 
+    uint32_t width, uint32_t height, uint32_t stride, 
+    uint32_t pixelBytes, uint32_t offset)
+{
+    if ((width == 0) || (height == 0) || (bytes < static_cast<size_t>(stride)*height))
+    {
+        // incomplete frame, let the converter deal with it
+        return m_threshold;
+    }
+
+    // gather the luma samples from the middle of each grid cell
+    uint8_t *samples = &m_samples[0];
+    for(uint32_t j=0; j<SAMPLES_Y; j++)
+    {
+        const uint32_t y = ((2*j+1)*height) / (2*SAMPLES_Y);
+        const uint8_t *line = ptr + static_cast<size_t>(y)*stride + offset;
+        for(uint32_t i=0; i<SAMPLES_X; i++)
+        {
+            const uint32_t x = ((2*i+1)*width) / (2*SAMPLES_X);
+            *samples++ = line[x*pixelBytes];
+        }
+    }
+
+    uint32_t score = 0;
+    if (m_hasReference)
+    {
+        uint32_t sad = 0;
+        for(uint32_t i=0; i<SAMPLES_X*SAMPLES_Y; i++)
+        {
+            int32_t d = static_cast<int32_t>(m_samples[i]) - m_refSamples[i];
+            sad += (d < 0) ? -d : d;
+        }
+
+        score = (sad * 1000) / (255*SAMPLES_X*SAMPLES_Y);
+
+        // any change of the samples counts as a minimal change
+        if ((score == 0) && (sad != 0))
+        {
+            score = 1;
+        }
+    }
+
+    m_hasPending = true;
+    return score;
+}
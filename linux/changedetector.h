@@ -0,0 +1,112 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Linux platform code
+    Cheap frame change detection to skip the
+    conversion of frames of static scenes
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#ifndef linux_changedetector_h
+#define linux_changedetector_h
+
+#include <stdint.h>
+#include <stdlib.h> // size_t
+#include <vector>
+
+/** The ChangeDetector compares a frame to the most recent
+    changed frame using a cheap test, so that the expensive
+    conversion of frames of static scenes can be skipped.
+
+    MJPEG frames are compared by their compressed size and
+    a hash of sampled bytes. YUYV and RGB24 frames are compared
+    by the sum of absolute differences of a sparse grid of
+    luma (or green) samples.
+
+    The threshold is given in parts per thousand of the
+    compressed size or of the full-scale luma range. A 
+    threshold of 1 reports any detectable change and a
+    threshold of 0 turns the detector off.
+*/
+class ChangeDetector
+{
+public:
+    ChangeDetector();
+
+    /** Set the threshold in parts per thousand, 0 turns the detector off.
+        The reference frame is discarded. */
+    void setThreshold(uint32_t threshold);
+
+    /** Returns true if change detection is on */
+    bool isEnabled() const
+    {
+        return m_threshold != 0;
+    }
+
+    /** Discard the reference frame so the next frame
+        counts as changed */
+    void reset()
+    {
+        m_hasReference = false;
+        m_hasPending = false;
+    }
+
+    /** Returns true if the frame differs from the reference frame
+        by at least the threshold. The frame only becomes the new
+        reference frame when commit is called, i.e. after it was
+        converted successfully. */
+    bool hasChanged(uint32_t fourcc, const uint8_t *ptr, size_t bytes, 
+        uint32_t width, uint32_t height, uint32_t stride);
+
+    /** Make the frame last reported as changed by hasChanged
+        the reference frame */
+    void commit();
+
+    /** Returns the number of bytes used for samples */
+    size_t getScratchBytes() const
+    {
+        return m_refSamples.capacity() + m_samples.capacity();
+    }
+
+protected:
+    /** score an MJPEG frame against the reference */
+    uint32_t scoreCompressed(const uint8_t *ptr, size_t bytes);
+
+    /** score an uncompressed frame against the reference */
+    uint32_t scoreUncompressed(const uint8_t *ptr, size_t bytes, 
+        uint32_t width, uint32_t height, uint32_t stride, 
+        uint32_t pixelBytes, uint32_t offset);
+
+    uint32_t    m_threshold;        ///< threshold in parts per thousand
+    bool        m_hasReference;     ///< true if a reference frame has been seen
+    size_t      m_refBytes;         ///< compressed size of the reference frame
+    uint32_t    m_refHash;          ///< hash of sampled bytes of the reference frame
+    bool        m_hasPending;       ///< true if the last changed frame can be committed
+    size_t      m_pendingBytes;     ///< compressed size of the last changed frame
+    uint32_t    m_pendingHash;      ///< hash of sampled bytes of the last changed frame
+    std::vector<uint8_t> m_refSamples;  ///< luma samples of the reference frame
+    std::vector<uint8_t> m_samples;     ///< luma samples of the last scored frame
+};
+
+#endif
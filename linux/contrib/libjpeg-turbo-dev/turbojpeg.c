@@ -1499,9 +1499,11 @@ DLLEXPORT int DLLCALL tjDecompress2(tjhandle handle,
 	}
 	#endif
 
-	if((row_pointer=(JSAMPROW *)malloc(sizeof(JSAMPROW)
-		*dinfo->output_height))==NULL)
-		_throw("tjDecompress2(): Memory allocation failure");
+	/* openpnp-capture: the row pointers come from the image pool, which
+	   jpeg_finish_decompress() and jpeg_abort_decompress() release, so
+	   decoding a frame does not call malloc() */
+	row_pointer=(JSAMPROW *)(*dinfo->mem->alloc_small)((j_common_ptr)dinfo,
+		JPOOL_IMAGE, sizeof(JSAMPROW)*dinfo->output_height);
 	if(setjmp(this->jerr.setjmp_buffer))
 	{
 		/* If we get here, the JPEG code has signaled an error. */
@@ -1530,7 +1532,6 @@ DLLEXPORT int DLLCALL tjDecompress2(tjhandle handle,
 	#ifndef JCS_EXTENSIONS
 	if(rgbBuf) free(rgbBuf);
 	#endif
-	if(row_pointer) free(row_pointer);
 	if(this->jerr.warning) retval=-1;
 	this->jerr.stopOnWarning=FALSE;
 	return retval;
@@ -0,0 +1,135 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Linux platform code, conversion stage of the capture thread
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#include "../common/logging.h"
+#include "conversionstage.h"
+
+ConversionStage::ConversionStage() :
+    m_thread(nullptr),
+    m_quit(false),
+    m_pending(0),
+    m_queueDepth(0)
+{
+}
+
+ConversionStage::~ConversionStage()
+{
+    stop();
+}
+
+void ConversionStage::start(convertFunction convert, uint32_t nBuffers)
+{
+    stop();
+
+    m_convert = convert;
+    m_quit = false;
+    m_pending = 0;
+    m_queueDepth = 0;
+    m_converted.reset(nBuffers);
+    m_thread = new std::thread(&ConversionStage::threadFunction, this);
+}
+
+void ConversionStage::stop()
+{
+    if (m_thread == nullptr)
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_frameReady.notify_one();
+    m_thread->join();
+    delete m_thread;
+    m_thread = nullptr;
+    m_pending = 0;
+    m_queueDepth = 0;
+}
+
+int32_t ConversionStage::submit(uint32_t index, uint32_t bytes)
+{
+    // count the buffer before it can be taken, so
+    // the depth never drops below zero.
+    m_queueDepth++;
+    uint64_t previous = m_pending.exchange((static_cast<uint64_t>(index + 1) << 32) | bytes);
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+    }
+    m_frameReady.notify_one();
+
+    if (previous == 0)
+    {
+        return -1;
+    }
+
+    m_queueDepth--;
+    return static_cast<int32_t>((previous >> 32) - 1);
+}
+
+void ConversionStage::waitForConverted(uint32_t timeoutMillis)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_bufferConverted.wait_for(lock, std::chrono::milliseconds(timeoutMillis), 
+        [this]{ return m_converted.size() != 0; });
+}
+
+void ConversionStage::threadFunction()
+{
+    LOG(LOG_DEBUG, "conversion thread started\n");
+
+    while(true)
+    {
+        uint64_t pending = m_pending.exchange(0);
+        if (pending == 0)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_frameReady.wait(lock, [this]{ return m_quit || (m_pending != 0); });
+            if (m_quit)
+            {
+                break;
+            }
+            continue;
+        }
+        m_queueDepth--;
+
+        uint32_t index = static_cast<uint32_t>((pending >> 32) - 1);
+        m_convert(index, static_cast<uint32_t>(pending & 0xFFFFFFFF));
+
+        // the queue holds every buffer of the stream, so it cannot be full
+        m_converted.push(index);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+        }
+        m_bufferConverted.notify_one();
+    }
+
+    LOG(LOG_DEBUG, "conversion thread exited\n");
+}
@@ -0,0 +1,102 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Linux platform code, conversion stage of the capture thread
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#ifndef linux_conversionstage_h
+#define linux_conversionstage_h
+
+#include <stdint.h>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include "spscqueue.h"
+
+/** Converts the frames dequeued by the capture thread on a
+    thread of its own, so the capture thread can give buffers
+    back to the driver while a slow frame is being decoded.
+
+    The capture thread hands over a buffer with submit. Only the
+    newest buffer waits for conversion: a buffer that is still 
+    waiting when the next one arrives is handed back at once and
+    its frame dropped, as the frame would be outdated anyway. 
+    Converted buffers return to the capture thread through a
+    lock-free queue, so at most two buffers are kept from the
+    driver at any time. The capture thread does all ioctls.
+*/
+class ConversionStage
+{
+public:
+    /** the conversion function, called with the buffer index and the number of bytes used */
+    typedef std::function<void(uint32_t index, uint32_t bytes)> convertFunction;
+
+    ConversionStage();
+    ~ConversionStage();
+
+    /** start the conversion thread for a stream with nBuffers driver buffers */
+    void start(convertFunction convert, uint32_t nBuffers);
+
+    /** stop the conversion thread, after the frame being converted */
+    void stop();
+
+    /** hand a dequeued buffer to the conversion thread, called by the
+        capture thread. Returns the index of a buffer that was still
+        waiting and must be re-queued without conversion, or -1. */
+    int32_t submit(uint32_t index, uint32_t bytes);
+
+    /** get a converted buffer to re-queue, called by the capture thread.
+        Returns false if no buffer has been converted. */
+    bool popConverted(uint32_t &index)
+    {
+        return m_converted.pop(index);
+    }
+
+    /** wait until a buffer has been converted or the timeout expires */
+    void waitForConverted(uint32_t timeoutMillis);
+
+    /** returns the number of buffers waiting for conversion */
+    uint32_t getQueueDepth() const
+    {
+        return m_queueDepth.load(std::memory_order_relaxed);
+    }
+
+protected:
+    void threadFunction();
+
+    convertFunction         m_convert;
+    std::thread*            m_thread;
+    std::atomic<bool>       m_quit;
+    std::atomic<uint64_t>   m_pending;      ///< (index+1) << 32 | bytes of the waiting buffer, 0 if none
+    std::atomic<uint32_t>   m_queueDepth;   ///< buffers waiting for conversion
+    SPSCQueue<uint32_t>     m_converted;    ///< converted buffers, consumed by the capture thread
+    std::mutex              m_mutex;        ///< only used to sleep on the condition variables
+    std::condition_variable m_frameReady;
+    std::condition_variable m_bufferConverted;
+};
+
+#endif
@@ -0,0 +1,234 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Linux platform code
+    A shared pool of decoder threads
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#include "decodepool.h"
+#include "jpegarena.h"
+#include "../common/logging.h"
+#include "../common/alloctracker.h"
+
+#define QUEUE_SIZE 64
+
+/** frames being converted per priority, by all streams */
+static std::atomic<uint32_t> gs_framesInProgress[CAPPRIORITY_BACKGROUND+1];
+
+DecodePool& DecodePool::getInstance()
+{
+    static DecodePool pool;
+    return pool;
+}
+
+DecodePool::DecodePool() :
+    m_queueHead(0),
+    m_queueCount(0),
+    m_quit(false)
+{
+    m_queue.resize(QUEUE_SIZE);
+
+    uint32_t cores = std::thread::hardware_concurrency();
+    uint32_t workers = (cores > 1) ? cores - 1 : 0;
+    for(uint32_t i=0; i<workers; i++)
+    {
+        m_workers.push_back(new std::thread(&DecodePool::workerThread, this));
+    }
+
+    LOG(LOG_DEBUG, "DecodePool created with %d workers\n", workers);
+}
+
+DecodePool::~DecodePool()
+{
+    m_mutex.lock();
+    m_quit = true;
+    m_mutex.unlock();
+    m_workAvailable.notify_all();
+
+    for(uint32_t i=0; i<m_workers.size(); i++)
+    {
+        m_workers[i]->join();
+        delete m_workers[i];
+    }
+}
+
+void DecodePool::beginFrame(uint32_t priority)
+{
+    gs_framesInProgress[priority]++;
+}
+
+void DecodePool::endFrame(uint32_t priority)
+{
+    gs_framesInProgress[priority]--;
+}
+
+bool DecodePool::isBusyAbove(uint32_t priority)
+{
+    for(uint32_t p=0; p<priority; p++)
+    {
+        if (gs_framesInProgress[p] != 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void DecodePool::run(decodeJobFunc func, void *arg, uint32_t count, tjhandle handle,
+    uint32_t priority)
+{
+    batch_t batch;
+    batch.func   = func;
+    batch.arg    = arg;
+    batch.count  = count;
+    batch.next   = 0;
+    batch.done   = 0;
+    batch.active = 0;
+    batch.priority = priority;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    // hand out one queue entry per worker that can help,
+    // the calling thread processes the first job itself.
+    uint32_t helpers = count - 1;
+    if (helpers > m_workers.size())
+    {
+        helpers = m_workers.size();
+    }
+
+    for(uint32_t i=0; (i<helpers) && (m_queueCount < QUEUE_SIZE); i++)
+    {
+        m_queue[(m_queueHead + m_queueCount) % QUEUE_SIZE] = &batch;
+        m_queueCount++;
+    }
+    m_workAvailable.notify_all();
+
+    processBatch(lock, &batch, handle, false);
+
+    // remove entries that no worker has picked up, so
+    // the batch is not referenced after we return.
+    uint32_t kept = 0;
+    for(uint32_t i=0; i<m_queueCount; i++)
+    {
+        batch_t *b = m_queue[(m_queueHead + i) % QUEUE_SIZE];
+        if (b != &batch)
+        {
+            m_queue[(m_queueHead + kept) % QUEUE_SIZE] = b;
+            kept++;
+        }
+    }
+    m_queueCount = kept;
+
+    while((batch.done < batch.count) || (batch.active != 0))
+    {
+        m_batchDone.wait(lock);
+    }
+}
+
+void DecodePool::processBatch(std::unique_lock<std::mutex> &lock, batch_t *batch, tjhandle handle,
+    bool yield)
+{
+    FRAMEPATH_SCOPE;
+    while(batch->next < batch->count)
+    {
+        if (yield && hasQueuedAbove(batch->priority))
+        {
+            // the submitting thread finishes the batch
+            return;
+        }
+
+        uint32_t index = batch->next++;
+        lock.unlock();
+        batch->func(batch->arg, index, handle);
+        lock.lock();
+        batch->done++;
+    }
+}
+
+void DecodePool::workerThread()
+{
+    // the worker's decompressor gets its memory from its own
+    // arena, which outlives it.
+    JpegArena arena;
+    JpegArenaScope arenaScope(arena);
+    tjhandle handle = tjInitDecompress();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while(!m_quit)
+    {
+        if (m_queueCount == 0)
+        {
+            m_workAvailable.wait(lock);
+            continue;
+        }
+
+        batch_t *batch = takeBatch();
+
+        batch->active++;
+        processBatch(lock, batch, handle, true);
+        batch->active--;
+        m_batchDone.notify_all();
+    }
+    lock.unlock();
+
+    tjDestroy(handle);
+}
+
+DecodePool::batch_t* DecodePool::takeBatch()
+{
+    uint32_t best = 0;
+    for(uint32_t i=1; i<m_queueCount; i++)
+    {
+        if (m_queue[(m_queueHead + i) % QUEUE_SIZE]->priority <
+            m_queue[(m_queueHead + best) % QUEUE_SIZE]->priority)
+        {
+            best = i;
+        }
+    }
+
+    batch_t *batch = m_queue[(m_queueHead + best) % QUEUE_SIZE];
+
+    // close the gap, keeping the order of the other batches
+    for(uint32_t i=best; i>0; i--)
+    {
+        m_queue[(m_queueHead + i) % QUEUE_SIZE] = m_queue[(m_queueHead + i - 1) % QUEUE_SIZE];
+    }
+    m_queueHead = (m_queueHead + 1) % QUEUE_SIZE;
+    m_queueCount--;
+
+    return batch;
+}
+
+bool DecodePool::hasQueuedAbove(uint32_t priority) const
+{
+    for(uint32_t i=0; i<m_queueCount; i++)
+    {
+        if (m_queue[(m_queueHead + i) % QUEUE_SIZE]->priority < priority)
+        {
+            return true;
+        }
+    }
+    return false;
+}
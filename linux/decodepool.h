@@ -0,0 +1,133 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Linux platform code
+    A shared pool of decoder threads
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#ifndef linux_decodepool_h
+#define linux_decodepool_h
+
+#include <stdint.h>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <turbojpeg.h>
+#include "openpnp-capture.h"
+
+/** job function that processes part 'index' of a batch. 
+    'handle' is a decompressor owned by the calling thread. */
+typedef void (*decodeJobFunc)(void *arg, uint32_t index, tjhandle handle);
+
+/** The DecodePool is a process-wide pool of threads that
+    helps decoding a single frame on several cores.
+
+    Each worker owns its own libjpeg-turbo decompressor.
+    The pool is created on the first frame that can be decoded
+    in parallel, i.e. an MJPEG frame with restart markers, and has one worker
+    less than the number of cores, because the thread that
+    submits a batch takes part in processing it.
+
+    Each batch has the priority (CAPPRIORITY_xxx) of its stream.
+    Workers take the highest-priority batch first and leave a
+    batch between jobs when a higher-priority batch is queued;
+    the submitting thread always finishes its own batch.
+*/
+class DecodePool
+{
+public:
+    /** Return the process-wide decode pool */
+    static DecodePool& getInstance();
+
+    /** Return the number of worker threads */
+    uint32_t getWorkerCount() const
+    {
+        return m_workers.size();
+    }
+
+    /** Process jobs 0 .. count-1 of a batch on the pool and the calling
+        thread. The calling thread uses 'handle' as its decompressor.
+        Returns when all jobs have been processed. */
+    void run(decodeJobFunc func, void *arg, uint32_t count, tjhandle handle,
+        uint32_t priority = CAPPRIORITY_NORMAL);
+
+    /** Mark the start of the conversion of a frame with the given priority.
+        The frame counts are kept outside the pool, so streams that
+        never decode in parallel do not create it. */
+    static void beginFrame(uint32_t priority);
+
+    /** Mark the end of the conversion of a frame with the given priority */
+    static void endFrame(uint32_t priority);
+
+    /** Returns true if frames with a higher priority than 'priority'
+        are being converted. */
+    static bool isBusyAbove(uint32_t priority);
+
+protected:
+    DecodePool();
+    ~DecodePool();
+
+    struct batch_t
+    {
+        decodeJobFunc   func;       ///< job function
+        void*           arg;        ///< job function argument
+        uint32_t        count;      ///< number of jobs in the batch
+        uint32_t        next;       ///< next job to be processed
+        uint32_t        done;       ///< number of processed jobs
+        uint32_t        active;     ///< number of workers working on the batch
+        uint32_t        priority;   ///< CAPPRIORITY_xxx of the batch
+    };
+
+    /** worker thread function */
+    void workerThread(); 
+
+    /** process jobs of a batch until none are left. If yield is true,
+        return early when a higher-priority batch is queued.
+        m_mutex must be held by the caller. */
+    void processBatch(std::unique_lock<std::mutex> &lock, batch_t *batch, tjhandle handle,
+        bool yield);
+
+    /** remove the highest-priority batch from the queue, the
+        oldest one if there are several. m_mutex must be held
+        and the queue must not be empty. */
+    batch_t* takeBatch();
+
+    /** returns true if a batch with a higher priority than 
+        'priority' is queued. m_mutex must be held. */
+    bool hasQueuedAbove(uint32_t priority) const;
+
+    std::mutex                  m_mutex;        ///< protects the queue and the batches
+    std::condition_variable     m_workAvailable;///< signalled when batches are queued
+    std::condition_variable     m_batchDone;    ///< signalled when jobs are done
+    std::vector<batch_t*>       m_queue;        ///< fixed size ring of queued batches
+    uint32_t                    m_queueHead;    ///< index of the oldest queued batch
+    uint32_t                    m_queueCount;   ///< number of queued batches
+    std::vector<std::thread*>   m_workers;      ///< worker threads
+    bool                        m_quit;         ///< if true, the workers exit
+};
+
+#endif
@@ -0,0 +1,86 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Linux platform code
+    Device I/O interface that routes the V4L2 system calls
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include "deviceio.h"
+
+int SystemDeviceIO::open(const char *path, int flags)
+{
+    return ::open(path, flags);
+}
+
+int SystemDeviceIO::close(int fd)
+{
+    return ::close(fd);
+}
+
+int SystemDeviceIO::ioctl(int fd, unsigned long request, void *arg)
+{
+    return ::ioctl(fd, request, arg);
+}
+
+void* SystemDeviceIO::mmap(size_t length, int prot, int flags, int fd, off_t offset)
+{
+    return ::mmap(NULL, length, prot, flags, fd, offset);
+}
+
+int SystemDeviceIO::munmap(void *addr, size_t length)
+{
+    return ::munmap(addr, length);
+}
+
+ssize_t SystemDeviceIO::read(int fd, void *buffer, size_t bytes)
+{
+    return ::read(fd, buffer, bytes);
+}
+
+int SystemDeviceIO::select(int fd, timeval *timeout)
+{
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(fd, &fds);
+    return ::select(fd + 1, &fds, NULL, NULL, timeout);
+}
+
+int xioctl(DeviceIO *io, int fd, unsigned long request, void *arg)
+{
+    int r;
+
+    do 
+    {
+        r = io->ioctl(fd, request, arg);
+    } while ((r == -1) && (errno == EINTR));
+
+    return r;
+}
@@ -0,0 +1,82 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Linux platform code
+    Device I/O interface that routes the V4L2 system calls
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#ifndef linux_deviceio_h
+#define linux_deviceio_h
+
+#include <stdint.h>
+#include <stdlib.h>     // size_t
+#include <sys/types.h>  // off_t, ssize_t
+#include <sys/time.h>   // timeval
+
+/** The DeviceIO interface routes the system calls that the
+    Linux platform code makes to V4L2 devices. SystemDeviceIO 
+    passes them on to the kernel, FakeDeviceIO emulates 
+    V4L2 devices in-process so the enumeration, the capture 
+    loop and the control code can run without cameras.
+
+    All functions follow the semantics of the corresponding
+    system calls, including returning -1 and setting errno 
+    on failure.
+*/
+class DeviceIO
+{
+public:
+    virtual ~DeviceIO() {}
+
+    virtual int open(const char *path, int flags) = 0;
+    virtual int close(int fd) = 0;
+    virtual int ioctl(int fd, unsigned long request, void *arg) = 0;
+    virtual void* mmap(size_t length, int prot, int flags, int fd, off_t offset) = 0;
+    virtual int munmap(void *addr, size_t length) = 0;
+    virtual ssize_t read(int fd, void *buffer, size_t bytes) = 0;
+
+    /** wait until the device can be read. Returns 1 when
+        the device is readable, 0 on a timeout and -1 on error,
+        like select() for a single file descriptor. */
+    virtual int select(int fd, timeval *timeout) = 0;
+};
+
+/** DeviceIO implementation that calls the kernel */
+class SystemDeviceIO : public DeviceIO
+{
+public:
+    virtual int open(const char *path, int flags) override;
+    virtual int close(int fd) override;
+    virtual int ioctl(int fd, unsigned long request, void *arg) override;
+    virtual void* mmap(size_t length, int prot, int flags, int fd, off_t offset) override;
+    virtual int munmap(void *addr, size_t length) override;
+    virtual ssize_t read(int fd, void *buffer, size_t bytes) override;
+    virtual int select(int fd, timeval *timeout) override;
+};
+
+/** ioctl that retries when interrupted by a signal */
+int xioctl(DeviceIO *io, int fd, unsigned long request, void *arg);
+
+#endif
@@ -0,0 +1,1050 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Linux platform code
+    In-process emulation of V4L2 capture devices
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <turbojpeg.h>
+#include "../common/logging.h"
+#include "fakedeviceio.h"
+#include "uvcmetadata.h"
+
+#define CLEAR(x) memset(&(x), 0, sizeof(x))
+
+// mmap offsets handed out by VIDIOC_QUERYBUF are 
+// buffer index * FAKE_OFFSET_STEP
+#define FAKE_OFFSET_STEP 0x100000
+
+// file descriptors of fake devices start here so they
+// are never mistaken for real ones
+#define FAKE_FIRST_FD 0x4000
+
+// size of the buffers of the metadata node and 
+// the number of frames it keeps for the reader
+#define FAKE_META_BUFFER_SIZE 1024
+#define FAKE_META_FRAMES      32
+
+static uint64_t getMonotonicMicros()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec)*1000000 + ts.tv_nsec/1000;
+}
+
+/** returns the simulated 48 MHz device clock at host time t,
+    which runs 50 ppm fast and has an arbitrary offset */
+static uint32_t fakeDeviceClock(uint64_t micros)
+{
+    return static_cast<uint32_t>(static_cast<uint64_t>(micros*48.0024) + 0x9E3779B9u);
+}
+
+static void sleepMicros(uint64_t micros)
+{
+    std::this_thread::sleep_for(std::chrono::microseconds(micros));
+}
+
+FakeDeviceConfig::FakeDeviceConfig() :
+    name("Fake Camera"),
+    busInfo("fake:0"),
+    realtime(true),
+    maxBuffers(32),
+    dqbufErrorFrame(0),
+    dqbufErrno(EIO),
+    stallFrame(0),
+    failRequest(0),
+    failErrno(EIO),
+    metadata(false),
+    exposureLatency(20000),
+    focusPeak(-1),
+    exposureResponse(false)
+{
+}
+
+FakeDeviceIO::FakeDeviceIO() :
+    m_nextFd(FAKE_FIRST_FD)
+{
+}
+
+FakeDeviceIO::~FakeDeviceIO()
+{
+}
+
+uint32_t FakeDeviceIO::addDevice(const FakeDeviceConfig &config)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    fakeDevice dev;
+    dev.config = config;
+    dev.metaStreaming = false;
+    for(auto const &ctrl : config.controls)
+    {
+        dev.values[ctrl.id] = ctrl.defaultValue;
+    }
+    m_devices.push_back(dev);
+    return m_devices.size()-1;
+}
+
+uint32_t FakeDeviceIO::addDefaultDevice(bool realtime)
+{
+    char str[64];
+
+    FakeDeviceConfig config;
+    snprintf(str, sizeof(str), "Fake Camera %d", static_cast<int>(m_devices.size()));
+    config.name = str;
+    snprintf(str, sizeof(str), "fake:%d", static_cast<int>(m_devices.size()));
+    config.busInfo = str;
+    config.realtime = realtime;
+    config.metadata = true;
+    config.focusPeak = 125;
+    config.exposureResponse = true;
+
+    config.formats.push_back({V4L2_PIX_FMT_YUYV, 640, 480, {30, 15}, 0, 0});
+    config.formats.push_back({V4L2_PIX_FMT_YUYV, 320, 240, {30, 15}, 0, 0});
+    config.formats.push_back({V4L2_PIX_FMT_MJPEG, 1280, 720, {30}, 0, 0});
+    config.formats.push_back({V4L2_PIX_FMT_MJPEG, 640, 480, {30}, 0, 0});
+    config.formats.push_back({V4L2_PIX_FMT_RGB24, 320, 240, {30}, 0, 0});
+
+    config.controls.push_back({V4L2_CID_EXPOSURE_ABSOLUTE, 3, 2047, 1, 250});
+    config.controls.push_back({V4L2_CID_EXPOSURE_AUTO, 0, 3, 1, 3});
+    config.controls.push_back({V4L2_CID_FOCUS_ABSOLUTE, 0, 250, 5, 0});
+    config.controls.push_back({V4L2_CID_FOCUS_AUTO, 0, 1, 1, 1});
+    config.controls.push_back({V4L2_CID_ZOOM_ABSOLUTE, 100, 500, 1, 100});
+    config.controls.push_back({V4L2_CID_WHITE_BALANCE_TEMPERATURE, 2000, 6500, 1, 4000});
+    config.controls.push_back({V4L2_CID_AUTO_WHITE_BALANCE, 0, 1, 1, 1});
+    config.controls.push_back({V4L2_CID_GAIN, 0, 255, 1, 0});
+    config.controls.push_back({V4L2_CID_AUTOGAIN, 0, 1, 1, 1});
+    config.controls.push_back({V4L2_CID_BRIGHTNESS, 0, 255, 1, 128});
+    config.controls.push_back({V4L2_CID_CONTRAST, 0, 255, 1, 128});
+    config.controls.push_back({V4L2_CID_SATURATION, 0, 255, 1, 128});
+    config.controls.push_back({V4L2_CID_GAMMA, 72, 500, 1, 100});
+    config.controls.push_back({V4L2_CID_HUE, -180, 180, 1, 0});
+    config.controls.push_back({V4L2_CID_SHARPNESS, 0, 255, 1, 128});
+    config.controls.push_back({V4L2_CID_BACKLIGHT_COMPENSATION, 0, 1, 1, 0});
+    config.controls.push_back({V4L2_CID_POWER_LINE_FREQUENCY, 0, 2, 1, 2});
+
+    return addDevice(config);
+}
+
+int FakeDeviceIO::open(const char *path, int)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    uint32_t index = 0;
+    char dummy;
+    if ((path == nullptr) || (sscanf(path, "/dev/video%u%c", &index, &dummy) != 1) || 
+        (index >= 2*m_devices.size()))
+    {
+        errno = ENOENT;
+        return -1;
+    }
+
+    // the nodes after the video nodes are metadata nodes
+    bool meta = (index >= m_devices.size());
+    if (meta)
+    {
+        index -= m_devices.size();
+        if (!m_devices[index].config.metadata)
+        {
+            errno = ENOENT;
+            return -1;
+        }
+    }
+
+    fakeFile file;
+    file.device = index;
+    file.meta = meta;
+    file.fps = 0;
+    file.streaming = false;
+    file.sequence = 0;
+    file.nextFrameTime = 0;
+    CLEAR(file.fmt);
+    file.fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+    if (meta)
+    {
+        file.fmt.type = V4L2_BUF_TYPE_META_CAPTURE;
+        file.fmt.fmt.meta.dataformat = V4L2_META_FMT_UVC;
+        file.fmt.fmt.meta.buffersize = FAKE_META_BUFFER_SIZE;
+        int fd = m_nextFd++;
+        m_files[fd] = file;
+        return fd;
+    }
+
+    // start in the first format, like a driver
+    // that was just loaded
+    const FakeDeviceConfig &config = m_devices[index].config;
+    if (config.formats.size() > 0)
+    {
+        v4l2_pix_format pix;
+        CLEAR(pix);
+        pix.pixelformat = config.formats[0].fourcc;
+        pix.width = config.formats[0].width;
+        pix.height = config.formats[0].height;
+        setFormat(file, pix);
+    }
+
+    int fd = m_nextFd++;
+    m_files[fd] = file;
+    return fd;
+}
+
+int FakeDeviceIO::close(int fd)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto iter = m_files.find(fd);
+    if (iter == m_files.end())
+    {
+        errno = EBADF;
+        return -1;
+    }
+
+    if (iter->second.meta && iter->second.streaming)
+    {
+        m_devices[iter->second.device].metaStreaming = false;
+    }
+    m_files.erase(iter);
+    return 0;
+}
+
+int FakeDeviceIO::ioctl(int fd, unsigned long request, void *arg)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto iter = m_files.find(fd);
+    if (iter == m_files.end())
+    {
+        errno = EBADF;
+        return -1;
+    }
+
+    const FakeDeviceConfig &config = m_devices[iter->second.device].config;
+    if ((config.failRequest != 0) && (config.failRequest == request))
+    {
+        errno = config.failErrno;
+        return -1;
+    }
+
+    if (iter->second.meta)
+    {
+        return doMetaIoctl(iter->second, request, arg);
+    }
+    return doIoctl(iter->second, request, arg);
+}
+
+void* FakeDeviceIO::mmap(size_t length, int, int, int fd, off_t offset)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto iter = m_files.find(fd);
+    if (iter == m_files.end())
+    {
+        errno = EBADF;
+        return MAP_FAILED;
+    }
+
+    fakeFile &file = iter->second;
+    uint32_t index = offset / FAKE_OFFSET_STEP;
+    if ((index >= file.buffers.size()) || (length > file.buffers[index].size()))
+    {
+        errno = EINVAL;
+        return MAP_FAILED;
+    }
+
+    return &file.buffers[index][0];
+}
+
+int FakeDeviceIO::munmap(void *, size_t)
+{
+    // the buffers are owned by the file and
+    // freed by VIDIOC_REQBUFS or close()
+    return 0;
+}
+
+ssize_t FakeDeviceIO::read(int fd, void *buffer, size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto iter = m_files.find(fd);
+    if (iter == m_files.end())
+    {
+        errno = EBADF;
+        return -1;
+    }
+
+    fakeFile &file = iter->second;
+    uint32_t bytesUsed = 0;
+    fillFrame(file, static_cast<uint8_t*>(buffer), bytes, file.sequence++, &bytesUsed);
+    return bytesUsed;
+}
+
+int FakeDeviceIO::select(int fd, timeval *timeout)
+{
+    uint64_t wait = 0;
+    uint64_t timeoutMicros = (timeout != nullptr) ? 
+        static_cast<uint64_t>(timeout->tv_sec)*1000000 + timeout->tv_usec : UINT64_MAX;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto iter = m_files.find(fd);
+        if (iter == m_files.end())
+        {
+            errno = EBADF;
+            return -1;
+        }
+
+        fakeFile &file = iter->second;
+        const FakeDeviceConfig &config = m_devices[file.device].config;
+        if (!file.streaming)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        if (file.meta)
+        {
+            // metadata is ready as soon as its video frame is
+            return m_devices[file.device].metaFrames.empty() ? 0 : 1;
+        }
+
+        if ((config.stallFrame != 0) && (file.sequence+1 >= config.stallFrame))
+        {
+            wait = UINT64_MAX;
+        }
+        else if (config.realtime)
+        {
+            uint64_t now = getMonotonicMicros();
+            wait = (file.nextFrameTime > now) ? file.nextFrameTime - now : 0;
+        }
+    }
+
+    // sleep without holding the lock, so
+    // controls can be changed meanwhile
+    if (wait > timeoutMicros)
+    {
+        sleepMicros(timeoutMicros);
+        return 0;
+    }
+
+    if (wait > 0)
+    {
+        sleepMicros(wait);
+    }
+    return 1;
+}
+
+uint64_t FakeDeviceIO::frameInterval(const fakeFile &file) const
+{
+    return (file.fps != 0) ? 1000000 / file.fps : 33333;
+}
+
+bool FakeDeviceIO::setFormat(fakeFile &file, v4l2_pix_format &pix)
+{
+    const FakeDeviceConfig &config = m_devices[file.device].config;
+    if (config.formats.size() == 0)
+    {
+        return false;
+    }
+
+    // choose the closest frame size of the requested
+    // pixel format, or the first format if the pixel
+    // format is not supported.
+    const FakeFormat *best = nullptr;
+    uint32_t bestDistance = UINT32_MAX;
+    for(auto const &f : config.formats)
+    {
+        if (f.fourcc != pix.pixelformat)
+        {
+            continue;
+        }
+
+        uint32_t distance = abs(static_cast<int32_t>(f.width - pix.width)) + 
+            abs(static_cast<int32_t>(f.height - pix.height));
+        if (distance < bestDistance)
+        {
+            best = &f;
+            bestDistance = distance;
+        }
+    }
+
+    if (best == nullptr)
+    {
+        best = &config.formats[0];
+    }
+
+    CLEAR(pix);
+    pix.width = best->width;
+    pix.height = best->height;
+    pix.pixelformat = best->fourcc;
+    pix.field = V4L2_FIELD_NONE;
+    pix.colorspace = V4L2_COLORSPACE_SRGB;
+    switch(best->fourcc)
+    {
+    case V4L2_PIX_FMT_YUYV:
+        pix.bytesperline = pix.width*2;
+        pix.sizeimage = pix.bytesperline*pix.height;
+        break;
+    case V4L2_PIX_FMT_RGB24:
+        pix.bytesperline = pix.width*3;
+        pix.sizeimage = pix.bytesperline*pix.height;
+        break;
+    default:
+        pix.bytesperline = 0;
+        pix.sizeimage = pix.width*pix.height*2;
+        break;
+    }
+
+    if (best->bytesPerLine != 0)
+    {
+        pix.bytesperline = best->bytesPerLine;
+    }
+    if (best->sizeImage != 0)
+    {
+        pix.sizeimage = best->sizeImage;
+    }
+
+    file.fmt.fmt.pix = pix;
+    file.fps = (best->fps.size() > 0) ? best->fps[0] : 30;
+    return true;
+}
+
+void FakeDeviceIO::fillFrame(fakeFile &file, uint8_t *dst, size_t bytes, 
+    uint32_t sequence, uint32_t *bytesUsed)
+{
+    const v4l2_pix_format &pix = file.fmt.fmt.pix;
+    const uint32_t shift = sequence*4;
+
+    // contrast of the 4x4 checker texture at the current focus
+    int32_t contrast = 0;
+    fakeDevice &dev = m_devices[file.device];
+    if (dev.config.focusPeak >= 0)
+    {
+        float defocus = (dev.values[V4L2_CID_FOCUS_ABSOLUTE] - dev.config.focusPeak) / 30.0f;
+        contrast = static_cast<int32_t>(40.0f / (1.0f + defocus*defocus));
+    }
+
+    // brightness in 1/256 relative to the default exposure without gain
+    int32_t brightness = 256;
+    if (dev.config.exposureResponse)
+    {
+        brightness = dev.values[V4L2_CID_EXPOSURE_ABSOLUTE] * (64 + dev.values[V4L2_CID_GAIN]) * 256 / (250*64);
+    }
+
+    switch(pix.pixelformat)
+    {
+    case V4L2_PIX_FMT_YUYV:
+        // diagonal luma ramp moving to the left
+        *bytesUsed = std::min<size_t>(bytes, pix.sizeimage);
+        for(uint32_t y=0; y<pix.height; y++)
+        {
+            uint8_t *line = dst + y*pix.bytesperline;
+            for(uint32_t x=0; x<pix.width; x++)
+            {
+                if ((line + x*2 + 2) > (dst + *bytesUsed))
+                {
+                    return;
+                }
+                int32_t texture = (((x ^ y) >> 2) & 1) ? contrast : -contrast;
+                int32_t luma = ((static_cast<int32_t>((x + y + shift) & 0xFF) + texture) * brightness) >> 8;
+                line[x*2]   = static_cast<uint8_t>(std::min(255, std::max(0, luma)));
+                line[x*2+1] = 128;
+            }
+        }
+        break;
+    case V4L2_PIX_FMT_RGB24:
+        *bytesUsed = std::min<size_t>(bytes, pix.sizeimage);
+        for(uint32_t y=0; y<pix.height; y++)
+        {
+            uint8_t *line = dst + y*pix.bytesperline;
+            for(uint32_t x=0; x<pix.width; x++)
+            {
+                if ((line + x*3 + 3) > (dst + *bytesUsed))
+                {
+                    return;
+                }
+                int32_t texture = (((x ^ y) >> 2) & 1) ? contrast : -contrast;
+                int32_t red   = (static_cast<int32_t>((x + shift) & 0xFF) * brightness) >> 8;
+                int32_t green = ((static_cast<int32_t>(y & 0xFF) + texture) * brightness) >> 8;
+                line[x*3]   = static_cast<uint8_t>(std::min(255, red));
+                line[x*3+1] = static_cast<uint8_t>(std::min(255, std::max(0, green)));
+                line[x*3+2] = static_cast<uint8_t>(std::min(255, (128 * brightness) >> 8));
+            }
+        }
+        break;
+    case V4L2_PIX_FMT_MJPEG:
+        if (file.jpeg.size() == 0)
+        {
+            // encode a single frame, re-encoding every
+            // frame would dominate capture benchmarks.
+            std::vector<uint8_t> rgb(pix.width*pix.height*3);
+            for(uint32_t y=0; y<pix.height; y++)
+            {
+                for(uint32_t x=0; x<pix.width; x++)
+                {
+                    uint8_t *p = &rgb[(y*pix.width + x)*3];
+                    p[0] = static_cast<uint8_t>(x);
+                    p[1] = static_cast<uint8_t>(y);
+                    p[2] = 128;
+                }
+            }
+
+            tjhandle handle = tjInitCompress();
+            unsigned char *jpegBuf = nullptr;
+            unsigned long jpegSize = 0;
+            if (tjCompress2(handle, &rgb[0], pix.width, 0, pix.height, TJPF_RGB,
+                &jpegBuf, &jpegSize, TJSAMP_422, 80, 0) == 0)
+            {
+                file.jpeg.assign(jpegBuf, jpegBuf + jpegSize);
+            }
+            else
+            {
+                LOG(LOG_ERR, "FakeDeviceIO: tjCompress2 failed: %s\n", tjGetErrorStr());
+            }
+            tjFree(jpegBuf);
+            tjDestroy(handle);
+        }
+        *bytesUsed = std::min<size_t>(bytes, file.jpeg.size());
+        if (*bytesUsed > 0)
+        {
+            memcpy(dst, &file.jpeg[0], *bytesUsed);
+        }
+        break;
+    default:
+        *bytesUsed = std::min<size_t>(bytes, pix.sizeimage);
+        memset(dst, 0, *bytesUsed);
+        break;
+    }
+}
+
+int FakeDeviceIO::doIoctl(fakeFile &file, unsigned long request, void *arg)
+{
+    fakeDevice &dev = m_devices[file.device];
+    const FakeDeviceConfig &config = dev.config;
+
+    switch(request)
+    {
+    case VIDIOC_QUERYCAP:
+        {
+            v4l2_capability *cap = static_cast<v4l2_capability*>(arg);
+            CLEAR(*cap);
+            strncpy(reinterpret_cast<char*>(cap->driver), "fake", sizeof(cap->driver)-1);
+            strncpy(reinterpret_cast<char*>(cap->card), config.name.c_str(), sizeof(cap->card)-1);
+            strncpy(reinterpret_cast<char*>(cap->bus_info), config.busInfo.c_str(), sizeof(cap->bus_info)-1);
+            cap->device_caps  = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING | V4L2_CAP_READWRITE;
+            cap->capabilities = cap->device_caps | V4L2_CAP_DEVICE_CAPS;
+            return 0;
+        }
+    case VIDIOC_ENUM_FMT:
+        {
+            // each pixel format is listed once, 
+            // in the order of first appearance
+            v4l2_fmtdesc *desc = static_cast<v4l2_fmtdesc*>(arg);
+            std::vector<uint32_t> fourccs;
+            for(auto const &f : config.formats)
+            {
+                if (std::find(fourccs.begin(), fourccs.end(), f.fourcc) == fourccs.end())
+                {
+                    fourccs.push_back(f.fourcc);
+                }
+            }
+            if (desc->index >= fourccs.size())
+            {
+                errno = EINVAL;
+                return -1;
+            }
+            uint32_t index = desc->index;
+            uint32_t type = desc->type;
+            CLEAR(*desc);
+            desc->index = index;
+            desc->type = type;
+            desc->pixelformat = fourccs[index];
+            desc->flags = (fourccs[index] == V4L2_PIX_FMT_MJPEG) ? V4L2_FMT_FLAG_COMPRESSED : 0;
+            return 0;
+        }
+    case VIDIOC_ENUM_FRAMESIZES:
+        {
+            v4l2_frmsizeenum *frmsize = static_cast<v4l2_frmsizeenum*>(arg);
+            uint32_t n = 0;
+            for(auto const &f : config.formats)
+            {
+                if ((f.fourcc == frmsize->pixel_format) && (n++ == frmsize->index))
+                {
+                    frmsize->type = V4L2_FRMSIZE_TYPE_DISCRETE;
+                    frmsize->discrete.width = f.width;
+                    frmsize->discrete.height = f.height;
+                    return 0;
+                }
+            }
+            errno = EINVAL;
+            return -1;
+        }
+    case VIDIOC_ENUM_FRAMEINTERVALS:
+        {
+            v4l2_frmivalenum *ival = static_cast<v4l2_frmivalenum*>(arg);
+            for(auto const &f : config.formats)
+            {
+                if ((f.fourcc == ival->pixel_format) && (f.width == ival->width) &&
+                    (f.height == ival->height) && (ival->index < f.fps.size()))
+                {
+                    ival->type = V4L2_FRMIVAL_TYPE_DISCRETE;
+                    ival->discrete.numerator = 1;
+                    ival->discrete.denominator = f.fps[ival->index];
+                    return 0;
+                }
+            }
+            errno = EINVAL;
+            return -1;
+        }
+    case VIDIOC_G_FMT:
+        {
+            v4l2_format *fmt = static_cast<v4l2_format*>(arg);
+            if (fmt->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+            {
+                errno = EINVAL;
+                return -1;
+            }
+            *fmt = file.fmt;
+            return 0;
+        }
+    case VIDIOC_S_FMT:
+    case VIDIOC_TRY_FMT:
+        {
+            v4l2_format *fmt = static_cast<v4l2_format*>(arg);
+            if (fmt->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+            {
+                errno = EINVAL;
+                return -1;
+            }
+            if ((request == VIDIOC_S_FMT) && ((file.streaming) || (file.buffers.size() != 0)))
+            {
+                errno = EBUSY;
+                return -1;
+            }
+            fakeFile tmp = file;
+            setFormat((request == VIDIOC_S_FMT) ? file : tmp, fmt->fmt.pix);
+            return 0;
+        }
+    case VIDIOC_G_PARM:
+    case VIDIOC_S_PARM:
+        {
+            v4l2_streamparm *parm = static_cast<v4l2_streamparm*>(arg);
+            if (parm->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+            {
+                errno = EINVAL;
+                return -1;
+            }
+
+            if (request == VIDIOC_S_PARM)
+            {
+                // choose the closest supported frame rate
+                const v4l2_fract &tpf = parm->parm.capture.timeperframe;
+                uint32_t want = (tpf.numerator != 0) ? tpf.denominator / tpf.numerator : 0;
+                const v4l2_pix_format &pix = file.fmt.fmt.pix;
+                for(auto const &f : config.formats)
+                {
+                    if ((f.fourcc != pix.pixelformat) || (f.width != pix.width) || (f.height != pix.height))
+                    {
+                        continue;
+                    }
+                    uint32_t bestDistance = UINT32_MAX;
+                    for(auto fps : f.fps)
+                    {
+                        uint32_t distance = abs(static_cast<int32_t>(fps - want));
+                        if (distance < bestDistance)
+                        {
+                            bestDistance = distance;
+                            file.fps = fps;
+                        }
+                    }
+                    break;
+                }
+            }
+
+            CLEAR(parm->parm);
+            parm->parm.capture.capability = V4L2_CAP_TIMEPERFRAME;
+            parm->parm.capture.timeperframe.numerator = 1;
+            parm->parm.capture.timeperframe.denominator = file.fps;
+            return 0;
+        }
+    case VIDIOC_REQBUFS:
+        {
+            v4l2_requestbuffers *req = static_cast<v4l2_requestbuffers*>(arg);
+            if ((req->type != V4L2_BUF_TYPE_VIDEO_CAPTURE) || (req->memory != V4L2_MEMORY_MMAP))
+            {
+                errno = EINVAL;
+                return -1;
+            }
+            if (file.streaming)
+            {
+                errno = EBUSY;
+                return -1;
+            }
+            req->count = std::min(req->count, config.maxBuffers);
+            file.buffers.clear();
+            file.queue.clear();
+            file.buffers.resize(req->count);
+            for(auto &buffer : file.buffers)
+            {
+                buffer.resize(file.fmt.fmt.pix.sizeimage);
+            }
+            return 0;
+        }
+    case VIDIOC_QUERYBUF:
+    case VIDIOC_QBUF:
+        {
+            v4l2_buffer *buf = static_cast<v4l2_buffer*>(arg);
+            if ((buf->type != V4L2_BUF_TYPE_VIDEO_CAPTURE) || (buf->index >= file.buffers.size()))
+            {
+                errno = EINVAL;
+                return -1;
+            }
+
+            bool queued = std::find(file.queue.begin(), file.queue.end(), buf->index) != file.queue.end();
+            if (request == VIDIOC_QBUF)
+            {
+                if (queued)
+                {
+                    errno = EINVAL;
+                    return -1;
+                }
+                file.queue.push_back(buf->index);
+                queued = true;
+            }
+
+            buf->length = file.buffers[buf->index].size();
+            buf->m.offset = buf->index * FAKE_OFFSET_STEP;
+            buf->flags = V4L2_BUF_FLAG_MAPPED | (queued ? V4L2_BUF_FLAG_QUEUED : 0);
+            return 0;
+        }
+    case VIDIOC_DQBUF:
+        {
+            v4l2_buffer *buf = static_cast<v4l2_buffer*>(arg);
+            if ((!file.streaming) || (file.queue.size() == 0))
+            {
+                errno = EINVAL;
+                return -1;
+            }
+
+            const uint64_t now = getMonotonicMicros();
+            if (config.realtime && (now < file.nextFrameTime))
+            {
+                errno = EAGAIN;
+                return -1;
+            }
+
+            const uint32_t frame = file.sequence + 1;
+            if ((config.stallFrame != 0) && (frame >= config.stallFrame))
+            {
+                errno = EAGAIN;
+                return -1;
+            }
+
+            if ((config.dqbufErrorFrame != 0) && (frame >= config.dqbufErrorFrame))
+            {
+                errno = config.dqbufErrno;
+                return -1;
+            }
+
+            uint32_t index = file.queue[0];
+            file.queue.erase(file.queue.begin());
+
+            uint32_t bytesUsed = 0;
+            std::vector<uint8_t> &buffer = file.buffers[index];
+            fillFrame(file, &buffer[0], buffer.size(), file.sequence, &bytesUsed);
+
+            buf->index = index;
+            buf->bytesused = bytesUsed;
+            buf->length = buffer.size();
+            buf->m.offset = index * FAKE_OFFSET_STEP;
+            buf->flags = V4L2_BUF_FLAG_MAPPED | V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+            buf->field = V4L2_FIELD_NONE;
+            buf->sequence = file.sequence++;
+            buf->timestamp.tv_sec = now / 1000000;
+            buf->timestamp.tv_usec = now % 1000000;
+
+            if (dev.metaStreaming)
+            {
+                if (dev.metaFrames.size() >= FAKE_META_FRAMES)
+                {
+                    dev.metaFrames.erase(dev.metaFrames.begin());
+                }
+                dev.metaFrames.push_back({buf->sequence, now});
+            }
+
+            // keep the frame cadence, but don't build up 
+            // a backlog when the reader falls behind.
+            file.nextFrameTime = std::max(file.nextFrameTime + frameInterval(file), now);
+            return 0;
+        }
+    case VIDIOC_STREAMON:
+        if (file.buffers.size() == 0)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+        if (!file.streaming)
+        {
+            file.streaming = true;
+            file.sequence = 0;
+            file.jpeg.clear();
+            file.nextFrameTime = getMonotonicMicros() + frameInterval(file);
+        }
+        return 0;
+    case VIDIOC_STREAMOFF:
+        file.streaming = false;
+        file.queue.clear();
+        return 0;
+    case VIDIOC_QUERYCTRL:
+        {
+            v4l2_queryctrl *qctrl = static_cast<v4l2_queryctrl*>(arg);
+            for(auto const &ctrl : config.controls)
+            {
+                if (ctrl.id == qctrl->id)
+                {
+                    CLEAR(*qctrl);
+                    qctrl->id = ctrl.id;
+                    qctrl->type = ((ctrl.minimum == 0) && (ctrl.maximum == 1)) ? 
+                        V4L2_CTRL_TYPE_BOOLEAN : V4L2_CTRL_TYPE_INTEGER;
+                    qctrl->minimum = ctrl.minimum;
+                    qctrl->maximum = ctrl.maximum;
+                    qctrl->step = ctrl.step;
+                    qctrl->default_value = ctrl.defaultValue;
+                    return 0;
+                }
+            }
+            errno = EINVAL;
+            return -1;
+        }
+    case VIDIOC_G_CTRL:
+    case VIDIOC_S_CTRL:
+        {
+            v4l2_control *vctrl = static_cast<v4l2_control*>(arg);
+            for(auto const &ctrl : config.controls)
+            {
+                if (ctrl.id != vctrl->id)
+                {
+                    continue;
+                }
+
+                if (request == VIDIOC_G_CTRL)
+                {
+                    vctrl->value = dev.values[ctrl.id];
+                    return 0;
+                }
+
+                if ((vctrl->value < ctrl.minimum) || (vctrl->value > ctrl.maximum))
+                {
+                    errno = ERANGE;
+                    return -1;
+                }
+                dev.values[ctrl.id] = vctrl->value;
+                return 0;
+            }
+            errno = EINVAL;
+            return -1;
+        }
+    default:
+        errno = ENOTTY;
+        return -1;
+    }
+}
+
+int FakeDeviceIO::doMetaIoctl(fakeFile &file, unsigned long request, void *arg)
+{
+    fakeDevice &dev = m_devices[file.device];
+    const FakeDeviceConfig &config = dev.config;
+
+    switch(request)
+    {
+    case VIDIOC_QUERYCAP:
+        {
+            v4l2_capability *cap = static_cast<v4l2_capability*>(arg);
+            CLEAR(*cap);
+            strncpy(reinterpret_cast<char*>(cap->driver), "fake", sizeof(cap->driver)-1);
+            strncpy(reinterpret_cast<char*>(cap->card), config.name.c_str(), sizeof(cap->card)-1);
+            strncpy(reinterpret_cast<char*>(cap->bus_info), config.busInfo.c_str(), sizeof(cap->bus_info)-1);
+            cap->device_caps  = V4L2_CAP_META_CAPTURE | V4L2_CAP_STREAMING;
+            cap->capabilities = cap->device_caps | V4L2_CAP_DEVICE_CAPS;
+            return 0;
+        }
+    case VIDIOC_ENUM_FMT:
+        {
+            v4l2_fmtdesc *desc = static_cast<v4l2_fmtdesc*>(arg);
+            if ((desc->type != V4L2_BUF_TYPE_META_CAPTURE) || (desc->index != 0))
+            {
+                errno = EINVAL;
+                return -1;
+            }
+            desc->pixelformat = V4L2_META_FMT_UVC;
+            desc->flags = 0;
+            return 0;
+        }
+    case VIDIOC_G_FMT:
+    case VIDIOC_S_FMT:
+    case VIDIOC_TRY_FMT:
+        {
+            // UVC metadata is the only format
+            v4l2_format *fmt = static_cast<v4l2_format*>(arg);
+            if (fmt->type != V4L2_BUF_TYPE_META_CAPTURE)
+            {
+                errno = EINVAL;
+                return -1;
+            }
+            *fmt = file.fmt;
+            return 0;
+        }
+    case VIDIOC_REQBUFS:
+        {
+            v4l2_requestbuffers *req = static_cast<v4l2_requestbuffers*>(arg);
+            if ((req->type != V4L2_BUF_TYPE_META_CAPTURE) || (req->memory != V4L2_MEMORY_MMAP))
+            {
+                errno = EINVAL;
+                return -1;
+            }
+            if (file.streaming)
+            {
+                errno = EBUSY;
+                return -1;
+            }
+            req->count = std::min(req->count, config.maxBuffers);
+            file.buffers.clear();
+            file.queue.clear();
+            file.buffers.resize(req->count);
+            for(auto &buffer : file.buffers)
+            {
+                buffer.resize(FAKE_META_BUFFER_SIZE);
+            }
+            return 0;
+        }
+    case VIDIOC_QUERYBUF:
+    case VIDIOC_QBUF:
+        {
+            v4l2_buffer *buf = static_cast<v4l2_buffer*>(arg);
+            if ((buf->type != V4L2_BUF_TYPE_META_CAPTURE) || (buf->index >= file.buffers.size()))
+            {
+                errno = EINVAL;
+                return -1;
+            }
+
+            bool queued = std::find(file.queue.begin(), file.queue.end(), buf->index) != file.queue.end();
+            if (request == VIDIOC_QBUF)
+            {
+                if (queued)
+                {
+                    errno = EINVAL;
+                    return -1;
+                }
+                file.queue.push_back(buf->index);
+                queued = true;
+            }
+
+            buf->length = file.buffers[buf->index].size();
+            buf->m.offset = buf->index * FAKE_OFFSET_STEP;
+            buf->flags = V4L2_BUF_FLAG_MAPPED | (queued ? V4L2_BUF_FLAG_QUEUED : 0);
+            return 0;
+        }
+    case VIDIOC_DQBUF:
+        {
+            v4l2_buffer *buf = static_cast<v4l2_buffer*>(arg);
+            if ((!file.streaming) || (file.queue.size() == 0))
+            {
+                errno = EINVAL;
+                return -1;
+            }
+            if (dev.metaFrames.size() == 0)
+            {
+                errno = EAGAIN;
+                return -1;
+            }
+
+            fakeMetaFrame frame = dev.metaFrames[0];
+            dev.metaFrames.erase(dev.metaFrames.begin());
+            uint32_t index = file.queue[0];
+            file.queue.erase(file.queue.begin());
+
+            // a single payload header with the presentation time 
+            // stamp of the start of exposure, and a source clock 
+            // reference sampled when the frame completed.
+            uint8_t *dst = &file.buffers[index][0];
+            uvcMetaBlock_t block;
+            block.ns     = frame.timestamp*1000;
+            block.sof    = static_cast<uint16_t>((frame.timestamp / 1000) & 0x7FF);
+            block.length = 12;
+            block.flags  = UVC_STREAM_PTS | UVC_STREAM_SCR | 0x80 /* end of header */ | (frame.sequence & 1);
+            memcpy(dst, &block, sizeof(block));
+
+            uint32_t pts = fakeDeviceClock(frame.timestamp - config.exposureLatency);
+            uint32_t stc = fakeDeviceClock(frame.timestamp);
+            uint8_t *header = dst + sizeof(block);
+            for(uint32_t i=0; i<4; i++)
+            {
+                header[i]   = static_cast<uint8_t>(pts >> (8*i));
+                header[4+i] = static_cast<uint8_t>(stc >> (8*i));
+            }
+            header[8] = static_cast<uint8_t>(block.sof & 0xFF);
+            header[9] = static_cast<uint8_t>(block.sof >> 8);
+
+            buf->index = index;
+            buf->bytesused = sizeof(block) + block.length - 2;
+            buf->length = file.buffers[index].size();
+            buf->m.offset = index * FAKE_OFFSET_STEP;
+            buf->flags = V4L2_BUF_FLAG_MAPPED | V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+            buf->sequence = frame.sequence;
+            buf->timestamp.tv_sec = frame.timestamp / 1000000;
+            buf->timestamp.tv_usec = frame.timestamp % 1000000;
+            return 0;
+        }
+    case VIDIOC_STREAMON:
+        if (file.buffers.size() == 0)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+        file.streaming = true;
+        dev.metaStreaming = true;
+        dev.metaFrames.clear();
+        return 0;
+    case VIDIOC_STREAMOFF:
+        file.streaming = false;
+        file.queue.clear();
+        dev.metaStreaming = false;
+        dev.metaFrames.clear();
+        return 0;
+    default:
+        errno = ENOTTY;
+        return -1;
+    }
+}
@@ -0,0 +1,175 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Linux platform code
+    In-process emulation of V4L2 capture devices
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#ifndef linux_fakedeviceio_h
+#define linux_fakedeviceio_h
+
+#include <vector>
+#include <string>
+#include <map>
+#include <mutex>
+#include <linux/videodev2.h>
+#include "deviceio.h"
+
+/** a frame format offered by a fake device */
+struct FakeFormat
+{
+    uint32_t fourcc;            ///< V4L2 pixel format
+    uint32_t width;             ///< width in pixels
+    uint32_t height;            ///< height in pixels
+    std::vector<uint32_t> fps;  ///< supported frame rates, highest first
+    uint32_t bytesPerLine;      ///< bytes per line, 0 for the packed size
+    uint32_t sizeImage;         ///< buffer size, 0 for the size of the packed frame
+};
+
+/** a control offered by a fake device */
+struct FakeControl
+{
+    uint32_t id;                ///< V4L2 control ID
+    int32_t  minimum;
+    int32_t  maximum;
+    int32_t  step;
+    int32_t  defaultValue;
+};
+
+/** configuration of a fake device */
+struct FakeDeviceConfig
+{
+    FakeDeviceConfig();
+
+    std::string name;                   ///< name reported by VIDIOC_QUERYCAP
+    std::string busInfo;                ///< bus info reported by VIDIOC_QUERYCAP
+    std::vector<FakeFormat> formats;    ///< supported formats
+    std::vector<FakeControl> controls;  ///< supported controls
+
+    bool     realtime;          ///< pace the frames at the frame rate, otherwise a frame is always ready
+    uint32_t maxBuffers;        ///< maximum number of buffers VIDIOC_REQBUFS hands out
+    uint32_t dqbufErrorFrame;   ///< VIDIOC_DQBUF fails from this frame number on (1 = first frame, 0 = never)
+    int      dqbufErrno;        ///< errno of the failing VIDIOC_DQBUF
+    uint32_t stallFrame;        ///< select() times out from this frame number on (0 = never)
+    unsigned long failRequest;  ///< ioctl request that always fails (0 = none)
+    int      failErrno;         ///< errno of the failing ioctl request
+    bool     metadata;          ///< add a UVC metadata node to the device
+    uint32_t exposureLatency;   ///< time from the start of exposure to the frame timestamp in microseconds
+    int32_t  focusPeak;         ///< focus position at which the texture is sharpest (-1 = no texture)
+    bool     exposureResponse;  ///< scale the YUYV and RGB24 frames by the exposure and gain controls
+};
+
+/** DeviceIO implementation that emulates V4L2 capture
+    devices in-process. The devices appear as /dev/video0,
+    /dev/video1 etc. in the order they are added.
+
+    The fake driver emulates format, frame size and frame
+    interval enumeration, VIDIOC_S_FMT / VIDIOC_S_PARM 
+    negotiation, memory mapped buffer queues and controls.
+    The frames contain a moving test pattern; MJPEG frames
+    are encoded once when streaming starts. Devices with a
+    focus peak overlay YUYV and RGB24 frames with a fine
+    checker texture whose contrast falls off with the distance
+    of the focus control from the peak, like a lens. With an
+    exposure response, their brightness is proportional to
+    the exposure and gain controls, relative to the defaults.
+
+    Devices with metadata also get a UVC metadata node, which 
+    appears as /dev/video<n+i> for device i of n devices. It 
+    reports a presentation time stamp and a source clock 
+    reference of a simulated 48 MHz device clock for every frame.
+*/
+class FakeDeviceIO : public DeviceIO
+{
+public:
+    FakeDeviceIO();
+    virtual ~FakeDeviceIO();
+
+    /** add a device, returns its index */
+    uint32_t addDevice(const FakeDeviceConfig &config);
+
+    /** add a webcam-like device with YUYV, MJPEG and RGB24 formats and
+        the controls PlatformStream supports */
+    uint32_t addDefaultDevice(bool realtime = true);
+
+    virtual int open(const char *path, int flags) override;
+    virtual int close(int fd) override;
+    virtual int ioctl(int fd, unsigned long request, void *arg) override;
+    virtual void* mmap(size_t length, int prot, int flags, int fd, off_t offset) override;
+    virtual int munmap(void *addr, size_t length) override;
+    virtual ssize_t read(int fd, void *buffer, size_t bytes) override;
+    virtual int select(int fd, timeval *timeout) override;
+
+protected:
+    /** a frame whose metadata has not been read from the metadata node */
+    struct fakeMetaFrame
+    {
+        uint32_t sequence;          ///< sequence number of the video frame
+        uint64_t timestamp;         ///< timestamp of the video frame in microseconds
+    };
+
+    struct fakeDevice
+    {
+        FakeDeviceConfig config;
+        std::map<uint32_t, int32_t> values;     ///< current control values
+        std::vector<fakeMetaFrame> metaFrames;  ///< frames waiting on the metadata node
+        bool metaStreaming;                     ///< true if the metadata node is streaming
+    };
+
+    struct fakeFile
+    {
+        uint32_t    device;             ///< index into m_devices
+        bool        meta;               ///< true for the metadata node of the device
+        v4l2_format fmt;                ///< current format
+        uint32_t    fps;                ///< current frame rate
+        std::vector<std::vector<uint8_t> > buffers; ///< driver buffers
+        std::vector<uint32_t> queue;    ///< indices of the queued buffers, in order
+        std::vector<uint8_t> jpeg;      ///< encoded MJPEG frame
+        bool        streaming;
+        uint32_t    sequence;           ///< number of frames dequeued since STREAMON
+        uint64_t    nextFrameTime;      ///< monotonic time of the next frame in microseconds
+    };
+
+    int doIoctl(fakeFile &file, unsigned long request, void *arg);
+
+    /** ioctl of a metadata node. Called with m_mutex held. */
+    int doMetaIoctl(fakeFile &file, unsigned long request, void *arg);
+    bool setFormat(fakeFile &file, v4l2_pix_format &pix);
+
+    /** write frame 'sequence' of a stream into a driver buffer.
+        Called with m_mutex held. */
+    virtual void fillFrame(fakeFile &file, uint8_t *dst, size_t bytes, uint32_t sequence, uint32_t *bytesUsed);
+
+    /** returns the time in microseconds between the frame that was 
+        dequeued last and frame file.sequence. Called with m_mutex held. */
+    virtual uint64_t frameInterval(const fakeFile &file) const;
+
+    std::mutex m_mutex;
+    std::vector<fakeDevice> m_devices;
+    std::map<int, fakeFile> m_files;
+    int m_nextFd;
+};
+
+#endif
@@ -0,0 +1,382 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Linux platform code
+    Frame conversion from the V4L2 capture formats
+    to the output formats of the library
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#include <memory.h>
+#include <math.h>
+#include <linux/videodev2.h>
+#include "openpnp-capture.h"
+#include "../common/logging.h"
+#include "../common/context.h"
+#include "frameconverter.h"
+#include "yuvconverters.h"
+
+FrameConverter::FrameConverter() :
+    m_frameFunction(nullptr),
+    m_lineKernel(nullptr),
+    m_srcLineBytes(0),
+    m_mjpegPixelFormat(TJPF_RGB),
+    m_valid(false),
+    m_fourcc(0),
+    m_width(0),
+    m_height(0),
+    m_outWidth(0),
+    m_outHeight(0),
+    m_dstFormat(CAPOUTFMT_RGB24),
+    m_colorEnabled(false)
+{
+}
+
+FrameConverter::~FrameConverter()
+{
+}
+
+bool FrameConverter::setup(uint32_t srcFourcc, uint32_t width, uint32_t height, uint32_t dstFormat)
+{
+    m_valid = false;
+
+    if ((dstFormat != CAPOUTFMT_RGB24) && (dstFormat != CAPOUTFMT_BGR24))
+    {
+        LOG(LOG_ERR, "FrameConverter: unsupported output format %d\n", dstFormat);
+        return false;
+    }
+
+    switch(srcFourcc)
+    {
+    case V4L2_PIX_FMT_RGB24:
+    case V4L2_PIX_FMT_MJPEG:
+        break;
+    case V4L2_PIX_FMT_YUYV:
+        if ((width & 1) != 0)
+        {
+            LOG(LOG_ERR, "FrameConverter: YUYV frames must have an even width\n");
+            return false;
+        }
+        break;
+    default:
+        LOG(LOG_ERR, "FrameConverter: unsupported format %s (%08X)\n", 
+            fourCCToString(srcFourcc).c_str(), srcFourcc);
+        return false;
+    }
+
+    m_fourcc    = srcFourcc;
+    m_width     = width;
+    m_height    = height;
+    m_outWidth  = width;
+    m_outHeight = height;
+    m_dstFormat = dstFormat;
+
+    if (m_colorEnabled)
+    {
+        updateColorTransform();
+    }
+
+    m_valid = selectPipeline();
+    return m_valid;
+}
+
+void FrameConverter::setColorPipeline(const CapColorPipeline *pipeline)
+{
+    if (pipeline == nullptr)
+    {
+        m_colorEnabled = false;
+    }
+    else
+    {
+        m_colorPipeline = *pipeline;
+        m_colorEnabled  = true;
+        updateColorTransform();
+    }
+
+    if (m_valid)
+    {
+        selectPipeline();
+    }
+}
+
+bool FrameConverter::selectPipeline()
+{
+    const bool scaled = (m_outWidth != m_width) || (m_outHeight != m_height);
+    const uint32_t features = m_colorEnabled ? KERNEL_COLORTRANSFORM : 0;
+
+    if (m_fourcc == V4L2_PIX_FMT_MJPEG)
+    {
+        // libjpeg-turbo does the YUV to RGB conversion and the
+        // channel order, unless the colour correction is applied
+        // to the decoded lines, which then puts them in order.
+        m_srcLineBytes  = 0;
+        m_frameFunction = &FrameConverter::convertMJPEG;
+        if (m_colorEnabled)
+        {
+            m_mjpegPixelFormat = TJPF_RGB;
+            m_lineKernel = selectLineKernel(V4L2_PIX_FMT_RGB24, m_dstFormat, features);
+        }
+        else
+        {
+            m_mjpegPixelFormat = (m_dstFormat == CAPOUTFMT_BGR24) ? TJPF_BGR : TJPF_RGB;
+            m_lineKernel = nullptr;
+            return true;
+        }
+    }
+    else
+    {
+        m_srcLineBytes  = (m_fourcc == V4L2_PIX_FMT_YUYV) ? m_width*2 : m_width*3;
+        m_frameFunction = scaled ? &FrameConverter::convertResampled : &FrameConverter::convertLines;
+        m_lineKernel    = selectLineKernel(m_fourcc, m_dstFormat, features);
+    }
+
+    if (m_lineKernel == nullptr)
+    {
+        LOG(LOG_ERR, "FrameConverter: no conversion kernel for %s\n", fourCCToString(m_fourcc).c_str());
+        return false;
+    }
+    return true;
+}
+
+void FrameConverter::updateColorTransform()
+{
+    // the YUYV to RGB matrix of the YUYV line kernels, 
+    // operating on (Y-16, Cr-128, Cb-128).
+    static const float yuv2rgb[9] = 
+    {
+        19.0f/16.0f,   0.0f/16.0f,  32.0f/16.0f,
+        19.0f/16.0f, -13.0f/16.0f,  -6.0f/16.0f,
+        19.0f/16.0f,  26.0f/16.0f,   0.0f/16.0f
+    };
+
+    static const float identity[9] =
+    {
+        1.0f, 0.0f, 0.0f,
+        0.0f, 1.0f, 0.0f,
+        0.0f, 0.0f, 1.0f
+    };
+
+    // MJPEG frames are decoded to RGB first, so only
+    // YUYV frames need the YUV to RGB matrix.
+    const float *input = (m_fourcc == V4L2_PIX_FMT_YUYV) ? yuv2rgb : identity;
+
+    // combine: matrix = ccm * diag(gains) * input
+    // the line kernels write the rows in output order.
+    const CapColorPipeline &p = m_colorPipeline;
+    for(uint32_t row=0; row<3; row++)
+    {
+        for(uint32_t col=0; col<3; col++)
+        {
+            float v = 0.0f;
+            for(uint32_t k=0; k<3; k++)
+            {
+                v += p.ccm[row*3+k] * p.gains[k] * input[k*3+col];
+            }
+            m_colorTransform.matrix[row*3+col] = static_cast<int32_t>(
+                lroundf(v * (1 << COLORTRANSFORM_SHIFT)));
+        }
+    }
+
+    const float invGamma = 1.0f / p.gamma;
+    for(uint32_t i=0; i<256; i++)
+    {
+        m_colorTransform.lut[i] = static_cast<uint8_t>(
+            lroundf(255.0f * powf(i / 255.0f, invGamma)));
+    }
+}
+
+bool FrameConverter::setOutputSize(uint32_t width, uint32_t height)
+{
+    if (!m_valid)
+    {
+        return false;
+    }
+
+    if ((width == 0) || (height == 0) || ((width == m_width) && (height == m_height)))
+    {
+        m_outWidth  = m_width;
+        m_outHeight = m_height;
+        return selectPipeline();
+    }
+
+    if ((width > m_width) || (height > m_height))
+    {
+        LOG(LOG_ERR, "FrameConverter: the output size cannot be larger than the frame size\n");
+        return false;
+    }
+
+    if (m_fourcc == V4L2_PIX_FMT_MJPEG)
+    {
+        // JPEG frames are scaled by libjpeg-turbo while decoding,
+        // which only supports a fixed set of scaling factors.
+        int nFactors = 0;
+        tjscalingfactor *factors = tjGetScalingFactors(&nFactors);
+        for(int i=0; i<nFactors; i++)
+        {
+            if ((factors[i].num < factors[i].denom) &&
+                (static_cast<uint32_t>(TJSCALED(m_width, factors[i])) == width) &&
+                (static_cast<uint32_t>(TJSCALED(m_height, factors[i])) == height))
+            {
+                m_outWidth  = width;
+                m_outHeight = height;
+                return selectPipeline();
+            }
+        }
+        LOG(LOG_ERR, "FrameConverter: MJPEG frames cannot be scaled to %d x %d\n", width, height);
+        return false;
+    }
+
+    if (!m_resampler.setup(m_width, m_height, width, height))
+    {
+        return false;
+    }
+
+    m_lineBuffer.resize(m_width*3);
+    m_outWidth  = width;
+    m_outHeight = height;
+    return selectPipeline();
+}
+
+bool FrameConverter::convert(const uint8_t *src, size_t srcBytes, uint32_t srcStride,
+    uint8_t *dst, uint32_t dstStride)
+{
+    if ((!m_valid) || (src == nullptr) || (dst == nullptr))
+    {
+        return false;
+    }
+
+    const uint32_t dstLineBytes = m_outWidth*3;
+    if (dstStride == 0)
+    {
+        dstStride = dstLineBytes;
+    }
+
+    if (dstStride < dstLineBytes)
+    {
+        LOG(LOG_ERR, "FrameConverter: destination stride too small\n");
+        return false;
+    }
+
+    // uncompressed frames must hold all lines
+    if (m_srcLineBytes != 0)
+    {
+        if (srcStride == 0)
+        {
+            srcStride = m_srcLineBytes;
+        }
+
+        if ((srcStride < m_srcLineBytes) || 
+            (srcBytes < static_cast<size_t>(srcStride)*(m_height-1) + m_srcLineBytes))
+        {
+            LOG(LOG_ERR, "FrameConverter: source buffer too small (got %lu bytes)\n", 
+                static_cast<unsigned long>(srcBytes));
+            return false;
+        }
+    }
+
+    return (this->*m_frameFunction)(src, srcBytes, srcStride, dst, dstStride);
+}
+
+bool FrameConverter::convertMJPEG(const uint8_t *src, size_t srcBytes, uint32_t,
+    uint8_t *dst, uint32_t dstStride)
+{
+    bool ok;
+    if ((m_outWidth != m_width) || (m_outHeight != m_height))
+    {
+        ok = m_mjpegHelper.decompressScaled(src, srcBytes, dst, m_outWidth, m_outHeight,
+            dstStride, m_mjpegPixelFormat);
+    }
+    else
+    {
+        ok = m_mjpegHelper.decompressFrame(src, srcBytes, dst, m_width, m_height, 
+            dstStride, m_mjpegPixelFormat);
+    }
+
+    // colour correction of the decoded lines, in place
+    if (ok && (m_lineKernel != nullptr))
+    {
+        for(uint32_t y=0; y<m_outHeight; y++)
+        {
+            uint8_t *line = dst + static_cast<size_t>(y)*dstStride;
+            m_lineKernel(line, line, m_outWidth, m_colorTransform);
+        }
+    }
+    return ok;
+}
+
+bool FrameConverter::convertLines(const uint8_t *src, size_t, uint32_t srcStride,
+    uint8_t *dst, uint32_t dstStride)
+{
+    // tightly packed frames can be converted in one go
+    if ((srcStride == m_srcLineBytes) && (dstStride == m_width*3))
+    {
+        m_lineKernel(src, dst, m_width*m_height, m_colorTransform);
+        return true;
+    }
+
+    for(uint32_t y=0; y<m_height; y++)
+    {
+        m_lineKernel(src + static_cast<size_t>(y)*srcStride, 
+            dst + static_cast<size_t>(y)*dstStride, m_width, m_colorTransform);
+    }
+    return true;
+}
+
+bool FrameConverter::convertResampled(const uint8_t *src, size_t, uint32_t srcStride,
+    uint8_t *dst, uint32_t dstStride)
+{
+    // each line is converted into a line buffer and 
+    // then fed to the resampler, so there is no
+    // full-size intermediate frame.
+    uint8_t *lineBuffer = &m_lineBuffer[0];
+    m_resampler.begin(dst, dstStride);
+    for(uint32_t y=0; y<m_height; y++)
+    {
+        m_lineKernel(src + static_cast<size_t>(y)*srcStride, lineBuffer, m_width, m_colorTransform);
+        m_resampler.addLine(lineBuffer);
+    }
+    return true;
+}
+
+// **********************************************************************
+//   Conversion of frames that did not come from a stream
+// **********************************************************************
+
+CapResult platformConvertFrame(uint32_t srcFourcc, const uint8_t *src, size_t srcBytes,
+    uint32_t srcStride, uint32_t width, uint32_t height,
+    uint32_t dstFormat, uint8_t *dst, uint32_t dstStride)
+{
+    FrameConverter converter;
+    if (!converter.setup(srcFourcc, width, height, dstFormat))
+    {
+        return CAPRESULT_FORMATNOTSUPPORTED;
+    }
+
+    if (!converter.convert(src, srcBytes, srcStride, dst, dstStride))
+    {
+        return CAPRESULT_ERR;
+    }
+
+    return CAPRESULT_OK;
+}
@@ -0,0 +1,162 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Linux platform code
+    Frame conversion from the V4L2 capture formats
+    to the output formats of the library
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#ifndef linux_frameconverter_h
+#define linux_frameconverter_h
+
+#include <stdint.h>
+#include <stdlib.h> // size_t
+#include <vector>
+#include "openpnp-capture.h"
+#include "mjpeghelper.h"
+#include "yuvconverters.h"
+#include "arearesampler.h"
+
+/** The FrameConverter converts frames in one of the
+    supported V4L2 capture formats to 24-bit RGB or BGR.
+
+    Whenever the format, output size or colour correction
+    changes, the conversion is resolved into a frame function
+    and a specialised line kernel, so converting a frame does
+    not test the settings again.
+
+    It is used by the PlatformStream to convert the
+    captured frames and by Cap_convertFrame to convert
+    frames from other sources.
+*/
+class FrameConverter
+{
+public:
+    FrameConverter();
+    virtual ~FrameConverter();
+
+    /** Configure the converter for a source format and frame size.
+        Returns false if the source or destination format is not
+        supported. */
+    bool setup(uint32_t srcFourcc, uint32_t width, uint32_t height, uint32_t dstFormat);
+
+    /** Convert a frame. When srcStride or dstStride are 0, the
+        lines are assumed to be tightly packed. srcStride is ignored
+        for compressed formats.
+        Returns false if the frame could not be converted. */
+    bool convert(const uint8_t *src, size_t srcBytes, uint32_t srcStride,
+        uint8_t *dst, uint32_t dstStride);
+
+    /** Set the size of the output frames. The frames are
+        downscaled while they are converted. 0 x 0 selects
+        the frame size. Returns false if the size is not
+        supported. setup() resets the output size. */
+    bool setOutputSize(uint32_t width, uint32_t height);
+
+    /** Returns the width of the output frames in pixels */
+    uint32_t getOutputWidth() const
+    {
+        return m_outWidth;
+    }
+
+    /** Returns the height of the output frames in pixels */
+    uint32_t getOutputHeight() const
+    {
+        return m_outHeight;
+    }
+
+    /** Set the colour correction that is folded into the
+        conversion. NULL turns colour correction off. */
+    void setColorPipeline(const CapColorPipeline *pipeline);
+
+    /** Set the priority (CAPPRIORITY_xxx) of the work
+        this converter hands to the decode pool */
+    void setPriority(uint32_t priority)
+    {
+        m_mjpegHelper.setPriority(priority);
+    }
+
+    /** Returns true if the converter has been set up succesfully */
+    bool isValid() const
+    {
+        return m_valid;
+    }
+
+    /** Returns the number of bytes of scratch memory used by the converter */
+    size_t getScratchBytes() const
+    {
+        return m_lineBuffer.capacity() + m_resampler.getScratchBytes() + 
+            m_mjpegHelper.getScratchBytes();
+    }
+
+protected:
+    /** Build the fixed-point colour transform for the current
+        source format and colour pipeline */
+    void updateColorTransform();
+
+    /** Choose the frame function and line kernel for the 
+        current settings. Returns false if there is none. */
+    bool selectPipeline();
+
+    /** frame function: decode an MJPEG frame, scaled if needed, and 
+        apply the colour correction to the decoded lines */
+    bool convertMJPEG(const uint8_t *src, size_t srcBytes, uint32_t srcStride,
+        uint8_t *dst, uint32_t dstStride);
+
+    /** frame function: convert an uncompressed frame line by line */
+    bool convertLines(const uint8_t *src, size_t srcBytes, uint32_t srcStride,
+        uint8_t *dst, uint32_t dstStride);
+
+    /** frame function: convert an uncompressed frame line by line 
+        into a line buffer that feeds the resampler */
+    bool convertResampled(const uint8_t *src, size_t srcBytes, uint32_t srcStride,
+        uint8_t *dst, uint32_t dstStride);
+
+    /** a frame function, see selectPipeline */
+    typedef bool (FrameConverter::*FrameFunction)(const uint8_t *src, size_t srcBytes, 
+        uint32_t srcStride, uint8_t *dst, uint32_t dstStride);
+
+    FrameFunction m_frameFunction;  ///< converts a frame with the current settings
+    LineKernel  m_lineKernel;       ///< converts a line, or colour corrects a decoded MJPEG line
+    uint32_t    m_srcLineBytes;     ///< bytes per line of uncompressed frames, 0 for MJPEG
+    int         m_mjpegPixelFormat; ///< TJPF_xxx format the MJPEG frames are decoded to
+
+    bool        m_valid;        ///< true if setup() succeeded
+    uint32_t    m_fourcc;       ///< V4L2 FOURCC of the source frames
+    uint32_t    m_width;        ///< width of the frames in pixels
+    uint32_t    m_height;       ///< height of the frames in pixels
+    uint32_t    m_outWidth;     ///< width of the output frames in pixels
+    uint32_t    m_outHeight;    ///< height of the output frames in pixels
+    uint32_t    m_dstFormat;    ///< output format (CAPOUTFMT_xxx)
+    MJPEGHelper m_mjpegHelper;  ///< helper to convert MJPEG frames
+    AreaResampler m_resampler;  ///< downscales uncompressed frames
+    std::vector<uint8_t> m_lineBuffer;  ///< one converted line for the resampler
+
+    bool             m_colorEnabled;    ///< true if colour correction is on
+    CapColorPipeline m_colorPipeline;   ///< colour correction settings
+    ColorTransform   m_colorTransform;  ///< fixed-point version of the colour correction
+};
+
+#endif
@@ -0,0 +1,176 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Linux platform code
+    Recycled memory for the libjpeg-turbo decompressors
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#include "jpegarena.h"
+
+// the header in front of each block, padded so the
+// block keeps the alignment of malloc.
+#define HEADER_BYTES 16
+
+struct JpegArena::blockHeader_t
+{
+    JpegArena  *owner;      ///< arena the block belongs to, NULL for a heap block
+    size_t      bytes;      ///< usable size of the block
+};
+
+/** the arena of the calling thread, see JpegArenaScope */
+static thread_local JpegArena *t_arena = nullptr;
+
+JpegArena::JpegArena() :
+    m_freeCount(0),
+    m_bytes(0)
+{
+    static_assert(sizeof(blockHeader_t) <= HEADER_BYTES, "block header too large");
+}
+
+JpegArena::~JpegArena()
+{
+    for(uint32_t i=0; i<m_freeCount; i++)
+    {
+        free(m_free[i]);
+    }
+}
+
+void* JpegArena::alloc(size_t bytes)
+{
+    // the memory manager asks for the same sizes for every
+    // frame, so the best fit is usually an exact match.
+    int32_t best = -1;
+    for(uint32_t i=0; i<m_freeCount; i++)
+    {
+        if ((m_free[i]->bytes >= bytes) && ((best < 0) || (m_free[i]->bytes < m_free[best]->bytes)))
+        {
+            best = i;
+        }
+    }
+
+    blockHeader_t *block;
+    if (best >= 0)
+    {
+        block = m_free[best];
+        m_free[best] = m_free[--m_freeCount];
+    }
+    else
+    {
+        block = static_cast<blockHeader_t*>(malloc(HEADER_BYTES + bytes));
+        if (block == nullptr)
+        {
+            return nullptr;
+        }
+        block->owner = this;
+        block->bytes = bytes;
+        m_bytes += bytes;
+    }
+    return reinterpret_cast<uint8_t*>(block) + HEADER_BYTES;
+}
+
+void JpegArena::recycle(blockHeader_t *block)
+{
+    if (m_freeCount < JPEGARENA_MAXFREE)
+    {
+        m_free[m_freeCount++] = block;
+    }
+    else
+    {
+        m_bytes -= block->bytes;
+        free(block);
+    }
+}
+
+void JpegArena::release(void *ptr)
+{
+    if (ptr == nullptr)
+    {
+        return;
+    }
+
+    blockHeader_t *block = reinterpret_cast<blockHeader_t*>(static_cast<uint8_t*>(ptr) - HEADER_BYTES);
+    if (block->owner != nullptr)
+    {
+        block->owner->recycle(block);
+    }
+    else
+    {
+        free(block);
+    }
+}
+
+JpegArenaScope::JpegArenaScope(JpegArena &arena) :
+    m_previous(t_arena)
+{
+    t_arena = &arena;
+}
+
+JpegArenaScope::~JpegArenaScope()
+{
+    t_arena = m_previous;
+}
+
+void* JpegArena::allocate(size_t bytes)
+{
+    if (t_arena != nullptr)
+    {
+        return t_arena->alloc(bytes);
+    }
+
+    // a heap block gets a header too, so release() 
+    // can tell it from a block of an arena.
+    blockHeader_t *block = static_cast<blockHeader_t*>(malloc(HEADER_BYTES + bytes));
+    if (block == nullptr)
+    {
+        return nullptr;
+    }
+    block->owner = nullptr;
+    block->bytes = bytes;
+    return reinterpret_cast<uint8_t*>(block) + HEADER_BYTES;
+}
+
+// The library is linked with --wrap for the memory functions of
+// libjpeg-turbo (see CMakeLists.txt), so its memory manager calls
+// these instead of the ones in jmemnobs.c.
+
+extern "C" void* __wrap_jpeg_get_small(void * /*cinfo*/, size_t bytes)
+{
+    return JpegArena::allocate(bytes);
+}
+
+extern "C" void __wrap_jpeg_free_small(void * /*cinfo*/, void *object, size_t /*bytes*/)
+{
+    JpegArena::release(object);
+}
+
+extern "C" void* __wrap_jpeg_get_large(void * /*cinfo*/, size_t bytes)
+{
+    return JpegArena::allocate(bytes);
+}
+
+extern "C" void __wrap_jpeg_free_large(void * /*cinfo*/, void *object, size_t /*bytes*/)
+{
+    JpegArena::release(object);
+}
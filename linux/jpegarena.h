@@ -0,0 +1,100 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Linux platform code
+    Recycled memory for the libjpeg-turbo decompressors
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#ifndef linux_jpegarena_h
+#define linux_jpegarena_h
+
+#include <stdint.h>
+#include <stdlib.h> // size_t
+
+#define JPEGARENA_MAXFREE 64    ///< most blocks an arena keeps for reuse
+
+/** A JpegArena holds the memory of one libjpeg-turbo decompressor.
+
+    libjpeg-turbo gets the memory of each frame from its memory
+    manager, which calls jpeg_get_small/jpeg_get_large, and gives
+    it back with jpeg_free_small/jpeg_free_large when the frame is
+    finished. The library is linked with these functions wrapped
+    (see CMakeLists.txt), so while a JpegArenaScope is active on a
+    thread the blocks come from its arena. Blocks that the memory
+    manager frees go back to the arena they came from, and the
+    next frame reuses them. Once the first frames have been
+    decoded, decoding a frame of the same size does not allocate.
+
+    The arena must be used with one decompressor only and by one
+    thread at a time, and must be destroyed after the decompressor.
+    This only applies to the bundled libjpeg-turbo; a system
+    libturbojpeg keeps allocating.
+*/
+class JpegArena
+{
+public:
+    JpegArena();
+    ~JpegArena();
+
+    /** allocate a block of at least 'bytes', reusing a free block if possible */
+    void* alloc(size_t bytes);
+
+    /** allocate a block from the arena that is active on the calling
+        thread, or from the heap if there is none */
+    static void* allocate(size_t bytes);
+
+    /** free a block returned by allocate, whichever arena it came from */
+    static void release(void *ptr);
+
+    /** returns the number of bytes held by the arena */
+    size_t getBytes() const
+    {
+        return m_bytes;
+    }
+
+protected:
+    struct blockHeader_t;
+
+    /** keep a free block for reuse */
+    void recycle(blockHeader_t *block);
+
+    blockHeader_t*  m_free[JPEGARENA_MAXFREE];  ///< blocks that can be reused
+    uint32_t        m_freeCount;                ///< number of entries in m_free
+    size_t          m_bytes;                    ///< bytes of the blocks owned by the arena
+};
+
+/** Makes the JPEG memory of the calling thread come from an arena
+    until the scope ends. Scopes may be nested. */
+class JpegArenaScope
+{
+public:
+    JpegArenaScope(JpegArena &arena);
+    ~JpegArenaScope();
+
+protected:
+    JpegArena *m_previous;      ///< arena that was active before the scope
+};
+
+#endif
@@ -27,12 +27,19 @@
 
 */
 
+#include <string.h>
 #include "mjpeghelper.h"
+#include "decodepool.h"
 #include "../common/logging.h"
 
+// minimum number of MCU rows in a band that is
+// decoded in parallel with the other bands
+#define MIN_SEGMENT_MCUROWS 4
+
 bool MJPEGHelper::decompressFrame(const uint8_t *inBuffer,
     size_t inBytes, uint8_t *outBuffer,
-    uint32_t outBufWidth, uint32_t outBufHeight)
+    uint32_t outBufWidth, uint32_t outBufHeight,
+    uint32_t outPitch, int pixelFormat)
 {
     // note: the jpeg-turbo library apparently uses a non-const
     // buffer pointer to the incoming JPEG data.
@@ -42,20 +49,26 @@ bool MJPEGHelper::decompressFrame(const uint8_t *inBuffer,
 
     uint8_t *jpegPtr = const_cast<uint8_t*>(inBuffer);
     int32_t width, height, jpegSubsamp;
+    JpegArenaScope arenaScope(m_arena);
     
     tjDecompressHeader2(m_decompressHandle, jpegPtr, inBytes, &width, &height, &jpegSubsamp);    
     if ((width != outBufWidth) || (height != outBufHeight))
     {
-        LOG(LOG_ERR, "tjDecompressHeader2 failed: %s\n", tjGetErrorStr());
+        LOG_LIMITED(LOG_ERR, "tjDecompressHeader2 failed: %s\n", tjGetErrorStr());
         return false;
     }
     else
     {
-        LOG(LOG_VERBOSE, "MJPG: %d %d size %d bytes\n", width, height, inBytes);
+        LOG_LIMITED(LOG_VERBOSE, "MJPG: %d %d size %d bytes\n", width, height, inBytes);
+    }
+
+    if (decompressParallel(inBuffer, inBytes, outBuffer, width, height, outPitch, pixelFormat))
+    {
+        return true;
     }
 
     if (tjDecompress2(m_decompressHandle, jpegPtr, inBytes, outBuffer, 
-        width, 0/*pitch*/, height, TJPF_RGB, TJFLAG_FASTDCT) != 0)
+        width, outPitch, height, pixelFormat, TJFLAG_FASTDCT) != 0)
     {
         // A lot of cameras produce incorrect but decodable JPEG data
         // and produce warnings that fill the console,
@@ -71,7 +84,7 @@ bool MJPEGHelper::decompressFrame(const uint8_t *inBuffer,
         #if 0
         if (tjGetErrorCode(m_decompressHandle)==TJERR_ERROR)
         {
-            LOG(LOG_ERR, "tjDecompress2 failed: %s\n", tjGetErrorStr());
+            LOG_LIMITED(LOG_ERR, "tjDecompress2 failed: %s\n", tjGetErrorStr());
             return false;
         }
         #endif
@@ -80,4 +93,343 @@ bool MJPEGHelper::decompressFrame(const uint8_t *inBuffer,
     }
 
     return true;
-}
\ No newline at end of file
+}
+
+bool MJPEGHelper::decompressScaled(const uint8_t *inBuffer, size_t inBytes, 
+    uint8_t *outBuffer, uint32_t outWidth, uint32_t outHeight,
+    uint32_t outPitch, int pixelFormat)
+{
+    uint8_t *jpegPtr = const_cast<uint8_t*>(inBuffer);
+    int32_t width, height, jpegSubsamp;
+    JpegArenaScope arenaScope(m_arena);
+
+    if (tjDecompressHeader2(m_decompressHandle, jpegPtr, inBytes, &width, &height, &jpegSubsamp) != 0)
+    {
+        LOG_LIMITED(LOG_ERR, "tjDecompressHeader2 failed: %s\n", tjGetErrorStr());
+        return false;
+    }
+
+    // libjpeg-turbo picks the largest scaling factor
+    // that fits the requested size, check that it is exact.
+    int nFactors = 0;
+    tjscalingfactor *factors = tjGetScalingFactors(&nFactors);
+    bool found = false;
+    for(int i=0; i<nFactors; i++)
+    {
+        if ((static_cast<uint32_t>(TJSCALED(width, factors[i])) == outWidth) &&
+            (static_cast<uint32_t>(TJSCALED(height, factors[i])) == outHeight))
+        {
+            found = true;
+            break;
+        }
+    }
+
+    if (!found)
+    {
+        LOG_LIMITED(LOG_ERR, "MJPG: %d x %d frame cannot be scaled to %d x %d\n", width, height, outWidth, outHeight);
+        return false;
+    }
+
+    // warnings are ignored, see decompressFrame
+    tjDecompress2(m_decompressHandle, jpegPtr, inBytes, outBuffer, 
+        outWidth, outPitch, outHeight, pixelFormat, TJFLAG_FASTDCT);
+    return true;
+}
+
+size_t MJPEGHelper::getScratchBytes() const
+{
+    size_t bytes = m_restarts.capacity()*sizeof(size_t) + m_segments.capacity()*sizeof(segment_t) + 
+        m_arena.getBytes();
+    for(auto const &seg : m_segments)
+    {
+        bytes += seg.jpeg.capacity();
+    }
+    return bytes;
+}
+
+static inline uint32_t read16(const uint8_t *ptr)
+{
+    return (static_cast<uint32_t>(ptr[0]) << 8) | ptr[1];
+}
+
+bool MJPEGHelper::decompressParallel(const uint8_t *inBuffer, size_t inBytes, 
+    uint8_t *outBuffer, uint32_t width, uint32_t height,
+    uint32_t outPitch, int pixelFormat)
+{
+    if (std::thread::hardware_concurrency() < 2)
+    {
+        return false;
+    }
+
+    if ((inBytes < 4) || (inBuffer[0] != 0xFF) || (inBuffer[1] != 0xD8))
+    {
+        return false;
+    }
+
+    // ****************************************
+    // parse the header up to the start of scan
+    // ****************************************
+
+    size_t   pos = 2;
+    size_t   sofOffset = 0;
+    size_t   headerBytes = 0;
+    uint32_t restartInterval = 0;
+    uint32_t components = 0;
+    uint32_t hmax = 1;
+    uint32_t vmax = 1;
+    while((headerBytes == 0) && (pos + 4 <= inBytes))
+    {
+        if (inBuffer[pos] != 0xFF)
+        {
+            return false;
+        }
+
+        uint8_t marker = inBuffer[pos+1];
+        if (marker == 0xFF)
+        {
+            pos++;  // fill byte
+            continue;
+        }
+
+        uint32_t len = read16(&inBuffer[pos+2]);
+        if (pos + 2 + len > inBytes)
+        {
+            return false;
+        }
+
+        switch(marker)
+        {
+        case 0xC0:  // baseline
+        case 0xC1:  // extended sequential, Huffman
+            if (len < 8)
+            {
+                return false;
+            }
+            sofOffset = pos;
+            components = inBuffer[pos+9];
+            if (len < 8 + 3*components)
+            {
+                return false;
+            }
+            for(uint32_t c=0; c<components; c++)
+            {
+                uint32_t h = inBuffer[pos+11+3*c] >> 4;
+                uint32_t v = inBuffer[pos+11+3*c] & 0x0F;
+                hmax = (h > hmax) ? h : hmax;
+                vmax = (v > vmax) ? v : vmax;
+            }
+            break;
+        case 0xC2: case 0xC3: case 0xC5: case 0xC6: case 0xC7:
+        case 0xC9: case 0xCA: case 0xCB: case 0xCD: case 0xCE: case 0xCF:
+            // progressive, lossless, hierarchical or arithmetic coding
+            return false;
+        case 0xDD:  // define restart interval
+            if (len < 4)
+            {
+                return false;
+            }
+            restartInterval = read16(&inBuffer[pos+4]);
+            break;
+        case 0xDA:  // start of scan
+            headerBytes = pos + 2 + len;
+            break;
+        }
+        pos += 2 + len;
+    }
+
+    if ((headerBytes == 0) || (sofOffset == 0) || (restartInterval == 0) || (components == 0))
+    {
+        return false;
+    }
+
+    if ((read16(&inBuffer[sofOffset+5]) != height) || (read16(&inBuffer[sofOffset+7]) != width))
+    {
+        return false;
+    }
+
+    // a non-interleaved scan has MCUs of a single block
+    const uint32_t mcuWidth  = (components == 1) ? 8 : 8*hmax;
+    const uint32_t mcuHeight = (components == 1) ? 8 : 8*vmax;
+    const uint32_t mcusPerRow = (width + mcuWidth - 1) / mcuWidth;
+    const uint32_t mcuRows = (height + mcuHeight - 1) / mcuHeight;
+    const uint32_t intervals = (mcusPerRow*mcuRows + restartInterval - 1) / restartInterval;
+
+    if (mcuRows < 2*MIN_SEGMENT_MCUROWS)
+    {
+        return false;
+    }
+
+    // ****************************************
+    // find the restart markers
+    // ****************************************
+
+    m_restarts.clear();
+    size_t dataEnd = inBytes;
+    pos = headerBytes;
+    while(pos + 1 < inBytes)
+    {
+        const uint8_t *ff = static_cast<const uint8_t*>(memchr(&inBuffer[pos], 0xFF, inBytes - pos - 1));
+        if (ff == nullptr)
+        {
+            break;
+        }
+        pos = ff - inBuffer;
+
+        uint8_t marker = inBuffer[pos+1];
+        if ((marker >= 0xD0) && (marker <= 0xD7))
+        {
+            m_restarts.push_back(pos);
+            pos += 2;
+        }
+        else if (marker == 0xD9)
+        {
+            dataEnd = pos;
+            break;
+        }
+        else if (marker == 0xFF)
+        {
+            pos++;      // fill byte, the next 0xFF may start a marker
+        }
+        else
+        {
+            pos += 2;   // stuffed zero byte
+        }
+    }
+
+    if (m_restarts.size() != intervals - 1)
+    {
+        // no restart markers or the frame is damaged
+        return false;
+    }
+
+    // only frames that can be split create the pool and its threads
+    DecodePool &pool = DecodePool::getInstance();
+
+    // ****************************************
+    // split the frame into bands that start
+    // at the beginning of an MCU row
+    // ****************************************
+
+    uint32_t segments = pool.getWorkerCount() + 1;
+    if (segments > mcuRows / MIN_SEGMENT_MCUROWS)
+    {
+        segments = mcuRows / MIN_SEGMENT_MCUROWS;
+    }
+
+    m_segments.resize(segments);
+    uint32_t used = 0;
+    uint32_t firstInterval = 0;
+    uint32_t firstRow = 0;
+    for(uint32_t s=1; (s<=segments) && (firstInterval < intervals); s++)
+    {
+        // find the first interval that starts a row at or beyond the target row
+        uint32_t lastInterval = intervals;
+        uint32_t lastRow = mcuRows;
+        if (s < segments)
+        {
+            uint32_t targetRow = (s*mcuRows) / segments;
+            uint32_t k = (targetRow*mcusPerRow + restartInterval - 1) / restartInterval;
+            while((k < intervals) && (((k*restartInterval) % mcusPerRow) != 0))
+            {
+                k++;
+            }
+            if (k >= intervals)
+            {
+                // no aligned restart marker, the rest is one band
+                s = segments;
+            }
+            else
+            {
+                lastInterval = k;
+                lastRow = (k*restartInterval) / mcusPerRow;
+            }
+        }
+
+        if (lastRow <= firstRow)
+        {
+            continue;
+        }
+
+        segment_t &seg = m_segments[used++];
+        seg.firstInterval = firstInterval;
+        seg.intervals = lastInterval - firstInterval;
+        seg.dataStart = (firstInterval == 0) ? headerBytes : m_restarts[firstInterval-1] + 2;
+        seg.dataEnd   = (lastInterval == intervals) ? dataEnd : m_restarts[lastInterval-1];
+        seg.y = firstRow*mcuHeight;
+        seg.lines = ((lastRow*mcuHeight < height) ? lastRow*mcuHeight : height) - seg.y;
+
+        firstInterval = lastInterval;
+        firstRow = lastRow;
+    }
+
+    if (used < 2)
+    {
+        return false;
+    }
+
+    // ****************************************
+    // decode the bands
+    // ****************************************
+
+    m_frame       = inBuffer;
+    m_headerBytes = headerBytes;
+    m_sofOffset   = sofOffset;
+    m_outBuffer   = outBuffer;
+    m_outPitch    = (outPitch != 0) ? outPitch : width*tjPixelSize[pixelFormat];
+    m_width       = width;
+    m_pixelFormat = pixelFormat;
+
+    // vertically subsampled chroma is smoothed across MCU rows
+    // when upsampled, which would leave seams between the bands.
+    m_flags = TJFLAG_FASTDCT;
+    if (vmax > 1)
+    {
+        m_flags |= TJFLAG_FASTUPSAMPLE;
+    }
+
+    pool.run(&MJPEGHelper::decodeSegment, this, used, m_decompressHandle, m_priority);
+
+    LOG_LIMITED(LOG_VERBOSE, "MJPG: decoded %d bands in parallel\n", used);
+    return true;
+}
+
+void MJPEGHelper::decodeSegment(void *arg, uint32_t index, tjhandle handle)
+{
+    MJPEGHelper *helper = static_cast<MJPEGHelper*>(arg);
+    segment_t &seg = helper->m_segments[index];
+
+    // build a stand-alone JPEG: the original header with
+    // the height of the band, the entropy coded data of 
+    // the band with renumbered restart markers and an EOI.
+    // the bands vary in size from frame to frame, so the
+    // buffer grows with headroom rather than on every new maximum.
+    const size_t dataBytes = seg.dataEnd - seg.dataStart;
+    const size_t jpegBytes = helper->m_headerBytes + dataBytes + 2;
+    if (seg.jpeg.capacity() < jpegBytes)
+    {
+        seg.jpeg.reserve(jpegBytes + jpegBytes/2);
+    }
+    seg.jpeg.resize(jpegBytes);
+    uint8_t *jpeg = &seg.jpeg[0];
+
+    memcpy(jpeg, helper->m_frame, helper->m_headerBytes);
+    jpeg[helper->m_sofOffset+5] = (seg.lines >> 8) & 0xFF;
+    jpeg[helper->m_sofOffset+6] = seg.lines & 0xFF;
+
+    memcpy(jpeg + helper->m_headerBytes, helper->m_frame + seg.dataStart, dataBytes);
+    for(uint32_t i=1; i<seg.intervals; i++)
+    {
+        size_t markerPos = helper->m_restarts[seg.firstInterval + i - 1] - seg.dataStart;
+        jpeg[helper->m_headerBytes + markerPos + 1] = 0xD0 + ((i-1) & 7);
+    }
+
+    jpeg[seg.jpeg.size()-2] = 0xFF;
+    jpeg[seg.jpeg.size()-1] = 0xD9;
+
+    // warnings about corrupt data are ignored, just like 
+    // for frames that are decoded in one go.
+    tjDecompress2(handle, jpeg, seg.jpeg.size(), 
+        helper->m_outBuffer + static_cast<size_t>(seg.y)*helper->m_outPitch,
+        helper->m_width, helper->m_outPitch, seg.lines, 
+        helper->m_pixelFormat, helper->m_flags);
+}
@@ -33,12 +33,16 @@
 #include <turbojpeg.h>
 #include <stdint.h>
 #include <stdlib.h> // size_t
+#include <vector>
+#include "openpnp-capture.h"
+#include "jpegarena.h"
 
 class MJPEGHelper
 {
 public:
-    MJPEGHelper()
+    MJPEGHelper() : m_priority(CAPPRIORITY_NORMAL)
     {
+        JpegArenaScope arenaScope(m_arena);
         m_decompressHandle = tjInitDecompress();
     }
 
@@ -51,12 +55,80 @@ public:
         The width and height of the output buffer are for
         sanity checking only. If the JPEG does not match
         the buffer size, the function will return false.
+
+        outPitch is the number of bytes per output line, 
+        or 0 for tightly packed lines. pixelFormat is the
+        libjpeg-turbo TJPF_xxx output pixel format.
     */
     bool decompressFrame(const uint8_t *inBuffer, size_t inBytes, 
-        uint8_t *outBuffer, uint32_t outBufWidth, uint32_t outButHeight);
+        uint8_t *outBuffer, uint32_t outBufWidth, uint32_t outButHeight,
+        uint32_t outPitch = 0, int pixelFormat = TJPF_RGB);
+
+    /** Decompress a JPEG contained in the buffer and scale
+        it to outWidth x outHeight while decoding. The output 
+        size must be one of the sizes libjpeg-turbo can
+        scale to.
+    */
+    bool decompressScaled(const uint8_t *inBuffer, size_t inBytes, 
+        uint8_t *outBuffer, uint32_t outWidth, uint32_t outHeight,
+        uint32_t outPitch, int pixelFormat);
+
+    /** Returns the number of bytes used to split frames into
+        bands and held by the arena of the decompressor. The
+        memory of the decode pool's decompressors is not included. */
+    size_t getScratchBytes() const;
+
+    /** Set the priority (CAPPRIORITY_xxx) of the frames
+        decoded on the decode pool */
+    void setPriority(uint32_t priority)
+    {
+        m_priority = priority;
+    }
 
 protected:
+    /** Decompress a JPEG that contains restart markers on
+        several threads. The frame is split at restart markers
+        that start a new MCU row and the resulting bands are
+        decoded as independent JPEG images into disjoint parts 
+        of the output buffer.
+
+        Returns false if the frame cannot be split, in which case
+        nothing has been written to the output buffer.
+    */
+    bool decompressParallel(const uint8_t *inBuffer, size_t inBytes, 
+        uint8_t *outBuffer, uint32_t width, uint32_t height,
+        uint32_t outPitch, int pixelFormat);
+
+    /** decode job run by the DecodePool */
+    static void decodeSegment(void *arg, uint32_t index, tjhandle handle);
+
+    /** a band of MCU rows that is decoded as an independent JPEG */
+    struct segment_t
+    {
+        size_t      dataStart;      ///< offset of the entropy coded data in the frame
+        size_t      dataEnd;        ///< end offset of the entropy coded data in the frame
+        uint32_t    firstInterval;  ///< index of the first restart interval in the band
+        uint32_t    intervals;      ///< number of restart intervals in the band
+        uint32_t    y;              ///< first pixel row of the band
+        uint32_t    lines;          ///< number of pixel rows in the band
+        std::vector<uint8_t> jpeg;  ///< the band as a JPEG image
+    };
+
+    JpegArena m_arena;            ///< memory of m_decompressHandle, destroyed after it
     tjhandle m_decompressHandle;  ///< decompressor handle
+    uint32_t m_priority;          ///< CAPPRIORITY_xxx of the decode pool batches
+
+    // state of the frame that is being decoded in parallel
+    const uint8_t*          m_frame;        ///< the frame being decoded
+    size_t                  m_headerBytes;  ///< size of the JPEG header up to the entropy coded data
+    size_t                  m_sofOffset;    ///< offset of the SOF marker in the header
+    uint8_t*                m_outBuffer;    ///< output buffer
+    uint32_t                m_outPitch;     ///< bytes per output line
+    uint32_t                m_width;        ///< width of the frame in pixels
+    int                     m_pixelFormat;  ///< TJPF_xxx output format
+    int                     m_flags;        ///< TJFLAG_xxx decode flags
+    std::vector<size_t>     m_restarts;     ///< offsets of the restart markers
+    std::vector<segment_t>  m_segments;     ///< bands of the frame
 };
 
 #endif
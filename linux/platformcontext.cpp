@@ -28,28 +28,134 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include <sys/ioctl.h>
 #include <string>
+#include <algorithm>
 #include <linux/videodev2.h>
 
 #include "../common/logging.h"
 #include "platformstream.h"
 #include "platformcontext.h"
+#include "fakedeviceio.h"
+#include "archivedeviceio.h"
 
-// a platform factory function needed by
+// platform factory functions needed by
 // libmain.cpp
+Context* createPlatformReplayContext(const char **filenames, uint32_t count, bool realtime)
+{
+    std::shared_ptr<ArchiveDeviceIO> io = std::make_shared<ArchiveDeviceIO>();
+    uint32_t devices = 0;
+    for(uint32_t i=0; i<count; i++)
+    {
+        if ((filenames[i] != nullptr) && io->addArchive(filenames[i], realtime))
+        {
+            devices++;
+        }
+    }
+
+    if (devices == 0)
+    {
+        return nullptr;
+    }
+
+    LOG(LOG_INFO, "Replaying %d capture archives\n", devices);
+    return new PlatformContext(io);
+}
+
 Context* createPlatformContext()
 {
+    // OPENPNP_CAPTURE_ARCHIVE=<file>[:<file>...] replaces the
+    // V4L2 devices by devices that replay capture archives.
+    // OPENPNP_CAPTURE_ARCHIVE_FAST=1 replays them as fast 
+    // as the frames are dequeued.
+    const char *archives = getenv("OPENPNP_CAPTURE_ARCHIVE");
+    if ((archives != nullptr) && (archives[0] != 0))
+    {
+        const char *fast = getenv("OPENPNP_CAPTURE_ARCHIVE_FAST");
+        bool realtime = (fast == nullptr) || (atoi(fast) == 0);
+
+        std::vector<std::string> names;
+        std::string list = archives;
+        size_t start = 0;
+        while(start <= list.size())
+        {
+            size_t end = list.find(':', start);
+            if (end == std::string::npos)
+            {
+                end = list.size();
+            }
+            if (end > start)
+            {
+                names.push_back(list.substr(start, end - start));
+            }
+            start = end + 1;
+        }
+
+        std::vector<const char*> filenames;
+        for(auto const &name : names)
+        {
+            filenames.push_back(name.c_str());
+        }
+        Context *ctx = createPlatformReplayContext(filenames.data(), filenames.size(), realtime);
+        if (ctx != nullptr)
+        {
+            return ctx;
+        }
+        LOG(LOG_ERR, "No capture archives could be read, using the V4L2 devices\n");
+    }
+
+    // OPENPNP_CAPTURE_FAKE_V4L2=<n> replaces the V4L2 
+    // devices by n fake devices, for testing without cameras.
+    // OPENPNP_CAPTURE_FAKE_V4L2_FREERUN=1 makes them deliver
+    // frames as fast as they are dequeued.
+    const char *fake = getenv("OPENPNP_CAPTURE_FAKE_V4L2");
+    if (fake != nullptr)
+    {
+        const char *freerun = getenv("OPENPNP_CAPTURE_FAKE_V4L2_FREERUN");
+        bool realtime = (freerun == nullptr) || (atoi(freerun) == 0);
+
+        std::shared_ptr<FakeDeviceIO> io = std::make_shared<FakeDeviceIO>();
+        int count = std::max(atoi(fake), 1);
+        for(int i=0; i<count; i++)
+        {
+            io->addDefaultDevice(realtime);
+        }
+        LOG(LOG_INFO, "Using %d fake V4L2 devices\n", count);
+        return new PlatformContext(io);
+    }
     return new PlatformContext();
 }
 
-PlatformContext::PlatformContext() :
-    Context()
+/** USB devices report a bus_info like "usb-0000:00:14.0-1.2", 
+    where the part before the port path identifies the host 
+    controller that the devices share. Other devices get an 
+    empty key, i.e. no known bandwidth constraint. */
+static std::string busKeyFromBusInfo(const std::string &busInfo)
+{
+    if (busInfo.compare(0, 4, "usb-") != 0)
+    {
+        return std::string();
+    }
+
+    size_t pos = busInfo.find('-', 4);
+    if (pos == std::string::npos)
+    {
+        return busInfo;
+    }
+    return busInfo.substr(0, pos);
+}
+
+PlatformContext::PlatformContext(std::shared_ptr<DeviceIO> io) :
+    Context(),
+    m_io(io)
 {
+    if (!m_io)
+    {
+        m_io = std::make_shared<SystemDeviceIO>();
+    }
     LOG(LOG_DEBUG, "Context created\n");
-    enumerateDevices();
 }
 
 PlatformContext::~PlatformContext()
@@ -65,25 +171,38 @@ bool PlatformContext::enumerateDevices()
 
     const uint32_t maxDevices = 64; // FIXME: is this a sane number for linux?
 
+    // metadata nodes and the bus of each video device,
+    // to pair them once all nodes are known.
+    std::vector<std::pair<std::string, std::string> > metadataNodes;
+    std::vector<std::string> videoBuses;
+
     uint32_t dcount = 0;
     while(dcount < maxDevices)
     {
         char fname[100];
         snprintf(fname, sizeof(fname), "/dev/video%d", dcount++);
 
-        if ((fd = ::open(fname, O_RDWR /* required */ | O_NONBLOCK)) == -1)
+        if ((fd = m_io->open(fname, O_RDWR /* required */ | O_NONBLOCK)) == -1)
         {
             //LOG(LOG_ERR, "enumerateDevices: Can't open device %s\n", fname);
             continue;
         }
 
-        if (ioctl(fd, VIDIOC_QUERYCAP, &video_cap) == -1)
+        if (xioctl(m_io.get(), fd, VIDIOC_QUERYCAP, &video_cap) == -1)
         {
-            ::close(fd);
+            m_io->close(fd);
             LOG(LOG_ERR, "enumerateDevices: Can't get capabilities\n");
             continue;
         }
         
+        if (((video_cap.device_caps & V4L2_CAP_META_CAPTURE) != 0) &&
+            ((video_cap.device_caps & V4L2_CAP_VIDEO_CAPTURE) == 0))
+        {
+            LOG(LOG_INFO,"Metadata node: '%s' bus '%s'\n", fname, video_cap.bus_info);
+            metadataNodes.push_back(std::make_pair(std::string((const char*)video_cap.bus_info), 
+                std::string(fname)));
+        }
+
         if ((video_cap.device_caps & V4L2_CAP_VIDEO_CAPTURE) != 0)
         {
             LOG(LOG_INFO,"Name: '%s'\n", video_cap.card);
@@ -124,6 +243,7 @@ bool PlatformContext::enumerateDevices()
             dinfo->m_devicePath = std::string(fname);
             dinfo->m_uniqueID = dinfo->m_name + " ";
             dinfo->m_uniqueID.append((const char*)video_cap.bus_info);
+            dinfo->m_busKey = busKeyFromBusInfo((const char*)video_cap.bus_info);
             
             // enumerate the frame formats
             v4l2_fmtdesc fmtdesc;
@@ -138,7 +258,7 @@ bool PlatformContext::enumerateDevices()
             {
                 fmtdesc.index = index;
             
-                if (ioctl(fd, VIDIOC_ENUM_FMT, &fmtdesc) == -1)
+                if (xioctl(m_io.get(), fd, VIDIOC_ENUM_FMT, &fmtdesc) == -1)
                 {
                     tryMore = false;
                 }
@@ -164,9 +284,28 @@ bool PlatformContext::enumerateDevices()
             }
 
             m_devices.push_back(dinfo);
+            videoBuses.push_back(std::string((const char*)video_cap.bus_info));
         }
 
-        ::close(fd);         
+        m_io->close(fd);         
+    }
+
+    // UVC creates a metadata node next to each video node,
+    // on the same bus. Pair them in order of appearance.
+    for(size_t i=0; i<m_devices.size(); i++)
+    {
+        for(auto iter = metadataNodes.begin(); iter != metadataNodes.end(); ++iter)
+        {
+            if (iter->first == videoBuses[i])
+            {
+                platformDeviceInfo *dinfo = static_cast<platformDeviceInfo*>(m_devices[i]);
+                dinfo->m_metadataPath = iter->second;
+                LOG(LOG_INFO, "%s has metadata node %s\n", dinfo->m_devicePath.c_str(), 
+                    dinfo->m_metadataPath.c_str());
+                metadataNodes.erase(iter);
+                break;
+            }
+        }
     }
     return true;
 }
@@ -177,7 +316,7 @@ bool PlatformContext::queryFrameSize(int fd, uint32_t index, uint32_t pixelforma
     v4l2_frmsizeenum frmSize;
     frmSize.index = index;
     frmSize.pixel_format = pixelformat;
-    if (ioctl(fd, VIDIOC_ENUM_FRAMESIZES, &frmSize) != -1)
+    if (xioctl(m_io.get(), fd, VIDIOC_ENUM_FRAMESIZES, &frmSize) != -1)
     {
         if (frmSize.type == V4L2_FRMSIZE_TYPE_DISCRETE)
         {
@@ -208,7 +347,7 @@ uint32_t PlatformContext::findMaxFrameRate(int fd, uint32_t pixelformat,
     ivals.height = height;
     ivals.index = 0;
     LOG(LOG_VERBOSE,"Finding max frame rates: \n");
-    while (ioctl(fd, VIDIOC_ENUM_FRAMEINTERVALS, &ivals) != -1)
+    while (xioctl(m_io.get(), fd, VIDIOC_ENUM_FRAMEINTERVALS, &ivals) != -1)
     {
         if (ivals.type == V4L2_FRMIVAL_TYPE_DISCRETE)
         {
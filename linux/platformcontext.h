@@ -36,12 +36,14 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <memory>
 #include <stdint.h>
 
 #include "openpnp-capture.h"
 
 #pragma comment(lib, "strmiids")
 #include "platformdeviceinfo.h"
+#include "deviceio.h"
 #include "../common/context.h"
 
 /** context base class keeps track of all the platform independent
@@ -51,15 +53,24 @@ class PlatformContext : public Context
 {
 public:
     /** Create a context for the library.
-        Device enumeration is perform in the constructor,
-        so all devices must be present in the system when
-        the Context is created or devices will not be found.
+        The devices are enumerated afterwards, see 
+        Context::enumerate, so all devices must be present
+        in the system at that time or they will not be found.
 
         Re-enumeration support is pending.
+
+        All device access goes through 'io', so a FakeDeviceIO
+        can stand in for the kernel. NULL selects the system calls.
     */
-    PlatformContext();
+    PlatformContext(std::shared_ptr<DeviceIO> io = nullptr);
     virtual ~PlatformContext();
 
+    /** returns the device I/O used by the context and its streams */
+    std::shared_ptr<DeviceIO> getDeviceIO() const
+    {
+        return m_io;
+    }
+
 protected:
     bool queryFrameSize(int fd, uint32_t index, uint32_t pixelformat, uint32_t *width, uint32_t *height);
 
@@ -70,6 +81,13 @@ protected:
     */
     virtual bool enumerateDevices();
 
+    /** V4L2 devices can be opened from several threads */
+    virtual bool supportsConcurrentOpen() const override
+    {
+        return true;
+    }
+
+    std::shared_ptr<DeviceIO> m_io;     ///< device I/O shared with the streams
 };
 
 #endif
\ No newline at end of file
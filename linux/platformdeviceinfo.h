@@ -49,6 +49,7 @@ public:
     }
 
     std::string     m_devicePath;   ///< unique device path
+    std::string     m_metadataPath; ///< path of the UVC metadata node of the device, empty if none
 };
 
 #endif
\ No newline at end of file
@@ -36,6 +36,7 @@
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/mman.h>
+#include <time.h>
 #include <memory.h>
 #include <string>
 #include "scopedptr.h"
@@ -43,35 +44,36 @@
 #include "platformdeviceinfo.h"
 #include "platformstream.h"
 #include "platformcontext.h"
-#include "yuvconverters.h"
+#include "decodepool.h"
+#include "../common/alloctracker.h"
 
 #define CLEAR(x) memset(&(x), 0, sizeof(x))
 
+// a background stream converts at least one
+// frame after this many skipped frames.
+#define MAX_SKIPPED_FRAMES 4
+
 Stream* createPlatformStream()
 {
     return new PlatformStream();
 }
 
-int xioctl(int fh, int request, void *arg)
+/** returns a monotonic timestamp in microseconds */
+static uint64_t getMonotonicMicros()
 {
-    int r;
-
-    do 
-    {
-        r = ioctl(fh, request, arg);
-    } while ((r == -1) && (errno == EINTR));
-
-    return r;
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec)*1000000 + ts.tv_nsec/1000;
 }
 
-
 // **********************************************************************
 //   PlatformStreamHelper functions
 // **********************************************************************
 
-bool PlatformStreamHelper::createAndMapBuffers(uint32_t nBuffers)
+bool PlatformStreamHelper::createAndMapBuffers(uint32_t nBuffers, CapOpenTiming *timing)
 {
     v4l2_requestbuffers req;
+    uint64_t t0 = getMonotonicMicros();
 
     CLEAR(req);
 
@@ -79,7 +81,7 @@ bool PlatformStreamHelper::createAndMapBuffers(uint32_t nBuffers)
     req.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     req.memory = V4L2_MEMORY_MMAP;
 
-    if (xioctl(m_fd, VIDIOC_REQBUFS, &req) == -1) 
+    if (xioctl(m_io, m_fd, VIDIOC_REQBUFS, &req) == -1) 
     {
         LOG(LOG_ERR, "createAndMapBuffers failed - no memory mapping support.\n");
         return false;
@@ -93,6 +95,12 @@ bool PlatformStreamHelper::createAndMapBuffers(uint32_t nBuffers)
 
     LOG(LOG_DEBUG, "Reserving %d mmap buffers\n", req.count);
 
+    uint64_t t1 = getMonotonicMicros();
+    if (timing != nullptr)
+    {
+        timing->requestBuffers = static_cast<uint32_t>(t1 - t0);
+    }
+
     m_buffers.resize(req.count);
 
     for (uint32_t b = 0; b < req.count; ++b) 
@@ -105,14 +113,14 @@ bool PlatformStreamHelper::createAndMapBuffers(uint32_t nBuffers)
         buf.memory      = V4L2_MEMORY_MMAP;
         buf.index       = b;
 
-        if (xioctl(m_fd, VIDIOC_QUERYBUF, &buf) == -1)
+        if (xioctl(m_io, m_fd, VIDIOC_QUERYBUF, &buf) == -1)
         {
             LOG(LOG_ERR, "createAndMapBuffers: VIDIOC_QUERYBUF failed.\n");
             return false;
         }
 
         m_buffers[b].length = buf.length;
-        m_buffers[b].start  = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, 
+        m_buffers[b].start  = m_io->mmap(buf.length, PROT_READ | PROT_WRITE, 
             MAP_SHARED, m_fd, buf.m.offset);
 
         if (m_buffers[b].start == MAP_FAILED)
@@ -127,6 +135,11 @@ bool PlatformStreamHelper::createAndMapBuffers(uint32_t nBuffers)
 
     }
 
+    if (timing != nullptr)
+    {
+        timing->mapBuffers = static_cast<uint32_t>(getMonotonicMicros() - t1);
+    }
+
     return true;
 }
 
@@ -134,7 +147,7 @@ void PlatformStreamHelper::unmapAndDeleteBuffers()
 {
     for(uint32_t i=0; i<m_buffers.size(); i++)
     {
-        munmap(m_buffers[i].start, m_buffers[i].length);
+        m_io->munmap(m_buffers[i].start, m_buffers[i].length);
     }
 
     m_buffers.clear();
@@ -157,7 +170,7 @@ bool PlatformStreamHelper::queueAllBuffers()
         buf.memory = V4L2_MEMORY_MMAP;
         buf.index = i;
 
-        if (xioctl(m_fd, VIDIOC_QBUF, &buf) == -1)
+        if (xioctl(m_io, m_fd, VIDIOC_QBUF, &buf) == -1)
         {
             LOG(LOG_ERR,"VIDIOC_QBUF failed (errno=%d)\n", errno);
             return false;
@@ -170,7 +183,7 @@ bool PlatformStreamHelper::streamOn()
 {
     v4l2_buf_type bufferType = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 
-    if (xioctl(m_fd, VIDIOC_STREAMON, &bufferType) == -1)
+    if (xioctl(m_io, m_fd, VIDIOC_STREAMON, &bufferType) == -1)
     {
         LOG(LOG_ERR,"VIDIOC_STREAMON failed (errno=%d)\n", errno);
         return false;
@@ -184,7 +197,7 @@ bool PlatformStreamHelper::streamOn()
 bool PlatformStreamHelper::streamOff()
 {
     v4l2_buf_type bufferType = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    if (xioctl(m_fd, VIDIOC_STREAMOFF, &bufferType) == -1)
+    if (xioctl(m_io, m_fd, VIDIOC_STREAMOFF, &bufferType) == -1)
     {
         LOG(LOG_ERR,"VIDIOC_STREAMOFF failed (errno=%d)\n", errno);
         return false;
@@ -199,7 +212,7 @@ bool PlatformStreamHelper::streamOff()
 //   Capture thread/function
 // **********************************************************************
 
-void captureThreadFunction(PlatformStream *stream, int fd, size_t bufferSizeBytes)
+void captureThreadFunction(PlatformStream *stream, DeviceIO *io, int fd, size_t bufferSizeBytes)
 {
     if (stream == nullptr)
     {
@@ -210,6 +223,8 @@ void captureThreadFunction(PlatformStream *stream, int fd, size_t bufferSizeByte
 
     // create local frame buffer
     std::vector<uint8_t> buffer(bufferSizeBytes);
+    stream->setDriverBufferBytes(bufferSizeBytes);
+    uint32_t sequence = 0;
 
     // FIXME: For now, weĺl just rely on the read to fail
     // when the PlatformStream closes the file
@@ -217,7 +232,8 @@ void captureThreadFunction(PlatformStream *stream, int fd, size_t bufferSizeByte
     // but it should work :)
     while(!stream->getThreadQuitState())
     {
-        ssize_t actualBytesRead = ::read(fd, &buffer[0], bufferSizeBytes);
+        FRAMEPATH_SCOPE;
+        ssize_t actualBytesRead = io->read(fd, &buffer[0], bufferSizeBytes);
         if (actualBytesRead < 0)
         {
             LOG(LOG_DEBUG, "capture thread exited (errno %d).\n", errno);
@@ -225,18 +241,21 @@ void captureThreadFunction(PlatformStream *stream, int fd, size_t bufferSizeByte
         }
 
         // read will only return complete buffers
-        stream->threadSubmitBuffer(&buffer[0], actualBytesRead);
-        LOG(LOG_INFO, "yay\n");
+        CapFrameMetadata metadata;
+        CLEAR(metadata);
+        metadata.sequence = sequence++;
+        metadata.captureTimestamp = getMonotonicMicros();
+        metadata.flags = CAPFRAMEMETA_TIMESTAMP;
+        stream->threadArchiveBuffer(&buffer[0], actualBytesRead, metadata.captureTimestamp, metadata.sequence);
+        stream->threadSubmitBuffer(&buffer[0], actualBytesRead, &metadata);
     }
 }
 
 
 
-void captureThreadFunctionAsync(PlatformStream *stream, int fd, size_t bufferSizeBytes)
+void captureThreadFunctionAsync(PlatformStream *stream, DeviceIO *io, int fd, uint32_t nBuffers)
 {
     //https://linuxtv.org/downloads/v4l-dvb-apis/uapi/v4l/capture.c.html
-    const uint32_t nBuffers = 8;
-    
     if (stream == nullptr)
     {
         return;
@@ -244,50 +263,132 @@ void captureThreadFunctionAsync(PlatformStream *stream, int fd, size_t bufferSiz
 
     LOG(LOG_DEBUG, "captureThreadFunctionAsync started\n");
 
-    PlatformStreamHelper *pHelper = new PlatformStreamHelper(fd);
+    PlatformStreamHelper *pHelper = new PlatformStreamHelper(io, fd);
     ScopedPtr<PlatformStreamHelper> helper(pHelper);
 
-    if (!helper->createAndMapBuffers(nBuffers))
+    // continue the open timing started by PlatformStream::open
+    CapOpenTiming timing;
+    stream->getOpenTiming(&timing);
+
+    bool mapped = helper->createAndMapBuffers(nBuffers, &timing);
+
+    // the driver may have changed the number or size of
+    // the buffers, so replace the reservation made by
+    // open() with the actual size.
+    stream->setDriverBufferBytes(helper->getMappedBytes());
+    if (!mapped)
     {
         return;
     }
     
+    uint64_t t0 = getMonotonicMicros();
     if (!helper->queueAllBuffers())
     {
         return;
     }
     
+    uint64_t t1 = getMonotonicMicros();
     if (!helper->streamOn())
     {
         return;
     }
 
+    uint64_t streamOnTime = getMonotonicMicros();
+    timing.queueBuffers = static_cast<uint32_t>(t1 - t0);
+    timing.streamOn     = static_cast<uint32_t>(streamOnTime - t1);
+    stream->threadSetOpenTiming(timing);
+    bool firstFrame = true;
+
+    // the start of exposure is known if the device
+    // has a UVC metadata node.
+    UVCMetadataNode metadataNode;
+    if (!stream->threadGetMetadataPath().empty())
+    {
+        metadataNode.open(io, stream->threadGetMetadataPath());
+    }
+
+    // metadata of the frame in each buffer, written by this 
+    // thread before the buffer is handed to the conversion thread.
+    std::vector<CapFrameMetadata> bufferMetadata(helper->getBufferCount());
+
+    // frames are converted on a thread of their own, so this
+    // thread can re-queue buffers while a frame is being decoded
+    // and the driver does not run out of buffers.
+    ConversionStage &stage = stream->threadGetConversionStage();
+    CapFrameMetadata *pMetadata = &bufferMetadata[0];
+    stage.start([stream, pHelper, pMetadata](uint32_t index, uint32_t bytes)
+        {
+            stream->threadSubmitBuffer(pHelper->getBufferPointer(index), bytes, &pMetadata[index]);
+        }, helper->getBufferCount());
+
+    // stop the conversion thread on every exit,
+    // before the helper unmaps the buffers.
+    struct stageGuard_t
+    {
+        ConversionStage &stage;
+        ~stageGuard_t() { stage.stop(); }
+    } stageGuard = {stage};
+
+    uint32_t queued = helper->getBufferCount();
+
     while(!stream->getThreadQuitState())
     {
-        fd_set fds;
+        FRAMEPATH_SCOPE;
+
+        // ****************************************
+        // give converted buffers back to the driver
+        // ****************************************
+        uint32_t index;
+        bool requeueFailed = false;
+        while(stage.popConverted(index))
+        {
+            v4l2_buffer buf;
+            CLEAR(buf);
+            buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            buf.memory = V4L2_MEMORY_MMAP;
+            buf.index = index;
+            if (xioctl(io, fd, VIDIOC_QBUF, &buf) == -1)
+            {
+                requeueFailed = true;
+                break;
+            }
+            queued++;
+        }
+
+        if (requeueFailed)
+        {
+            LOG_LIMITED(LOG_ERR, "VIDIOC_QBUF error\n");
+            return;
+        }
+
+        if (queued == 0)
+        {
+            // all buffers are waiting for or being converted
+            stage.waitForConverted(100);
+            continue;
+        }
+
         struct timeval tv;
         int result;
 
-        FD_ZERO(&fds);
-        FD_SET(fd, &fds);
-
         /* Timeout. */
         tv.tv_sec = 5;
         tv.tv_usec = 0;
 
-        result = select(fd + 1, &fds, NULL, NULL, &tv);
+        result = io->select(fd, &tv);
         if (result == -1)
         {
             if (errno == EINTR)
             {
+                stream->threadRecordRecovery();
                 continue;
             }
-            LOG(LOG_ERR,"Select failed (errno=%d)\n", errno);
+            LOG_LIMITED(LOG_ERR,"Select failed (errno=%d)\n", errno);
             return;
         }
         else if (result == 0)
         {
-            LOG(LOG_ERR,"Select timeout\n");
+            LOG_LIMITED(LOG_ERR,"Select timeout\n");
             return;
         }
 
@@ -299,13 +400,14 @@ void captureThreadFunctionAsync(PlatformStream *stream, int fd, size_t bufferSiz
         buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
         buf.memory = V4L2_MEMORY_MMAP;
 
-        if (xioctl(fd, VIDIOC_DQBUF, &buf) == -1)
+        if (xioctl(io, fd, VIDIOC_DQBUF, &buf) == -1)
         {
             switch (errno) 
             {
             case EAGAIN:
-                LOG(LOG_DEBUG, "VIDIOC_DQBUF returned EAGAIN\n");
+                LOG_LIMITED(LOG_DEBUG, "VIDIOC_DQBUF returned EAGAIN\n");
                 //FIXME: what to do here?!?
+                stream->threadRecordRecovery();
                 continue;
 
             case EIO:
@@ -314,19 +416,74 @@ void captureThreadFunctionAsync(PlatformStream *stream, int fd, size_t bufferSiz
                 /* fall through */
 
             default:
-                LOG(LOG_ERR, "VIDIOC_DQBUF error\n");
+                LOG_LIMITED(LOG_ERR, "VIDIOC_DQBUF error\n");
                 return;
             }
         }
 
+        if (firstFrame)
+        {
+            uint64_t now = getMonotonicMicros();
+            timing.firstFrame = static_cast<uint32_t>(now - streamOnTime);
+            timing.total      = static_cast<uint32_t>(now - stream->getOpenStartTime());
+            stream->threadSetOpenTiming(timing);
+            firstFrame = false;
+
+            LOG(LOG_DEBUG, "Open timing (us): open %u, S_FMT %u, G_FMT %u, S_PARM %u, "
+                "REQBUFS %u, mmap %u, QBUF %u, STREAMON %u, first DQBUF %u, total %u\n",
+                timing.deviceOpen, timing.setFormat, timing.getFormat, timing.setFrameRate,
+                timing.requestBuffers, timing.mapBuffers, timing.queueBuffers, timing.streamOn,
+                timing.firstFrame, timing.total);
+        }
+
+        queued--;
+
         //assert(buf.index < nBuffers);
-        stream->threadSubmitBuffer(helper->getBufferPointer(buf.index), buf.bytesused);
+        uint64_t timestamp = static_cast<uint64_t>(buf.timestamp.tv_sec)*1000000 + buf.timestamp.tv_usec;
+        stream->threadArchiveBuffer(helper->getBufferPointer(buf.index), buf.bytesused, 
+            timestamp, buf.sequence);
 
-        // re-queue the buffer
-        if (xioctl(fd, VIDIOC_QBUF, &buf) == -1)
+        if (buf.index < bufferMetadata.size())
         {
-            LOG(LOG_ERR, "VIDIOC_DQBUF error\n");
-            return;    
+            CapFrameMetadata &metadata = bufferMetadata[buf.index];
+            CLEAR(metadata);
+            metadata.sequence = buf.sequence;
+            metadata.captureTimestamp = timestamp;
+            metadata.flags = CAPFRAMEMETA_TIMESTAMP;
+
+            // the metadata buffer of a frame completes
+            // together with its video buffer.
+            metadataNode.poll();
+            bool exposureValid = false;
+            if (metadataNode.getExposure(buf.sequence, metadata.devicePTS, 
+                metadata.exposureTimestamp, exposureValid))
+            {
+                metadata.flags |= CAPFRAMEMETA_PTS;
+                if (exposureValid)
+                {
+                    metadata.flags |= CAPFRAMEMETA_EXPOSURE;
+                }
+                else
+                {
+                    metadata.exposureTimestamp = 0;
+                }
+            }
+        }
+
+        // hand the buffer to the conversion thread. A buffer
+        // it has not started on yet holds an older frame, which
+        // is dropped and re-queued right away.
+        int32_t dropped = stage.submit(buf.index, buf.bytesused);
+        if (dropped >= 0)
+        {
+            stream->threadRecordDroppedFrame();
+            buf.index = static_cast<uint32_t>(dropped);
+            if (xioctl(io, fd, VIDIOC_QBUF, &buf) == -1)
+            {
+                LOG_LIMITED(LOG_ERR, "VIDIOC_QBUF error\n");
+                return;    
+            }
+            queued++;
         }
     } // while  
 
@@ -343,21 +500,45 @@ void captureThreadFunctionAsync(PlatformStream *stream, int fd, size_t bufferSiz
 
 PlatformStream::PlatformStream() : 
     Stream(),
+    m_deviceHandle(-1),
     m_quitThread(false),
-    m_helperThread(nullptr)
+    m_helperThread(nullptr),
+    m_exposureController(nullptr),
+    m_bufferRing(nullptr),
+    m_openStart(0),
+    m_priority(CAPPRIORITY_NORMAL),
+    m_skippedFrames(0),
+    m_droppedFrames(0),
+    m_decodeMicros(0),
+    m_lastDecodeMicros(0),
+    m_recoveries(0),
+    m_fpsWindowStart(0),
+    m_fpsWindowFrames(0),
+    m_fps(0.0f),
+    m_scratchBytes(0),
+    m_frameRate(0),
+    m_archive(nullptr),
+    m_preview(nullptr)
 {
+    CLEAR(m_openTiming);
 
 }
 
 PlatformStream::~PlatformStream()
 {
     close();
+    delete m_bufferRing;
 }
 
 void PlatformStream::close()
 {
     LOG(LOG_INFO, "closing stream\n");
 
+    // the exposure controller posts property requests and
+    // pending property requests need the device
+    setExposureControl(nullptr);
+    stopControlWorker();
+
     m_owner = nullptr;
     m_width = 0;
     m_height = 0;
@@ -373,10 +554,18 @@ void PlatformStream::close()
         m_helperThread = nullptr;
     }
 
-    m_frameBuffer.resize(0);
-    ::close(m_deviceHandle);
+    // the capture thread has unmapped its buffers
+    setDriverBufferBytes(0);
+    stopRecording();
+    stopPreviewServer();
+    resizeFrameBuffer(0);
+    if (m_io && (m_deviceHandle >= 0))
+    {
+        m_io->close(m_deviceHandle);
+    }
 
     m_deviceHandle = -1;    
+    m_io.reset();
 }
 
 void test(size_t bufferSizeBytes)
@@ -411,12 +600,28 @@ bool PlatformStream::open(Context *owner, deviceInfo *device, uint32_t width, ui
         return false;
     }
 
+    PlatformContext *pctx = dynamic_cast<PlatformContext*>(owner);
+    if (pctx == NULL)
+    {
+        LOG(LOG_CRIT, "Could not cast Context* to PlatformContext*!");
+        return false;
+    }
+
+    // the stream keeps the device I/O alive
+    // until it is closed.
+    m_io = pctx->getDeviceIO();
     m_owner = owner;
     m_frames = 0;
     m_width = 0;
     m_height = 0;    
 
-    m_deviceHandle = ::open(dinfo->m_devicePath.c_str(), O_RDWR /* required */ | O_NONBLOCK);
+    // the capture thread is not running, so the
+    // open timing can be written without locking
+    CLEAR(m_openTiming);
+    m_openStart = getMonotonicMicros();
+
+    m_metadataPath = dinfo->m_metadataPath;
+    m_deviceHandle = m_io->open(dinfo->m_devicePath.c_str(), O_RDWR /* required */ | O_NONBLOCK);
     if (m_deviceHandle < 0)
     {
         LOG(LOG_CRIT, "Could not open device %s (errno = %d)\n", dinfo->m_devicePath.c_str(), errno);
@@ -424,6 +629,9 @@ bool PlatformStream::open(Context *owner, deviceInfo *device, uint32_t width, ui
         return false;
     }
 
+    uint64_t t0 = getMonotonicMicros();
+    m_openTiming.deviceOpen = static_cast<uint32_t>(t0 - m_openStart);
+
     // request a format
     m_fmt.type       = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     m_fmt.fmt.pix.width  = width;
@@ -438,23 +646,28 @@ bool PlatformStream::open(Context *owner, deviceInfo *device, uint32_t width, ui
     m_fmt.fmt.pix.sizeimage = 0;        // only set be the driver
     m_fmt.fmt.pix.priv = 0; 
 
-    if (xioctl(m_deviceHandle, VIDIOC_S_FMT, &m_fmt) == -1)
+    if (xioctl(m_io.get(), m_deviceHandle, VIDIOC_S_FMT, &m_fmt) == -1)
     {
         LOG(LOG_CRIT, "Could set the frame buffer format (errno = %d)\n", errno);
         close();
         return false;
     }
 
+    uint64_t t1 = getMonotonicMicros();
+    m_openTiming.setFormat = static_cast<uint32_t>(t1 - t0);
+
     // now get the actual format information set by the
     // driver
 
-    if (xioctl(m_deviceHandle, VIDIOC_G_FMT, &m_fmt) == -1)
+    if (xioctl(m_io.get(), m_deviceHandle, VIDIOC_G_FMT, &m_fmt) == -1)
     {
         LOG(LOG_CRIT, "Could not query default format (errno = %d)\n", errno);
         close();
         return false;
     }
 
+    m_openTiming.getFormat = static_cast<uint32_t>(getMonotonicMicros() - t1);
+
     LOG(LOG_INFO, "Format buffer type: %d\n", m_fmt.type);
     if (m_fmt.type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
     {
@@ -471,24 +684,43 @@ bool PlatformStream::open(Context *owner, deviceInfo *device, uint32_t width, ui
     LOG(LOG_INFO, "FOURCC = %s\n", fourCCToString(m_fmt.fmt.pix.pixelformat).c_str());
     LOG(LOG_INFO, "FPS    = %d\n", fps);
 
+    // setup the converter for the frames. Unsupported
+    // formats will still be captured but not converted.
+    m_converter.setup(m_fmt.fmt.pix.pixelformat, m_width, m_height, CAPOUTFMT_RGB24);
+
     // set the desired frame rate
     v4l2_streamparm sparam;
     CLEAR(sparam);
     sparam.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     sparam.parm.capture.timeperframe.numerator   = 1;
     sparam.parm.capture.timeperframe.denominator = fps;
-    if (xioctl(m_deviceHandle, VIDIOC_S_PARM, &sparam) == -1)
+    uint64_t t2 = getMonotonicMicros();
+    if (xioctl(m_io.get(), m_deviceHandle, VIDIOC_S_PARM, &sparam) == -1)
     {
         LOG(LOG_CRIT, "Could not set the frame rate (errno = %d)\n", errno);
         close();
         return false;
     }    
+    m_openTiming.setFrameRate = static_cast<uint32_t>(getMonotonicMicros() - t2);
 
     // set the (max) size of the frame buffer in Stream class
     //
     // Note: we only support 24-bit per pixel RGB
     // buffers for now!
-    m_frameBuffer.resize(m_width*m_height*3);
+    resizeFrameBuffer(m_width*m_height*3);
+    m_frameRate = fps;
+
+#ifndef __V4L2_NO_STREAMNING_SUPPORT
+    // choose the number of driver buffers that fit the
+    // memory budget of the context. 
+    size_t bufferBytes = m_fmt.fmt.pix.sizeimage;
+    if (bufferBytes == 0)
+    {
+        bufferBytes = m_width*m_height*2;
+    }
+    uint32_t nBuffers = m_owner->chooseBufferCount(this, bufferBytes, 
+        m_frameBuffer.capacity() + m_converter.getScratchBytes(), 2, 8);
+#endif
 
     m_isOpen = true;
 
@@ -498,10 +730,10 @@ bool PlatformStream::open(Context *owner, deviceInfo *device, uint32_t width, ui
     // for now, assume we always have streaming driver support
 #ifdef __V4L2_NO_STREAMNING_SUPPORT
     m_helperThread = new std::thread(&captureThreadFunction, this,
-        m_deviceHandle, m_width*m_height*4);
+        m_io.get(), m_deviceHandle, m_width*m_height*4);
 #else
     m_helperThread = new std::thread(&captureThreadFunctionAsync, this,
-        m_deviceHandle, m_width*m_height*4);
+        m_io.get(), m_deviceHandle, nBuffers);
 #endif
 
     return true;
@@ -528,57 +760,188 @@ V4L2_PIX_FMT_SBGGR8  BA81
 
 //#define FRAMEDUMP
 
-void PlatformStream::threadSubmitBuffer(void *ptr, size_t bytes)
+void PlatformStream::threadSubmitBuffer(void *ptr, size_t bytes, const CapFrameMetadata *metadata)
 {
-    if (ptr != nullptr) 
+    FRAMEPATH_SCOPE;
+    if (ptr == nullptr) 
     {
-        switch(m_fmt.fmt.pix.pixelformat)
+        return;
+    }
+
+    if (!m_converter.isValid())
+    {
+        LOG_LIMITED(LOG_DEBUG, "ThreadSubmitBuffer: unsupported format %s (%08X)\n", fourCCToString(m_fmt.fmt.pix.pixelformat).c_str(),
+            m_fmt.fmt.pix.pixelformat);
+        return;
+    }
+
+    // forward MJPEG frames to the preview as they are,
+    // there is no need to re-encode them.
+    bool mjpeg = (m_fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_MJPEG);
+    m_previewMutex.lock();
+    bool preview = (m_preview != nullptr) && m_preview->wantsFrame();
+    if (preview && mjpeg)
+    {
+        m_preview->submitJPEG((const uint8_t*)ptr, bytes);
+        preview = false;
+    }
+    m_previewMutex.unlock();
+
+    #ifdef FRAMEDUMP
+    if (m_fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_MJPEG)
+    {
+        static int32_t fcnt = 0;
+        char fname[100];
+        if (fcnt < 10)
         {
-        case V4L2_PIX_FMT_RGB24:
-            Stream::submitBuffer((uint8_t*)ptr, bytes);
-            break;
-        case V4L2_PIX_FMT_YUYV:
-            // here we implement our own ::submitBuffer replacement
-            // so we can decode the 16-bit YUYV frames and copy the 24-bit
-            // RGB pixels into m_frameBuffer
-            m_bufferMutex.lock();
-            YUYV2RGB((const uint8_t*)ptr, &m_frameBuffer[0], bytes);
-            m_newFrame = true;
-            m_frames++;
+            sprintf(fname,"frame_%d.dat", fcnt++);
+            FILE *fout = fopen(fname, "wb");
+            fwrite(ptr, 1, bytes, fout);
+            fclose(fout);
+        }
+    }
+    #endif
+
+    // here we implement our own ::submitBuffer replacement
+    // so we can convert the frames and copy the 24-bit
+    // RGB pixels straight into m_frameBuffer
+    m_bufferMutex.lock();
+    if ((m_priority == CAPPRIORITY_BACKGROUND) && (m_skippedFrames < MAX_SKIPPED_FRAMES) &&
+        DecodePool::isBusyAbove(m_priority))
+    {
+        // other streams are converting frames, so drop this
+        // one to leave the CPU to them.
+        m_skippedFrames++;
+        m_droppedFrames++;
+        LOG_LIMITED(LOG_VERBOSE, "Background stream skipped a frame\n");
+        m_bufferMutex.unlock();
+        return;
+    }
+    m_skippedFrames = 0;
+
+    // with an application buffer ring, the frame is converted
+    // straight into its next slot instead of m_frameBuffer.
+    uint8_t *dst = &m_frameBuffer[0];
+    if (m_bufferRing != nullptr)
+    {
+        dst = m_bufferRing->beginFrame(static_cast<size_t>(m_width)*m_height*3);
+        if (dst == nullptr)
+        {
+            m_droppedFrames++;
+            LOG_LIMITED(LOG_VERBOSE, "Buffer ring is full, frame dropped\n");
             m_bufferMutex.unlock();
-            break;            
-        case 0x47504A4D:    // MJPG
-            #ifdef FRAMEDUMP
-            {
-                static int32_t fcnt = 0;
-                char fname[100];
-                if (fcnt < 10)
-                {
-                    sprintf(fname,"frame_%d.dat", fcnt++);
-                    FILE *fout = fopen(fname, "wb");
-                    fwrite(ptr, 1, bytes, fout);
-                    fclose(fout);
-                }
-            }
-            #endif        
+            return;
+        }
+    }
 
-            // here we implement our own ::submitBuffer replacement
-            // so we can decode the MJEG frames and copy the 24-bit
-            // RGB pixels into m_frameBuffer
-            m_bufferMutex.lock();
-            if (m_mjpegHelper.decompressFrame((uint8_t*)ptr, bytes, &m_frameBuffer[0], m_width, m_height))
+    DecodePool::beginFrame(m_priority);
+    uint64_t t0 = getMonotonicMicros();
+    bool delivered = true;
+    if ((m_bufferRing == nullptr) &&
+        !m_changeDetector.hasChanged(m_fmt.fmt.pix.pixelformat, (const uint8_t*)ptr, bytes,
+        m_fmt.fmt.pix.width, m_fmt.fmt.pix.height, m_fmt.fmt.pix.bytesperline))
+    {
+        // the frame arrived but the scene did not change,
+        // so m_frameBuffer already holds an equivalent frame.
+        m_newFrame = true;
+        m_frames++;
+        if (metadata != nullptr)
+        {
+            m_frameMetadata = *metadata;
+        }
+    }
+    else if (m_converter.convert((const uint8_t*)ptr, bytes, m_fmt.fmt.pix.bytesperline, 
+        dst, m_width*3))
+    {
+        m_frames++;
+        if (m_bufferRing == nullptr)
+        {
+            // a frame that failed to convert must not become
+            // the reference, or its successor is skipped.
+            m_changeDetector.commit();
+            m_newFrame = true; 
+            m_changedFrame = true;
+            if (metadata != nullptr)
             {
-                m_newFrame = true; 
-                m_frames++;
+                m_frameMetadata = *metadata;
             }
-            m_bufferMutex.unlock();
-            break;
-        default:
-            LOG(LOG_DEBUG, "ThreadSubmitBuffer: unsupported format %s (%08X)\n", fourCCToString(m_fmt.fmt.pix.pixelformat).c_str(),
-                m_fmt.fmt.pix.pixelformat);
-            break;
-        }        
+        }
+    }
+    else
+    {
+        if (m_bufferRing != nullptr)
+        {
+            m_bufferRing->dropFrame();
+        }
+        m_droppedFrames++;
+        delivered = false;
+    }
+    DecodePool::endFrame(m_priority);
+
+    if ((m_exposureController != nullptr) && delivered)
+    {
+        m_exposureController->processFrame(dst, m_width, m_height, m_width*3, metadata);
     }
+
+    // the preview only copies the frame here and encodes
+    // it on its own thread, outside m_bufferMutex.
+    if (preview && delivered)
+    {
+        std::lock_guard<std::mutex> lock(m_previewMutex);
+        if (m_preview != nullptr)
+        {
+            m_preview->submitRGB(dst, m_width, m_height, m_width*3);
+        }
+    }
+
+    // the application may reuse a ring slot as soon as head
+    // is published, so that comes after the last read of it.
+    if ((m_bufferRing != nullptr) && delivered)
+    {
+        m_bufferRing->commitFrame(metadata);
+    }
+
+    uint64_t t1 = getMonotonicMicros();
+    m_lastDecodeMicros = static_cast<uint32_t>(t1 - t0);
+    m_decodeMicros += static_cast<uint32_t>(t1 - t0);
+    m_scratchBytes = m_converter.getScratchBytes() + m_changeDetector.getScratchBytes();
+
+    // measure the frame rate over windows of about a second
+    if (delivered)
+    {
+        m_fpsWindowFrames++;
+    }
+    if (m_fpsWindowStart == 0)
+    {
+        m_fpsWindowStart = t1;
+        m_fpsWindowFrames = 0;
+    }
+    else if (t1 - m_fpsWindowStart >= 1000000)
+    {
+        m_fps = static_cast<float>(m_fpsWindowFrames*1.0e6/(t1 - m_fpsWindowStart));
+        m_fpsWindowStart = t1;
+        m_fpsWindowFrames = 0;
+    }
+    m_bufferMutex.unlock();
+}
+
+void PlatformStream::threadArchiveBuffer(const void *ptr, size_t bytes, uint64_t timestamp, uint32_t sequence)
+{
+    std::lock_guard<std::mutex> lock(m_archiveMutex);
+    if ((m_archive != nullptr) && (ptr != nullptr))
+    {
+        m_archive->addFrame(static_cast<const uint8_t*>(ptr), bytes, timestamp, sequence, m_controlCache);
+    }
+}
+
+void PlatformStream::threadRecordRecovery()
+{
+    m_recoveries++;
+}
+
+void PlatformStream::threadRecordDroppedFrame()
+{
+    m_droppedFrames++;
 }
 
 bool PlatformStream::setFrameRate(uint32_t fps)
@@ -591,12 +954,355 @@ bool PlatformStream::setFrameRate(uint32_t fps)
     param.parm.capture.timeperframe.numerator = 1;
     param.parm.capture.timeperframe.denominator = fps;
 
-    if (xioctl(m_deviceHandle, VIDIOC_S_PARM, &param) == -1)
+    if (xioctl(m_io.get(), m_deviceHandle, VIDIOC_S_PARM, &param) == -1)
     {
         LOG(LOG_ERR,"setFrameRate failed on VIDIOC_S_PARM (errno %d)\n", errno);
         return false;
     }
 
+    m_frameRate = fps;
+    return true;
+}
+
+bool PlatformStream::setColorPipeline(const CapColorPipeline *pipeline)
+{
+    m_bufferMutex.lock();
+    m_converter.setColorPipeline(pipeline);
+
+    // convert the next frame even if the scene is static,
+    // so the new colours reach the frame buffer.
+    m_changeDetector.reset();
+    m_bufferMutex.unlock();
+    return true;
+}
+
+bool PlatformStream::setChangeDetection(uint32_t threshold)
+{
+    m_bufferMutex.lock();
+    m_changeDetector.setThreshold(threshold);
+    m_bufferMutex.unlock();
+    return true;
+}
+
+bool PlatformStream::setExposureControl(const CapExposureControl *control)
+{
+    // the controller is configured here, as that takes
+    // several control requests, and handed over to the
+    // capture thread when it is ready.
+    ExposureController *controller = nullptr;
+    if (control != nullptr)
+    {
+        controller = new ExposureController(this);
+        if (!controller->configure(*control))
+        {
+            delete controller;
+            return false;
+        }
+    }
+
+    m_bufferMutex.lock();
+    std::swap(controller, m_exposureController);
+    m_bufferMutex.unlock();
+
+    delete controller;
+    return true;
+}
+
+bool PlatformStream::registerBufferRing(uint32_t count, void * const *buffers, const uint32_t *sizes)
+{
+    BufferRing *ring = nullptr;
+    if (count > 0)
+    {
+        ring = new BufferRing(count, buffers, sizes);
+    }
+
+    m_bufferMutex.lock();
+    if ((ring != nullptr) && !ring->fits(static_cast<size_t>(m_width)*m_height*3))
+    {
+        m_bufferMutex.unlock();
+        LOG(LOG_ERR, "registerBufferRing: the slots must hold %d x %d x 3 bytes\n", m_width, m_height);
+        delete ring;
+        return false;
+    }
+    m_ringMutex.lock();
+    std::swap(ring, m_bufferRing);
+    m_ringMutex.unlock();
+    m_hasBufferRing = (m_bufferRing != nullptr);
+    m_bufferMutex.unlock();
+
+    delete ring;
+    return true;
+}
+
+// The ring calls of the application only take m_ringMutex, which
+// keeps the ring alive; the ring itself is safe to use concurrently
+// with the capture thread, which holds m_bufferMutex while it converts.
+
+CapBufferRing* PlatformStream::getBufferRing()
+{
+    std::lock_guard<std::mutex> lock(m_ringMutex);
+    return (m_bufferRing != nullptr) ? m_bufferRing->getIndices() : nullptr;
+}
+
+bool PlatformStream::releaseBufferRingFrames(uint32_t frames)
+{
+    std::lock_guard<std::mutex> lock(m_ringMutex);
+    return (m_bufferRing != nullptr) && m_bufferRing->release(frames);
+}
+
+bool PlatformStream::getBufferRingMetadata(uint32_t frame, CapFrameMetadata *metadata)
+{
+    std::lock_guard<std::mutex> lock(m_ringMutex);
+    return (m_bufferRing != nullptr) && m_bufferRing->getMetadata(frame, metadata);
+}
+
+bool PlatformStream::getExposureState(CapExposureState *state)
+{
+    m_bufferMutex.lock();
+    if (m_exposureController != nullptr)
+    {
+        m_exposureController->getState(state);
+    }
+    else
+    {
+        memset(state, 0, sizeof(CapExposureState));
+    }
+    m_bufferMutex.unlock();
+    return true;
+}
+
+/** controls whose values are stored in capture archives */
+static const uint32_t archivedControls[] = 
+{
+    V4L2_CID_EXPOSURE_ABSOLUTE,
+    V4L2_CID_EXPOSURE_AUTO,
+    V4L2_CID_FOCUS_ABSOLUTE,
+    V4L2_CID_FOCUS_AUTO,
+    V4L2_CID_ZOOM_ABSOLUTE,
+    V4L2_CID_WHITE_BALANCE_TEMPERATURE,
+    V4L2_CID_AUTO_WHITE_BALANCE,
+    V4L2_CID_GAIN,
+    V4L2_CID_AUTOGAIN,
+    V4L2_CID_BRIGHTNESS,
+    V4L2_CID_CONTRAST,
+    V4L2_CID_SATURATION,
+    V4L2_CID_GAMMA,
+    V4L2_CID_HUE,
+    V4L2_CID_SHARPNESS,
+    V4L2_CID_BACKLIGHT_COMPENSATION,
+    V4L2_CID_POWER_LINE_FREQUENCY
+};
+
+bool PlatformStream::startRecording(const char *filename)
+{
+    if (!m_isOpen)
+    {
+        return false;
+    }
+
+    // read the current control values once, they are
+    // kept up to date by setProperty and setAutoProperty.
+    std::vector<archiveControl_t> controls;
+    for(uint32_t i=0; i<sizeof(archivedControls)/sizeof(archivedControls[0]); i++)
+    {
+        v4l2_control ctrl;
+        CLEAR(ctrl);
+        ctrl.id = archivedControls[i];
+        if (xioctl(m_io.get(), m_deviceHandle, VIDIOC_G_CTRL, &ctrl) != -1)
+        {
+            controls.push_back({ctrl.id, ctrl.value});
+        }
+    }
+
+    // the previous archive is closed first, as it may
+    // be written to the same file.
+    stopRecording();
+
+    CaptureArchiveWriter *archive = new CaptureArchiveWriter();
+    if (!archive->open(filename, m_fmt.fmt.pix.pixelformat, m_fmt.fmt.pix.width, 
+        m_fmt.fmt.pix.height, m_fmt.fmt.pix.bytesperline, m_fmt.fmt.pix.sizeimage, m_frameRate))
+    {
+        delete archive;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_archiveMutex);
+    m_controlCache = controls;
+    m_archive = archive;
+    LOG(LOG_INFO, "Recording to %s\n", filename);
+    return true;
+}
+
+bool PlatformStream::stopRecording()
+{
+    std::lock_guard<std::mutex> lock(m_archiveMutex);
+    if (m_archive == nullptr)
+    {
+        return false;
+    }
+
+    bool ok = m_archive->close();
+    delete m_archive;
+    m_archive = nullptr;
+    m_controlCache.clear();
+    return ok;
+}
+
+bool PlatformStream::startPreviewServer(const char *address)
+{
+    std::lock_guard<std::mutex> lock(m_previewMutex);
+    if (m_preview == nullptr)
+    {
+        m_preview = new PreviewServer();
+    }
+
+    if (!m_preview->start(address))
+    {
+        delete m_preview;
+        m_preview = nullptr;
+        return false;
+    }
+    return true;
+}
+
+bool PlatformStream::stopPreviewServer()
+{
+    std::lock_guard<std::mutex> lock(m_previewMutex);
+    if (m_preview == nullptr)
+    {
+        return false;
+    }
+
+    delete m_preview;
+    m_preview = nullptr;
+    return true;
+}
+
+void PlatformStream::updateControlCache(uint32_t id, int32_t value)
+{
+    std::lock_guard<std::mutex> lock(m_archiveMutex);
+    for(auto &ctrl : m_controlCache)
+    {
+        if (ctrl.id == id)
+        {
+            ctrl.value = value;
+        }
+    }
+}
+
+bool PlatformStream::setPriority(uint32_t priority)
+{
+    m_bufferMutex.lock();
+    m_priority = priority;
+    m_skippedFrames = 0;
+    m_converter.setPriority(priority);
+    m_bufferMutex.unlock();
+    return true;
+}
+
+void PlatformStream::getStats(CapStreamStats *stats)
+{
+    Stream::getStats(stats);
+
+    uint64_t now = getMonotonicMicros();
+
+    stats->droppedFrames    = m_droppedFrames;
+    stats->decodeMicros     = m_decodeMicros;
+    stats->lastDecodeMicros = m_lastDecodeMicros;
+    stats->recoveries       = m_recoveries;
+    stats->queueDepth       = m_conversionStage.getQueueDepth();
+
+    // a stream that stopped delivering frames has no frame rate
+    uint64_t windowStart = m_fpsWindowStart;
+    if ((windowStart != 0) && (now - windowStart < 2000000))
+    {
+        stats->fps = m_fps;
+    }
+}
+
+void PlatformStream::getMemoryUsage(CapMemoryUsage *usage)
+{
+    Stream::getMemoryUsage(usage);
+    usage->decoderScratch = m_scratchBytes;
+
+    m_previewMutex.lock();
+    if (m_preview != nullptr)
+    {
+        usage->frameBuffers += m_preview->getMemoryBytes();
+    }
+    m_previewMutex.unlock();
+
+    usage->total = usage->driverBuffers + usage->frameBuffers + usage->decoderScratch;
+}
+
+bool PlatformStream::getFrameMetadata(CapFrameMetadata *metadata)
+{
+    m_bufferMutex.lock();
+    *metadata = m_capturedMetadata;
+    m_bufferMutex.unlock();
+    return true;
+}
+
+bool PlatformStream::getOpenTiming(CapOpenTiming *timing)
+{
+    if (timing == nullptr)
+    {
+        return false;
+    }
+
+    m_bufferMutex.lock();
+    *timing = m_openTiming;
+    m_bufferMutex.unlock();
+    return true;
+}
+
+void PlatformStream::threadSetOpenTiming(const CapOpenTiming &timing)
+{
+    m_bufferMutex.lock();
+    m_openTiming = timing;
+    m_bufferMutex.unlock();
+}
+
+bool PlatformStream::setOutputSize(uint32_t width, uint32_t height)
+{
+    if (!m_isOpen)
+    {
+        return false;
+    }
+
+    m_bufferMutex.lock();
+    const uint32_t oldWidth  = m_width;
+    const uint32_t oldHeight = m_height;
+    if (!m_converter.setOutputSize(width, height))
+    {
+        m_bufferMutex.unlock();
+        return false;
+    }
+
+    // a registered buffer ring must hold the new frames,
+    // otherwise every frame would be dropped.
+    const uint32_t newWidth  = m_converter.getOutputWidth();
+    const uint32_t newHeight = m_converter.getOutputHeight();
+    if ((m_bufferRing != nullptr) && !m_bufferRing->fits(static_cast<size_t>(newWidth)*newHeight*3))
+    {
+        m_converter.setOutputSize(oldWidth, oldHeight);
+        m_bufferMutex.unlock();
+        LOG(LOG_ERR, "setOutputSize: the buffer ring slots cannot hold %d x %d frames\n", 
+            newWidth, newHeight);
+        return false;
+    }
+
+    m_width  = m_converter.getOutputWidth();
+    m_height = m_converter.getOutputHeight();
+    resizeFrameBuffer(m_width*m_height*3);
+
+    // the frame buffer no longer holds a valid frame
+    m_newFrame = false;
+    m_changedFrame = false;
+    m_changeDetector.reset();
+    m_bufferMutex.unlock();
+
+    LOG(LOG_INFO, "Output size = %d x %d pixels\n", m_width, m_height);
     return true;
 }
 
@@ -655,16 +1361,20 @@ bool PlatformStream::setProperty(uint32_t propID, int32_t value)
     case CAPPROPID_POWERLINEFREQ:
         ctrl.id = V4L2_CID_POWER_LINE_FREQUENCY;
         break;
+    case CAPPROPID_GAIN:
+        ctrl.id = V4L2_CID_GAIN;
+        break;
     default:    
         return false;
     }
 
     ctrl.value = value;
-    if (xioctl(m_deviceHandle, VIDIOC_S_CTRL, &ctrl)==-1)
+    if (xioctl(m_io.get(), m_deviceHandle, VIDIOC_S_CTRL, &ctrl)==-1)
     {
         LOG(LOG_ERR,"setProperty (ID=%d) failed on VIDIOC_S_CTRL (errno %d)\n", propID, errno);
         return false;        
     }
+    updateControlCache(ctrl.id, ctrl.value);
     return true;
 }
 
@@ -699,11 +1409,12 @@ bool PlatformStream::setAutoProperty(uint32_t propID, bool enabled)
         return false;
     }
 
-    if (xioctl(m_deviceHandle, VIDIOC_S_CTRL, &ctrl)==-1)
+    if (xioctl(m_io.get(), m_deviceHandle, VIDIOC_S_CTRL, &ctrl)==-1)
     {
         LOG(LOG_ERR,"setAutoProperty (ID=%d) failed on VIDIOC_S_CTRL (errno %d)\n", propID, errno);
         return false;    
     }
+    updateControlCache(ctrl.id, ctrl.value);
     return true;    
 }
 
@@ -756,11 +1467,14 @@ bool PlatformStream::getPropertyLimits(uint32_t propID, int32_t *emin, int32_t *
     case CAPPROPID_POWERLINEFREQ:
         ctrl.id = V4L2_CID_POWER_LINE_FREQUENCY;
         break;        
+    case CAPPROPID_GAIN:
+        ctrl.id = V4L2_CID_GAIN;
+        break;
     default:
         return false;
     }
 
-    if (xioctl(m_deviceHandle, VIDIOC_QUERYCTRL, &ctrl) == -1)
+    if (xioctl(m_io.get(), m_deviceHandle, VIDIOC_QUERYCTRL, &ctrl) == -1)
     {
         LOG(LOG_ERR,"getPropertyLimits (ID=%d) failed on VIDIOC_QUERYCTRL (errno %d)\n", propID, errno);
         return false;
@@ -814,11 +1528,14 @@ bool PlatformStream::getProperty(uint32_t propID, int32_t &value)
     case CAPPROPID_POWERLINEFREQ:
         ctrl.id = V4L2_CID_POWER_LINE_FREQUENCY;
         break;                       
+    case CAPPROPID_GAIN:
+        ctrl.id = V4L2_CID_GAIN;
+        break;
     default:
         return false;
     }
 
-    if (xioctl(m_deviceHandle, VIDIOC_G_CTRL, &ctrl)==-1)
+    if (xioctl(m_io.get(), m_deviceHandle, VIDIOC_G_CTRL, &ctrl)==-1)
     {
         LOG(LOG_ERR,"getProperty (ID=%d) failed on VIDIOC_G_CTRL (errno %d)\n", propID, errno);
         return false;        
@@ -852,7 +1569,7 @@ bool PlatformStream::getAutoProperty(uint32_t propID, bool &enabled)
         return false;
     }
 
-    if (xioctl(m_deviceHandle, VIDIOC_G_CTRL, &ctrl)==-1)
+    if (xioctl(m_io.get(), m_deviceHandle, VIDIOC_G_CTRL, &ctrl)==-1)
     {
         LOG(LOG_ERR,"getAutoProperty (ID=%d) failed on VIDIOC_G_CTRL (errno %d)\n", propID, errno);
         return false;        
@@ -35,10 +35,20 @@
 #include <vector>
 #include <mutex>
 #include <thread>
+#include <atomic>
+#include <memory>
 #include <linux/videodev2.h>
 #include "../common/logging.h"
 #include "../common/stream.h"
-#include "mjpeghelper.h"
+#include "frameconverter.h"
+#include "changedetector.h"
+#include "../common/exposurecontroller.h"
+#include "../common/bufferring.h"
+#include "deviceio.h"
+#include "capturearchive.h"
+#include "previewserver.h"
+#include "conversionstage.h"
+#include "uvcmetadata.h"
 
 
 class Context;          // pre-declaration
@@ -50,7 +60,7 @@ class PlatformStream;  // pre-declaration
 class PlatformStreamHelper
 {
 public:
-    PlatformStreamHelper(int fd) : m_fd(fd)
+    PlatformStreamHelper(DeviceIO *io, int fd) : m_io(io), m_fd(fd)
     {
         LOG(LOG_DEBUG, "PlatformStreamHelper created.\n");
     }
@@ -68,8 +78,10 @@ public:
     /** remove the memory mapped buffers from the system */
     void unmapAndDeleteBuffers();
 
-    /** create a number of memory mapped buffers */
-    bool createAndMapBuffers(uint32_t nBuffers);
+    /** create a number of memory mapped buffers. When timing
+        is not NULL, the time spent requesting and mapping the 
+        buffers is stored in it. */
+    bool createAndMapBuffers(uint32_t nBuffers, CapOpenTiming *timing = nullptr);
 
     /** queue all the buffer for use by V4L2 */
     bool queueAllBuffers();
@@ -94,6 +106,23 @@ public:
         }
     }
 
+    /** return the number of mapped buffers */
+    uint32_t getBufferCount() const
+    {
+        return static_cast<uint32_t>(m_buffers.size());
+    }
+
+    /** return the total number of bytes of the mapped buffers */
+    size_t getMappedBytes() const
+    {
+        size_t bytes = 0;
+        for(auto const &b : m_buffers)
+        {
+            bytes += b.length;
+        }
+        return bytes;
+    }
+
     struct bufferInfo
     {
         void*   start;      // pointer to start of buffer
@@ -101,6 +130,7 @@ public:
     };
 
     std::vector<bufferInfo> m_buffers;
+    DeviceIO *m_io;
     int m_fd; 
 };
 
@@ -134,6 +164,56 @@ public:
 
     virtual bool setFrameRate(uint32_t fps) override;
 
+    virtual bool setColorPipeline(const CapColorPipeline *pipeline) override;
+
+    virtual bool setChangeDetection(uint32_t threshold) override;
+
+    virtual bool setExposureControl(const CapExposureControl *control) override;
+
+    virtual bool getExposureState(CapExposureState *state) override;
+
+    virtual bool supportsBufferRing() const override
+    {
+        return true;
+    }
+
+    virtual bool registerBufferRing(uint32_t count, void * const *buffers, const uint32_t *sizes) override;
+
+    virtual CapBufferRing* getBufferRing() override;
+
+    virtual bool releaseBufferRingFrames(uint32_t frames) override;
+
+    virtual bool getBufferRingMetadata(uint32_t frame, CapFrameMetadata *metadata) override;
+
+    virtual bool setOutputSize(uint32_t width, uint32_t height) override;
+
+    virtual bool getOpenTiming(CapOpenTiming *timing) override;
+
+    virtual bool getFrameMetadata(CapFrameMetadata *metadata) override;
+
+    virtual void getMemoryUsage(CapMemoryUsage *usage) override;
+
+    virtual bool setPriority(uint32_t priority) override;
+
+    virtual void getStats(CapStreamStats *stats) override;
+
+    virtual bool supportsRecording() const override
+    {
+        return true;
+    }
+
+    virtual bool startRecording(const char *filename) override;
+    virtual bool stopRecording() override;
+
+    virtual bool supportsPreviewServer() const override
+    {
+        return true;
+    }
+
+    virtual bool startPreviewServer(const char *address) override;
+
+    virtual bool stopPreviewServer() override;
+
     /** called by the capture thread/function to query if it
         should quit */
     bool getThreadQuitState() const
@@ -144,14 +224,83 @@ public:
     /** public submit buffer so the capture thread/function
         can access it. In additon, this function handles any 
         conversion to RGB output buffers, if necessary */
-    void threadSubmitBuffer(void *ptr, size_t bytes);
+    void threadSubmitBuffer(void *ptr, size_t bytes, const CapFrameMetadata *metadata = nullptr);
+
+    /** called by the capture thread for every dequeued buffer,
+        before it is converted. Writes the raw buffer to the 
+        capture archive when recording. */
+    void threadArchiveBuffer(const void *ptr, size_t bytes, uint64_t timestamp, uint32_t sequence);
+
+    /** called by the capture thread when it recovered from 
+        a transient error, e.g. an interrupted select() */
+    void threadRecordRecovery();
+
+    /** Count a frame that was captured but replaced by a newer
+        one before it could be converted. Called by the capture thread. */
+    void threadRecordDroppedFrame();
+
+    /** returns the path of the UVC metadata node of the device, empty if none */
+    const std::string& threadGetMetadataPath() const
+    {
+        return m_metadataPath;
+    }
+
+    /** returns the stage that converts the frames of the capture thread */
+    ConversionStage& threadGetConversionStage()
+    {
+        return m_conversionStage;
+    }
+
+    /** called by the capture thread to store the timing of
+        the open steps it runs. The capture thread starts from
+        the timing recorded by open(), see getOpenTiming(). */
+    void threadSetOpenTiming(const CapOpenTiming &timing);
+
+    /** returns the monotonic time in microseconds at which open() started */
+    uint64_t getOpenStartTime() const
+    {
+        return m_openStart;
+    }
 
 protected:
+    std::shared_ptr<DeviceIO> m_io; ///< device I/O of the owning context
     int         m_deviceHandle;     ///< V4L2 device handle
     v4l2_format m_fmt;              ///< V4L2 frame format
     bool        m_quitThread;       ///< if true, captureThreadFunction should return
     std::thread *m_helperThread;    ///< helper object threading control
-    MJPEGHelper m_mjpegHelper;      ///< helper to convert MJPEG stream to RGB
+    FrameConverter m_converter;     ///< converts the captured frames to RGB
+    ChangeDetector m_changeDetector;///< skips the conversion of unchanged frames
+    ExposureController *m_exposureController; ///< software exposure controller or NULL, protected by m_bufferMutex
+    BufferRing  *m_bufferRing;      ///< application buffer ring or NULL, changed with m_bufferMutex and m_ringMutex held
+    std::mutex  m_ringMutex;        ///< lets the application's ring calls read m_bufferRing without m_bufferMutex
+    ConversionStage m_conversionStage; ///< converts frames off the capture thread
+    std::string m_metadataPath;     ///< UVC metadata node of the device, empty if none
+    CapOpenTiming m_openTiming;     ///< time spent in each step of opening the stream
+    uint64_t    m_openStart;        ///< monotonic time in microseconds at which open() started
+    uint32_t    m_priority;         ///< CAPPRIORITY_xxx, protected by m_bufferMutex
+    uint32_t    m_skippedFrames;    ///< consecutive frames skipped by a background stream
+
+    // counters reported by getStats. They are written with m_bufferMutex 
+    // held and read without it, so a scrape never waits for a conversion.
+    std::atomic<uint64_t> m_droppedFrames;    ///< frames that were captured but not converted
+    std::atomic<uint64_t> m_decodeMicros;     ///< total conversion time in microseconds
+    std::atomic<uint32_t> m_lastDecodeMicros; ///< conversion time of the last frame in microseconds
+    std::atomic<uint32_t> m_recoveries;       ///< transient capture errors the capture thread recovered from
+    std::atomic<uint64_t> m_fpsWindowStart;   ///< start of the frame rate measurement in microseconds
+    uint32_t    m_fpsWindowFrames;  ///< frames delivered since m_fpsWindowStart
+    std::atomic<float>    m_fps;              ///< frame rate of the last measurement
+    std::atomic<size_t>   m_scratchBytes;     ///< scratch memory of the converter and change detector
+
+    /** update the cached value of a control while recording */
+    void updateControlCache(uint32_t id, int32_t value);
+
+    uint32_t    m_frameRate;        ///< frame rate requested from the device
+    std::mutex  m_archiveMutex;     ///< protects m_archive and m_controlCache
+    CaptureArchiveWriter *m_archive;///< capture archive being recorded, or NULL
+    std::vector<archiveControl_t> m_controlCache; ///< control values stored with each archived frame
+
+    std::mutex  m_previewMutex;     ///< protects m_preview
+    PreviewServer *m_preview;       ///< MJPEG preview server, or NULL
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,644 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Linux platform code, MJPEG preview server
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include "../common/logging.h"
+#include "../common/listensocket.h"
+#include "previewserver.h"
+
+#define MAX_SLOTS   8       // frames shared by the clients and the capture thread
+#define MAX_CLIENTS 16
+#define JPEG_QUALITY 80     // quality used to encode non-MJPEG streams
+#define PART_HEADER_BYTES 128 // room for the multipart header of a frame
+
+static const char responseHeader[] = 
+    "HTTP/1.0 200 OK\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Connection: close\r\n"
+    "Content-Type: multipart/x-mixed-replace; boundary=frame\r\n"
+    "\r\n";
+
+/** Build the DHT segment holding the standard Huffman tables
+    of the JPEG standard, section K.3. Motion JPEG streams use 
+    these tables implicitly. */
+static void buildStandardDHT(std::vector<uint8_t> &dht)
+{
+    static const uint8_t bitsDCLuminance[16] = 
+        { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+    static const uint8_t valDCLuminance[12] = 
+        { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+    static const uint8_t bitsDCChrominance[16] = 
+        { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+    static const uint8_t valDCChrominance[12] = 
+        { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+    static const uint8_t bitsACLuminance[16] = 
+        { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+    static const uint8_t valACLuminance[162] =
+        { 0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12,
+          0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+          0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08,
+          0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+          0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16,
+          0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+          0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39,
+          0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+          0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+          0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+          0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79,
+          0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+          0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98,
+          0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+          0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+          0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+          0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4,
+          0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+          0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea,
+          0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+          0xf9, 0xfa };
+
+    static const uint8_t bitsACChrominance[16] = 
+        { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+    static const uint8_t valACChrominance[162] =
+        { 0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21,
+          0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+          0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
+          0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+          0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34,
+          0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+          0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38,
+          0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+          0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+          0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+          0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78,
+          0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+          0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96,
+          0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+          0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
+          0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+          0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2,
+          0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+          0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9,
+          0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+          0xf9, 0xfa };
+
+    struct table_t
+    {
+        uint8_t         classAndID;
+        const uint8_t  *bits;
+        const uint8_t  *values;
+        size_t          count;
+    };
+
+    const table_t tables[4] = 
+    {
+        {0x00, bitsDCLuminance,   valDCLuminance,   sizeof(valDCLuminance)},
+        {0x10, bitsACLuminance,   valACLuminance,   sizeof(valACLuminance)},
+        {0x01, bitsDCChrominance, valDCChrominance, sizeof(valDCChrominance)},
+        {0x11, bitsACChrominance, valACChrominance, sizeof(valACChrominance)}
+    };
+
+    dht.clear();
+    dht.push_back(0xFF);
+    dht.push_back(0xC4);
+    dht.push_back(0);   // length, filled in below
+    dht.push_back(0);
+    for(uint32_t i=0; i<4; i++)
+    {
+        dht.push_back(tables[i].classAndID);
+        dht.insert(dht.end(), tables[i].bits, tables[i].bits + 16);
+        dht.insert(dht.end(), tables[i].values, tables[i].values + tables[i].count);
+    }
+    size_t length = dht.size() - 2;
+    dht[2] = static_cast<uint8_t>(length >> 8);
+    dht[3] = static_cast<uint8_t>(length & 0xFF);
+}
+
+PreviewServer::PreviewServer() :
+    m_sequence(0),
+    m_wantFrame(false),
+    m_quit(false),
+    m_ringBytes(0),
+    m_encoderBytes(0),
+    m_rgbWidth(0),
+    m_rgbHeight(0),
+    m_rgbReady(false),
+    m_compressHandle(nullptr),
+    m_jpegBuffer(nullptr),
+    m_jpegBufferSize(0),
+    m_listenFd(-1),
+    m_thread(nullptr)
+{
+    m_wakePipe[0] = -1;
+    m_wakePipe[1] = -1;
+    m_response = std::make_shared<std::vector<uint8_t> >(responseHeader, 
+        responseHeader + sizeof(responseHeader) - 1);
+}
+
+PreviewServer::~PreviewServer()
+{
+    stop();
+    if (m_compressHandle != nullptr)
+    {
+        tjDestroy(m_compressHandle);
+    }
+    if (m_jpegBuffer != nullptr)
+    {
+        tjFree(m_jpegBuffer);
+    }
+}
+
+bool PreviewServer::start(const std::string &address)
+{
+    stop();
+
+    m_listenFd = createListenSocket(address, m_unixPath);
+    if (m_listenFd < 0)
+    {
+        return false;
+    }
+
+    if (pipe(m_wakePipe) != 0)
+    {
+        LOG(LOG_ERR, "Preview server: cannot create pipe (errno = %d)\n", errno);
+        stop();
+        return false;
+    }
+
+    // the capture thread must never block on the pipe
+    fcntl(m_wakePipe[1], F_SETFL, fcntl(m_wakePipe[1], F_GETFL) | O_NONBLOCK);
+
+    m_quit = false;
+    m_thread = new std::thread(&PreviewServer::serverThread, this);
+    LOG(LOG_INFO, "Preview server listening on %s\n", address.c_str());
+    return true;
+}
+
+void PreviewServer::stop()
+{
+    if (m_thread != nullptr)
+    {
+        m_quit = true;
+        char c = 0;
+        if (write(m_wakePipe[1], &c, 1) != 1)
+        {
+            LOG(LOG_ERR, "Preview server: cannot wake the server thread\n");
+        }
+        m_thread->join();
+        delete m_thread;
+        m_thread = nullptr;
+    }
+
+    for(uint32_t i=0; i<2; i++)
+    {
+        if (m_wakePipe[i] >= 0)
+        {
+            ::close(m_wakePipe[i]);
+            m_wakePipe[i] = -1;
+        }
+    }
+
+    if (m_listenFd >= 0)
+    {
+        ::close(m_listenFd);
+        m_listenFd = -1;
+    }
+
+    if (!m_unixPath.empty())
+    {
+        unlink(m_unixPath.c_str());
+        m_unixPath.clear();
+    }
+
+    m_wantFrame = false;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_latest.reset();
+    m_slots.clear();
+    m_rgbReady = false;
+    m_ringBytes = m_encoderBytes.load();
+}
+
+size_t PreviewServer::getMemoryBytes()
+{
+    return m_ringBytes;
+}
+
+PreviewServer::frame_t PreviewServer::acquireSlot()
+{
+    for(auto const &slot : m_slots)
+    {
+        // a slot referenced only by the ring is neither the latest
+        // frame nor being sent. Clients only take new references
+        // to m_latest with m_mutex held, so it stays free.
+        if (slot.use_count() == 1)
+        {
+            // make the client's reads of the slot happen before our writes
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return slot;
+        }
+    }
+
+    if (m_slots.size() < MAX_SLOTS)
+    {
+        m_slots.push_back(std::make_shared<std::vector<uint8_t> >());
+        return m_slots.back();
+    }
+
+    return frame_t();
+}
+
+void PreviewServer::publish(frame_t frame)
+{
+    size_t ringBytes = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_latest = frame;
+        m_sequence++;
+        if (m_sequence == 0)
+        {
+            m_sequence = 1; // 0 marks new clients
+        }
+        for(auto const &slot : m_slots)
+        {
+            ringBytes += slot->capacity();
+        }
+    }
+    m_ringBytes = ringBytes + m_encoderBytes;
+    m_wantFrame = false;
+
+    char c = 1;
+    if (write(m_wakePipe[1], &c, 1) != 1)
+    {
+        // the pipe is full, so the server thread will wake anyway.
+    }
+}
+
+void PreviewServer::appendPartHeader(std::vector<uint8_t> &slot, size_t jpegBytes)
+{
+    char header[PART_HEADER_BYTES];
+    int n = snprintf(header, sizeof(header), 
+        "--frame\r\nContent-Type: image/jpeg\r\nContent-Length: %lu\r\n\r\n",
+        static_cast<unsigned long>(jpegBytes));
+    slot.insert(slot.end(), header, header + n);
+}
+
+void PreviewServer::submitJPEG(const uint8_t *jpeg, size_t bytes)
+{
+    if ((m_thread == nullptr) || (bytes < 4) || (jpeg[0] != 0xFF) || (jpeg[1] != 0xD8))
+    {
+        return;
+    }
+
+    // walk the marker segments up to the start of scan
+    // to find out whether the frame has Huffman tables.
+    size_t sos = 0;
+    bool hasDHT = false;
+    size_t i = 2;
+    while((i + 4) <= bytes)
+    {
+        if (jpeg[i] != 0xFF)
+        {
+            break;  // corrupt frame, send it as it is
+        }
+        uint8_t marker = jpeg[i+1];
+        if (marker == 0xFF)
+        {
+            i++;    // fill byte
+            continue;
+        }
+        if (marker == 0xC4)
+        {
+            hasDHT = true;
+        }
+        else if (marker == 0xDA)
+        {
+            sos = i;
+            break;
+        }
+        i += 2 + ((jpeg[i+2] << 8) | jpeg[i+3]);
+    }
+
+    static std::vector<uint8_t> standardDHT;
+    static std::once_flag dhtFlag;
+    std::call_once(dhtFlag, [](){ buildStandardDHT(standardDHT); });
+
+    size_t extraBytes = (!hasDHT && (sos != 0)) ? standardDHT.size() : 0;
+
+    frame_t slot;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        slot = acquireSlot();
+    }
+    if (!slot)
+    {
+        LOG(LOG_VERBOSE, "Preview server: all frame slots are in use\n");
+        return;
+    }
+
+    // the size of MJPEG frames varies, so a slot that
+    // must grow is given some headroom to grow rarely.
+    size_t slotBytes = PART_HEADER_BYTES + bytes + extraBytes + 2;
+    if (slot->capacity() < slotBytes)
+    {
+        slot->reserve(slotBytes + slotBytes/4);
+    }
+
+    slot->clear();
+    appendPartHeader(*slot, bytes + extraBytes);
+    if (extraBytes != 0)
+    {
+        slot->insert(slot->end(), jpeg, jpeg + sos);
+        slot->insert(slot->end(), standardDHT.begin(), standardDHT.end());
+        slot->insert(slot->end(), jpeg + sos, jpeg + bytes);
+    }
+    else
+    {
+        slot->insert(slot->end(), jpeg, jpeg + bytes);
+    }
+    slot->push_back('\r');
+    slot->push_back('\n');
+    publish(slot);
+}
+
+void PreviewServer::submitRGB(const uint8_t *rgb, uint32_t width, uint32_t height, uint32_t stride)
+{
+    if (m_thread == nullptr)
+    {
+        return;
+    }
+
+    // only the copy is made here; the capture thread holds the
+    // frame buffer lock, so it must not wait for the encoder.
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const size_t lineBytes = static_cast<size_t>(width)*3;
+        m_rgbPending.resize(lineBytes*height);
+        for(uint32_t y=0; y<height; y++)
+        {
+            memcpy(&m_rgbPending[y*lineBytes], rgb + static_cast<size_t>(y)*stride, lineBytes);
+        }
+        m_rgbWidth = width;
+        m_rgbHeight = height;
+        m_rgbReady = true;
+    }
+    m_wantFrame = false;
+
+    char c = 1;
+    if (write(m_wakePipe[1], &c, 1) != 1)
+    {
+        // the pipe is full, so the server thread will wake anyway.
+    }
+}
+
+void PreviewServer::encodePendingFrame()
+{
+    uint32_t width, height;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_rgbReady)
+        {
+            return;
+        }
+        // both buffers keep their capacity, so after the
+        // first frames the swap does not allocate memory.
+        m_rgbEncode.swap(m_rgbPending);
+        width = m_rgbWidth;
+        height = m_rgbHeight;
+        m_rgbReady = false;
+    }
+
+    if (m_compressHandle == nullptr)
+    {
+        m_compressHandle = tjInitCompress();
+        if (m_compressHandle == nullptr)
+        {
+            LOG(LOG_ERR, "Preview server: cannot create the JPEG encoder\n");
+            return;
+        }
+    }
+
+    // the encoder buffer is sized for the worst case once,
+    // so encoding does not allocate memory.
+    unsigned long bufferSize = tjBufSize(width, height, TJSAMP_420);
+    if (m_jpegBufferSize < bufferSize)
+    {
+        if (m_jpegBuffer != nullptr)
+        {
+            tjFree(m_jpegBuffer);
+        }
+        m_jpegBuffer = tjAlloc(bufferSize);
+        m_jpegBufferSize = (m_jpegBuffer != nullptr) ? bufferSize : 0;
+        if (m_jpegBuffer == nullptr)
+        {
+            LOG(LOG_ERR, "Preview server: cannot allocate the JPEG buffer\n");
+            return;
+        }
+    }
+    m_encoderBytes = m_jpegBufferSize + 2*m_rgbEncode.capacity();
+
+    unsigned long jpegBytes = m_jpegBufferSize;
+    if (tjCompress2(m_compressHandle, &m_rgbEncode[0], width, width*3, height, TJPF_RGB,
+        &m_jpegBuffer, &jpegBytes, TJSAMP_420, JPEG_QUALITY, 
+        TJFLAG_FASTDCT | TJFLAG_NOREALLOC) != 0)
+    {
+        LOG(LOG_ERR, "Preview server: %s\n", tjGetErrorStr());
+        return;
+    }
+
+    frame_t slot;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        slot = acquireSlot();
+    }
+    if (!slot)
+    {
+        LOG(LOG_VERBOSE, "Preview server: all frame slots are in use\n");
+        return;
+    }
+
+    // sized for the largest possible frame, so the
+    // slot does not grow again.
+    slot->reserve(PART_HEADER_BYTES + m_jpegBufferSize + 2);
+    slot->clear();
+    appendPartHeader(*slot, jpegBytes);
+    slot->insert(slot->end(), m_jpegBuffer, m_jpegBuffer + jpegBytes);
+    slot->push_back('\r');
+    slot->push_back('\n');
+    publish(slot);
+}
+
+void PreviewServer::serverThread()
+{
+    std::vector<client_t> clients;
+    std::vector<pollfd> fds;
+    char discard[256];
+
+    while(!m_quit)
+    {
+        encodePendingFrame();
+
+        // hand the latest frame to every client that has
+        // finished sending its previous one.
+        bool idle = false;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for(auto &client : clients)
+            {
+                if (client.frame)
+                {
+                    continue;
+                }
+                if (m_latest && (client.sequence != m_sequence))
+                {
+                    client.frame = m_latest;
+                    client.offset = 0;
+                    client.sequence = m_sequence;
+                }
+                else
+                {
+                    idle = true;
+                }
+            }
+        }
+        m_wantFrame = idle;
+
+        fds.resize(2 + clients.size());
+        fds[0].fd = m_listenFd;
+        fds[0].events = POLLIN;
+        fds[1].fd = m_wakePipe[0];
+        fds[1].events = POLLIN;
+        for(size_t i=0; i<clients.size(); i++)
+        {
+            fds[2+i].fd = clients[i].fd;
+            fds[2+i].events = clients[i].frame ? (POLLIN | POLLOUT) : POLLIN;
+        }
+        for(auto &pfd : fds)
+        {
+            pfd.revents = 0;
+        }
+
+        if (poll(&fds[0], fds.size(), -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            LOG(LOG_ERR, "Preview server: poll failed (errno = %d)\n", errno);
+            break;
+        }
+
+        if (fds[1].revents & POLLIN)
+        {
+            char buffer[64];
+            if (read(m_wakePipe[0], buffer, sizeof(buffer)) <= 0)
+            {
+                break;
+            }
+        }
+
+        // serve the existing clients first, the indices 
+        // in fds do not include newly accepted ones.
+        for(size_t i=clients.size(); i>0; i--)
+        {
+            client_t &client = clients[i-1];
+            short revents = fds[1+i].revents;
+            bool drop = (revents & (POLLERR | POLLHUP | POLLNVAL)) != 0;
+
+            if (!drop && (revents & POLLIN))
+            {
+                // the request is not needed, the client 
+                // closing its connection is.
+                ssize_t n = recv(client.fd, discard, sizeof(discard), 0);
+                drop = (n == 0) || ((n < 0) && (errno != EAGAIN) && (errno != EINTR));
+            }
+
+            if (!drop && (revents & POLLOUT) && client.frame)
+            {
+                const std::vector<uint8_t> &data = *client.frame;
+                ssize_t n = send(client.fd, &data[client.offset], data.size() - client.offset, 
+                    MSG_NOSIGNAL | MSG_DONTWAIT);
+                if (n > 0)
+                {
+                    client.offset += n;
+                    if (client.offset >= data.size())
+                    {
+                        client.frame.reset();
+                    }
+                }
+                else if ((n < 0) && (errno != EAGAIN) && (errno != EINTR))
+                {
+                    drop = true;
+                }
+            }
+
+            if (drop)
+            {
+                LOG(LOG_INFO, "Preview server: client disconnected\n");
+                ::close(client.fd);
+                clients.erase(clients.begin() + (i-1));
+            }
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            int fd = accept(m_listenFd, nullptr, nullptr);
+            if (fd >= 0)
+            {
+                if (clients.size() >= MAX_CLIENTS)
+                {
+                    LOG(LOG_WARNING, "Preview server: too many clients\n");
+                    ::close(fd);
+                }
+                else
+                {
+                    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                    client_t client;
+                    client.fd = fd;
+                    client.frame = m_response;
+                    client.offset = 0;
+                    client.sequence = 0;
+                    clients.push_back(client);
+                    LOG(LOG_INFO, "Preview server: client connected\n");
+                }
+            }
+        }
+    }
+
+    for(auto &client : clients)
+    {
+        ::close(client.fd);
+    }
+    m_wantFrame = false;
+}
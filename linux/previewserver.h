@@ -0,0 +1,147 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Linux platform code, MJPEG preview server
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#ifndef linux_previewserver_h
+#define linux_previewserver_h
+
+#include <stdint.h>
+#include <stdlib.h> // size_t
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <turbojpeg.h>
+
+/** A small HTTP server that streams the frames of a capture stream
+    as multipart/x-mixed-replace MJPEG, which browsers and most video
+    tools display directly.
+
+    The capture thread publishes each MJPEG frame once into a slot of
+    a small shared ring; other formats are copied and encoded by the
+    server thread, so the capture thread never waits for the encoder.
+    Every client holds a reference to the slot it is sending, so
+    frames are never copied per client. A client that has finished
+    sending a frame continues with the most recent one, which drops
+    the frames a slow client could not keep up with rather than
+    queueing them.
+*/
+class PreviewServer
+{
+public:
+    PreviewServer();
+    ~PreviewServer();
+
+    /** Start serving on "unix:<path>", "tcp:<port>" or a socket path,
+        see createListenSocket. Returns false if the socket could not
+        be created. */
+    bool start(const std::string &address);
+
+    /** stop the server and disconnect all clients */
+    void stop();
+
+    /** returns true if a client is waiting for a new frame. The 
+        capture thread only submits frames when this is true, so
+        nothing is encoded or copied while nobody is watching. */
+    bool wantsFrame() const
+    {
+        return m_wantFrame.load(std::memory_order_relaxed);
+    }
+
+    /** publish a JPEG frame as it was delivered by the camera. Motion
+        JPEG cameras often omit the Huffman tables; the standard tables
+        are inserted in that case, as JPEG viewers require them. */
+    void submitJPEG(const uint8_t *jpeg, size_t bytes);
+
+    /** copy a 24-bit RGB frame for the server thread, which
+        JPEG-encodes and publishes it. A frame that has not been
+        encoded yet is replaced. */
+    void submitRGB(const uint8_t *rgb, uint32_t width, uint32_t height, uint32_t stride);
+
+    /** returns the number of bytes held by the frame ring and the encoder */
+    size_t getMemoryBytes();
+
+protected:
+    typedef std::shared_ptr<std::vector<uint8_t> > frame_t;
+
+    /** a connected client and the frame it is sending */
+    struct client_t
+    {
+        int         fd;
+        frame_t     frame;      ///< frame being sent, or NULL
+        size_t      offset;     ///< bytes of frame already sent
+        uint32_t    sequence;   ///< sequence number of the last frame taken
+    };
+
+    /** returns a ring slot that no client references, or NULL
+        if every slot is in use. Must be called with m_mutex held. */
+    frame_t acquireSlot();
+
+    /** publish a slot filled by the capture thread as the latest frame */
+    void publish(frame_t frame);
+
+    /** JPEG-encode and publish the frame passed to submitRGB, if any.
+        Called by the server thread. */
+    void encodePendingFrame();
+
+    /** append the multipart header of a part with the given
+        JPEG length to a slot */
+    static void appendPartHeader(std::vector<uint8_t> &slot, size_t jpegBytes);
+
+    void serverThread();
+
+    std::mutex          m_mutex;        ///< protects m_slots, m_latest, m_sequence and the m_rgbPending frame
+    std::vector<frame_t> m_slots;       ///< ring of frame slots shared with the clients
+    frame_t             m_latest;       ///< most recent frame, or NULL
+    uint32_t            m_sequence;     ///< incremented for every published frame
+    frame_t             m_response;     ///< HTTP response header, sent to every new client
+
+    std::atomic<bool>   m_wantFrame;    ///< set by the server thread when a client is idle
+    std::atomic<bool>   m_quit;         ///< if true, serverThread should return
+    std::atomic<size_t> m_ringBytes;    ///< bytes held by m_slots and the encoder, updated on publish
+    std::atomic<size_t> m_encoderBytes; ///< bytes held by the encoder and its RGB frames
+
+    std::vector<uint8_t> m_rgbPending;  ///< RGB frame waiting to be encoded
+    uint32_t            m_rgbWidth;     ///< width of m_rgbPending in pixels
+    uint32_t            m_rgbHeight;    ///< height of m_rgbPending in pixels
+    bool                m_rgbReady;     ///< true if m_rgbPending holds a frame
+
+    // owned by the server thread
+    std::vector<uint8_t> m_rgbEncode;   ///< RGB frame being encoded, swapped with m_rgbPending
+    tjhandle            m_compressHandle; ///< JPEG encoder for non-MJPEG streams, created on first use
+    unsigned char*      m_jpegBuffer;   ///< output buffer of the encoder
+    unsigned long       m_jpegBufferSize; ///< size of m_jpegBuffer in bytes
+
+    int                 m_listenFd;
+    int                 m_wakePipe[2];  ///< wakes the server thread for new frames and to quit
+    std::string         m_unixPath;     ///< path of the Unix socket, removed on stop
+    std::thread*        m_thread;       ///< server thread, or NULL
+};
+
+#endif
@@ -0,0 +1,112 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Linux platform code, lock-free single producer single consumer queue
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#ifndef linux_spscqueue_h
+#define linux_spscqueue_h
+
+#include <stdint.h>
+#include <stdlib.h> // size_t
+#include <vector>
+#include <atomic>
+
+#define SPSC_CACHELINE_BYTES 64
+
+/** A bounded lock-free queue for exactly one producer thread
+    and one consumer thread. push and pop never block and never
+    allocate memory.
+*/
+template<class T> class SPSCQueue
+{
+public:
+    SPSCQueue() : m_mask(0), m_head(0), m_tail(0) {}
+
+    /** set the capacity, rounded up to a power of two, and
+        empty the queue. Must not be called while the queue
+        is in use. */
+    void reset(size_t capacity)
+    {
+        size_t size = 1;
+        while(size < capacity)
+        {
+            size <<= 1;
+        }
+        m_items.resize(size);
+        m_mask = size - 1;
+        m_head = 0;
+        m_tail = 0;
+    }
+
+    /** add an item, called by the producer.
+        Returns false if the queue is full. */
+    bool push(const T &item)
+    {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) >= m_items.size())
+        {
+            return false;
+        }
+        m_items[tail & m_mask] = item;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /** remove the oldest item, called by the consumer.
+        Returns false if the queue is empty. */
+    bool pop(T &item)
+    {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        item = m_items[head & m_mask];
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /** returns the number of queued items, which may
+        be outdated when called by neither thread. */
+    size_t size() const
+    {
+        return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+    }
+
+protected:
+    // The indices are kept on separate cache lines by padding.
+    // alignas(64) would do the same, but C++11 operator new does
+    // not honour it for the streams that hold the queue.
+    std::vector<T>      m_items;
+    size_t              m_mask;
+    char                m_pad0[SPSC_CACHELINE_BYTES];
+    std::atomic<size_t> m_head;   ///< next item to pop, written by the consumer
+    char                m_pad1[SPSC_CACHELINE_BYTES - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> m_tail;   ///< next item to push, written by the producer
+    char                m_pad2[SPSC_CACHELINE_BYTES - sizeof(std::atomic<size_t>)];
+};
+
+#endif
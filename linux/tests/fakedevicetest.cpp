@@ -0,0 +1,305 @@
+/*
+
+    openpnp-capture-fakedevice-test: opens the fake V4L2
+    devices (see linux/fakedeviceio.h) and checks the frames
+    the library delivers against the test pattern the fake
+    driver generates. Returns 0 if all checks pass.
+
+    The YUYV and RGB24 patterns are reproduced exactly, so
+    those frames are compared pixel by pixel. MJPEG frames
+    are compared with a tolerance for the JPEG encoding.
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include "openpnp-capture.h"
+
+#define FOURCC(a,b,c,d) ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+#define FOCUS_PEAK      125     ///< focus position of the sharpest texture, see FakeDeviceIO::addDefaultDevice
+#define TEXTURE         40      ///< contrast of the texture at the focus peak
+#define SETTLE_FRAMES   3       ///< frames read after a control change before checking
+#define MJPEG_MAXERROR  24      ///< largest difference of an MJPEG pixel from the pattern
+#define MJPEG_MEANERROR 4.0     ///< largest mean difference of the MJPEG pixels
+
+static uint32_t g_failures = 0;
+
+static void check(bool ok, const char *what)
+{
+    printf("  %s: %s\n", ok ? "ok  " : "FAIL", what);
+    if (!ok)
+    {
+        g_failures++;
+    }
+}
+
+/** wait for the next frame and read it. Returns false if
+    no frame arrived within two seconds. */
+static bool readFrame(CapContext ctx, CapStream stream, std::vector<uint8_t> &rgb, uint32_t &sequence)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while(Cap_hasNewFrame(ctx, stream) == 0)
+    {
+        if (std::chrono::steady_clock::now() > deadline)
+        {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    CapFrameMetadata metadata;
+    if ((Cap_captureFrame(ctx, stream, &rgb[0], rgb.size()) != CAPRESULT_OK) ||
+        (Cap_getFrameMetadata(ctx, stream, &metadata) != CAPRESULT_OK))
+    {
+        return false;
+    }
+    sequence = metadata.sequence;
+    return true;
+}
+
+/** open the first format with the given FOURCC and move the focus to
+    the peak, so the texture has its full contrast. Returns -1 if the
+    stream could not be opened. */
+static CapStream openFormat(CapContext ctx, uint32_t fourcc, CapFormatInfo &info)
+{
+    int32_t formats = Cap_getNumFormats(ctx, 0);
+    for(int32_t i=0; i<formats; i++)
+    {
+        if ((Cap_getFormatInfo(ctx, 0, i, &info) == CAPRESULT_OK) && (info.fourcc == fourcc))
+        {
+            CapStream stream = Cap_openStream(ctx, 0, i);
+            if (stream >= 0)
+            {
+                Cap_setAutoProperty(ctx, stream, CAPPROPID_FOCUS, 0);
+                Cap_setProperty(ctx, stream, CAPPROPID_FOCUS, FOCUS_PEAK);
+            }
+            return stream;
+        }
+    }
+    return -1;
+}
+
+/** read frames until the control changes made before the call are in effect */
+static bool settle(CapContext ctx, CapStream stream, std::vector<uint8_t> &rgb)
+{
+    uint32_t sequence;
+    for(uint32_t i=0; i<SETTLE_FRAMES; i++)
+    {
+        if (!readFrame(ctx, stream, rgb, sequence))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** texture of the fake driver at the focus peak */
+static int32_t texture(uint32_t x, uint32_t y)
+{
+    return (((x ^ y) >> 2) & 1) ? TEXTURE : -TEXTURE;
+}
+
+static uint8_t clamp(int32_t v)
+{
+    return static_cast<uint8_t>(std::min(255, std::max(0, v)));
+}
+
+/** the YUYV frame the fake driver generates for a sequence number */
+static void makeYUYV(std::vector<uint8_t> &yuyv, uint32_t width, uint32_t height, uint32_t sequence)
+{
+    yuyv.resize(width*height*2);
+    for(uint32_t y=0; y<height; y++)
+    {
+        for(uint32_t x=0; x<width; x++)
+        {
+            int32_t luma = ((x + y + sequence*4) & 0xFF) + texture(x, y);
+            yuyv[(y*width + x)*2]   = clamp(luma);
+            yuyv[(y*width + x)*2+1] = 128;
+        }
+    }
+}
+
+/** the RGB24 frame the fake driver generates for a sequence number */
+static void makeRGB(std::vector<uint8_t> &rgb, uint32_t width, uint32_t height, uint32_t sequence)
+{
+    rgb.resize(width*height*3);
+    for(uint32_t y=0; y<height; y++)
+    {
+        for(uint32_t x=0; x<width; x++)
+        {
+            uint8_t *p = &rgb[(y*width + x)*3];
+            p[0] = static_cast<uint8_t>((x + sequence*4) & 0xFF);
+            p[1] = clamp(static_cast<int32_t>(y & 0xFF) + texture(x, y));
+            p[2] = 128;
+        }
+    }
+}
+
+static void testYUYV(CapContext ctx)
+{
+    printf("YUYV\n");
+    CapFormatInfo info;
+    CapStream stream = openFormat(ctx, FOURCC('Y','U','Y','V'), info);
+    check(stream >= 0, "stream opened");
+    if (stream < 0)
+    {
+        return;
+    }
+
+    std::vector<uint8_t> frame(info.width*info.height*3);
+    std::vector<uint8_t> expected(frame.size());
+    std::vector<uint8_t> yuyv;
+    uint32_t sequence = 0;
+    bool ok = settle(ctx, stream, frame) && readFrame(ctx, stream, frame, sequence);
+    check(ok, "frame received");
+    if (ok)
+    {
+        // the YUV to RGB conversion is checked by converting
+        // the pattern with the same converter.
+        makeYUYV(yuyv, info.width, info.height, sequence);
+        ok = (Cap_convertFrame(info.fourcc, &yuyv[0], yuyv.size(), 0, info.width, info.height,
+            CAPOUTFMT_RGB24, &expected[0], 0) == CAPRESULT_OK);
+        check(ok, "pattern converted");
+        check(ok && (frame == expected), "frame matches the pattern");
+
+        bool grey = true;
+        for(size_t i=0; i<frame.size(); i+=3)
+        {
+            grey = grey && (abs(frame[i] - frame[i+1]) <= 1) && (abs(frame[i+1] - frame[i+2]) <= 1);
+        }
+        check(grey, "frame is grey");
+    }
+    Cap_closeStream(ctx, stream);
+}
+
+static void testRGB(CapContext ctx)
+{
+    printf("RGB24\n");
+    CapFormatInfo info;
+    CapStream stream = openFormat(ctx, FOURCC('R','G','B','3'), info);
+    check(stream >= 0, "stream opened");
+    if (stream < 0)
+    {
+        return;
+    }
+
+    std::vector<uint8_t> frame(info.width*info.height*3);
+    std::vector<uint8_t> expected;
+    uint32_t sequence = 0;
+    bool ok = settle(ctx, stream, frame) && readFrame(ctx, stream, frame, sequence);
+    check(ok, "frame received");
+    if (ok)
+    {
+        makeRGB(expected, info.width, info.height, sequence);
+        check(frame == expected, "frame matches the pattern");
+    }
+
+    // downscaling by two averages blocks of 2 x 2 pixels
+    const uint32_t width = info.width/2;
+    const uint32_t height = info.height/2;
+    ok = (Cap_setOutputSize(ctx, stream, width, height) == CAPRESULT_OK);
+    check(ok, "output size set");
+    std::vector<uint8_t> small(width*height*3);
+    ok = ok && settle(ctx, stream, small) && readFrame(ctx, stream, small, sequence);
+    check(ok, "downscaled frame received");
+    if (ok)
+    {
+        makeRGB(expected, info.width, info.height, sequence);
+        int32_t maxError = 0;
+        for(uint32_t y=0; y<height; y++)
+        {
+            for(uint32_t x=0; x<width; x++)
+            {
+                for(uint32_t c=0; c<3; c++)
+                {
+                    const uint8_t *src = &expected[((2*y)*info.width + 2*x)*3 + c];
+                    const size_t line = info.width*3;
+                    int32_t mean = (src[0] + src[3] + src[line] + src[line+3] + 2) / 4;
+                    maxError = std::max(maxError, abs(small[(y*width + x)*3 + c] - mean));
+                }
+            }
+        }
+        check(maxError <= 1, "downscaled frame matches the pattern");
+    }
+    Cap_closeStream(ctx, stream);
+}
+
+static void testMJPEG(CapContext ctx)
+{
+    printf("MJPEG\n");
+    CapFormatInfo info;
+    CapStream stream = openFormat(ctx, FOURCC('M','J','P','G'), info);
+    check(stream >= 0, "stream opened");
+    if (stream < 0)
+    {
+        return;
+    }
+
+    std::vector<uint8_t> frame(info.width*info.height*3);
+    uint32_t sequence = 0;
+    bool ok = readFrame(ctx, stream, frame, sequence);
+    check(ok, "frame received");
+    if (ok)
+    {
+        // the MJPEG frames encode x, y and 128 as red, green and blue;
+        // the wrap-around of x and y is skipped, as it rings.
+        int32_t maxError = 0;
+        uint64_t sumError = 0;
+        uint32_t count = 0;
+        for(uint32_t y=0; y<info.height; y++)
+        {
+            for(uint32_t x=0; x<info.width; x++)
+            {
+                if (((x & 0xFF) < 8) || ((x & 0xFF) > 247) || ((y & 0xFF) < 8) || ((y & 0xFF) > 247))
+                {
+                    continue;
+                }
+                const uint8_t *p = &frame[(y*info.width + x)*3];
+                const int32_t pattern[3] = {static_cast<int32_t>(x & 0xFF), static_cast<int32_t>(y & 0xFF), 128};
+                for(uint32_t c=0; c<3; c++)
+                {
+                    int32_t error = abs(p[c] - pattern[c]);
+                    maxError = std::max(maxError, error);
+                    sumError += error;
+                    count++;
+                }
+            }
+        }
+        double meanError = (count > 0) ? static_cast<double>(sumError) / count : 0.0;
+        printf("  mean error %.2f, max error %d\n", meanError, maxError);
+        check((maxError <= MJPEG_MAXERROR) && (meanError <= MJPEG_MEANERROR), "frame matches the pattern");
+    }
+    Cap_closeStream(ctx, stream);
+}
+
+int main()
+{
+    // one fake device that delivers frames as fast as they are read
+    setenv("OPENPNP_CAPTURE_FAKE_V4L2", "1", 1);
+    setenv("OPENPNP_CAPTURE_FAKE_V4L2_FREERUN", "1", 1);
+    Cap_setLogLevel(3);
+
+    CapContext ctx = Cap_createContext();
+    check(Cap_getDeviceCount(ctx) == 1, "one fake device");
+
+    testYUYV(ctx);
+    testRGB(ctx);
+    testMJPEG(ctx);
+
+    Cap_releaseContext(ctx);
+
+    if (g_failures != 0)
+    {
+        printf("%d checks failed\n", g_failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
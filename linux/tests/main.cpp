@@ -225,6 +225,7 @@ int main(int argc, char*argv[])
     printf("  [/]    : change the white balance\n");
     printf("  a/s    : change the gain\n");
     printf("  p      : estimate the frame rate\n");
+    printf("  t      : show the stream open timing\n");
     printf("  w      : write one frame to a PPM file\n");
     printf("  q      : quit\n");
 
@@ -298,6 +299,25 @@ int main(int argc, char*argv[])
             printf("Estimating frame rate..\n");
             estimateFrameRate(ctx, streamID);
             break;            
+        case 't':
+            {
+                CapOpenTiming timing;
+                if (Cap_getStreamOpenTiming(ctx, streamID, &timing) == CAPRESULT_OK)
+                {
+                    printf("Open timing (us):\n");
+                    printf("  device open : %u\n", timing.deviceOpen);
+                    printf("  S_FMT       : %u\n", timing.setFormat);
+                    printf("  G_FMT       : %u\n", timing.getFormat);
+                    printf("  S_PARM      : %u\n", timing.setFrameRate);
+                    printf("  REQBUFS     : %u\n", timing.requestBuffers);
+                    printf("  mmap        : %u\n", timing.mapBuffers);
+                    printf("  QBUF        : %u\n", timing.queueBuffers);
+                    printf("  STREAMON    : %u\n", timing.streamOn);
+                    printf("  first frame : %u\n", timing.firstFrame);
+                    printf("  total       : %u\n", timing.total);
+                }
+            }
+            break;
         case 'w':
             if (Cap_captureFrame(ctx, streamID, &m_buffer[0], m_buffer.size()) == CAPRESULT_OK)
             {
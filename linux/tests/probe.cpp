@@ -0,0 +1,493 @@
+/*
+
+    openpnp-capture-probe: measures every format of every
+    capture device and writes a JSON or CSV report.
+
+    For each format the stream is opened and captured for a
+    while. The report contains the time to the first frame,
+    the frame rate and jitter measured with the driver's
+    timestamps, the conversion time and the CPU time per frame.
+
+    Run it on the vivid driver, the fake devices
+    (OPENPNP_CAPTURE_FAKE_V4L2=<n>) or capture archives (-r)
+    to get reproducible baselines.
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <sys/resource.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include "openpnp-capture.h"
+
+/** the measurements of one format */
+struct probeResult_t
+{
+    uint32_t    device;
+    std::string deviceName;
+    uint32_t    format;
+    CapFormatInfo info;
+
+    bool        opened;             ///< the stream could be opened
+    bool        gotFrame;           ///< the first frame arrived in time
+    double      firstFrameMillis;   ///< time from opening to the first frame
+    bool        hasOpenTiming;      ///< openTiming is valid
+    CapOpenTiming openTiming;       ///< the library's breakdown of the open
+
+    uint64_t    frames;             ///< frames delivered during the measurement
+    uint64_t    droppedFrames;      ///< frames dropped during the measurement
+    bool        driverTimestamps;   ///< fps and jitter are based on driver timestamps
+    double      fps;                ///< measured frame rate
+    double      intervalMicros;     ///< mean frame interval
+    double      jitterMicros;       ///< standard deviation of the frame interval
+    double      maxJitterMicros;    ///< largest deviation from the mean interval
+    double      convertMicros;      ///< conversion time per frame
+    double      cpuMicros;          ///< process CPU time per frame
+    bool        allocTracked;       ///< the frame path allocations were measured
+    uint64_t    framePathAllocs;    ///< frame path allocations after the warm-up frames
+};
+
+#define WARMUP_FRAMES 10    ///< frames read before the frame path allocations are counted
+
+static std::string FourCCToString(uint32_t fourcc)
+{
+    std::string v;
+    for(uint32_t i=0; i<4; i++)
+    {
+        v += static_cast<char>(fourcc & 0xFF);
+        fourcc >>= 8;
+    }
+    return v;
+}
+
+static uint64_t cpuMicros()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000ULL +
+        usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static double millisSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void probeFormat(CapContext ctx, probeResult_t &r, double seconds, uint32_t timeoutMillis)
+{
+    auto openStart = std::chrono::steady_clock::now();
+    int32_t stream = Cap_openStream(ctx, r.device, r.format);
+    if ((stream < 0) || (Cap_isOpenStream(ctx, stream) != 1))
+    {
+        if (stream >= 0)
+        {
+            Cap_closeStream(ctx, stream);
+        }
+        return;
+    }
+    r.opened = true;
+
+    // time to first frame, as seen by the application
+    while(!Cap_hasNewFrame(ctx, stream) && (millisSince(openStart) < timeoutMillis))
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    r.firstFrameMillis = millisSince(openStart);
+    r.gotFrame = (Cap_hasNewFrame(ctx, stream) != 0);
+    r.hasOpenTiming = (Cap_getStreamOpenTiming(ctx, stream, &r.openTiming) == CAPRESULT_OK);
+
+    if (!r.gotFrame)
+    {
+        Cap_closeStream(ctx, stream);
+        return;
+    }
+
+    std::vector<uint8_t> buffer(r.info.width*r.info.height*3);
+    std::vector<uint32_t> sequences;
+    std::vector<uint64_t> timestamps;
+
+    CapStreamStats stats0, stats1;
+    memset(&stats0, 0, sizeof(stats0));
+    memset(&stats1, 0, sizeof(stats1));
+    Cap_getStreamStats(ctx, stream, &stats0);
+
+    // the frame path may allocate while the first
+    // frames set up decoders and conversion buffers.
+    CapAllocationStats alloc0, alloc1;
+    memset(&alloc0, 0, sizeof(alloc0));
+    memset(&alloc1, 0, sizeof(alloc1));
+    uint32_t framesRead = 0;
+
+    uint64_t cpu0 = cpuMicros();
+    auto start = std::chrono::steady_clock::now();
+
+    // read every frame and keep its driver timestamp; frames
+    // that are missed show up as gaps in the sequence numbers.
+    while(millisSince(start) < seconds*1000.0)
+    {
+        if (Cap_hasNewFrame(ctx, stream))
+        {
+            Cap_captureFrame(ctx, stream, &buffer[0], buffer.size());
+            if (++framesRead == WARMUP_FRAMES)
+            {
+                Cap_getAllocationStats(&alloc0);
+            }
+            CapFrameMetadata meta;
+            if ((Cap_getFrameMetadata(ctx, stream, &meta) == CAPRESULT_OK) &&
+                ((meta.flags & CAPFRAMEMETA_TIMESTAMP) != 0))
+            {
+                sequences.push_back(meta.sequence);
+                timestamps.push_back(meta.captureTimestamp);
+            }
+        }
+        else
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(500));
+        }
+    }
+
+    double elapsedMicros = millisSince(start) * 1000.0;
+    uint64_t cpu1 = cpuMicros();
+    Cap_getStreamStats(ctx, stream, &stats1);
+    Cap_getAllocationStats(&alloc1);
+    Cap_closeStream(ctx, stream);
+
+    if ((alloc1.enabled != 0) && (framesRead > WARMUP_FRAMES))
+    {
+        r.allocTracked = true;
+        r.framePathAllocs = alloc1.framePathAllocations - alloc0.framePathAllocations;
+    }
+
+    r.frames = stats1.frames - stats0.frames;
+    r.droppedFrames = stats1.droppedFrames - stats0.droppedFrames;
+    if (r.frames > 0)
+    {
+        r.convertMicros = static_cast<double>(stats1.decodeMicros - stats0.decodeMicros) / r.frames;
+        r.cpuMicros = static_cast<double>(cpu1 - cpu0) / r.frames;
+    }
+
+    // per-frame intervals from the driver timestamps
+    std::vector<double> intervals;
+    for(size_t i=1; i<timestamps.size(); i++)
+    {
+        uint32_t frames = sequences[i] - sequences[i-1];
+        if ((frames > 0) && (timestamps[i] > timestamps[i-1]))
+        {
+            intervals.push_back(static_cast<double>(timestamps[i] - timestamps[i-1]) / frames);
+        }
+    }
+
+    if (intervals.size() >= 2)
+    {
+        r.driverTimestamps = true;
+        uint32_t frames = sequences.back() - sequences.front();
+        r.intervalMicros = static_cast<double>(timestamps.back() - timestamps.front()) / frames;
+        r.fps = 1.0e6 / r.intervalMicros;
+
+        double sum2 = 0.0;
+        for(double interval : intervals)
+        {
+            double d = interval - r.intervalMicros;
+            sum2 += d*d;
+            r.maxJitterMicros = std::max(r.maxJitterMicros, fabs(d));
+        }
+        r.jitterMicros = sqrt(sum2 / intervals.size());
+    }
+    else if (r.frames > 0)
+    {
+        // no driver timestamps, use the frame counter
+        r.fps = r.frames * 1.0e6 / elapsedMicros;
+        r.intervalMicros = elapsedMicros / r.frames;
+    }
+}
+
+static std::string jsonString(const std::string &s)
+{
+    std::string out = "\"";
+    for(char c : s)
+    {
+        if ((c == '"') || (c == '\\'))
+        {
+            out += '\\';
+            out += c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+            out += esc;
+        }
+        else
+        {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+static void writeJSON(FILE *f, const std::vector<probeResult_t> &results, double seconds)
+{
+    fprintf(f, "{\n  \"library\": %s,\n  \"seconds\": %.1f,\n  \"results\": [\n",
+        jsonString(Cap_getLibraryVersion()).c_str(), seconds);
+    for(size_t i=0; i<results.size(); i++)
+    {
+        const probeResult_t &r = results[i];
+        fprintf(f, "    {\"device\": %u, \"name\": %s, \"format\": %u, "
+            "\"fourcc\": %s, \"width\": %u, \"height\": %u, \"nominalFps\": %u, "
+            "\"opened\": %s, \"gotFrame\": %s, \"firstFrameMs\": %.2f, ",
+            r.device, jsonString(r.deviceName).c_str(), r.format,
+            jsonString(FourCCToString(r.info.fourcc)).c_str(), r.info.width, r.info.height, r.info.fps,
+            r.opened ? "true" : "false", r.gotFrame ? "true" : "false", r.firstFrameMillis);
+        if (r.hasOpenTiming)
+        {
+            const CapOpenTiming &t = r.openTiming;
+            fprintf(f, "\"openTimingUs\": {\"deviceOpen\": %u, \"setFormat\": %u, \"getFormat\": %u, "
+                "\"setFrameRate\": %u, \"requestBuffers\": %u, \"mapBuffers\": %u, \"queueBuffers\": %u, "
+                "\"streamOn\": %u, \"firstFrame\": %u, \"total\": %u}, ",
+                t.deviceOpen, t.setFormat, t.getFormat, t.setFrameRate, t.requestBuffers,
+                t.mapBuffers, t.queueBuffers, t.streamOn, t.firstFrame, t.total);
+        }
+        fprintf(f, "\"frames\": %llu, \"droppedFrames\": %llu, \"driverTimestamps\": %s, "
+            "\"fps\": %.3f, \"intervalUs\": %.1f, \"jitterUs\": %.1f, \"maxJitterUs\": %.1f, "
+            "\"convertUs\": %.1f, \"cpuUs\": %.1f",
+            static_cast<unsigned long long>(r.frames), static_cast<unsigned long long>(r.droppedFrames),
+            r.driverTimestamps ? "true" : "false", r.fps, r.intervalMicros, r.jitterMicros,
+            r.maxJitterMicros, r.convertMicros, r.cpuMicros);
+        if (r.allocTracked)
+        {
+            fprintf(f, ", \"framePathAllocations\": %llu", static_cast<unsigned long long>(r.framePathAllocs));
+        }
+        fprintf(f, "}%s\n", (i+1 < results.size()) ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+}
+
+static void writeCSV(FILE *f, const std::vector<probeResult_t> &results)
+{
+    fprintf(f, "device,name,format,fourcc,width,height,nominal_fps,opened,got_frame,first_frame_ms,"
+        "open_total_us,frames,dropped_frames,driver_timestamps,fps,interval_us,jitter_us,"
+        "max_jitter_us,convert_us,cpu_us,frame_path_allocs\n");
+    for(const probeResult_t &r : results)
+    {
+        // names are quoted, with quotes doubled
+        std::string name;
+        for(char c : r.deviceName)
+        {
+            name += c;
+            if (c == '"')
+            {
+                name += c;
+            }
+        }
+
+        // the allocations are left empty when they were not measured
+        char allocs[32] = "";
+        if (r.allocTracked)
+        {
+            snprintf(allocs, sizeof(allocs), "%llu", static_cast<unsigned long long>(r.framePathAllocs));
+        }
+
+        fprintf(f, "%u,\"%s\",%u,%s,%u,%u,%u,%d,%d,%.2f,%u,%llu,%llu,%d,%.3f,%.1f,%.1f,%.1f,%.1f,%.1f,%s\n",
+            r.device, name.c_str(), r.format, FourCCToString(r.info.fourcc).c_str(),
+            r.info.width, r.info.height, r.info.fps, r.opened ? 1 : 0, r.gotFrame ? 1 : 0,
+            r.firstFrameMillis, r.hasOpenTiming ? r.openTiming.total : 0,
+            static_cast<unsigned long long>(r.frames), static_cast<unsigned long long>(r.droppedFrames),
+            r.driverTimestamps ? 1 : 0, r.fps, r.intervalMicros, r.jitterMicros, r.maxJitterMicros,
+            r.convertMicros, r.cpuMicros, allocs);
+    }
+}
+
+static void usage()
+{
+    fprintf(stderr, "Usage: openpnp-capture-probe [options]\n"
+        "  -d <device>    probe only this device index\n"
+        "  -F <format>    probe only this format index\n"
+        "  -t <seconds>   measurement time per format (default 3)\n"
+        "  -T <millis>    timeout for the first frame (default 5000)\n"
+        "  -c             write CSV instead of JSON\n"
+        "  -o <file>      write the report to a file instead of stdout\n"
+        "  -r <archive>   replay a capture archive, may be repeated\n"
+        "  -v <level>     library log level (default 3)\n"
+        "  -a             fail if the frame path allocates memory after the\n"
+        "                 first %d frames (needs OPENPNP_CAPTURE_ALLOCTRACK)\n", WARMUP_FRAMES);
+}
+
+int main(int argc, char*argv[])
+{
+    int32_t onlyDevice = -1;
+    int32_t onlyFormat = -1;
+    double  seconds = 3.0;
+    uint32_t timeoutMillis = 5000;
+    bool    csv = false;
+    const char *outputName = nullptr;
+    std::vector<const char*> archives;
+    uint32_t logLevel = 3;
+    bool    checkAllocs = false;
+
+    int opt;
+    while((opt = getopt(argc, argv, "d:F:t:T:co:r:v:ah")) != -1)
+    {
+        switch(opt)
+        {
+        case 'd':
+            onlyDevice = atoi(optarg);
+            break;
+        case 'F':
+            onlyFormat = atoi(optarg);
+            break;
+        case 't':
+            seconds = atof(optarg);
+            break;
+        case 'T':
+            timeoutMillis = atoi(optarg);
+            break;
+        case 'c':
+            csv = true;
+            break;
+        case 'o':
+            outputName = optarg;
+            break;
+        case 'r':
+            archives.push_back(optarg);
+            break;
+        case 'v':
+            logLevel = atoi(optarg);
+            break;
+        case 'a':
+            checkAllocs = true;
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    Cap_setLogLevel(logLevel);
+
+    CapAllocationStats allocStats;
+    if (checkAllocs && ((Cap_getAllocationStats(&allocStats) != CAPRESULT_OK) || (allocStats.enabled == 0)))
+    {
+        fprintf(stderr, "The library was built without OPENPNP_CAPTURE_ALLOCTRACK\n");
+        return 1;
+    }
+
+    CapContext ctx;
+    if (archives.empty())
+    {
+        ctx = Cap_createContext();
+    }
+    else
+    {
+        ctx = Cap_createReplayContext(&archives[0], archives.size(), 1);
+    }
+
+    if (ctx == nullptr)
+    {
+        fprintf(stderr, "Could not create a capture context\n");
+        return 1;
+    }
+
+    std::vector<probeResult_t> results;
+    uint32_t deviceCount = Cap_getDeviceCount(ctx);
+    for(uint32_t device=0; device<deviceCount; device++)
+    {
+        if ((onlyDevice >= 0) && (device != static_cast<uint32_t>(onlyDevice)))
+        {
+            continue;
+        }
+
+        int32_t nFormats = Cap_getNumFormats(ctx, device);
+        for(int32_t format=0; format<nFormats; format++)
+        {
+            if ((onlyFormat >= 0) && (format != onlyFormat))
+            {
+                continue;
+            }
+
+            probeResult_t r;
+            memset(&r.info, 0, sizeof(r.info));
+            memset(&r.openTiming, 0, sizeof(r.openTiming));
+            r.device = device;
+            r.deviceName = Cap_getDeviceName(ctx, device);
+            r.format = format;
+            r.opened = false;
+            r.gotFrame = false;
+            r.firstFrameMillis = 0.0;
+            r.hasOpenTiming = false;
+            r.frames = 0;
+            r.droppedFrames = 0;
+            r.driverTimestamps = false;
+            r.fps = 0.0;
+            r.intervalMicros = 0.0;
+            r.jitterMicros = 0.0;
+            r.maxJitterMicros = 0.0;
+            r.convertMicros = 0.0;
+            r.cpuMicros = 0.0;
+            r.allocTracked = false;
+            r.framePathAllocs = 0;
+            Cap_getFormatInfo(ctx, device, format, &r.info);
+
+            fprintf(stderr, "Probing device %u (%s) format %d: %u x %u %s @ %u fps\n",
+                device, r.deviceName.c_str(), format, r.info.width, r.info.height,
+                FourCCToString(r.info.fourcc).c_str(), r.info.fps);
+
+            probeFormat(ctx, r, seconds, timeoutMillis);
+
+            fprintf(stderr, "  %s: %.2f fps, jitter %.1f us, convert %.1f us, cpu %.1f us per frame\n",
+                r.gotFrame ? "ok" : (r.opened ? "no frames" : "open failed"),
+                r.fps, r.jitterMicros, r.convertMicros, r.cpuMicros);
+            if (r.allocTracked && (r.framePathAllocs > 0))
+            {
+                fprintf(stderr, "  frame path allocated memory %llu times after the warm-up\n",
+                    static_cast<unsigned long long>(r.framePathAllocs));
+            }
+            results.push_back(r);
+        }
+    }
+
+    Cap_releaseContext(ctx);
+
+    FILE *f = stdout;
+    if (outputName != nullptr)
+    {
+        f = fopen(outputName, "w");
+        if (f == nullptr)
+        {
+            fprintf(stderr, "Cannot open %s for writing\n", outputName);
+            return 1;
+        }
+    }
+
+    if (csv)
+    {
+        writeCSV(f, results);
+    }
+    else
+    {
+        writeJSON(f, results, seconds);
+    }
+
+    if (f != stdout)
+    {
+        fclose(f);
+    }
+
+    if (checkAllocs)
+    {
+        for(const probeResult_t &r : results)
+        {
+            if (r.allocTracked && (r.framePathAllocs > 0))
+            {
+                return 2;
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,433 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Linux platform code, UVC metadata node capture and
+    device clock correlation
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#include <string.h>
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "../common/logging.h"
+#include "uvcmetadata.h"
+
+#define CLEAR(x) memset(&(x), 0, sizeof(x))
+
+#define MAX_CLOCK_SAMPLES   32      // source clock references used by the fit
+#define MIN_CLOCK_SAMPLES   4       // source clock references needed before converting
+#define META_BUFFERS        4       // driver buffers of the metadata node
+#define MAX_FRAME_RECORDS   16      // frames whose presentation time stamp is remembered
+
+static uint32_t readLE32(const uint8_t *p)
+{
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+        (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static uint16_t readLE16(const uint8_t *p)
+{
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+// **********************************************************************
+//   DeviceClock
+// **********************************************************************
+
+DeviceClock::DeviceClock() :
+    m_next(0),
+    m_lastSTC(0),
+    m_haveSample(false)
+{
+    m_samples.reserve(MAX_CLOCK_SAMPLES);
+}
+
+void DeviceClock::reset()
+{
+    m_samples.clear();
+    m_next = 0;
+    m_lastSTC = 0;
+    m_haveSample = false;
+}
+
+int64_t DeviceClock::unwrap(uint32_t deviceTime) const
+{
+    if (!m_haveSample)
+    {
+        return deviceTime;
+    }
+
+    // the signed 32-bit difference to the last sample
+    // handles the wrap-around of the device clock.
+    int32_t delta = static_cast<int32_t>(deviceTime - static_cast<uint32_t>(m_lastSTC));
+    return m_lastSTC + delta;
+}
+
+void DeviceClock::addSample(uint32_t stc, uint64_t hostNanos)
+{
+    int64_t extended = unwrap(stc);
+    if (m_haveSample)
+    {
+        if (extended == m_lastSTC)
+        {
+            return; // a repeated reference adds no information
+        }
+        if (extended < m_lastSTC)
+        {
+            LOG(LOG_DEBUG, "DeviceClock: source clock went backwards, restarting the fit\n");
+            reset();
+            extended = stc;
+        }
+    }
+
+    sample_t sample;
+    sample.stc = extended;
+    sample.hostNanos = hostNanos;
+    if (m_samples.size() < MAX_CLOCK_SAMPLES)
+    {
+        m_samples.push_back(sample);
+    }
+    else
+    {
+        m_samples[m_next] = sample;
+        m_next = (m_next + 1) % MAX_CLOCK_SAMPLES;
+    }
+
+    m_lastSTC = extended;
+    m_haveSample = true;
+}
+
+bool DeviceClock::toHost(uint32_t deviceTime, uint64_t &hostMicros) const
+{
+    const size_t n = m_samples.size();
+    if (n < MIN_CLOCK_SAMPLES)
+    {
+        return false;
+    }
+
+    // fit host = a + b*stc relative to the most recent
+    // sample, to keep the precision of the doubles.
+    const int64_t  stcRef  = m_lastSTC;
+    const uint64_t hostRef = m_samples[(m_next + n - 1) % n].hostNanos;
+
+    double meanX = 0.0;
+    double meanY = 0.0;
+    for(auto const &s : m_samples)
+    {
+        meanX += static_cast<double>(s.stc - stcRef);
+        meanY += static_cast<double>(static_cast<int64_t>(s.hostNanos - hostRef));
+    }
+    meanX /= n;
+    meanY /= n;
+
+    double sxx = 0.0;
+    double sxy = 0.0;
+    for(auto const &s : m_samples)
+    {
+        double dx = static_cast<double>(s.stc - stcRef) - meanX;
+        double dy = static_cast<double>(static_cast<int64_t>(s.hostNanos - hostRef)) - meanY;
+        sxx += dx*dx;
+        sxy += dx*dy;
+    }
+
+    if (sxx <= 0.0)
+    {
+        return false;
+    }
+
+    double slope = sxy / sxx;   // host ns per device tick
+    double x = static_cast<double>(unwrap(deviceTime) - stcRef);
+    double host = static_cast<double>(hostRef) + meanY + slope*(x - meanX);
+    if (host < 0.0)
+    {
+        return false;
+    }
+
+    hostMicros = static_cast<uint64_t>(host / 1000.0);
+    return true;
+}
+
+// **********************************************************************
+//   UVCMetadataNode
+// **********************************************************************
+
+UVCMetadataNode::UVCMetadataNode() :
+    m_io(nullptr),
+    m_fd(-1),
+    m_streaming(false),
+    m_nextFrame(0)
+{
+}
+
+UVCMetadataNode::~UVCMetadataNode()
+{
+    close();
+}
+
+bool UVCMetadataNode::open(DeviceIO *io, const std::string &path)
+{
+    close();
+
+    m_io = io;
+    m_fd = m_io->open(path.c_str(), O_RDWR | O_NONBLOCK);
+    if (m_fd < 0)
+    {
+        LOG(LOG_ERR, "Cannot open metadata node %s (errno = %d)\n", path.c_str(), errno);
+        return false;
+    }
+
+    v4l2_format fmt;
+    CLEAR(fmt);
+    fmt.type = V4L2_BUF_TYPE_META_CAPTURE;
+    fmt.fmt.meta.dataformat = V4L2_META_FMT_UVC;
+    if ((xioctl(m_io, m_fd, VIDIOC_S_FMT, &fmt) == -1) || 
+        (fmt.fmt.meta.dataformat != V4L2_META_FMT_UVC))
+    {
+        LOG(LOG_INFO, "%s does not deliver UVC metadata\n", path.c_str());
+        close();
+        return false;
+    }
+
+    v4l2_requestbuffers req;
+    CLEAR(req);
+    req.count  = META_BUFFERS;
+    req.type   = V4L2_BUF_TYPE_META_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    if ((xioctl(m_io, m_fd, VIDIOC_REQBUFS, &req) == -1) || (req.count == 0))
+    {
+        LOG(LOG_ERR, "Cannot request metadata buffers (errno = %d)\n", errno);
+        close();
+        return false;
+    }
+
+    for(uint32_t i=0; i<req.count; i++)
+    {
+        v4l2_buffer buf;
+        CLEAR(buf);
+        buf.type   = V4L2_BUF_TYPE_META_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index  = i;
+        if (xioctl(m_io, m_fd, VIDIOC_QUERYBUF, &buf) == -1)
+        {
+            LOG(LOG_ERR, "Cannot query metadata buffer %d (errno = %d)\n", i, errno);
+            close();
+            return false;
+        }
+
+        buffer_t buffer;
+        buffer.length = buf.length;
+        buffer.start = m_io->mmap(buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, buf.m.offset);
+        if (buffer.start == MAP_FAILED)
+        {
+            LOG(LOG_ERR, "Cannot map metadata buffer %d (errno = %d)\n", i, errno);
+            close();
+            return false;
+        }
+        m_buffers.push_back(buffer);
+
+        if (xioctl(m_io, m_fd, VIDIOC_QBUF, &buf) == -1)
+        {
+            LOG(LOG_ERR, "Cannot queue metadata buffer %d (errno = %d)\n", i, errno);
+            close();
+            return false;
+        }
+    }
+
+    v4l2_buf_type type = V4L2_BUF_TYPE_META_CAPTURE;
+    if (xioctl(m_io, m_fd, VIDIOC_STREAMON, &type) == -1)
+    {
+        LOG(LOG_ERR, "Cannot start the metadata stream (errno = %d)\n", errno);
+        close();
+        return false;
+    }
+    m_streaming = true;
+
+    m_frames.clear();
+    m_nextFrame = 0;
+    m_clock.reset();
+
+    LOG(LOG_INFO, "Capturing UVC metadata from %s\n", path.c_str());
+    return true;
+}
+
+void UVCMetadataNode::close()
+{
+    if (m_fd < 0)
+    {
+        return;
+    }
+
+    if (m_streaming)
+    {
+        v4l2_buf_type type = V4L2_BUF_TYPE_META_CAPTURE;
+        xioctl(m_io, m_fd, VIDIOC_STREAMOFF, &type);
+        m_streaming = false;
+    }
+
+    for(auto const &buffer : m_buffers)
+    {
+        m_io->munmap(buffer.start, buffer.length);
+    }
+    m_buffers.clear();
+
+    m_io->close(m_fd);
+    m_fd = -1;
+}
+
+void UVCMetadataNode::poll()
+{
+    if (!m_streaming)
+    {
+        return;
+    }
+
+    while(true)
+    {
+        v4l2_buffer buf;
+        CLEAR(buf);
+        buf.type   = V4L2_BUF_TYPE_META_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        if (xioctl(m_io, m_fd, VIDIOC_DQBUF, &buf) == -1)
+        {
+            if (errno != EAGAIN)
+            {
+                LOG(LOG_ERR, "Metadata VIDIOC_DQBUF failed (errno = %d), stopping metadata capture\n", errno);
+                close();
+            }
+            return;
+        }
+
+        if (buf.index < m_buffers.size())
+        {
+            size_t bytes = std::min<size_t>(buf.bytesused, m_buffers[buf.index].length);
+            parseBuffer(static_cast<const uint8_t*>(m_buffers[buf.index].start), bytes, buf.sequence);
+        }
+
+        if (xioctl(m_io, m_fd, VIDIOC_QBUF, &buf) == -1)
+        {
+            LOG(LOG_ERR, "Metadata VIDIOC_QBUF failed (errno = %d), stopping metadata capture\n", errno);
+            close();
+            return;
+        }
+    }
+}
+
+void UVCMetadataNode::parseBuffer(const uint8_t *data, size_t bytes, uint32_t sequence)
+{
+    frameRecord_t record;
+    record.sequence = sequence;
+    record.pts = 0;
+    record.valid = false;
+
+    size_t offset = 0;
+    while((offset + sizeof(uvcMetaBlock_t)) <= bytes)
+    {
+        uvcMetaBlock_t block;
+        memcpy(&block, data + offset, sizeof(block));
+        if (block.length < 2)
+        {
+            break;
+        }
+
+        // the block holds the payload header from its third byte on
+        const size_t blockBytes = sizeof(block) + block.length - 2;
+        if ((offset + blockBytes) > bytes)
+        {
+            break;
+        }
+
+        const uint8_t *header = data + offset + sizeof(block);
+        const size_t headerBytes = block.length - 2;
+        size_t pos = 0;
+
+        if (block.flags & UVC_STREAM_PTS)
+        {
+            if ((pos + 4) > headerBytes)
+            {
+                break;
+            }
+            if (!record.valid)
+            {
+                record.pts = readLE32(header + pos);
+                record.valid = true;
+            }
+            pos += 4;
+        }
+
+        if (block.flags & UVC_STREAM_SCR)
+        {
+            if ((pos + 6) > headerBytes)
+            {
+                break;
+            }
+            uint32_t stc = readLE32(header + pos);
+            uint16_t scrSOF = readLE16(header + pos + 4) & 0x7FF;
+
+            // the device sampled its clock at USB frame scrSOF and the
+            // host received the payload at frame block.sof. Moving the
+            // host time back by the frames in between removes most of
+            // the transfer latency.
+            uint32_t frames = (block.sof - scrSOF) & 0x7FF;
+            uint64_t hostNanos = block.ns;
+            if ((frames < 64) && (hostNanos > frames*1000000ULL))
+            {
+                hostNanos -= frames*1000000ULL;
+            }
+            m_clock.addSample(stc, hostNanos);
+        }
+
+        offset += blockBytes;
+    }
+
+    if (!record.valid)
+    {
+        return;
+    }
+
+    if (m_frames.size() < MAX_FRAME_RECORDS)
+    {
+        m_frames.push_back(record);
+    }
+    else
+    {
+        m_frames[m_nextFrame] = record;
+        m_nextFrame = (m_nextFrame + 1) % MAX_FRAME_RECORDS;
+    }
+}
+
+bool UVCMetadataNode::getExposure(uint32_t sequence, uint32_t &pts, uint64_t &exposureMicros, bool &exposureValid) const
+{
+    for(auto const &record : m_frames)
+    {
+        if (record.sequence == sequence)
+        {
+            pts = record.pts;
+            exposureValid = m_clock.toHost(record.pts, exposureMicros);
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,168 @@
+/*
+
+    OpenPnp-Capture: a video capture subsystem.
+
+    Linux platform code, UVC metadata node capture and
+    device clock correlation
+
+    Copyright (c) 2017 Jason von Nieda, Niels Moseley.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#ifndef linux_uvcmetadata_h
+#define linux_uvcmetadata_h
+
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <linux/videodev2.h>
+#include "deviceio.h"
+
+// older kernel headers lack the metadata definitions
+#ifndef V4L2_CAP_META_CAPTURE
+#define V4L2_CAP_META_CAPTURE   0x00800000
+#endif
+
+#ifndef V4L2_META_FMT_UVC
+#define V4L2_META_FMT_UVC       v4l2_fourcc('U', 'V', 'C', 'H')
+#endif
+
+/** a block of a UVC metadata buffer, see struct uvc_meta_buf
+    in linux/uvcvideo.h. A buffer holds one block for every
+    payload header of the frame that differed from the previous. */
+#pragma pack(push, 1)
+struct uvcMetaBlock_t
+{
+    uint64_t ns;        ///< host time at which the payload arrived, CLOCK_MONOTONIC in ns
+    uint16_t sof;       ///< USB frame number of the host
+    uint8_t  length;    ///< length of the payload header, including length and flags
+    uint8_t  flags;     ///< payload header flags, UVC_STREAM_xxx
+    // followed by length-2 bytes of the payload header: 
+    // PTS (4 bytes) and SCR (6 bytes), if flagged.
+};
+#pragma pack(pop)
+
+#define UVC_STREAM_PTS  0x04    ///< the payload header has a presentation time stamp
+#define UVC_STREAM_SCR  0x08    ///< the payload header has a source clock reference
+
+/** Maps the 32-bit source clock of a UVC device to the host clock.
+
+    Each source clock reference (SCR) sampled by the device is paired
+    with the host time at which its payload arrived. A least squares 
+    fit over the most recent pairs gives the offset and the rate of
+    the device clock, without knowing its nominal frequency, and 
+    averages out the USB transfer jitter.
+*/
+class DeviceClock
+{
+public:
+    DeviceClock();
+
+    /** forget all samples */
+    void reset();
+
+    /** add a source clock reference and the host time in ns */
+    void addSample(uint32_t stc, uint64_t hostNanos);
+
+    /** convert a device time near the most recent sample to host
+        time in microseconds. Returns false until enough samples
+        have been collected. */
+    bool toHost(uint32_t deviceTime, uint64_t &hostMicros) const;
+
+protected:
+    /** extend a 32-bit device time to 64 bits, choosing 
+        the value closest to the most recent sample */
+    int64_t unwrap(uint32_t deviceTime) const;
+
+    struct sample_t
+    {
+        int64_t  stc;       ///< unwrapped source clock
+        uint64_t hostNanos;
+    };
+
+    std::vector<sample_t> m_samples;    ///< ring of the most recent samples
+    uint32_t    m_next;                 ///< next sample to replace
+    int64_t     m_lastSTC;              ///< unwrapped source clock of the most recent sample
+    bool        m_haveSample;           ///< true if m_lastSTC is valid
+};
+
+/** Captures the UVC metadata node that belongs to a video node,
+    and estimates the start of exposure of each video frame from
+    the presentation time stamp (PTS) of its payload headers.
+
+    The node is read without blocking by the capture thread after
+    each video frame. Metadata buffers carry the sequence number
+    of their video frame.
+*/
+class UVCMetadataNode
+{
+public:
+    UVCMetadataNode();
+    ~UVCMetadataNode();
+
+    /** open and start streaming a metadata node.
+        Returns false if the node does not deliver UVC metadata. */
+    bool open(DeviceIO *io, const std::string &path);
+
+    /** stop streaming and close the node */
+    void close();
+
+    bool isOpen() const
+    {
+        return m_fd >= 0;
+    }
+
+    /** dequeue and parse all metadata buffers that are ready */
+    void poll();
+
+    /** get the presentation time stamp of a frame and, once the clocks
+        are correlated, the estimated host time of the start of its 
+        exposure in microseconds. Returns false if no presentation 
+        time stamp is known for the frame. */
+    bool getExposure(uint32_t sequence, uint32_t &pts, uint64_t &exposureMicros, bool &exposureValid) const;
+
+protected:
+    /** parse the blocks of a metadata buffer */
+    void parseBuffer(const uint8_t *data, size_t bytes, uint32_t sequence);
+
+    struct frameRecord_t
+    {
+        uint32_t sequence;
+        uint32_t pts;
+        bool     valid;
+    };
+
+    struct buffer_t
+    {
+        void*   start;
+        size_t  length;
+    };
+
+    DeviceIO*   m_io;
+    int         m_fd;
+    bool        m_streaming;
+    std::vector<buffer_t> m_buffers;
+    std::vector<frameRecord_t> m_frames;    ///< ring of the most recent frames
+    uint32_t    m_nextFrame;                ///< next record of m_frames to replace
+    DeviceClock m_clock;
+};
+
+#endif
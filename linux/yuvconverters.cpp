@@ -28,15 +28,44 @@
     
 */
 
+#include <string.h>
+#include <linux/videodev2.h>
+#include "openpnp-capture.h"
 #include "yuvconverters.h"
 
-static inline uint8_t clamp(int16_t v)
+static inline uint8_t clamp(int32_t v)
 {
     v =  (v > 255) ? 255 : v;
     v =  (v < 0) ? 0 : v;
     return v;
 }
 
+static inline uint8_t transformClamp(int32_t v)
+{
+    v = (v + (1 << (COLORTRANSFORM_SHIFT-1))) >> COLORTRANSFORM_SHIFT;
+    v = (v > 255) ? 255 : v;
+    v = (v < 0) ? 0 : v;
+    return v;
+}
+
+/** write a pixel in the channel order of the output format */
+template<uint32_t DstFormat>
+static inline void storePixel(uint8_t *dst, uint8_t r, uint8_t g, uint8_t b)
+{
+    if (DstFormat == CAPOUTFMT_BGR24)
+    {
+        dst[0] = b;
+        dst[1] = g;
+        dst[2] = r;
+    }
+    else
+    {
+        dst[0] = r;
+        dst[1] = g;
+        dst[2] = b;
+    }
+}
+
 /*
     In the YUYV2/YUV2 pixel, the order of the fields is:
     Y0 | Cr | Y1 | Cb ... repeating, which encode two 24-bit pixels.
@@ -53,24 +82,117 @@ static inline uint8_t clamp(int16_t v)
     G = Y - 0.344U' - 0.714V'
     B = Y + 1.770U'
 
+    Without colour transform a 4-bit fixed-point 
+    approximation is used.
 */
-void YUYV2RGB(const uint8_t *yuv, uint8_t *rgb, uint32_t bytes)
+template<uint32_t DstFormat, uint32_t Features>
+static void YUYVKernel(const uint8_t *yuv, uint8_t *dst, uint32_t pixels, const ColorTransform &t)
 {
-    while(bytes > 3)
+    const int32_t *m = t.matrix;
+    const uint8_t *lut = t.lut;
+    for(uint32_t i=0; i<pixels/2; i++)
+    {
+        int32_t y0 = yuv[0] - 16;   // Y0
+        int32_t cr = yuv[1] - 128;  // Cr (aka U)
+        int32_t y1 = yuv[2] - 16;   // Y1
+        int32_t cb = yuv[3] - 128;  // Cb (aka V)
+        yuv += 4;
+
+        if ((Features & KERNEL_COLORTRANSFORM) != 0)
+        {
+            // the chroma contribution is shared by both pixels
+            int32_t c0 = m[1]*cr + m[2]*cb;
+            int32_t c1 = m[4]*cr + m[5]*cb;
+            int32_t c2 = m[7]*cr + m[8]*cb;
+
+            storePixel<DstFormat>(dst, 
+                lut[transformClamp(m[0]*y0 + c0)],
+                lut[transformClamp(m[3]*y0 + c1)],
+                lut[transformClamp(m[6]*y0 + c2)]);
+            storePixel<DstFormat>(dst+3, 
+                lut[transformClamp(m[0]*y1 + c0)],
+                lut[transformClamp(m[3]*y1 + c1)],
+                lut[transformClamp(m[6]*y1 + c2)]);
+        }
+        else
+        {
+            int32_t yy0 = 19*y0;
+            int32_t yy1 = 19*y1;
+            int32_t c0 = 32*cb;
+            int32_t c1 = -13*cr - 6*cb;
+            int32_t c2 = 26*cr;
+            storePixel<DstFormat>(dst,   clamp((yy0 + c0) >> 4), clamp((yy0 + c1) >> 4), clamp((yy0 + c2) >> 4));
+            storePixel<DstFormat>(dst+3, clamp((yy1 + c0) >> 4), clamp((yy1 + c1) >> 4), clamp((yy1 + c2) >> 4));
+        }
+        dst += 6;
+    }
+}
+
+template<uint32_t DstFormat, uint32_t Features>
+static void RGBKernel(const uint8_t *src, uint8_t *dst, uint32_t pixels, const ColorTransform &t)
+{
+    if ((DstFormat == CAPOUTFMT_RGB24) && ((Features & KERNEL_COLORTRANSFORM) == 0))
+    {
+        if (src != dst)
+        {
+            memcpy(dst, src, static_cast<size_t>(pixels)*3);
+        }
+        return;
+    }
+
+    const int32_t *m = t.matrix;
+    const uint8_t *lut = t.lut;
+    for(uint32_t i=0; i<pixels; i++)
+    {
+        int32_t r = src[0];
+        int32_t g = src[1];
+        int32_t b = src[2];
+        src += 3;
+
+        if ((Features & KERNEL_COLORTRANSFORM) != 0)
+        {
+            storePixel<DstFormat>(dst,
+                lut[transformClamp(m[0]*r + m[1]*g + m[2]*b)],
+                lut[transformClamp(m[3]*r + m[4]*g + m[5]*b)],
+                lut[transformClamp(m[6]*r + m[7]*g + m[8]*b)]);
+        }
+        else
+        {
+            storePixel<DstFormat>(dst, r, g, b);
+        }
+        dst += 3;
+    }
+}
+
+LineKernel selectLineKernel(uint32_t srcFourcc, uint32_t dstFormat, uint32_t features)
+{
+    struct kernelEntry_t
+    {
+        uint32_t    fourcc;
+        uint32_t    dstFormat;
+        uint32_t    features;
+        LineKernel  kernel;
+    };
+
+    // every supported combination, instantiated at compile time
+    static const kernelEntry_t kernels[] =
+    {
+        {V4L2_PIX_FMT_YUYV,  CAPOUTFMT_RGB24, 0, YUYVKernel<CAPOUTFMT_RGB24, 0> },
+        {V4L2_PIX_FMT_YUYV,  CAPOUTFMT_BGR24, 0, YUYVKernel<CAPOUTFMT_BGR24, 0> },
+        {V4L2_PIX_FMT_YUYV,  CAPOUTFMT_RGB24, KERNEL_COLORTRANSFORM, YUYVKernel<CAPOUTFMT_RGB24, KERNEL_COLORTRANSFORM> },
+        {V4L2_PIX_FMT_YUYV,  CAPOUTFMT_BGR24, KERNEL_COLORTRANSFORM, YUYVKernel<CAPOUTFMT_BGR24, KERNEL_COLORTRANSFORM> },
+        {V4L2_PIX_FMT_RGB24, CAPOUTFMT_RGB24, 0, RGBKernel<CAPOUTFMT_RGB24, 0> },
+        {V4L2_PIX_FMT_RGB24, CAPOUTFMT_BGR24, 0, RGBKernel<CAPOUTFMT_BGR24, 0> },
+        {V4L2_PIX_FMT_RGB24, CAPOUTFMT_RGB24, KERNEL_COLORTRANSFORM, RGBKernel<CAPOUTFMT_RGB24, KERNEL_COLORTRANSFORM> },
+        {V4L2_PIX_FMT_RGB24, CAPOUTFMT_BGR24, KERNEL_COLORTRANSFORM, RGBKernel<CAPOUTFMT_BGR24, KERNEL_COLORTRANSFORM> },
+    };
+
+    for(const kernelEntry_t &entry : kernels)
     {
-        int16_t y0 = *yuv++;    // Y0
-        int16_t cr = *yuv++;    // Cr (aka U)
-        int16_t y1 = *yuv++;    // Y1
-        int16_t cb = *yuv++;    // Cb (aka V)
-
-        int16_t yy0 = 19*(y0 - 16); 
-        int16_t yy1 = 19*(y1 - 16); 
-        *rgb++ = clamp((yy0                 + 32*(cb - 128)) >> 4);
-        *rgb++ = clamp((yy0 - 13*(cr - 128) -  6*(cb - 128)) >> 4);
-        *rgb++ = clamp((yy0 + 26*(cr - 128)                ) >> 4);
-        *rgb++ = clamp((yy1                 + 32*(cb - 128)) >> 4);
-        *rgb++ = clamp((yy1 - 13*(cr - 128) -  6*(cb - 128)) >> 4);
-        *rgb++ = clamp((yy1 + 26*(cr - 128)                ) >> 4);
-        bytes -= 4;
+        if ((entry.fourcc == srcFourcc) && (entry.dstFormat == dstFormat) && (entry.features == features))
+        {
+            return entry.kernel;
+        }
     }
+    return nullptr;
 }
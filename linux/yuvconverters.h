@@ -33,6 +33,34 @@
 
 #include <stdint.h>
 
-void YUYV2RGB(const uint8_t *yuv, uint8_t *rgb, uint32_t bytes);
+/** A fixed-point colour transform: a 3x3 matrix with
+    COLORTRANSFORM_SHIFT fractional bits followed by
+    an 8-bit look-up table. The rows are in RGB order;
+    the line kernels write the channels in the order of 
+    the output format. */
+#define COLORTRANSFORM_SHIFT 12
 
-#endif
\ No newline at end of file
+struct ColorTransform
+{
+    int32_t matrix[9];  ///< row-major matrix, one row per output channel
+    uint8_t lut[256];   ///< output look-up table
+};
+
+/** feature flags of a line kernel */
+#define KERNEL_COLORTRANSFORM 1     ///< apply the colour transform
+
+/** Converts 'pixels' pixels of a line to 24-bit pixels. Each
+    kernel is specialised at compile time for one source format,
+    output format and set of features, so the per-pixel loop has
+    no branches. The colour transform is only read by kernels with
+    KERNEL_COLORTRANSFORM, whose YUYV variant operates on 
+    (Y-16, Cr-128, Cb-128). The source and destination may be the
+    same buffer for 24-bit sources. */
+typedef void (*LineKernel)(const uint8_t *src, uint8_t *dst, uint32_t pixels, const ColorTransform &t);
+
+/** Returns the line kernel for a V4L2 source format, output 
+    format (CAPOUTFMT_xxx) and KERNEL_xxx features, or NULL 
+    if there is none. Call once when the format is set up. */
+LineKernel selectLineKernel(uint32_t srcFourcc, uint32_t dstFormat, uint32_t features);
+
+#endif
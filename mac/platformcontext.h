@@ -41,9 +41,9 @@ class PlatformContext : public Context
 {
 public:
     /** Create a context for the library.
-        Device enumeration is performed in the constructor,
-        so all devices must be present in the system when
-        the Context is created or devices will not be found.
+        The devices are enumerated afterwards, see 
+        Context::enumerate, so all devices must be present
+        in the system at that time or they will not be found.
 
         Re-enumeration support is pending.
     */
@@ -56,6 +56,10 @@ protected:
     */
     virtual bool enumerateDevices();
 private:
+    /** Ask for camera permission if it has not been granted
+        and wait for the answer. Returns true if granted. */
+    bool requestCameraPermission();
+
     int cameraPermissionReceived; // 0 = waiting, 1 = success, -1 = error
 };
 
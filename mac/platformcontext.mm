@@ -41,10 +41,21 @@ Context* createPlatformContext()
     return new PlatformContext();
 }
 
+Context* createPlatformReplayContext(const char **filenames, uint32_t count, bool realtime)
+{
+    LOG(LOG_ERR, "Replaying capture archives is not supported on this platform\n");
+    return nullptr;
+}
+
 PlatformContext::PlatformContext() :
     Context()
 {
     LOG(LOG_INFO, "Platform context created\n");
+    cameraPermissionReceived = 0;
+}
+
+bool PlatformContext::requestCameraPermission()
+{
     if ([AVCaptureDevice respondsToSelector:@selector(authorizationStatusForMediaType:)]) {
         cameraPermissionReceived = 0;
         if ([AVCaptureDevice authorizationStatusForMediaType:AVMediaTypeVideo] == AVAuthorizationStatusAuthorized) {
@@ -69,13 +80,9 @@ PlatformContext::PlatformContext() :
                 std::this_thread::sleep_for(std::chrono::milliseconds(200));
             }
         }
-        if (cameraPermissionReceived == 1) {
-            enumerateDevices();
-        }
-    }
-    else {
-        enumerateDevices();
+        return (cameraPermissionReceived == 1);
     }
+    return true;
 }
 
 PlatformContext::~PlatformContext()
@@ -87,6 +94,13 @@ bool PlatformContext::enumerateDevices()
 {
     LOG(LOG_DEBUG, "enumerateDevices called\n");
 
+    // the permission dialog can take a while, which is
+    // why it is part of the (possibly background) enumeration
+    if (!requestCameraPermission())
+    {
+        return false;
+    }
+
     m_devices.clear();
     for (AVCaptureDevice* device in [AVCaptureDevice devicesWithMediaType:AVMediaTypeVideo]) 
     {
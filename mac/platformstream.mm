@@ -105,6 +105,15 @@ Stream* createPlatformStream()
     return new PlatformStream();
 }
 
+CapResult platformConvertFrame(uint32_t srcFourcc, const uint8_t *src, size_t srcBytes,
+    uint32_t srcStride, uint32_t width, uint32_t height,
+    uint32_t dstFormat, uint8_t *dst, uint32_t dstStride)
+{
+    // FIXME: expose the platform converters
+    LOG(LOG_ERR, "Cap_convertFrame is not supported on this platform\n");
+    return CAPRESULT_FORMATNOTSUPPORTED;
+}
+
 PlatformStream::PlatformStream() :
     Stream()
 {
@@ -223,7 +232,7 @@ bool PlatformStream::open(Context *owner, deviceInfo *device, uint32_t width, ui
     m_width = width;
     m_height = height;
     m_owner = owner;
-    m_frameBuffer.resize(m_width*m_height*3);
+    resizeFrameBuffer(m_width*m_height*3);
     m_tmpBuffer.resize(m_width*m_height*3);
 
     AVCaptureVideoDataOutput* output = [AVCaptureVideoDataOutput new];
@@ -44,6 +44,12 @@ Context* createPlatformContext()
     return new PlatformContext();
 }
 
+Context* createPlatformReplayContext(const char **filenames, uint32_t count, bool realtime)
+{
+    LOG(LOG_ERR, "Replaying capture archives is not supported on this platform\n");
+    return nullptr;
+}
+
 PlatformContext::PlatformContext() : Context()
 {
     HRESULT hr;
@@ -59,8 +65,6 @@ PlatformContext::PlatformContext() : Context()
     {
         LOG(LOG_DEBUG, "PlatformContext created\n");
     }
-
-    enumerateDevices();
 }
 
 PlatformContext::~PlatformContext()
@@ -68,6 +72,26 @@ PlatformContext::~PlatformContext()
     CoUninitialize();
 }
 
+bool PlatformContext::enumerateDevicesInBackground()
+{
+    // COM must be initialised on every thread that uses it.
+    // The device information is copied into plain strings,
+    // so no COM objects outlive this thread.
+    HRESULT hr = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+    if (FAILED(hr))
+    {
+        LOG(LOG_WARNING, "PlatformContext::enumerateDevicesInBackground CoInitializeEx failed (HRESULT = %08X)!\n", hr);
+    }
+
+    bool ok = enumerateDevices();
+
+    if (SUCCEEDED(hr))
+    {
+        CoUninitialize();
+    }
+    return ok;
+}
+
 
 bool PlatformContext::enumerateDevices()
 {
@@ -49,9 +49,9 @@ class PlatformContext : public Context
 {
 public:
     /** Create a context for the library.
-        Device enumeration is performed in the constructor,
-        so all devices must be present in the system when
-        the Context is created or devices will not be found.
+        The devices are enumerated afterwards, see 
+        Context::enumerate, so all devices must be present
+        in the system at that time or they will not be found.
 
         Re-enumeration support is pending.
     */
@@ -71,6 +71,11 @@ protected:
     */
     virtual bool enumerateDevices();
 
+    /** Enumerate the devices on the background thread of
+        Context::enumerateAsync, which needs its own COM
+        initialisation. */
+    virtual bool enumerateDevicesInBackground() override;
+
     /** Convert a wide character string to an UTF-8 string 
         
         Implement this function in a platform-dependent
@@ -43,6 +43,15 @@ Stream* createPlatformStream()
     return new PlatformStream();
 }
 
+CapResult platformConvertFrame(uint32_t srcFourcc, const uint8_t *src, size_t srcBytes,
+    uint32_t srcStride, uint32_t width, uint32_t height,
+    uint32_t dstFormat, uint8_t *dst, uint32_t dstStride)
+{
+    // FIXME: expose the platform converters
+    LOG(LOG_ERR, "Cap_convertFrame is not supported on this platform\n");
+    return CAPRESULT_FORMATNOTSUPPORTED;
+}
+
 // **********************************************************************
 //   Property translation data
 // **********************************************************************
@@ -162,7 +171,7 @@ void PlatformStream::close()
     m_owner = nullptr;
     m_width = 0;
     m_height = 0;
-    m_frameBuffer.resize(0);
+    resizeFrameBuffer(0);
     m_isOpen = false;    
 }
 
@@ -483,7 +492,7 @@ bool PlatformStream::open(Context *owner, deviceInfo *device, uint32_t width, ui
 
             //FIXME: for now, just set the frame buffer size to
             //       width*height*3 for 24 RGB raw images
-            m_frameBuffer.resize(m_width*m_height*3);                  
+            resizeFrameBuffer(m_width*m_height*3);
         }
         CoTaskMemFree( info->pbFormat );        
     }
@@ -893,6 +902,7 @@ void PlatformStream::submitBuffer(const uint8_t *ptr, size_t bytes)
         }
 
         m_newFrame = true; 
+        m_changedFrame = true;
         m_frames++;        
     }
 